@@ -29,96 +29,329 @@
  *
  */
 
+#include <string.h>
+#include <immintrin.h>
+
 #include "base64.h"
 
 
-static const std::string encode_table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char encode_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define DECODE_INVALID 0xff
+
+/* maps a character to its 6 bit value, DECODE_INVALID for '=' and anything outside the alphabet */
+static const uint8_t decode_table[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 62,   0xff, 0xff, 0xff, 63,
+    52,   53,   54,   55,   56,   57,   58,   59,   60,   61,   0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0,    1,    2,    3,    4,    5,    6,    7,    8,    9,    10,   11,   12,   13,   14,
+    15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25,   0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+    41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51,   0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static size_t encode_scalar(const uint8_t *in, size_t len, char *out) {
+    char *p = out;
+
+    for (; len >= 3; len -= 3, in += 3) {
+        uint32_t v = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+        *p++ = encode_table[(v >> 18) & 0x3f];
+        *p++ = encode_table[(v >> 12) & 0x3f];
+        *p++ = encode_table[(v >> 6) & 0x3f];
+        *p++ = encode_table[v & 0x3f];
+    }
+
+    if (len) {
+        uint32_t v = (uint32_t)in[0] << 16;
+        if (len == 2)
+            v |= (uint32_t)in[1] << 8;
+        *p++ = encode_table[(v >> 18) & 0x3f];
+        *p++ = encode_table[(v >> 12) & 0x3f];
+        *p++ = (len == 2) ? encode_table[(v >> 6) & 0x3f] : '=';
+        *p++ = '=';
+    }
 
-static inline bool is_base64(unsigned char c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
+    return p - out;
 }
 
-std::string base64_encode(const uint8_t *bytes_to_encode, uint32_t in_len) {
-    std::string encode_str;
-    uint32_t i = 0;
-    uint32_t j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for(i = 0; (i <4) ; i++)
-                encode_str += encode_table[char_array_4[i]];
-            i = 0;
+/* stops at the first character outside the alphabet, a trailing partial group yields its whole bytes */
+static size_t decode_scalar(const char *in, size_t len, uint8_t *out) {
+    uint8_t *p = out;
+    uint32_t v = 0;
+    size_t i = 0;
+
+    for (; i < len; i++) {
+        uint8_t c = decode_table[(uint8_t)in[i]];
+        if (c == DECODE_INVALID)
+            break;
+        v = (v << 6) | c;
+        if ((i & 3) == 3) {
+            *p++ = (uint8_t)(v >> 16);
+            *p++ = (uint8_t)(v >> 8);
+            *p++ = (uint8_t)v;
+            v = 0;
         }
     }
 
-    if (i) {
-        for(j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+    switch (i & 3) {
+    case 2:
+        *p++ = (uint8_t)(v >> 4);
+        break;
+    case 3:
+        *p++ = (uint8_t)(v >> 10);
+        *p++ = (uint8_t)(v >> 2);
+        break;
+    default:
+        break;
+    }
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+    return p - out;
+}
 
-        for (j = 0; (j < i + 1); j++)
-            encode_str += encode_table[char_array_4[j]];
+/*
+ * The vector paths follow W. Mula and D. Lemire, "Faster Base64 Encoding and
+ * Decoding using AVX2 Instructions". Each 128 bit lane turns 12 bytes into 16
+ * characters and back, the scalar code finishes the tail.
+ */
 
-        while((i++ < 3))
-            encode_str += '=';
-    }
+/* spread 12 bytes into 16 6-bit indices, one per byte */
+__attribute__((target("sse4.1")))
+static inline __m128i encode_unpack_128(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t0, t1);
+}
 
-  return encode_str;
+/* map the 6-bit indices to the alphabet */
+__attribute__((target("sse4.1")))
+static inline __m128i encode_lookup_128(__m128i in) {
+    __m128i r = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+    r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+    r = _mm_shuffle_epi8(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                       '/' - 63, 'A', 0, 0), r);
+    return _mm_add_epi8(r, in);
+}
+
+/*
+ * map the characters to their 6-bit values, *bad is set when a character
+ * is outside the alphabet (including '=')
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i decode_lookup_128(__m128i in, int *bad) {
+    __m128i hi = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+    __m128i lo = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+    __m128i mask = _mm_shuffle_epi8(_mm_setr_epi8((char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                  (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                  (char)0xf8, (char)0xf8, (char)0xf0, 0x54,
+                                                  0x50, 0x50, 0x50, 0x54), lo);
+    __m128i bit = _mm_shuffle_epi8(_mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                                 0, 0, 0, 0, 0, 0, 0, 0), hi);
+    __m128i shift = _mm_shuffle_epi8(_mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71,
+                                                   0, 0, 0, 0, 0, 0, 0, 0), hi);
 
+    *bad = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(mask, bit), _mm_setzero_si128()));
+    shift = _mm_blendv_epi8(shift, _mm_set1_epi8(16), _mm_cmpeq_epi8(in, _mm_set1_epi8('/')));
+    return _mm_add_epi8(in, shift);
 }
 
-std::string base64_decode(const std::string &encoded_string) {
-    uint32_t in_len = encoded_string.size();
-    uint32_t i = 0;
-    uint32_t j = 0;
-    uint32_t in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string decode_str;
-
-    while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_]; in_++;
-        if (i ==4) {
-            for (i = 0; i <4; i++)
-                char_array_4[i] = static_cast<unsigned char>(encode_table.find(char_array_4[i]));
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-                decode_str += char_array_3[i];
-            i = 0;
-        }
+/* pack 16 6-bit values back into 12 bytes at the start of the register */
+__attribute__((target("sse4.1")))
+static inline __m128i decode_pack_128(__m128i in) {
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(in, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("sse4.1")))
+static size_t encode_sse41(const uint8_t *in, size_t len, char *out) {
+    size_t done = 0;
+
+    /* each step reads 16 bytes and consumes 12 */
+    for (; len - done >= 16; done += 12) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + done));
+        v = encode_lookup_128(encode_unpack_128(v));
+        _mm_storeu_si128((__m128i *)(out + done / 3 * 4), v);
+    }
+
+    return done / 3 * 4 + encode_scalar(in + done, len - done, out + done / 3 * 4);
+}
+
+__attribute__((target("sse4.1")))
+static size_t decode_sse41(const char *in, size_t len, uint8_t *out) {
+    size_t done = 0;
+    int bad = 0;
+
+    for (; len - done >= 16; done += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + done));
+        v = decode_lookup_128(v, &bad);
+        if (bad)
+            break;
+        v = decode_pack_128(v);
+        /* store exactly 12 bytes, out is only sized for the decoded length */
+        uint32_t last = (uint32_t)_mm_extract_epi32(v, 2);
+        _mm_storel_epi64((__m128i *)(out + done / 4 * 3), v);
+        memcpy(out + done / 4 * 3 + 8, &last, sizeof(last));
     }
 
-    if (i) {
-        for (j = i; j <4; j++)
-            char_array_4[j] = 0;
+    return done / 4 * 3 + decode_scalar(in + done, len - done, out + done / 4 * 3);
+}
+
+/* the AVX2 versions run the same steps on both lanes */
+__attribute__((target("avx2")))
+static inline __m256i encode_unpack_256(__m256i in) {
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+                                    _mm256_set1_epi32(0x04000040));
+    __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+                                    _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(t0, t1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i encode_lookup_256(__m256i in) {
+    __m256i r = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), in);
+    r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    r = _mm256_shuffle_epi8(_mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0), r);
+    return _mm256_add_epi8(r, in);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i decode_lookup_256(__m256i in, int *bad) {
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+    __m256i lo = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+    __m256i mask = _mm256_shuffle_epi8(_mm256_setr_epi8((char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                        (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                        (char)0xf8, (char)0xf8, (char)0xf0, 0x54,
+                                                        0x50, 0x50, 0x50, 0x54,
+                                                        (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                        (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                        (char)0xf8, (char)0xf8, (char)0xf0, 0x54,
+                                                        0x50, 0x50, 0x50, 0x54), lo);
+    __m256i bit = _mm256_shuffle_epi8(_mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                                       0, 0, 0, 0, 0, 0, 0, 0,
+                                                       0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                                       0, 0, 0, 0, 0, 0, 0, 0), hi);
+    __m256i shift = _mm256_shuffle_epi8(_mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71,
+                                                         0, 0, 0, 0, 0, 0, 0, 0,
+                                                         0, 0, 19, 4, -65, -65, -71, -71,
+                                                         0, 0, 0, 0, 0, 0, 0, 0), hi);
 
-        for (j = 0; j <4; j++)
-            char_array_4[j] = static_cast<unsigned char>(encode_table.find(char_array_4[j]));
+    *bad = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(mask, bit), _mm256_setzero_si256()));
+    shift = _mm256_blendv_epi8(shift, _mm256_set1_epi8(16), _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')));
+    return _mm256_add_epi8(in, shift);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i decode_pack_256(__m256i in) {
+    in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+    in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+    in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    /* move the 12 bytes of the upper lane right after the lower ones */
+    return _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
 
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+__attribute__((target("avx2")))
+static size_t encode_avx2(const uint8_t *in, size_t len, char *out) {
+    size_t done = 0;
 
-        for (j = 0; (j < i - 1); j++)
-            decode_str += char_array_3[j];
+    /* the lanes load 16 bytes at +0 and +12, each step consumes 24 */
+    for (; len - done >= 28; done += 24) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + done))),
+            _mm_loadu_si128((const __m128i *)(in + done + 12)), 1);
+        v = encode_lookup_256(encode_unpack_256(v));
+        _mm256_storeu_si256((__m256i *)(out + done / 3 * 4), v);
     }
 
-    return decode_str;
+    return done / 3 * 4 + encode_sse41(in + done, len - done, out + done / 3 * 4);
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(const char *in, size_t len, uint8_t *out) {
+    size_t done = 0;
+    int bad = 0;
+
+    for (; len - done >= 32; done += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + done));
+        v = decode_lookup_256(v, &bad);
+        if (bad)
+            break;
+        v = decode_pack_256(v);
+        /* store exactly 24 bytes */
+        _mm_storeu_si128((__m128i *)(out + done / 4 * 3), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *)(out + done / 4 * 3 + 16), _mm256_extracti128_si256(v, 1));
+    }
+
+    return done / 4 * 3 + decode_sse41(in + done, len - done, out + done / 4 * 3);
+}
+
+typedef size_t (*encode_fn)(const uint8_t *, size_t, char *);
+typedef size_t (*decode_fn)(const char *, size_t, uint8_t *);
+
+static encode_fn select_encode() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return encode_avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return encode_sse41;
+    return encode_scalar;
 }
 
+static decode_fn select_decode() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return decode_avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return decode_sse41;
+    return decode_scalar;
+}
+
+static const encode_fn encode_impl = select_encode();
+static const decode_fn decode_impl = select_decode();
+
+size_t base64_encode_to(const uint8_t *in, size_t len, char *out) {
+    return encode_impl(in, len, out);
+}
+
+size_t base64_decode_to(const char *in, size_t len, uint8_t *out) {
+    return decode_impl(in, len, out);
+}
+
+std::string base64_encode(const uint8_t *bytes_to_encode, uint32_t in_len) {
+    std::string encode_str(base64_encoded_size(in_len), '\0');
 
+    if (in_len > 0)
+        base64_encode_to(bytes_to_encode, in_len, &encode_str[0]);
+
+    return encode_str;
+}
+
+std::string base64_decode(const std::string &encoded_string) {
+    std::string decode_str(base64_decoded_size(encoded_string.size()), '\0');
+
+    if (!decode_str.empty())
+        decode_str.resize(base64_decode_to(encoded_string.data(), encoded_string.size(),
+                                           (uint8_t *)&decode_str[0]));
+
+    return decode_str;
+}
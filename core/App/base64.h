@@ -32,8 +32,42 @@
 #ifndef _BASE64_H_
 #define _BASE64_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
 
+/*
+ * The codec picks an AVX2 or SSE4.1 implementation at load time when the
+ * CPU supports it and falls back to a table driven scalar one otherwise.
+ * All of them produce the same output.
+ */
+
+/* number of characters base64_encode_to() writes for len bytes */
+static inline size_t base64_encoded_size(size_t len)
+{
+    return (len + 2) / 3 * 4;
+}
+
+/* upper bound of the bytes base64_decode_to() writes for len characters */
+static inline size_t base64_decoded_size(size_t len)
+{
+    return (len + 3) / 4 * 3;
+}
+
+/*
+ * Encode len bytes into out, which must hold base64_encoded_size(len)
+ * characters. The output is padded and not NUL terminated.
+ * Returns the number of characters written.
+ */
+size_t base64_encode_to(const uint8_t *in, size_t len, char *out);
+
+/*
+ * Decode len characters into out, which must hold base64_decoded_size(len)
+ * bytes. Decoding stops at the first '=' or non base64 character.
+ * Returns the number of bytes written.
+ */
+size_t base64_decode_to(const char *in, size_t len, uint8_t *out);
+
 std::string base64_encode(const uint8_t *bytes_to_encode, uint32_t in_len);
 
 std::string base64_decode(const std::string &encoded_string);
@@ -0,0 +1,771 @@
+/*
+ * Copyright (C) 2020-2021 Intel Corporation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * ehsm_bench: a benchmark of the provider api, built next to ehsm_core_test.
+ * Each thread runs the same operation with the same cmk on its own buffers and
+ * times every call, a run is repeated for every payload size of the sweep.
+ * Build with SGX_MODE=SIM to run it without SGX hardware.
+ *
+ *   ehsm_bench --op encrypt --keyspec EH_AES_GCM_128 --sizes 32,1024,4096 \
+ *              --threads 8 --duration 10 --warmup 100 --json result.json
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ehsm_provider.h"
+#include "auto_version.h"
+#include <jsoncpp/json/json.h>
+
+#define BENCH_DEFAULT_THREADS       1
+#define BENCH_DEFAULT_DURATION      10
+#define BENCH_DEFAULT_WARMUP        100
+#define BENCH_DEFAULT_SIZE          1024
+#define BENCH_DATAKEY_MAX_SIZE      1024
+#define BENCH_HISTOGRAM_BUCKETS     32
+
+typedef enum
+{
+    BENCH_CREATE_KEY = 0,
+    BENCH_ENCRYPT,
+    BENCH_DECRYPT,
+    BENCH_ASYMMETRIC_ENCRYPT,
+    BENCH_ASYMMETRIC_DECRYPT,
+    BENCH_SIGN,
+    BENCH_VERIFY,
+    BENCH_GENERATE_DATAKEY,
+} bench_op_t;
+
+typedef struct
+{
+    const char *name;
+    bench_op_t op;
+} bench_op_name_t;
+
+static const bench_op_name_t g_bench_ops[] = {
+    {"createkey", BENCH_CREATE_KEY},
+    {"encrypt", BENCH_ENCRYPT},
+    {"decrypt", BENCH_DECRYPT},
+    {"asymmetric-encrypt", BENCH_ASYMMETRIC_ENCRYPT},
+    {"asymmetric-decrypt", BENCH_ASYMMETRIC_DECRYPT},
+    {"sign", BENCH_SIGN},
+    {"verify", BENCH_VERIFY},
+    {"generate-datakey", BENCH_GENERATE_DATAKEY},
+};
+
+typedef struct
+{
+    const char *name;
+    ehsm_keyspec_t keyspec;
+} bench_keyspec_name_t;
+
+static const bench_keyspec_name_t g_bench_keyspecs[] = {
+    {"EH_AES_GCM_128", EH_AES_GCM_128},
+    {"EH_AES_GCM_192", EH_AES_GCM_192},
+    {"EH_AES_GCM_256", EH_AES_GCM_256},
+    {"EH_SM4_CTR", EH_SM4_CTR},
+    {"EH_SM4_CBC", EH_SM4_CBC},
+    {"EH_RSA_2048", EH_RSA_2048},
+    {"EH_RSA_3072", EH_RSA_3072},
+    {"EH_RSA_4096", EH_RSA_4096},
+    {"EH_EC_P224", EH_EC_P224},
+    {"EH_EC_P256", EH_EC_P256},
+    {"EH_EC_P384", EH_EC_P384},
+    {"EH_EC_P521", EH_EC_P521},
+    {"EH_SM2", EH_SM2},
+};
+
+typedef struct
+{
+    bench_op_t op;
+    ehsm_keyspec_t keyspec;
+    std::vector<uint32_t> sizes;
+    uint32_t threads;
+    uint32_t duration;   // seconds, used when iterations is 0
+    uint64_t iterations; // per thread
+    uint64_t warmup;     // per thread, not timed
+    std::string json;
+} bench_config_t;
+
+typedef struct
+{
+    uint32_t size;
+    uint64_t ops;
+    uint64_t errors;
+    double seconds;
+    std::vector<uint64_t> latencies; // nanoseconds, sorted
+} bench_result_t;
+
+/* the inputs shared by all the threads of a run, prepared once */
+typedef struct
+{
+    const bench_config_t *config;
+    uint32_t size;
+    ehsm_keyblob_t *cmk;
+    ehsm_data_t *input;     // plaintext, ciphertext or digest
+    ehsm_data_t *aad;
+    ehsm_data_t *signature; // for verify
+    uint32_t output_len;    // capacity of the output of one call
+    pthread_barrier_t *start;
+} bench_run_t;
+
+typedef struct
+{
+    bench_run_t *run;
+    uint64_t ops;
+    uint64_t errors;
+    std::vector<uint64_t> latencies;
+} bench_thread_t;
+
+static ehsm_data_t *bench_alloc_data(uint32_t datalen)
+{
+    ehsm_data_t *data = (ehsm_data_t *)calloc(1, APPEND_SIZE_TO_DATA_T((size_t)datalen));
+
+    if (data != NULL)
+        data->datalen = datalen;
+    return data;
+}
+
+static ehsm_data_t *bench_random_data(uint32_t datalen)
+{
+    ehsm_data_t *data = bench_alloc_data(datalen);
+
+    for (uint32_t i = 0; data != NULL && i < datalen; i++)
+        data->data[i] = (uint8_t)rand();
+    return data;
+}
+
+static void bench_set_metadata(bench_op_t op, ehsm_keyspec_t keyspec, ehsm_keymetadata_t *metadata)
+{
+    memset(metadata, 0, sizeof(ehsm_keymetadata_t));
+    metadata->keyspec = keyspec;
+    metadata->origin = EH_INTERNAL_KEY;
+
+    switch (keyspec)
+    {
+    case EH_RSA_2048:
+    case EH_RSA_3072:
+    case EH_RSA_4096:
+        if (op == BENCH_SIGN || op == BENCH_VERIFY)
+        {
+            metadata->purpose = EH_PURPOSE_SIGN_VERIFY;
+            metadata->padding_mode = EH_PAD_RSA_PKCS1_PSS;
+            metadata->digest_mode = EH_SHA_2_256;
+        }
+        else
+        {
+            metadata->purpose = EH_PURPOSE_ENCRYPT_DECRYPT;
+            metadata->padding_mode = EH_PAD_RSA_PKCS1_OAEP;
+        }
+        break;
+    case EH_EC_P224:
+    case EH_EC_P256:
+    case EH_EC_P384:
+    case EH_EC_P521:
+        metadata->purpose = EH_PURPOSE_SIGN_VERIFY;
+        metadata->digest_mode = EH_SHA_2_256;
+        break;
+    case EH_SM2:
+        metadata->purpose = (op == BENCH_SIGN || op == BENCH_VERIFY) ? EH_PURPOSE_SIGN_VERIFY : EH_PURPOSE_ENCRYPT_DECRYPT;
+        metadata->digest_mode = EH_SM3;
+        break;
+    default:
+        metadata->purpose = EH_PURPOSE_ENCRYPT_DECRYPT;
+        break;
+    }
+}
+
+static ehsm_keyblob_t *bench_create_key(bench_op_t op, ehsm_keyspec_t keyspec)
+{
+    uint32_t keyblob_len = ehsm_get_keyblob_max_size(keyspec);
+    ehsm_keyblob_t *cmk = NULL;
+
+    if (keyblob_len == 0)
+        return NULL;
+
+    cmk = (ehsm_keyblob_t *)calloc(1, APPEND_SIZE_TO_KEYBLOB_T((size_t)keyblob_len));
+    if (cmk == NULL)
+        return NULL;
+
+    bench_set_metadata(op, keyspec, &cmk->metadata);
+    cmk->keybloblen = keyblob_len;
+
+    if (CreateKey(cmk) != EH_OK)
+        SAFE_FREE(cmk);
+
+    return cmk;
+}
+
+/* run the operation once on the prepared inputs, output is reused across the calls */
+static ehsm_status_t bench_call(bench_run_t *run, ehsm_keyblob_t *key, ehsm_data_t *output, ehsm_data_t *output2)
+{
+    bool result = false;
+    ehsm_status_t ret = EH_OK;
+
+    output->datalen = run->output_len;
+
+    switch (run->config->op)
+    {
+    case BENCH_CREATE_KEY:
+        key->keybloblen = run->output_len;
+        return CreateKey(key);
+    case BENCH_ENCRYPT:
+        return Encrypt(run->cmk, run->input, run->aad, output);
+    case BENCH_DECRYPT:
+        return Decrypt(run->cmk, run->input, run->aad, output);
+    case BENCH_ASYMMETRIC_ENCRYPT:
+        return AsymmetricEncrypt(run->cmk, run->input, output);
+    case BENCH_ASYMMETRIC_DECRYPT:
+        return AsymmetricDecrypt(run->cmk, run->input, output);
+    case BENCH_SIGN:
+        return Sign(run->cmk, run->input, output);
+    case BENCH_VERIFY:
+        ret = Verify(run->cmk, run->input, run->signature, &result);
+        return (ret == EH_OK && !result) ? EH_FUNCTION_FAILED : ret;
+    case BENCH_GENERATE_DATAKEY:
+        output2->datalen = run->size;
+        return GenerateDataKey(run->cmk, run->aad, output2, output);
+    default:
+        return EH_ARGUMENTS_BAD;
+    }
+}
+
+static void *bench_thread(void *arg)
+{
+    bench_thread_t *thread = (bench_thread_t *)arg;
+    bench_run_t *run = thread->run;
+    const bench_config_t *config = run->config;
+    ehsm_keyblob_t *key = NULL;
+    ehsm_data_t *output = bench_alloc_data(run->output_len);
+    ehsm_data_t *output2 = bench_alloc_data(run->size);
+    std::chrono::steady_clock::time_point deadline;
+
+    if (config->op == BENCH_CREATE_KEY)
+    {
+        key = (ehsm_keyblob_t *)calloc(1, APPEND_SIZE_TO_KEYBLOB_T((size_t)run->output_len));
+        if (key != NULL)
+            bench_set_metadata(config->op, config->keyspec, &key->metadata);
+    }
+
+    if (output == NULL || output2 == NULL || (config->op == BENCH_CREATE_KEY && key == NULL))
+    {
+        thread->errors++;
+        pthread_barrier_wait(run->start);
+        goto out;
+    }
+
+    for (uint64_t i = 0; i < config->warmup; i++)
+        bench_call(run, key, output, output2);
+
+    // every thread starts timing together, after all the warmups
+    pthread_barrier_wait(run->start);
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config->duration);
+
+    if (config->iterations > 0)
+        thread->latencies.reserve(config->iterations);
+
+    while (config->iterations > 0 ? thread->ops + thread->errors < config->iterations
+                                   : std::chrono::steady_clock::now() < deadline)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        ehsm_status_t ret = bench_call(run, key, output, output2);
+        auto end = std::chrono::steady_clock::now();
+
+        if (ret != EH_OK)
+        {
+            thread->errors++;
+            continue;
+        }
+        thread->ops++;
+        thread->latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    }
+
+out:
+    SAFE_FREE(key);
+    SAFE_FREE(output);
+    SAFE_FREE(output2);
+    return NULL;
+}
+
+/* prepare the inputs of one payload size, the ciphertext or signature is made with the same cmk */
+static bool bench_prepare(bench_run_t *run)
+{
+    const bench_config_t *config = run->config;
+    ehsm_keyspec_t keyspec = config->keyspec;
+    ehsm_data_t *plaintext = NULL;
+    bool ret = false;
+
+    run->aad = bench_random_data(16);
+    run->input = bench_random_data(run->size);
+    if (run->aad == NULL || run->input == NULL)
+        goto out;
+
+    switch (config->op)
+    {
+    case BENCH_CREATE_KEY:
+        run->output_len = ehsm_get_keyblob_max_size(keyspec);
+        break;
+    case BENCH_ENCRYPT:
+        run->output_len = ehsm_get_ciphertext_size(keyspec, run->size);
+        break;
+    case BENCH_DECRYPT:
+        plaintext = run->input;
+        run->input = bench_alloc_data(ehsm_get_ciphertext_size(keyspec, run->size));
+        if (run->input == NULL || Encrypt(run->cmk, plaintext, run->aad, run->input) != EH_OK)
+            goto out;
+        run->output_len = run->size;
+        break;
+    case BENCH_ASYMMETRIC_ENCRYPT:
+        run->output_len = ehsm_get_asymmetric_ciphertext_max_size(keyspec, run->size);
+        break;
+    case BENCH_ASYMMETRIC_DECRYPT:
+        plaintext = run->input;
+        run->input = bench_alloc_data(ehsm_get_asymmetric_ciphertext_max_size(keyspec, run->size));
+        if (run->input == NULL || AsymmetricEncrypt(run->cmk, plaintext, run->input) != EH_OK)
+            goto out;
+        run->output_len = ehsm_get_asymmetric_plaintext_max_size(keyspec, run->input->datalen);
+        break;
+    case BENCH_SIGN:
+        run->output_len = ehsm_get_signature_max_size(keyspec);
+        break;
+    case BENCH_VERIFY:
+        run->signature = bench_alloc_data(ehsm_get_signature_max_size(keyspec));
+        if (run->signature == NULL || Sign(run->cmk, run->input, run->signature) != EH_OK)
+            goto out;
+        run->output_len = 0;
+        break;
+    case BENCH_GENERATE_DATAKEY:
+        if (run->size > BENCH_DATAKEY_MAX_SIZE)
+            goto out;
+        run->output_len = ehsm_get_ciphertext_size(keyspec, run->size);
+        break;
+    default:
+        goto out;
+    }
+
+    ret = config->op == BENCH_VERIFY || run->output_len > 0;
+
+out:
+    if (plaintext != NULL)
+        SAFE_FREE(plaintext);
+    return ret;
+}
+
+static bool bench_run(const bench_config_t *config, ehsm_keyblob_t *cmk, uint32_t size, bench_result_t *result)
+{
+    bench_run_t run;
+    pthread_barrier_t start;
+    std::vector<bench_thread_t> threads(config->threads);
+    std::vector<pthread_t> tids(config->threads);
+    std::chrono::steady_clock::time_point begin;
+    bool ret = false;
+
+    memset(&run, 0, sizeof(run));
+    run.config = config;
+    run.size = size;
+    run.cmk = cmk;
+    run.start = &start;
+
+    result->size = size;
+    result->ops = 0;
+    result->errors = 0;
+    result->seconds = 0;
+    result->latencies.clear();
+
+    if (!bench_prepare(&run))
+    {
+        printf("failed to prepare the inputs of %u bytes\n", size);
+        goto out;
+    }
+
+    // the main thread joins the barrier too, to time the whole run
+    pthread_barrier_init(&start, NULL, config->threads + 1);
+    for (uint32_t i = 0; i < config->threads; i++)
+    {
+        threads[i].run = &run;
+        threads[i].ops = 0;
+        threads[i].errors = 0;
+        if (pthread_create(&tids[i], NULL, bench_thread, &threads[i]) != 0)
+        {
+            printf("failed to create thread %u\n", i);
+            exit(-1);
+        }
+    }
+    pthread_barrier_wait(&start);
+    begin = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < config->threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+        result->ops += threads[i].ops;
+        result->errors += threads[i].errors;
+        result->latencies.insert(result->latencies.end(), threads[i].latencies.begin(), threads[i].latencies.end());
+    }
+    result->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    pthread_barrier_destroy(&start);
+
+    std::sort(result->latencies.begin(), result->latencies.end());
+    ret = true;
+
+out:
+    SAFE_FREE(run.input);
+    SAFE_FREE(run.aad);
+    SAFE_FREE(run.signature);
+    return ret;
+}
+
+/* nearest-rank percentile of the sorted latencies, in microseconds */
+static double bench_percentile(const std::vector<uint64_t> &latencies, double q)
+{
+    size_t rank = 0;
+
+    if (latencies.empty())
+        return 0;
+
+    rank = (size_t)(q * latencies.size() + 0.999999);
+    rank = rank == 0 ? 0 : std::min(rank - 1, latencies.size() - 1);
+    return latencies[rank] / 1000.0;
+}
+
+/* latencies in power of two buckets of microseconds, bucket i counts those in [2^i, 2^(i+1)) us, bucket 0 from 0 */
+static std::vector<uint64_t> bench_histogram(const std::vector<uint64_t> &latencies)
+{
+    std::vector<uint64_t> buckets(BENCH_HISTOGRAM_BUCKETS, 0);
+
+    for (size_t i = 0; i < latencies.size(); i++)
+    {
+        uint64_t us = latencies[i] / 1000;
+        int bucket = 0;
+
+        while (us > 1 && bucket < BENCH_HISTOGRAM_BUCKETS - 1)
+        {
+            us >>= 1;
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+
+    while (!buckets.empty() && buckets.back() == 0)
+        buckets.pop_back();
+    return buckets;
+}
+
+static void bench_print(const bench_result_t *result)
+{
+    std::vector<uint64_t> buckets = bench_histogram(result->latencies);
+    uint64_t peak = 1;
+
+    printf("size %u bytes: %lu ops, %lu errors in %.3f s, %.1f ops/s\n",
+           result->size, result->ops, result->errors, result->seconds,
+           result->seconds > 0 ? result->ops / result->seconds : 0);
+    printf("  latency (us): p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+           bench_percentile(result->latencies, 0.50), bench_percentile(result->latencies, 0.90),
+           bench_percentile(result->latencies, 0.99), bench_percentile(result->latencies, 0.999),
+           bench_percentile(result->latencies, 1.0));
+
+    for (size_t i = 0; i < buckets.size(); i++)
+        peak = std::max(peak, buckets[i]);
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        if (buckets[i] == 0)
+            continue;
+        printf("  < %8lu us | %-40s %lu\n", 2UL << i,
+               std::string((size_t)(buckets[i] * 40 / peak), '#').c_str(), buckets[i]);
+    }
+}
+
+static Json::Value bench_to_json(const bench_result_t *result)
+{
+    Json::Value json;
+    Json::Value latency;
+    Json::Value histogram(Json::arrayValue);
+    std::vector<uint64_t> buckets = bench_histogram(result->latencies);
+
+    latency["p50"] = bench_percentile(result->latencies, 0.50);
+    latency["p90"] = bench_percentile(result->latencies, 0.90);
+    latency["p99"] = bench_percentile(result->latencies, 0.99);
+    latency["p999"] = bench_percentile(result->latencies, 0.999);
+    latency["max"] = bench_percentile(result->latencies, 1.0);
+    for (size_t i = 0; i < buckets.size(); i++)
+        histogram.append((Json::UInt64)buckets[i]);
+    latency["histogram_log2"] = histogram;
+
+    json["size"] = result->size;
+    json["ops"] = (Json::UInt64)result->ops;
+    json["errors"] = (Json::UInt64)result->errors;
+    json["seconds"] = result->seconds;
+    json["throughput"] = result->seconds > 0 ? result->ops / result->seconds : 0;
+    json["latency_us"] = latency;
+    return json;
+}
+
+static void bench_usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  --op NAME          createkey, encrypt, decrypt, asymmetric-encrypt, asymmetric-decrypt,\n");
+    printf("                     sign, verify, generate-datakey (default encrypt)\n");
+    printf("  --keyspec NAME     e.g. EH_AES_GCM_128, EH_SM4_CBC, EH_RSA_3072, EH_EC_P256, EH_SM2\n");
+    printf("  --sizes LIST       comma separated payload sizes in bytes (default %u)\n", BENCH_DEFAULT_SIZE);
+    printf("  --threads N        concurrent callers (default %u)\n", BENCH_DEFAULT_THREADS);
+    printf("  --duration S       seconds per payload size (default %u)\n", BENCH_DEFAULT_DURATION);
+    printf("  --iterations N     calls per thread instead of a duration\n");
+    printf("  --warmup N         untimed calls per thread before each run (default %u)\n", BENCH_DEFAULT_WARMUP);
+    printf("  --json FILE        also write the results as JSON, - for stdout\n");
+}
+
+static bool bench_parse_args(int argc, char *argv[], bench_config_t *config)
+{
+    static const struct option options[] = {
+        {"op", required_argument, NULL, 'o'},
+        {"keyspec", required_argument, NULL, 'k'},
+        {"sizes", required_argument, NULL, 's'},
+        {"threads", required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"iterations", required_argument, NULL, 'n'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"json", required_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    bool keyspec_set = false;
+    bool found = false;
+    int opt = 0;
+
+    config->op = BENCH_ENCRYPT;
+    config->keyspec = EH_AES_GCM_128;
+    config->threads = BENCH_DEFAULT_THREADS;
+    config->duration = BENCH_DEFAULT_DURATION;
+    config->iterations = 0;
+    config->warmup = BENCH_DEFAULT_WARMUP;
+
+    while ((opt = getopt_long(argc, argv, "o:k:s:t:d:n:w:j:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            found = false;
+            for (size_t i = 0; i < sizeof(g_bench_ops) / sizeof(g_bench_ops[0]); i++)
+            {
+                if (strcmp(optarg, g_bench_ops[i].name) == 0)
+                {
+                    config->op = g_bench_ops[i].op;
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                printf("unknown op %s\n", optarg);
+                return false;
+            }
+            break;
+        case 'k':
+            found = false;
+            for (size_t i = 0; i < sizeof(g_bench_keyspecs) / sizeof(g_bench_keyspecs[0]); i++)
+            {
+                if (strcmp(optarg, g_bench_keyspecs[i].name) == 0)
+                {
+                    config->keyspec = g_bench_keyspecs[i].keyspec;
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                printf("unknown keyspec %s\n", optarg);
+                return false;
+            }
+            keyspec_set = true;
+            break;
+        case 's':
+            config->sizes.clear();
+            for (char *size = strtok(optarg, ","); size != NULL; size = strtok(NULL, ","))
+                config->sizes.push_back((uint32_t)strtoul(size, NULL, 0));
+            break;
+        case 't':
+            config->threads = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            config->duration = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            config->iterations = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            config->warmup = strtoull(optarg, NULL, 0);
+            break;
+        case 'j':
+            config->json = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    // the asymmetric operations have no sensible default among the symmetric keyspecs
+    if (!keyspec_set && (config->op == BENCH_SIGN || config->op == BENCH_VERIFY))
+        config->keyspec = EH_EC_P256;
+    if (!keyspec_set && (config->op == BENCH_ASYMMETRIC_ENCRYPT || config->op == BENCH_ASYMMETRIC_DECRYPT))
+        config->keyspec = EH_RSA_2048;
+
+    if (config->sizes.empty())
+        config->sizes.push_back(config->op == BENCH_GENERATE_DATAKEY ? 32 : BENCH_DEFAULT_SIZE);
+
+    for (size_t i = 0; i < config->sizes.size(); i++)
+    {
+        if (config->sizes[i] == 0)
+        {
+            printf("payload sizes must be positive\n");
+            return false;
+        }
+    }
+
+    if (config->threads == 0 || (config->duration == 0 && config->iterations == 0))
+    {
+        printf("threads and duration (or iterations) must be positive\n");
+        return false;
+    }
+
+    return true;
+}
+
+static const char *bench_op_name(bench_op_t op)
+{
+    for (size_t i = 0; i < sizeof(g_bench_ops) / sizeof(g_bench_ops[0]); i++)
+    {
+        if (g_bench_ops[i].op == op)
+            return g_bench_ops[i].name;
+    }
+    return "unknown";
+}
+
+static const char *bench_keyspec_name(ehsm_keyspec_t keyspec)
+{
+    for (size_t i = 0; i < sizeof(g_bench_keyspecs) / sizeof(g_bench_keyspecs[0]); i++)
+    {
+        if (g_bench_keyspecs[i].keyspec == keyspec)
+            return g_bench_keyspecs[i].name;
+    }
+    return "unknown";
+}
+
+int main(int argc, char *argv[])
+{
+    bench_config_t config;
+    bench_result_t result;
+    ehsm_keyblob_t *cmk = NULL;
+    Json::Value report;
+    Json::Value results(Json::arrayValue);
+    ehsm_status_t status = EH_OK;
+    int ret = -1;
+
+    if (!bench_parse_args(argc, argv, &config))
+    {
+        bench_usage(argv[0]);
+        return -1;
+    }
+
+    status = Initialize();
+    if (status != EH_OK)
+    {
+        printf("Initialize failed %d\n", status);
+        return status;
+    }
+
+    printf("ehsm_bench %s: op %s, keyspec %s, %u threads, ",
+           EHSM_VERSION, bench_op_name(config.op), bench_keyspec_name(config.keyspec), config.threads);
+    if (config.iterations > 0)
+        printf("%lu iterations per thread\n", config.iterations);
+    else
+        printf("%u s per size\n", config.duration);
+
+    if (config.op != BENCH_CREATE_KEY)
+    {
+        cmk = bench_create_key(config.op, config.keyspec);
+        if (cmk == NULL)
+        {
+            printf("failed to create the %s cmk\n", bench_keyspec_name(config.keyspec));
+            goto out;
+        }
+    }
+
+    for (size_t i = 0; i < config.sizes.size(); i++)
+    {
+        if (!bench_run(&config, cmk, config.sizes[i], &result))
+            goto out;
+        bench_print(&result);
+        results.append(bench_to_json(&result));
+    }
+
+    if (!config.json.empty())
+    {
+        Json::StyledWriter writer;
+
+        report["version"] = EHSM_VERSION;
+        report["op"] = bench_op_name(config.op);
+        report["keyspec"] = bench_keyspec_name(config.keyspec);
+        report["threads"] = config.threads;
+        report["duration"] = config.duration;
+        report["iterations"] = (Json::UInt64)config.iterations;
+        report["warmup"] = (Json::UInt64)config.warmup;
+        report["results"] = results;
+
+        if (config.json == "-")
+        {
+            printf("%s", writer.write(report).c_str());
+        }
+        else
+        {
+            std::ofstream out(config.json.c_str());
+            out << writer.write(report);
+            if (!out)
+            {
+                printf("failed to write %s\n", config.json.c_str());
+                goto out;
+            }
+        }
+    }
+
+    ret = 0;
+
+out:
+    SAFE_FREE(cmk);
+    Finalize();
+    return ret;
+}
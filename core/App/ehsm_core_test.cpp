@@ -39,149 +39,66 @@
 #include "base64.h"
 #include "dsohandle.h"
 #include "json_utils.h"
+#include "log_utils.h"
 
 #include <iostream>
 #include <fstream>
 
 #include <pthread.h>
-#include <chrono>
-
-#define PERF_NUM 1000
-
-#define NUM_THREADS 100
 
 int case_number = 0;
 int success_number = 0;
 
-void test_perf_createkey()
-{
-    RetJsonObj retJsonObj;
-    JsonObj param_json;
-    JsonObj payload_json;
-    char *returnJsonChar = nullptr;
-    ehsm_keyspec_t symmetry_keyspec_test[] = {EH_AES_GCM_128, EH_AES_GCM_192, EH_AES_GCM_256, EH_SM4_CBC, EH_SM4_CTR};
-    int symmetry_keyspec_test_num = sizeof(symmetry_keyspec_test) / sizeof(symmetry_keyspec_test[0]);
-    ehsm_keyspec_t asymmetry_keyspec_test[] = {EH_RSA_2048, EH_RSA_3072, EH_RSA_4096, EH_SM2, EH_EC_P224, EH_EC_P256, EH_EC_P384, EH_EC_P521};
-    int asymmetry_keyspec_test_num = sizeof(asymmetry_keyspec_test) / sizeof(asymmetry_keyspec_test[0]);
-    ehsm_padding_mode_t rsa_padding_test[] = {EH_PAD_RSA_PKCS1_OAEP, EH_PAD_RSA_PKCS1_PSS};
-    int rsa_padding_num = sizeof(rsa_padding_test) / sizeof(rsa_padding_test[0]);
-    for (int j = 0; j < symmetry_keyspec_test_num; j++)
-    { // Start measuring time
-        auto begin = std::chrono::high_resolution_clock::now();
-
-        for (int i = 0; i < PERF_NUM * 100; i++)
-        {
-            payload_json.clear();
-            param_json.clear();
-            payload_json.addData_uint32("keyspec", symmetry_keyspec_test[j]);
-            payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-            param_json.addData_uint32("action", EH_CREATE_KEY);
-            param_json.addData_JsonValue("payload", payload_json.getJson());
-
-            returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-            retJsonObj.parse(returnJsonChar);
-
-            if (retJsonObj.getCode() != 200)
-            {
-                printf("Createkey with keyspec code %d failed in time(%d)\n", symmetry_keyspec_test[j], i);
-                SAFE_FREE(returnJsonChar);
-                break;
-            }
-            SAFE_FREE(returnJsonChar);
-        }
-
-        // Stop measuring time and calculate the elapsed time
-        auto end = std::chrono::high_resolution_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
+/*
 
-        printf("Time measured of CreateKey keyspec code %d with Repeat NUM(%d): %.6f seconds.\n",symmetry_keyspec_test[j], PERF_NUM * 100, elapsed.count() * 1e-9);
-    }
+step1. generate an aes-gcm-128 key as the CM(customer master key)
 
-    for (int j = 0; j < asymmetry_keyspec_test_num; j++)
-    {
-        for (int k = 0; k < rsa_padding_num; k++)
-        { // Start measuring time
-            auto begin = std::chrono::high_resolution_clock::now();
-            /*The EVP_PKEY_keygen() function in RSA createkey runs for a long time
-            cannot be tested for PERF_NUM times */
-            for (int i = 0; i < 10; i++)
-            {
-                payload_json.clear();
-                param_json.clear();
-                payload_json.addData_uint32("keyspec", asymmetry_keyspec_test[j]);
-                payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-                switch (asymmetry_keyspec_test[j])
-                {
-                case EH_RSA_2048:
-                case EH_RSA_3072:
-                case EH_RSA_4096:
-                    payload_json.addData_uint32("padding_mode", rsa_padding_test[k]);
-                    break;
-                default:
-                    break;
-                }
-
-                param_json.addData_uint32("action", EH_CREATE_KEY);
-                param_json.addData_JsonValue("payload", payload_json.getJson());
-
-                returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-                retJsonObj.parse(returnJsonChar);
-
-                if (retJsonObj.getCode() != 200)
-                {
-                    printf("Createkey with keyspec code %d failed in time(%d)\n",asymmetry_keyspec_test[j], i);
-                    SAFE_FREE(returnJsonChar);
-                    break;
-                }
-                SAFE_FREE(returnJsonChar);
-            }
+step2. encrypt a plaintext by the CMK
 
-            // Stop measuring time and calculate the elapsed time
-            auto end = std::chrono::high_resolution_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-            printf("Time measured of CreateKey keyspec code %d with Repeat NUM(%d): %.6f seconds.\n", asymmetry_keyspec_test[j], 10, elapsed.count() * 1e-9);
-        }
-    }
-}
+step3. decrypt the cipher text by CMK correctly
 
-void test_perf_encrypt()
+*/
+void test_symmertric_encrypt_decrypt()
 {
-    char *returnJsonChar = nullptr;
-    char plaintext[32] = "helloworld";
-    char aad[] = "challenge";
+    printf("============test_AES_SM_encrypt_decrypt start==========\n");
+    std::string plaintext[] = {"Test1234-AES128", "Test1234-AES192",
+                               "Test1234-AES256", "Test1234-SM4-CTR", "Test1234-SM4-CBC"};
+    uint32_t keyspec[] = {EH_AES_GCM_128, EH_AES_GCM_192, EH_AES_GCM_256, EH_SM4_CTR, EH_SM4_CBC};
 
-    std::chrono::high_resolution_clock::time_point begin;
-    std::chrono::high_resolution_clock::time_point end;
-    std::chrono::nanoseconds elapsed;
+    case_number += sizeof(plaintext) / sizeof(plaintext[0]);
 
-    char *cmk_base64 = nullptr;
-    char *plaintext_base64 = nullptr;
-    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
-    std::string input_aad_base64 = base64_encode((const uint8_t *)aad, sizeof(aad) / sizeof(aad[0]));
+    for (int i = 0; i < sizeof(plaintext) / sizeof(plaintext[0]); i++)
+    {
+        char *returnJsonChar = nullptr;
+        char aad[] = "challenge";
+        printf("============%s start==========\n", plaintext[i].c_str());
 
-    RetJsonObj retJsonObj;
-    JsonObj param_json;
-    JsonObj payload_json;
-    payload_json.addData_uint32("keyspec", EH_AES_GCM_256);
-    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-    param_json.addData_uint32("action", EH_CREATE_KEY);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
+        char *cmk_base64 = nullptr;
+        char *ciphertext_base64 = nullptr;
+        char *plaintext_base64 = nullptr;
+        std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext[i].c_str(), plaintext[i].length());
+        std::string input_aad_base64 = base64_encode((const uint8_t *)aad, sizeof(aad) / sizeof(aad[0]));
 
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
+        RetJsonObj retJsonObj;
+        JsonObj param_json;
+        JsonObj payload_json;
+        payload_json.addData_uint32("keyspec", keyspec[i]);
+        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+        param_json.addData_uint32("action", EH_CREATE_KEY);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
 
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("Createkey with aes-gcm-256 failed, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    cmk_base64 = retJsonObj.readData_cstr("cmk");
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
 
-    // Start measuring time
-    begin = std::chrono::high_resolution_clock::now();
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("Createkey with aes-gcm failed, error message: %s \n", retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        printf("FFI_CreateKey Json = %s\n", returnJsonChar);
+        printf("Create CMK with AES SUCCESSFULLY!\n");
+        cmk_base64 = retJsonObj.readData_cstr("cmk");
 
-    for (int i = 0; i < PERF_NUM * 100; i++)
-    {
         payload_json.clear();
         payload_json.addData_string("cmk", cmk_base64);
         payload_json.addData_string("plaintext", input_plaintext_base64);
@@ -195,80 +112,13 @@ void test_perf_encrypt()
 
         if (retJsonObj.getCode() != 200)
         {
-            printf("failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
+            printf("Failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
             goto cleanup;
         }
-        SAFE_FREE(returnJsonChar);
-    }
-
-    // Stop measuring time and calculate the elapsed time
-    end = std::chrono::high_resolution_clock::now();
-    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-
-    printf("Time measured of Encrypt(AES_256) with Repeat NUM(%d): %.6f seconds.\n", PERF_NUM * 100, elapsed.count() * 1e-9);
-
-cleanup:
-    SAFE_FREE(plaintext_base64);
-    SAFE_FREE(cmk_base64);
-    SAFE_FREE(returnJsonChar);
-}
-
-void test_perf_decrypt()
-{
-    char *returnJsonChar = nullptr;
-    char plaintext[32] = "helloworld";
-    char aad[] = "challenge";
-
-    std::chrono::high_resolution_clock::time_point begin;
-    std::chrono::high_resolution_clock::time_point end;
-    std::chrono::nanoseconds elapsed;
-    char *cmk_base64 = nullptr;
-    char *ciphertext_base64 = nullptr;
-    char *plaintext_base64 = nullptr;
-    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
-    std::string input_aad_base64 = base64_encode((const uint8_t *)aad, sizeof(aad) / sizeof(aad[0]));
-
-    RetJsonObj retJsonObj;
-    JsonObj param_json;
-    JsonObj payload_json;
-    payload_json.addData_uint32("keyspec", EH_AES_GCM_256);
-    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-    param_json.addData_uint32("action", EH_CREATE_KEY);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
-
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
-
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("Createkey with aes-gcm-256 failed, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    cmk_base64 = retJsonObj.readData_cstr("cmk");
-
-    payload_json.clear();
-    payload_json.addData_string("cmk", cmk_base64);
-    payload_json.addData_string("plaintext", input_plaintext_base64);
-    payload_json.addData_string("aad", input_aad_base64);
-
-    param_json.addData_uint32("action", EH_ENCRYPT);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
-
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
-
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    ciphertext_base64 = retJsonObj.readData_cstr("ciphertext");
-
-    // Start measuring time
-    begin = std::chrono::high_resolution_clock::now();
+        printf("FFI_Encrypt json = %s\n", returnJsonChar);
+        printf("Encrypt data SUCCESSFULLY!\n");
 
-    for (int i = 0; i < PERF_NUM * 100; i++)
-    {
+        ciphertext_base64 = retJsonObj.readData_cstr("ciphertext");
         payload_json.addData_string("ciphertext", ciphertext_base64);
 
         param_json.addData_uint32("action", EH_DECRYPT);
@@ -282,445 +132,152 @@ void test_perf_decrypt()
             printf("Failed to Decrypt the data, error message: %s \n", retJsonObj.getMessage().c_str());
             goto cleanup;
         }
+        printf("FFI_Decrypt json = %s\n", returnJsonChar);
+        plaintext_base64 = retJsonObj.readData_cstr("plaintext");
+        if (plaintext_base64 == input_plaintext_base64)
+        {
+            success_number++;
+            printf("decode64 plaintext = %s\n", base64_decode(plaintext_base64).c_str());
+            printf("Decrypt data SUCCESSFULLY!\n");
+        }
+        else
+        {
+            printf("Failed to Decrypt the data, result = %s \n", base64_decode(plaintext_base64).c_str());
+        }
+
+    cleanup:
+        SAFE_FREE(plaintext_base64);
+        SAFE_FREE(ciphertext_base64);
+        SAFE_FREE(cmk_base64);
         SAFE_FREE(returnJsonChar);
+        printf("============%s end==========\n", plaintext[i].c_str());
     }
 
-    // Stop measuring time and calculate the elapsed time
-    end = std::chrono::high_resolution_clock::now();
-    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-
-    printf("Time measured of Decrypt(AES_256) with Repeat NUM(%d): %.6f seconds.\n", PERF_NUM * 100, elapsed.count() * 1e-9);
-
-cleanup:
-    SAFE_FREE(ciphertext_base64);
-    SAFE_FREE(plaintext_base64);
-    SAFE_FREE(cmk_base64);
-    SAFE_FREE(returnJsonChar);
+    printf("============test_AES_SM_encrypt_decrypt end==========\n");
 }
 
-void test_perf_sign_verify()
+void test_symmertric_encrypt_decrypt_without_aad()
 {
-    ehsm_status_t ret = EH_OK;
-    char *returnJsonChar = nullptr;
-    char data2sign[] = "SIGN";
+    printf("============test_AES_encrypt_decrypt_without_aad start==========\n");
+    std::string plaintext[] = {"Test1234-AES128", "Test1234-AES192",
+                               "Test1234-AES256"};
+    uint32_t keyspec[] = {EH_AES_GCM_128, EH_AES_GCM_192, EH_AES_GCM_256};
 
-    std::chrono::high_resolution_clock::time_point begin;
-    std::chrono::high_resolution_clock::time_point end;
-    std::chrono::nanoseconds elapsed;
+    case_number += sizeof(plaintext) / sizeof(plaintext[0]);
 
-    char *cmk_base64 = nullptr;
-    char *signature_base64 = nullptr;
-    bool result = false;
-    RetJsonObj retJsonObj;
+    for (int i = 0; i < sizeof(plaintext) / sizeof(plaintext[0]); i++)
+    {
+        char *returnJsonChar = nullptr;
+        char aad[] = "";
+        printf("============%s start==========\n", plaintext[i].c_str());
 
-    JsonObj param_json;
-    JsonObj payload_json;
+        char *cmk_base64 = nullptr;
+        char *ciphertext_base64 = nullptr;
+        char *plaintext_base64 = nullptr;
+        std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext[i].c_str(), plaintext[i].length());
+        std::string input_aad_base64 = base64_encode((const uint8_t *)aad, sizeof(aad) / sizeof(aad[0]));
 
-    std::string input_data2sign_base64 = base64_encode((const uint8_t *)data2sign, sizeof(data2sign) / sizeof(data2sign[0]));
+        RetJsonObj retJsonObj;
+        JsonObj param_json;
+        JsonObj payload_json;
+        payload_json.addData_uint32("keyspec", keyspec[i]);
+        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+        param_json.addData_uint32("action", EH_CREATE_KEY);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
 
-    payload_json.addData_uint32("keyspec", EH_RSA_4096);
-    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-    payload_json.addData_uint32("padding_mode", EH_PAD_RSA_PKCS1_PSS);
-    payload_json.addData_uint32("digest_mode", EH_SHA_2_256);
-    param_json.addData_uint32("action", EH_CREATE_KEY);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("FFI_CreateKey failed, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    cmk_base64 = retJsonObj.readData_cstr("cmk");
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
 
-    // Start measuring time
-    begin = std::chrono::high_resolution_clock::now();
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("Createkey with aes-gcm failed, error message: %s \n", retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        printf("FFI_CreateKey Json = %s\n", returnJsonChar);
+        printf("Create CMK with AES SUCCESSFULLY!\n");
+        cmk_base64 = retJsonObj.readData_cstr("cmk");
 
-    for (int i = 0; i < PERF_NUM; i++)
-    {
         payload_json.clear();
         payload_json.addData_string("cmk", cmk_base64);
-        payload_json.addData_string("digest", input_data2sign_base64);
+        payload_json.addData_string("plaintext", input_plaintext_base64);
+        payload_json.addData_string("aad", input_aad_base64);
 
-        param_json.addData_uint32("action", EH_SIGN);
+        param_json.addData_uint32("action", EH_ENCRYPT);
         param_json.addData_JsonValue("payload", payload_json.getJson());
 
         returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
         retJsonObj.parse(returnJsonChar);
+
         if (retJsonObj.getCode() != 200)
         {
-            printf("FFI_Sign failed, error message: %s \n", retJsonObj.getMessage().c_str());
+            printf("Failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
             goto cleanup;
         }
-    }
-
-    // Stop measuring time and calculate the elapsed time
-    end = std::chrono::high_resolution_clock::now();
-    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-
-    printf("Time measured of Sign(RSA_4096) with Repeat NUM(%d): %.6f seconds.\n", PERF_NUM, elapsed.count() * 1e-9);
-
-    signature_base64 = retJsonObj.readData_cstr("signature");
-    // Start measuring time
-    begin = std::chrono::high_resolution_clock::now();
+        printf("FFI_Encrypt json = %s\n", returnJsonChar);
+        printf("Encrypt data SUCCESSFULLY!\n");
 
-    for (int i = 0; i < PERF_NUM; i++)
-    {
-        payload_json.addData_string("signature", signature_base64);
+        ciphertext_base64 = retJsonObj.readData_cstr("ciphertext");
+        payload_json.addData_string("ciphertext", ciphertext_base64);
 
-        param_json.addData_uint32("action", EH_VERIFY);
+        param_json.addData_uint32("action", EH_DECRYPT);
         param_json.addData_JsonValue("payload", payload_json.getJson());
 
         returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
         retJsonObj.parse(returnJsonChar);
+
         if (retJsonObj.getCode() != 200)
         {
-            printf("FFI_Verify failed, error message: %s \n", retJsonObj.getMessage().c_str());
+            printf("Failed to Decrypt the data, error message: %s \n", retJsonObj.getMessage().c_str());
             goto cleanup;
         }
-        SAFE_FREE(returnJsonChar);
-    }
-
-    // Stop measuring time and calculate the elapsed time
-    end = std::chrono::high_resolution_clock::now();
-    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-
-    printf("Time measured of Verify(RSA_4096) with Repeat NUM(%d): %.6f seconds.\n", PERF_NUM, elapsed.count() * 1e-9);
-
-cleanup:
-    SAFE_FREE(signature_base64);
-    SAFE_FREE(cmk_base64);
-    SAFE_FREE(returnJsonChar);
-}
-
-void test_perf_asymmetricencrypt()
-{
-    std::chrono::high_resolution_clock::time_point begin;
-    std::chrono::high_resolution_clock::time_point end;
-    std::chrono::nanoseconds elapsed;
-
-    char *returnJsonChar = nullptr;
-    char plaintext[32] = "TestRSA-4096";
-    char *cmk_base64 = nullptr;
-    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
-
-    RetJsonObj retJsonObj;
-    JsonObj param_json;
-    JsonObj payload_json;
-    payload_json.addData_uint32("keyspec", EH_RSA_3072);
-    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-    payload_json.addData_uint32("padding_mode", EH_PAD_RSA_PKCS1_OAEP);
-    param_json.addData_uint32("action", EH_CREATE_KEY);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
-
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("FFI_CreateKey failed, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    cmk_base64 = retJsonObj.readData_cstr("cmk");
-
-    // Start measuring time
-    begin = std::chrono::high_resolution_clock::now();
-
-    for (int i = 0; i < PERF_NUM; i++)
-    {
-        payload_json.clear();
-        payload_json.addData_string("cmk", cmk_base64);
-        payload_json.addData_string("plaintext", input_plaintext_base64);
-
-        param_json.addData_uint32("action", EH_ASYMMETRIC_ENCRYPT);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("FFI_AsymmetricEncrypt failed, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        SAFE_FREE(returnJsonChar);
-    }
-
-    // Stop measuring time and calculate the elapsed time
-    end = std::chrono::high_resolution_clock::now();
-    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-    printf("Time measured of AsymmetricEncrypt(RSA_3072) with Repeat NUM(%d): %.6f seconds.\n", PERF_NUM, elapsed.count() * 1e-9);
-
-cleanup:
-    SAFE_FREE(cmk_base64);
-    SAFE_FREE(returnJsonChar);
-}
-
-void test_perf_asymmetricdecrypt()
-{
-    std::chrono::high_resolution_clock::time_point begin;
-    std::chrono::high_resolution_clock::time_point end;
-    std::chrono::nanoseconds elapsed;
-
-    char *returnJsonChar = nullptr;
-    char plaintext[32] = "TestRSA-3072";
-    char *cmk_base64 = nullptr;
-    char *ciphertext_base64 = nullptr;
-    char *plaintext_base64 = nullptr;
-    RetJsonObj retJsonObj;
-    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
-
-    JsonObj param_json;
-    JsonObj payload_json;
-    payload_json.addData_uint32("keyspec", EH_RSA_3072);
-    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-    payload_json.addData_uint32("padding_mode", EH_PAD_RSA_PKCS1_OAEP);
-    param_json.addData_uint32("action", EH_CREATE_KEY);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
-
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("FFI_CreateKey failed, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    cmk_base64 = retJsonObj.readData_cstr("cmk");
-
-    payload_json.clear();
-    payload_json.addData_string("cmk", cmk_base64);
-    payload_json.addData_string("plaintext", input_plaintext_base64);
-
-    param_json.addData_uint32("action", EH_ASYMMETRIC_ENCRYPT);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
-
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("FFI_AsymmetricEncrypt failed, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    ciphertext_base64 = retJsonObj.readData_cstr("ciphertext");
-
-    // Start measuring time
-    begin = std::chrono::high_resolution_clock::now();
-
-    for (int i = 0; i < PERF_NUM; i++)
-    {
-        payload_json.addData_string("ciphertext", ciphertext_base64);
-
-        param_json.addData_uint32("action", EH_ASYMMETRIC_DECRYPT);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("FFI_AsymmetricDecrypt failed, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        SAFE_FREE(returnJsonChar);
-    }
-
-    // Stop measuring time and calculate the elapsed time
-    end = std::chrono::high_resolution_clock::now();
-    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin);
-    printf("Time measured of AsymmetricDecrypt(RSA_3072) with Repeat NUM(%d): %.6f seconds.\n", PERF_NUM, elapsed.count() * 1e-9);
-
-cleanup:
-    SAFE_FREE(cmk_base64);
-    SAFE_FREE(ciphertext_base64);
-    SAFE_FREE(plaintext_base64);
-    SAFE_FREE(returnJsonChar);
-}
-
-void *test_createkey(void *threadid)
-{
-    RetJsonObj retJsonObj;
-    JsonObj param_json;
-    JsonObj payload_json;
-    char *returnJsonChar = nullptr;
-    long tid = (long)threadid;
-
-    for (int i = 0; i < PERF_NUM; i++)
-    {
-        payload_json.addData_uint32("keyspec", EH_AES_GCM_256);
-        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-        param_json.addData_uint32("action", EH_CREATE_KEY);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("Createkey with aes-128 failed in time(%d)\n", i);
-            SAFE_FREE(returnJsonChar);
-            break;
-        }
-        SAFE_FREE(returnJsonChar);
-        printf("Thread[%ld], CreateKey(AES-128) succeed in time[%d]\n", tid, i);
-    }
-
-    pthread_exit(NULL);
-}
-
-void test_parallel_createkey()
-{
-    void *status;
-    pthread_t threads[NUM_THREADS];
-    int rc;
-    int i;
-    for (i = 0; i < NUM_THREADS; i++)
-    {
-        printf("creating thread [%d]\n", i);
-        rc = pthread_create(&threads[i], NULL, test_createkey, (void *)i);
-        if (rc)
-        {
-            printf("Error(%d):unable to create thread\n", rc);
-            exit(-1);
-        }
-    }
-
-    for (i = 0; i < NUM_THREADS; i++)
-    {
-        rc = pthread_join(threads[i], &status);
-        if (rc)
+        printf("FFI_Decrypt json = %s\n", returnJsonChar);
+        plaintext_base64 = retJsonObj.readData_cstr("plaintext");
+        if (plaintext_base64 == input_plaintext_base64)
         {
-            printf("Error(%d) to join with thread[%d]\n", rc, i);
-            exit(-1);
+            success_number++;
+            printf("decode64 plaintext = %s\n", base64_decode(plaintext_base64).c_str());
+            printf("Decrypt data SUCCESSFULLY!\n");
         }
-        printf("Main: completed thread[%d]\n", i);
-    }
-    pthread_exit(NULL);
-}
-
-void *test_encrypt(void *threadid)
-{
-    long tid = (long)threadid;
-    char *returnJsonChar = nullptr;
-    char plaintext[32] = "helloworld";
-    char aad[] = "challenge";
-
-    printf("Thread[%ld]. plaintext is %s\n", tid, plaintext);
-
-    char *cmk_base64 = nullptr;
-    char *plaintext_base64 = nullptr;
-    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
-    std::string input_aad_base64 = base64_encode((const uint8_t *)aad, sizeof(aad) / sizeof(aad[0]));
-
-    RetJsonObj retJsonObj;
-    JsonObj param_json;
-    JsonObj payload_json;
-    payload_json.addData_uint32("keyspec", EH_AES_GCM_256);
-    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-    param_json.addData_uint32("action", EH_CREATE_KEY);
-    param_json.addData_JsonValue("payload", payload_json.getJson());
-
-    if (retJsonObj.getCode() != 200)
-    {
-        printf("Thread[%ld], Createkey with aes-gcm-128 failed, error message: %s \n", tid, retJsonObj.getMessage().c_str());
-        goto cleanup;
-    }
-    printf("Thread[%ld], FFI_CreateKey Json = %s\n", tid, returnJsonChar);
-    cmk_base64 = retJsonObj.readData_cstr("cmk");
-
-    for (int i = 0; i < PERF_NUM; i++)
-    {
-        payload_json.clear();
-        payload_json.addData_string("cmk", cmk_base64);
-        payload_json.addData_string("plaintext", input_plaintext_base64);
-        payload_json.addData_string("aad", input_aad_base64);
-
-        param_json.addData_uint32("action", EH_ENCRYPT);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
+        else
         {
-            printf("Thread[%ld] with time[%d], failed to Encrypt the plaittext data, error message: %s \n", tid, i, retJsonObj.getMessage().c_str());
-            goto cleanup;
+            printf("Failed to Decrypt the data, result = %s \n", base64_decode(plaintext_base64).c_str());
         }
 
-        printf("Thread[%ld] with time[%d], FFI_Encrypt json = %s\n", tid, i, returnJsonChar);
-
+    cleanup:
+        SAFE_FREE(plaintext_base64);
+        SAFE_FREE(ciphertext_base64);
+        SAFE_FREE(cmk_base64);
         SAFE_FREE(returnJsonChar);
+        printf("============%s end==========\n", plaintext[i].c_str());
     }
 
-cleanup:
-    SAFE_FREE(plaintext_base64);
-    SAFE_FREE(cmk_base64);
-    SAFE_FREE(returnJsonChar);
-
-    pthread_exit(NULL);
-}
-
-void test_parallel_encrypt()
-{
-    void *status;
-    pthread_t threads[NUM_THREADS];
-    int rc;
-    int i;
-    for (i = 0; i < NUM_THREADS; i++)
-    {
-        printf("creating thread [%d]\n", i);
-        rc = pthread_create(&threads[i], NULL, test_encrypt, (void *)i);
-        if (rc)
-        {
-            printf("Error(%d):unable to create thread\n", rc);
-            exit(-1);
-        }
-    }
-
-    for (i = 0; i < NUM_THREADS; i++)
-    {
-        rc = pthread_join(threads[i], &status);
-        if (rc)
-        {
-            printf("Error(%d) to join with thread[%d]\n", rc, i);
-            exit(-1);
-        }
-        printf("Main: completed thread[%d]\n", i);
-    }
-    pthread_exit(NULL);
+    printf("============test_AES_encrypt_decrypt_without_aad end==========\n");
 }
 
-/*
-
-step1. generate an aes-gcm-128 key as the CM(customer master key)
-
-step2. encrypt a plaintext by the CMK
-
-step3. decrypt the cipher text by CMK correctly
-
-*/
-void test_symmertric_encrypt_decrypt()
+void test_RSA_encrypt_decrypt()
 {
-    printf("============test_AES_SM_encrypt_decrypt start==========\n");
-    std::string plaintext[] = {"Test1234-AES128", "Test1234-AES192",
-                               "Test1234-AES256", "Test1234-SM4-CTR", "Test1234-SM4-CBC"};
-    uint32_t keyspec[] = {EH_AES_GCM_128, EH_AES_GCM_192, EH_AES_GCM_256, EH_SM4_CTR, EH_SM4_CBC};
+    printf("============test_RSA_encrypt_decrypt start==========\n");
+    std::string plaintext[] = {"Test1234-RSA2048", "Test1234-RSA3072", "Test1234-RSA4096"};
+    uint32_t keyspec[] = {EH_RSA_2048, EH_RSA_3072, EH_RSA_4096};
 
     case_number += sizeof(plaintext) / sizeof(plaintext[0]);
 
     for (int i = 0; i < sizeof(plaintext) / sizeof(plaintext[0]); i++)
     {
         char *returnJsonChar = nullptr;
-        char aad[] = "challenge";
         printf("============%s start==========\n", plaintext[i].c_str());
 
         char *cmk_base64 = nullptr;
         char *ciphertext_base64 = nullptr;
         char *plaintext_base64 = nullptr;
         std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext[i].c_str(), plaintext[i].length());
-        std::string input_aad_base64 = base64_encode((const uint8_t *)aad, sizeof(aad) / sizeof(aad[0]));
 
         RetJsonObj retJsonObj;
         JsonObj param_json;
         JsonObj payload_json;
         payload_json.addData_uint32("keyspec", keyspec[i]);
         payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+        payload_json.addData_uint32("padding_mode", EH_PAD_RSA_PKCS1_OAEP);
         param_json.addData_uint32("action", EH_CREATE_KEY);
         param_json.addData_JsonValue("payload", payload_json.getJson());
 
@@ -729,19 +286,18 @@ void test_symmertric_encrypt_decrypt()
 
         if (retJsonObj.getCode() != 200)
         {
-            printf("Createkey with aes-gcm failed, error message: %s \n", retJsonObj.getMessage().c_str());
+            printf("Createkey with rsa failed, error message: %s \n", retJsonObj.getMessage().c_str());
             goto cleanup;
         }
         printf("FFI_CreateKey Json = %s\n", returnJsonChar);
-        printf("Create CMK with AES SUCCESSFULLY!\n");
+        printf("Create CMK with RSA SUCCESSFULLY!\n");
         cmk_base64 = retJsonObj.readData_cstr("cmk");
 
         payload_json.clear();
         payload_json.addData_string("cmk", cmk_base64);
         payload_json.addData_string("plaintext", input_plaintext_base64);
-        payload_json.addData_string("aad", input_aad_base64);
 
-        param_json.addData_uint32("action", EH_ENCRYPT);
+        param_json.addData_uint32("action", EH_ASYMMETRIC_ENCRYPT);
         param_json.addData_JsonValue("payload", payload_json.getJson());
 
         returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
@@ -749,7 +305,7 @@ void test_symmertric_encrypt_decrypt()
 
         if (retJsonObj.getCode() != 200)
         {
-            printf("Failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
+            printf("Failed to Encrypt the plaintext data, error message: %s \n", retJsonObj.getMessage().c_str());
             goto cleanup;
         }
         printf("FFI_Encrypt json = %s\n", returnJsonChar);
@@ -758,7 +314,7 @@ void test_symmertric_encrypt_decrypt()
         ciphertext_base64 = retJsonObj.readData_cstr("ciphertext");
         payload_json.addData_string("ciphertext", ciphertext_base64);
 
-        param_json.addData_uint32("action", EH_DECRYPT);
+        param_json.addData_uint32("action", EH_ASYMMETRIC_DECRYPT);
         param_json.addData_JsonValue("payload", payload_json.getJson());
 
         returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
@@ -790,200 +346,7 @@ void test_symmertric_encrypt_decrypt()
         printf("============%s end==========\n", plaintext[i].c_str());
     }
 
-    printf("============test_AES_SM_encrypt_decrypt end==========\n");
-}
-
-void test_symmertric_encrypt_decrypt_without_aad()
-{
-    printf("============test_AES_encrypt_decrypt_without_aad start==========\n");
-    std::string plaintext[] = {"Test1234-AES128", "Test1234-AES192",
-                               "Test1234-AES256"};
-    uint32_t keyspec[] = {EH_AES_GCM_128, EH_AES_GCM_192, EH_AES_GCM_256};
-
-    case_number += sizeof(plaintext) / sizeof(plaintext[0]);
-
-    for (int i = 0; i < sizeof(plaintext) / sizeof(plaintext[0]); i++)
-    {
-        char *returnJsonChar = nullptr;
-        char aad[] = "";
-        printf("============%s start==========\n", plaintext[i].c_str());
-
-        char *cmk_base64 = nullptr;
-        char *ciphertext_base64 = nullptr;
-        char *plaintext_base64 = nullptr;
-        std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext[i].c_str(), plaintext[i].length());
-        std::string input_aad_base64 = base64_encode((const uint8_t *)aad, sizeof(aad) / sizeof(aad[0]));
-
-        RetJsonObj retJsonObj;
-        JsonObj param_json;
-        JsonObj payload_json;
-        payload_json.addData_uint32("keyspec", keyspec[i]);
-        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-        param_json.addData_uint32("action", EH_CREATE_KEY);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("Createkey with aes-gcm failed, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        printf("FFI_CreateKey Json = %s\n", returnJsonChar);
-        printf("Create CMK with AES SUCCESSFULLY!\n");
-        cmk_base64 = retJsonObj.readData_cstr("cmk");
-
-        payload_json.clear();
-        payload_json.addData_string("cmk", cmk_base64);
-        payload_json.addData_string("plaintext", input_plaintext_base64);
-        payload_json.addData_string("aad", input_aad_base64);
-
-        param_json.addData_uint32("action", EH_ENCRYPT);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("Failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        printf("FFI_Encrypt json = %s\n", returnJsonChar);
-        printf("Encrypt data SUCCESSFULLY!\n");
-
-        ciphertext_base64 = retJsonObj.readData_cstr("ciphertext");
-        payload_json.addData_string("ciphertext", ciphertext_base64);
-
-        param_json.addData_uint32("action", EH_DECRYPT);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("Failed to Decrypt the data, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        printf("FFI_Decrypt json = %s\n", returnJsonChar);
-        plaintext_base64 = retJsonObj.readData_cstr("plaintext");
-        if (plaintext_base64 == input_plaintext_base64)
-        {
-            success_number++;
-            printf("decode64 plaintext = %s\n", base64_decode(plaintext_base64).c_str());
-            printf("Decrypt data SUCCESSFULLY!\n");
-        }
-        else
-        {
-            printf("Failed to Decrypt the data, result = %s \n", base64_decode(plaintext_base64).c_str());
-        }
-
-    cleanup:
-        SAFE_FREE(plaintext_base64);
-        SAFE_FREE(ciphertext_base64);
-        SAFE_FREE(cmk_base64);
-        SAFE_FREE(returnJsonChar);
-        printf("============%s end==========\n", plaintext[i].c_str());
-    }
-
-    printf("============test_AES_encrypt_decrypt_without_aad end==========\n");
-}
-
-void test_RSA_encrypt_decrypt()
-{
-    printf("============test_RSA_encrypt_decrypt start==========\n");
-    std::string plaintext[] = {"Test1234-RSA2048", "Test1234-RSA3072", "Test1234-RSA4096"};
-    uint32_t keyspec[] = {EH_RSA_2048, EH_RSA_3072, EH_RSA_4096};
-
-    case_number += sizeof(plaintext) / sizeof(plaintext[0]);
-
-    for (int i = 0; i < sizeof(plaintext) / sizeof(plaintext[0]); i++)
-    {
-        char *returnJsonChar = nullptr;
-        printf("============%s start==========\n", plaintext[i].c_str());
-
-        char *cmk_base64 = nullptr;
-        char *ciphertext_base64 = nullptr;
-        char *plaintext_base64 = nullptr;
-        std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext[i].c_str(), plaintext[i].length());
-
-        RetJsonObj retJsonObj;
-        JsonObj param_json;
-        JsonObj payload_json;
-        payload_json.addData_uint32("keyspec", keyspec[i]);
-        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
-        payload_json.addData_uint32("padding_mode", EH_PAD_RSA_PKCS1_OAEP);
-        param_json.addData_uint32("action", EH_CREATE_KEY);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("Createkey with rsa failed, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        printf("FFI_CreateKey Json = %s\n", returnJsonChar);
-        printf("Create CMK with RSA SUCCESSFULLY!\n");
-        cmk_base64 = retJsonObj.readData_cstr("cmk");
-
-        payload_json.clear();
-        payload_json.addData_string("cmk", cmk_base64);
-        payload_json.addData_string("plaintext", input_plaintext_base64);
-
-        param_json.addData_uint32("action", EH_ASYMMETRIC_ENCRYPT);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("Failed to Encrypt the plaintext data, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        printf("FFI_Encrypt json = %s\n", returnJsonChar);
-        printf("Encrypt data SUCCESSFULLY!\n");
-
-        ciphertext_base64 = retJsonObj.readData_cstr("ciphertext");
-        payload_json.addData_string("ciphertext", ciphertext_base64);
-
-        param_json.addData_uint32("action", EH_ASYMMETRIC_DECRYPT);
-        param_json.addData_JsonValue("payload", payload_json.getJson());
-
-        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-        retJsonObj.parse(returnJsonChar);
-
-        if (retJsonObj.getCode() != 200)
-        {
-            printf("Failed to Decrypt the data, error message: %s \n", retJsonObj.getMessage().c_str());
-            goto cleanup;
-        }
-        printf("FFI_Decrypt json = %s\n", returnJsonChar);
-        plaintext_base64 = retJsonObj.readData_cstr("plaintext");
-        if (plaintext_base64 == input_plaintext_base64)
-        {
-            success_number++;
-            printf("decode64 plaintext = %s\n", base64_decode(plaintext_base64).c_str());
-            printf("Decrypt data SUCCESSFULLY!\n");
-        }
-        else
-        {
-            printf("Failed to Decrypt the data, result = %s \n", base64_decode(plaintext_base64).c_str());
-        }
-
-    cleanup:
-        SAFE_FREE(plaintext_base64);
-        SAFE_FREE(ciphertext_base64);
-        SAFE_FREE(cmk_base64);
-        SAFE_FREE(returnJsonChar);
-        printf("============%s end==========\n", plaintext[i].c_str());
-    }
-
-    printf("============test_RSA_encrypt_decrypt end==========\n");
+    printf("============test_RSA_encrypt_decrypt end==========\n");
 }
 
 void test_SM2_encrypt_decrypt()
@@ -1805,197 +1168,1944 @@ void test_export_datakey()
             SAFE_FREE(newdatakeyplaintext_base64)
         }
         SAFE_FREE(returnJsonChar);
-        SAFE_FREE(cmk_base64);
-        SAFE_FREE(ukey_base64);
-        SAFE_FREE(olddatakey_base64);
-        SAFE_FREE(newdatakey_base64);
-        SAFE_FREE(olddatakeyplaintext_base64);
-        SAFE_FREE(newdatakeyplaintext_base64);
-        SAFE_FREE(plaintext_base64);
-        SAFE_FREE(ciphertext_base64);
+        SAFE_FREE(cmk_base64);
+        SAFE_FREE(ukey_base64);
+        SAFE_FREE(olddatakey_base64);
+        SAFE_FREE(newdatakey_base64);
+        SAFE_FREE(olddatakeyplaintext_base64);
+        SAFE_FREE(newdatakeyplaintext_base64);
+        SAFE_FREE(plaintext_base64);
+        SAFE_FREE(ciphertext_base64);
+    }
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    SAFE_FREE(cmk_base64);
+    SAFE_FREE(ukey_base64);
+    SAFE_FREE(olddatakey_base64);
+    SAFE_FREE(newdatakey_base64);
+    SAFE_FREE(olddatakeyplaintext_base64);
+    SAFE_FREE(newdatakeyplaintext_base64);
+    SAFE_FREE(plaintext_base64);
+    SAFE_FREE(ciphertext_base64);
+    printf("============test_export_datakey end==========\n");
+}
+
+void test_GenerateQuote_and_VerifyQuote()
+{
+    printf("============test_GenerateQuote_and_VerifyQuote start==========\n");
+    JsonObj param_json;
+    JsonObj payload_json;
+
+    RetJsonObj retJsonObj;
+    char *returnJsonChar = nullptr;
+    char *quote_base64 = nullptr;
+
+    char challenge[32] = "challenge123456";
+    char nonce[16] = "nonce123456";
+
+    std::string input_challenge_base64 = base64_encode((const uint8_t *)challenge, sizeof(challenge) / sizeof(challenge[0]));
+    std::string input_nonce_base64 = base64_encode((const uint8_t *)nonce, sizeof(nonce) / sizeof(nonce[0]));
+
+    // the string generated after converting the value of mr_signer and mr_enclave to hexadecimal
+    // notice: these 2 values will be changed if our enclave has been updated. then the case may be failed.
+    // you can get mr_signer and mr_enclave through cmd:
+    // "/opt/intel/sgxsdk/bin/x64/sgx_sign dump -enclave libenclave-ehsm-core.signed.so -dumpfile out.log"
+    std::string mr_enclave;
+    std::string mr_signer;
+    std::string signedEnclaveFileName = SIGNED_ENCLAVE_FILENAME;
+    std::string sgxSignFileName = SGX_SIGNING_TOOL;
+    std::string tmpFileName = "ehsm_enclave_out.log";
+    printf("NAPI_GenerateQuote signedEnclaveFileName : %s\n", signedEnclaveFileName.c_str());
+    printf("NAPI_GenerateQuote sgxSignFileName : %s\n", sgxSignFileName.c_str());
+    std::string delTmpFileCMD = "rm " + tmpFileName;
+    std::string CMD1 = " dump -enclave ";
+    std::string CMD2 = " -dumpfile " + tmpFileName;
+    std::string splicedCMD = sgxSignFileName + CMD1 + signedEnclaveFileName + CMD2;
+    const char *dumpFileCMD = splicedCMD.data();
+    system(dumpFileCMD);
+    std::fstream ifs;
+    std::string line;
+    u_int32_t readEnclaveLineNum = 0;
+    u_int32_t readSignerLineNum = 0;
+    ifs.open(tmpFileName, std::ios::in);
+    if (!ifs.is_open())
+    {
+        printf("load mr_signer & mr_enclave faild. \n");
+        goto cleanup;
+    }
+    while (getline(ifs, line))
+    {
+        if (readEnclaveLineNum > 0)
+        {
+            readEnclaveLineNum -= 1;
+            mr_enclave += line;
+        }
+        if (readSignerLineNum > 0)
+        {
+            readSignerLineNum -= 1;
+            mr_signer += line;
+        }
+        if (line.compare("metadata->enclave_css.body.enclave_hash.m:") == 0)
+        {
+            if (mr_enclave.length() == 0)
+            {
+                readEnclaveLineNum = 2;
+            }
+        }
+        if (line.compare("mrsigner->value:") == 0)
+        {
+            if (mr_signer.length() == 0)
+            {
+                readSignerLineNum = 2;
+            }
+        }
+    }
+    while (mr_enclave.find("0x") != -1)
+    {
+        mr_enclave = mr_enclave.replace(mr_enclave.find("0x"), 2, "");
+    }
+    while (mr_enclave.find(" ") != -1)
+    {
+        mr_enclave = mr_enclave.replace(mr_enclave.find(" "), 1, "");
+    }
+    while (mr_signer.find("0x") != -1)
+    {
+        mr_signer = mr_signer.replace(mr_signer.find("0x"), 2, "");
+    }
+    while (mr_signer.find(" ") != -1)
+    {
+        mr_signer = mr_signer.replace(mr_signer.find(" "), 1, "");
+    }
+    system(delTmpFileCMD.data());
+
+    payload_json.addData_string("challenge", input_challenge_base64);
+    param_json.addData_uint32("action", EH_GENERATE_QUOTE);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("FFI_GenerateQuote failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    printf("FFI_GenerateQuote Json : %s\n", returnJsonChar);
+    printf("FFI_GenerateQuote SUCCESSFULLY!\n");
+
+    quote_base64 = retJsonObj.readData_cstr("quote");
+    printf("quote_base64 : %s\n", quote_base64);
+
+    payload_json.clear();
+    param_json.clear();
+    payload_json.addData_string("quote", quote_base64);
+    payload_json.addData_string("mr_signer", mr_signer);
+    payload_json.addData_string("mr_enclave", mr_enclave);
+    payload_json.addData_string("nonce", input_nonce_base64);
+    param_json.addData_uint32("action", EH_VERIFY_QUOTE);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("FFI_VerifyQuote failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    printf("FFI_VerifyQuote Json : %s\n", returnJsonChar);
+    printf("FFI_VerifyQuote SUCCESSFULLY!\n");
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_GenerateQuote_and_VerifyQuote end==========\n");
+}
+
+void test_Enroll()
+{
+    printf("============test_Enroll start==========\n");
+    RetJsonObj retJsonObj;
+    char *returnJsonChar = nullptr;
+    char *appid = nullptr;
+    char *apikey = nullptr;
+
+    JsonObj param_json;
+    JsonObj payload_json;
+    param_json.addData_uint32("action", EH_ENROLL);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL(param_json.toString().c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("FFI_Enroll failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    printf("FFI_Enroll Json : %s\n", returnJsonChar);
+    printf("FFI_Enroll SUCCESSFULLY!\n");
+
+    appid = retJsonObj.readData_cstr("appid");
+    apikey = retJsonObj.readData_cstr("apikey");
+    printf("appid : %s\n", appid);
+    printf("apikey : %s\n", apikey);
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_Enroll end==========\n");
+}
+
+/*
+
+step1. generate asymmetric keys, they are wrapped in the compact DER keyblob layout
+
+step2. upgrade the keyblobs, which must leave them unchanged
+
+*/
+void test_upgrade_keyblob()
+{
+    printf("============test_upgrade_keyblob start==========\n");
+    uint32_t keyspec[] = {EH_RSA_2048, EH_EC_P256, EH_SM2};
+
+    case_number += sizeof(keyspec) / sizeof(keyspec[0]);
+
+    for (int i = 0; i < sizeof(keyspec) / sizeof(keyspec[0]); i++)
+    {
+        RetJsonObj retJsonObj;
+        JsonObj param_json;
+        JsonObj payload_json;
+        char *returnJsonChar = nullptr;
+        char *cmk_base64 = nullptr;
+        char *upgraded_cmk_base64 = nullptr;
+
+        payload_json.addData_uint32("keyspec", keyspec[i]);
+        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+        payload_json.addData_uint32("digest_mode", EH_SHA_2_256);
+        param_json.addData_uint32("action", EH_CREATE_KEY);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("Createkey with keyspec %d failed, error message: %s \n", keyspec[i], retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        cmk_base64 = retJsonObj.readData_cstr("cmk");
+        printf("keyspec %d, cmk size(base64) = %lu\n", keyspec[i], strlen(cmk_base64));
+        SAFE_FREE(returnJsonChar);
+
+        payload_json.clear();
+        payload_json.addData_string("cmk", cmk_base64);
+        param_json.addData_uint32("action", EH_UPGRADE_KEYBLOB);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("FFI_UpgradeKeyBlob failed, error message: %s \n", retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        upgraded_cmk_base64 = retJsonObj.readData_cstr("cmk");
+
+        if (strcmp(cmk_base64, upgraded_cmk_base64) == 0)
+        {
+            success_number++;
+            printf("Upgrade keyblob SUCCESSFULLY!\n");
+        }
+        else
+        {
+            printf("Failed to upgrade keyblob, the v2 keyblob was changed\n");
+        }
+
+    cleanup:
+        SAFE_FREE(cmk_base64);
+        SAFE_FREE(upgraded_cmk_base64);
+        SAFE_FREE(returnJsonChar);
+    }
+
+    printf("============test_upgrade_keyblob end==========\n");
+}
+
+/*
+ * A v1 SM2 keyblob as written before the DER layout: the PEM public key followed
+ * by the PEM private key, sealed by AES-128-GCM under the all-zero default domain
+ * key without aad. The ciphertext is "eHSM v1 keyblob" encrypted by its public key.
+ */
+static const char *g_v1_sm2_keyblob_base64 =
+    "lQEAAAAAAAAAAAAAAAAAAP44dDylNE7Zx4w47AAAAADsy41zY1KuVJHJyg/W75RCm5PMUdhgKt9p"
+    "ArYKY293IDds39mS4+NWP+9A77wqAALCA5COERVjzfnH3nejhnpvHBf3WOifrm0f2ki5tgoo6P2u"
+    "Y9OQOtZ9gvDoJC+EpXN1CsAU3sKAWqOdurODJWveCbeo08eR5SB/sTNU0vCCUJ5NhEPz7UcrP4tu"
+    "Hxf/muDLCVWeqgKG7kxjyRYhKcQT38QmqfLPL2T4KW4AT9abyI4Z1sOYt1D0OAsQLhZVCowNX8GS"
+    "D11o7lLWd//vdHy+BHRW72EmgWo/pIbj6KGmCsDHFO+gv4b2Jx6Vyzmg+y6nSIdaETYzQjYidraR"
+    "S9B1JH2B80+jDobFXJLx5GRIO7fwGPdyKdKMwOmD7+lFnRqyZzg5WwlcDBg7efVnXJVlA/hoKhxJ"
+    "EUMA48Ch04XRtpyvvbc/3tmsIzg5dRe2BP+qm0FVCqniuVCBStBxWKUokXVpWYF0eBnrCr2vMppR"
+    "fAY8crSpTDeoFn8O0jgN6ISmjaH4YOKVafka20tg7U9lufrO1YnFpZw6QFrUfIRcIfClPYf5";
+
+static const char *g_v1_sm2_ciphertext_base64 =
+    "MHgCICMCeGciNdY/QQTzgQY6L9RHsCuE2l4LZTn7cnqkEBzpAiEAvdn8ffNJ+nwoeK/onK3gLJd/"
+    "DVQf5ubq2x/9Azr5Tz8EICfygpKIqmUVvXtVBjg6Abzga/v5KYUNZiolB7WuV009BA+wM35QcpuH"
+    "arb75sB8woM=";
+
+static const char g_v1_sm2_plaintext[] = "eHSM v1 keyblob";
+
+/* fields of the sgx_aes_gcm_data_ex_t header at the start of a keyblob */
+#define KEYBLOB_AAD_SIZE_OFFSET 4
+#define KEYBLOB_VERSION_OFFSET  8
+#define KEYBLOB_VERSION_2       2
+
+static bool test_v1_decrypt(const std::string &cmk_base64, const std::string &plaintext_base64)
+{
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    bool ok = false;
+
+    payload_json.addData_string("cmk", cmk_base64);
+    payload_json.addData_string("ciphertext", g_v1_sm2_ciphertext_base64);
+    param_json.addData_uint32("action", EH_ASYMMETRIC_DECRYPT);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+        printf("AsymmetricDecrypt failed, error message: %s \n", retJsonObj.getMessage().c_str());
+    else
+        ok = retJsonObj.readData_string("plaintext") == plaintext_base64;
+
+    SAFE_FREE(returnJsonChar);
+    return ok;
+}
+
+/*
+
+step1. decrypt with the v1 keyblob fixture, it needs the default domain key
+
+step2. upgrade it, the result must carry the v2 header
+
+step3. decrypt the same ciphertext with the upgraded keyblob
+
+*/
+void test_upgrade_v1_keyblob()
+{
+    printf("============test_upgrade_v1_keyblob start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    std::string keyblob = base64_decode(g_v1_sm2_keyblob_base64);
+    std::string plaintext_base64 = base64_encode((const uint8_t *)g_v1_sm2_plaintext, strlen(g_v1_sm2_plaintext));
+    std::string cmk(sizeof(ehsm_keyblob_t) + keyblob.size(), '\0');
+    std::string upgraded;
+    ehsm_keyblob_t *v1_cmk = (ehsm_keyblob_t *)&cmk[0];
+    const ehsm_keyblob_t *v2_cmk = NULL;
+    uint32_t aad_size = 0;
+
+    case_number++;
+
+    v1_cmk->metadata.keyspec = EH_SM2;
+    v1_cmk->metadata.origin = EH_INTERNAL_KEY;
+    v1_cmk->keybloblen = keyblob.size();
+    memcpy(v1_cmk->keyblob, keyblob.data(), keyblob.size());
+
+    if (!test_v1_decrypt(base64_encode((const uint8_t *)cmk.data(), cmk.size()), plaintext_base64))
+    {
+        printf("Failed to decrypt with the v1 keyblob, is the default domain key in use?\n");
+        goto cleanup;
+    }
+
+    payload_json.addData_string("cmk", base64_encode((const uint8_t *)cmk.data(), cmk.size()));
+    param_json.addData_uint32("action", EH_UPGRADE_KEYBLOB);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("FFI_UpgradeKeyBlob failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+
+    upgraded = base64_decode(retJsonObj.readData_string("cmk"));
+    v2_cmk = (const ehsm_keyblob_t *)upgraded.data();
+    if (upgraded.size() < sizeof(ehsm_keyblob_t) + EH_KEYBLOB_HEADER_SIZE ||
+        upgraded.size() != sizeof(ehsm_keyblob_t) + v2_cmk->keybloblen)
+    {
+        printf("Failed to upgrade keyblob, the result is malformed\n");
+        goto cleanup;
+    }
+
+    memcpy(&aad_size, v2_cmk->keyblob + KEYBLOB_AAD_SIZE_OFFSET, sizeof(aad_size));
+    if (aad_size == 0 || v2_cmk->keyblob[KEYBLOB_VERSION_OFFSET] != KEYBLOB_VERSION_2)
+    {
+        printf("Failed to upgrade keyblob, no v2 header\n");
+        goto cleanup;
+    }
+
+    if (test_v1_decrypt(retJsonObj.readData_string("cmk"), plaintext_base64))
+    {
+        success_number++;
+        printf("Upgrade v1 keyblob SUCCESSFULLY!\n");
+    }
+    else
+    {
+        printf("Failed to decrypt with the upgraded keyblob\n");
+    }
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_upgrade_v1_keyblob end==========\n");
+}
+
+/*
+
+step1. generate an aes-gcm-128 key as the CMK
+
+step2. encrypt the same plaintext twice by the CMK
+
+step3. check the second encryption was served by the in-enclave key cache
+
+*/
+void test_key_cache()
+{
+    printf("============test_key_cache start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    char *cmk_base64 = nullptr;
+    char plaintext[] = "Test1234-KeyCache";
+    ehsm_key_cache_stats_t before = {0};
+    ehsm_key_cache_stats_t after = {0};
+    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
+
+    case_number++;
+
+    payload_json.addData_uint32("keyspec", EH_AES_GCM_128);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("Createkey with aes-gcm-128 failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    cmk_base64 = retJsonObj.readData_cstr("cmk");
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.clear();
+    payload_json.addData_string("cmk", cmk_base64);
+    payload_json.addData_string("plaintext", input_plaintext_base64);
+    param_json.addData_uint32("action", EH_ENCRYPT);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (i == 1 && GetKeyCacheStats(&before) != EH_OK)
+        {
+            printf("GetKeyCacheStats failed\n");
+            goto cleanup;
+        }
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("Failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        SAFE_FREE(returnJsonChar);
+    }
+
+    if (GetKeyCacheStats(&after) != EH_OK)
+    {
+        printf("GetKeyCacheStats failed\n");
+        goto cleanup;
+    }
+    printf("key cache: hits=%lu, misses=%lu, evictions=%lu, entries=%u, bytes=%u\n",
+           after.hits, after.misses, after.evictions, after.entries, after.bytes);
+
+    if (after.hits > before.hits && after.entries > 0)
+    {
+        success_number++;
+        printf("Key cache hit SUCCESSFULLY!\n");
+    }
+    else
+    {
+        printf("Failed to hit the key cache\n");
+    }
+
+cleanup:
+    SAFE_FREE(cmk_base64);
+    SAFE_FREE(returnJsonChar);
+    printf("============test_key_cache end==========\n");
+}
+
+void test_key_pool()
+{
+    printf("============test_key_pool start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    ehsm_key_pool_stats_t before = {0};
+    ehsm_key_pool_stats_t after = {0};
+
+    case_number++;
+
+    // give the background refill some time to generate the first key pairs
+    for (int i = 0; i < 50; i++)
+    {
+        if (GetKeyPoolStats(EH_EC_P256, &before) != EH_OK)
+        {
+            printf("GetKeyPoolStats failed\n");
+            goto cleanup;
+        }
+        if (before.available > 0)
+            break;
+        usleep(100 * 1000);
+    }
+
+    payload_json.addData_uint32("keyspec", EH_EC_P256);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    payload_json.addData_uint32("digest_mode", EH_SHA_2_256);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("Createkey with ec-p256 failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+
+    if (GetKeyPoolStats(EH_EC_P256, &after) != EH_OK)
+    {
+        printf("GetKeyPoolStats failed\n");
+        goto cleanup;
+    }
+    printf("key pool: hits=%lu, misses=%lu, generated=%lu, available=%u, watermarks=%u/%u\n",
+           after.hits, after.misses, after.generated, after.available, after.low_watermark, after.high_watermark);
+
+    if (before.available > 0 && after.hits == before.hits + 1)
+    {
+        success_number++;
+        printf("Create key from the key pool SUCCESSFULLY!\n");
+    }
+    else
+    {
+        printf("Failed to take the key pair from the key pool\n");
+    }
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_key_pool end==========\n");
+}
+
+/*
+
+step1. generate an aes-gcm-128 key and an ec-p256 key as the CMKs
+
+step2. encrypt, sign and generate a datakey in one batch, with a broken decrypt request
+
+step3. decrypt the ciphertext and verify the signature in a second batch
+
+*/
+/*
+
+step1. create an EH_HMAC key for each supported digest mode
+
+step2. generate the mac of a message and verify it, a tampered mac is rejected
+
+step3. generate and verify the mac again in a batch, the batched mac matches the unbatched one
+
+*/
+void test_hmac_generate_verify()
+{
+    printf("============test_hmac_generate_verify start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    JsonObj item_json;
+    Json::Value requests;
+    Json::Value results;
+    char *returnJsonChar = nullptr;
+    std::string cmk_base64;
+    std::string mac_base64;
+    std::string mac;
+    uint32_t digest_mode[] = {EH_SHA_2_256, EH_SHA_2_384, EH_SHA_2_512, EH_SM3};
+    char message[] = "Test1234-HMAC";
+    std::string input_message_base64 = base64_encode((const uint8_t *)message, sizeof(message) / sizeof(message[0]));
+
+    case_number++;
+
+    for (int i = 0; i < sizeof(digest_mode) / sizeof(digest_mode[0]); i++)
+    {
+        payload_json.clear();
+        payload_json.addData_uint32("keyspec", EH_HMAC);
+        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+        payload_json.addData_uint32("digest_mode", digest_mode[i]);
+        param_json.addData_uint32("action", EH_CREATE_KEY);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("Createkey with hmac digest mode %d failed, error message: %s \n", digest_mode[i], retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        cmk_base64 = retJsonObj.readData_string("cmk");
+        SAFE_FREE(returnJsonChar);
+
+        payload_json.clear();
+        payload_json.addData_string("cmk", cmk_base64);
+        payload_json.addData_string("message", input_message_base64);
+        param_json.addData_uint32("action", EH_GENERATE_MAC);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("GenerateMac failed, error message: %s \n", retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        mac_base64 = retJsonObj.readData_string("mac");
+        mac = base64_decode(mac_base64);
+        SAFE_FREE(returnJsonChar);
+        if (mac.size() != ehsm_get_mac_size(digest_mode[i]))
+        {
+            printf("GenerateMac returned a mac of %zu bytes\n", mac.size());
+            goto cleanup;
+        }
+
+        payload_json.addData_string("mac", mac_base64);
+        param_json.addData_uint32("action", EH_VERIFY_MAC);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200 || !retJsonObj.readData_bool("result"))
+        {
+            printf("VerifyMac failed: %s \n", returnJsonChar);
+            goto cleanup;
+        }
+        SAFE_FREE(returnJsonChar);
+
+        mac[0] ^= 1;
+        payload_json.addData_string("mac", base64_encode((const uint8_t *)mac.data(), mac.size()));
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200 || retJsonObj.readData_bool("result"))
+        {
+            printf("VerifyMac accepted a tampered mac: %s \n", returnJsonChar);
+            goto cleanup;
+        }
+        SAFE_FREE(returnJsonChar);
+    }
+
+    item_json.addData_uint32("action", EH_GENERATE_MAC);
+    item_json.addData_string("cmk", cmk_base64);
+    item_json.addData_string("message", input_message_base64);
+    requests.append(item_json.getJson());
+
+    item_json.addData_uint32("action", EH_VERIFY_MAC);
+    item_json.addData_string("mac", mac_base64);
+    requests.append(item_json.getJson());
+
+    payload_json.clear();
+    payload_json.addData_JsonValue("requests", requests);
+    param_json.addData_uint32("action", EH_BATCH);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("FFI_Batch failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+
+    results = retJsonObj.readData_JsonValue("results");
+    if (results.size() != 2 ||
+        results[0]["code"].asInt() != 200 ||
+        results[0]["mac"].asString() != mac_base64 ||
+        results[1]["code"].asInt() != 200 ||
+        !results[1]["result"].asBool())
+    {
+        printf("FFI_Batch with macs failed: %s\n", returnJsonChar);
+        goto cleanup;
+    }
+
+    success_number++;
+    printf("GenerateMac and VerifyMac SUCCESSFULLY!\n");
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_hmac_generate_verify end==========\n");
+}
+
+void test_batch()
+{
+    printf("============test_batch start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    JsonObj item_json;
+    Json::Value requests;
+    Json::Value results;
+    char *returnJsonChar = nullptr;
+    std::string cmk_base64[2];
+    uint32_t keyspec[] = {EH_AES_GCM_128, EH_EC_P256};
+    char plaintext[] = "Test1234-Batch";
+    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
+
+    case_number++;
+
+    for (int i = 0; i < sizeof(keyspec) / sizeof(keyspec[0]); i++)
+    {
+        payload_json.clear();
+        payload_json.addData_uint32("keyspec", keyspec[i]);
+        payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+        payload_json.addData_uint32("digest_mode", EH_SHA_2_256);
+        param_json.addData_uint32("action", EH_CREATE_KEY);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("Createkey with keyspec %d failed, error message: %s \n", keyspec[i], retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        cmk_base64[i] = retJsonObj.readData_string("cmk");
+        SAFE_FREE(returnJsonChar);
+    }
+
+    item_json.addData_uint32("action", EH_ENCRYPT);
+    item_json.addData_string("cmk", cmk_base64[0]);
+    item_json.addData_string("plaintext", input_plaintext_base64);
+    requests.append(item_json.getJson());
+
+    item_json.clear();
+    item_json.addData_uint32("action", EH_SIGN);
+    item_json.addData_string("cmk", cmk_base64[1]);
+    item_json.addData_string("digest", input_plaintext_base64);
+    requests.append(item_json.getJson());
+
+    item_json.clear();
+    item_json.addData_uint32("action", EH_GENERATE_DATAKEY);
+    item_json.addData_string("cmk", cmk_base64[0]);
+    item_json.addData_uint32("keylen", 32);
+    requests.append(item_json.getJson());
+
+    item_json.clear();
+    item_json.addData_uint32("action", EH_DECRYPT);
+    item_json.addData_string("cmk", cmk_base64[0]);
+    item_json.addData_string("ciphertext", input_plaintext_base64);
+    requests.append(item_json.getJson());
+
+    payload_json.clear();
+    payload_json.addData_JsonValue("requests", requests);
+    param_json.addData_uint32("action", EH_BATCH);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("FFI_Batch failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    printf("FFI_Batch Json = %s\n", returnJsonChar);
+    SAFE_FREE(returnJsonChar);
+
+    results = retJsonObj.readData_JsonValue("results");
+    if (results.size() != 4 ||
+        results[0]["action"].asUInt() != EH_ENCRYPT ||
+        results[1]["action"].asUInt() != EH_SIGN ||
+        results[2]["action"].asUInt() != EH_GENERATE_DATAKEY ||
+        results[3]["action"].asUInt() != EH_DECRYPT ||
+        results[0]["code"].asInt() != 200 ||
+        results[1]["code"].asInt() != 200 ||
+        results[2]["code"].asInt() != 200 ||
+        results[3]["code"].asInt() == 200)
+    {
+        printf("Failed to get the expected result of each batched request\n");
+        goto cleanup;
+    }
+
+    requests.clear();
+    item_json.clear();
+    item_json.addData_uint32("action", EH_DECRYPT);
+    item_json.addData_string("cmk", cmk_base64[0]);
+    item_json.addData_string("ciphertext", results[0]["ciphertext"].asString());
+    requests.append(item_json.getJson());
+
+    item_json.clear();
+    item_json.addData_uint32("action", EH_VERIFY);
+    item_json.addData_string("cmk", cmk_base64[1]);
+    item_json.addData_string("digest", input_plaintext_base64);
+    item_json.addData_string("signature", results[1]["signature"].asString());
+    requests.append(item_json.getJson());
+
+    payload_json.clear();
+    payload_json.addData_JsonValue("requests", requests);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("FFI_Batch failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    printf("FFI_Batch Json = %s\n", returnJsonChar);
+
+    results = retJsonObj.readData_JsonValue("results");
+    if (results.size() == 2 &&
+        results[0]["action"].asUInt() == EH_DECRYPT &&
+        results[1]["action"].asUInt() == EH_VERIFY &&
+        results[0]["plaintext"].asString() == input_plaintext_base64 &&
+        results[1]["result"].asBool())
+    {
+        success_number++;
+        printf("Batch requests SUCCESSFULLY!\n");
+    }
+    else
+    {
+        printf("Failed to decrypt or verify within the batch\n");
+    }
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_batch end==========\n");
+}
+
+static void bin_append_data(std::string &payload, const uint8_t *data, uint32_t datalen)
+{
+    payload.append((const char *)&datalen, sizeof(datalen));
+    if (datalen > 0)
+        payload.append((const char *)data, datalen);
+}
+
+static int32_t bin_call(uint32_t action, const std::string &payload, std::string &response)
+{
+    ehsm_ffi_bin_t header = {EH_FFI_BIN_MAGIC, EH_FFI_BIN_VERSION, action, 0, 0, (uint32_t)payload.size()};
+    std::string request((const char *)&header, sizeof(header));
+    ehsm_ffi_bin_t probe;
+    size_t resp_len = sizeof(probe);
+    int32_t ret = EH_OK;
+
+    request += payload;
+
+    // probe with room for the header only first to exercise EH_BUFFER_TOO_SMALL
+    ret = EHSM_FFI_CALL_BIN((const uint8_t *)request.data(), request.size(), (uint8_t *)&probe, &resp_len);
+    if (ret != EH_BUFFER_TOO_SMALL)
+        return ret;
+
+    response.resize(resp_len);
+    ret = EHSM_FFI_CALL_BIN((const uint8_t *)request.data(), request.size(), (uint8_t *)&response[0], &resp_len);
+    response.resize(resp_len);
+    return ret;
+}
+
+void test_ffi_call_bin()
+{
+    printf("============test_ffi_call_bin start==========\n");
+    ehsm_keyblob_t cmk_meta;
+    std::string payload;
+    std::string cmk;
+    std::string ciphertext;
+    std::string response;
+    const ehsm_data_t *result = NULL;
+    char plaintext[] = "Test1234-BinaryFFI";
+    int32_t ret = EH_OK;
+
+    case_number++;
+
+    memset(&cmk_meta, 0, sizeof(cmk_meta));
+    cmk_meta.metadata.keyspec = EH_AES_GCM_128;
+    cmk_meta.metadata.origin = EH_INTERNAL_KEY;
+    cmk_meta.metadata.purpose = EH_PURPOSE_ENCRYPT_DECRYPT;
+    payload.assign((const char *)&cmk_meta, sizeof(cmk_meta));
+
+    ret = bin_call(EH_CREATE_KEY, payload, response);
+    if (ret != EH_OK)
+    {
+        printf("Binary createkey failed, error code: %d\n", ret);
+        goto cleanup;
+    }
+    cmk = response.substr(sizeof(ehsm_ffi_bin_t));
+
+    payload = cmk;
+    bin_append_data(payload, NULL, 0);
+    bin_append_data(payload, (const uint8_t *)plaintext, sizeof(plaintext));
+    ret = bin_call(EH_ENCRYPT, payload, response);
+    if (ret != EH_OK)
+    {
+        printf("Binary encrypt failed, error code: %d\n", ret);
+        goto cleanup;
+    }
+    result = (const ehsm_data_t *)(response.data() + sizeof(ehsm_ffi_bin_t));
+    ciphertext.assign((const char *)result->data, result->datalen);
+
+    payload = cmk;
+    bin_append_data(payload, NULL, 0);
+    bin_append_data(payload, (const uint8_t *)ciphertext.data(), ciphertext.size());
+    ret = bin_call(EH_DECRYPT, payload, response);
+    if (ret != EH_OK)
+    {
+        printf("Binary decrypt failed, error code: %d\n", ret);
+        goto cleanup;
+    }
+    result = (const ehsm_data_t *)(response.data() + sizeof(ehsm_ffi_bin_t));
+
+    if (result->datalen == sizeof(plaintext) && memcmp(result->data, plaintext, sizeof(plaintext)) == 0)
+    {
+        success_number++;
+        printf("Binary ffi encrypt/decrypt SUCCESSFULLY!\n");
+    }
+    else
+    {
+        printf("Binary ffi decrypted data mismatch\n");
+    }
+
+cleanup:
+    printf("============test_ffi_call_bin end==========\n");
+}
+
+#define STREAM_CHUNK_NUM 4
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+static std::string bin_handle(const std::string &response)
+{
+    const ehsm_data_t *handle = (const ehsm_data_t *)(response.data() + sizeof(ehsm_ffi_bin_t));
+
+    return std::string((const char *)handle, APPEND_SIZE_TO_DATA_T(handle->datalen));
+}
+
+/*
+
+step1. generate an aes-gcm-128 key and an sm4-cbc key as the CMKs
+
+step2. encrypt a few large chunks with EncryptInit/EncryptUpdate/EncryptFinal through the binary ffi
+
+step3. decrypt them back with DecryptInit/DecryptUpdate/DecryptFinal, and check that
+       a stream cut before its last chunk is rejected
+
+*/
+void test_stream_encrypt_decrypt()
+{
+    printf("============test_stream_encrypt_decrypt start==========\n");
+    ehsm_keyspec_t keyspecs[] = {EH_AES_GCM_128, EH_SM4_CBC};
+    ehsm_keyblob_t cmk_meta;
+    std::string payload;
+    std::string response;
+    std::string cmk;
+    std::string header;
+    std::string handle;
+    std::string plaintext;
+    std::string decrypted;
+    std::string chunks[STREAM_CHUNK_NUM];
+    const ehsm_data_t *result = NULL;
+    char aad[] = "challenge";
+    int32_t ret = EH_OK;
+    int passed = 0;
+
+    case_number++;
+
+    for (size_t i = 0; i < STREAM_CHUNK_NUM * STREAM_CHUNK_SIZE; i++)
+        plaintext.push_back((char)(i * 31 + 7));
+
+    for (size_t k = 0; k < sizeof(keyspecs) / sizeof(keyspecs[0]); k++)
+    {
+        memset(&cmk_meta, 0, sizeof(cmk_meta));
+        cmk_meta.metadata.keyspec = keyspecs[k];
+        cmk_meta.metadata.origin = EH_INTERNAL_KEY;
+        cmk_meta.metadata.purpose = EH_PURPOSE_ENCRYPT_DECRYPT;
+        payload.assign((const char *)&cmk_meta, sizeof(cmk_meta));
+
+        ret = bin_call(EH_CREATE_KEY, payload, response);
+        if (ret != EH_OK)
+        {
+            printf("Binary createkey failed, keyspec: %u, error code: %d\n", keyspecs[k], ret);
+            goto cleanup;
+        }
+        cmk = response.substr(sizeof(ehsm_ffi_bin_t));
+
+        payload = cmk;
+        bin_append_data(payload, (const uint8_t *)aad, sizeof(aad));
+        ret = bin_call(EH_ENCRYPT_INIT, payload, response);
+        if (ret != EH_OK)
+        {
+            printf("EncryptInit failed, keyspec: %u, error code: %d\n", keyspecs[k], ret);
+            goto cleanup;
+        }
+        handle = bin_handle(response);
+        header = response.substr(sizeof(ehsm_ffi_bin_t) + handle.size());
+
+        for (int i = 0; i < STREAM_CHUNK_NUM; i++)
+        {
+            payload = handle;
+            bin_append_data(payload, (const uint8_t *)plaintext.data() + i * STREAM_CHUNK_SIZE, STREAM_CHUNK_SIZE);
+            ret = bin_call(i == STREAM_CHUNK_NUM - 1 ? EH_ENCRYPT_FINAL : EH_ENCRYPT_UPDATE, payload, response);
+            if (ret != EH_OK)
+            {
+                printf("Encrypt chunk %d failed, keyspec: %u, error code: %d\n", i, keyspecs[k], ret);
+                goto cleanup;
+            }
+            result = (const ehsm_data_t *)(response.data() + sizeof(ehsm_ffi_bin_t));
+            chunks[i].assign((const char *)result->data, result->datalen);
+        }
+
+        // a stream that stops before its last chunk must not decrypt as complete
+        payload = cmk;
+        bin_append_data(payload, (const uint8_t *)aad, sizeof(aad));
+        payload += header;
+        ret = bin_call(EH_DECRYPT_INIT, payload, response);
+        if (ret != EH_OK)
+        {
+            printf("DecryptInit failed, keyspec: %u, error code: %d\n", keyspecs[k], ret);
+            goto cleanup;
+        }
+        payload = bin_handle(response);
+        bin_append_data(payload, (const uint8_t *)chunks[0].data(), chunks[0].size());
+        if (bin_call(EH_DECRYPT_FINAL, payload, response) == EH_OK)
+        {
+            printf("A truncated stream was accepted, keyspec: %u\n", keyspecs[k]);
+            goto cleanup;
+        }
+
+        payload = cmk;
+        bin_append_data(payload, (const uint8_t *)aad, sizeof(aad));
+        payload += header;
+        ret = bin_call(EH_DECRYPT_INIT, payload, response);
+        if (ret != EH_OK)
+        {
+            printf("DecryptInit failed, keyspec: %u, error code: %d\n", keyspecs[k], ret);
+            goto cleanup;
+        }
+        handle = bin_handle(response);
+
+        decrypted.clear();
+        for (int i = 0; i < STREAM_CHUNK_NUM; i++)
+        {
+            payload = handle;
+            bin_append_data(payload, (const uint8_t *)chunks[i].data(), chunks[i].size());
+            ret = bin_call(i == STREAM_CHUNK_NUM - 1 ? EH_DECRYPT_FINAL : EH_DECRYPT_UPDATE, payload, response);
+            if (ret != EH_OK)
+            {
+                printf("Decrypt chunk %d failed, keyspec: %u, error code: %d\n", i, keyspecs[k], ret);
+                goto cleanup;
+            }
+            result = (const ehsm_data_t *)(response.data() + sizeof(ehsm_ffi_bin_t));
+            decrypted.append((const char *)result->data, result->datalen);
+        }
+
+        if (decrypted == plaintext)
+            passed++;
+        else
+            printf("Stream decrypted data mismatch, keyspec: %u\n", keyspecs[k]);
+    }
+
+    if (passed == sizeof(keyspecs) / sizeof(keyspecs[0]))
+    {
+        success_number++;
+        printf("Stream encrypt/decrypt SUCCESSFULLY!\n");
+    }
+
+cleanup:
+    printf("============test_stream_encrypt_decrypt end==========\n");
+}
+
+#define ASYNC_REQUEST_NUM 32
+
+static pthread_mutex_t g_async_test_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_async_test_cond = PTHREAD_COND_INITIALIZER;
+static int g_async_test_done = 0;
+static int g_async_test_success = 0;
+
+static void test_async_callback(char *respJson, void *ctx)
+{
+    RetJsonObj retJsonObj;
+
+    retJsonObj.parse(respJson);
+
+    pthread_mutex_lock(&g_async_test_lock);
+    if (retJsonObj.getCode() == 200)
+        g_async_test_success++;
+    g_async_test_done++;
+    pthread_cond_signal(&g_async_test_cond);
+    pthread_mutex_unlock(&g_async_test_lock);
+}
+
+void test_ffi_call_async()
+{
+    printf("============test_ffi_call_async start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    char plaintext[] = "Test1234-Async";
+    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext) / sizeof(plaintext[0]));
+    int queued = 0;
+    int32_t ret = EH_OK;
+
+    case_number++;
+
+    payload_json.addData_uint32("keyspec", EH_AES_GCM_128);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("Createkey failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+
+    payload_json.clear();
+    payload_json.addData_string("cmk", retJsonObj.readData_string("cmk"));
+    payload_json.addData_string("plaintext", input_plaintext_base64);
+    param_json.addData_uint32("action", EH_ENCRYPT);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    g_async_test_done = 0;
+    g_async_test_success = 0;
+    for (int i = 0; i < ASYNC_REQUEST_NUM; i++)
+    {
+        ret = EHSM_FFI_CALL_ASYNC((param_json.toString()).c_str(), test_async_callback, NULL);
+        if (ret != EH_OK)
+        {
+            printf("FFI_CALL_ASYNC failed, error code: %d\n", ret);
+            break;
+        }
+        queued++;
+    }
+
+    pthread_mutex_lock(&g_async_test_lock);
+    while (g_async_test_done < queued)
+        pthread_cond_wait(&g_async_test_cond, &g_async_test_lock);
+    pthread_mutex_unlock(&g_async_test_lock);
+
+    if (queued == ASYNC_REQUEST_NUM && g_async_test_success == ASYNC_REQUEST_NUM)
+    {
+        success_number++;
+        printf("Async requests SUCCESSFULLY!\n");
+    }
+    else
+    {
+        printf("Async requests failed, %d queued, %d succeeded\n", queued, g_async_test_success);
+    }
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_ffi_call_async end==========\n");
+}
+
+static int g_async_test_entered = 0;
+static bool g_async_test_released = false;
+
+/* like an ffi-napi callback, it can only complete once the finalizing thread is free */
+static void test_async_blocking_callback(char *respJson, void *ctx)
+{
+    pthread_mutex_lock(&g_async_test_lock);
+    g_async_test_entered++;
+    while (!g_async_test_released)
+        pthread_cond_wait(&g_async_test_cond, &g_async_test_lock);
+    g_async_test_done++;
+    pthread_cond_broadcast(&g_async_test_cond);
+    pthread_mutex_unlock(&g_async_test_lock);
+}
+
+/*
+ * Finalize with async requests still queued and callbacks waiting on the finalizing
+ * thread, it must return without invoking the queued callbacks
+ */
+void test_finalize_async_queued()
+{
+    printf("============test_finalize_async_queued start==========\n");
+    JsonObj param_json;
+    JsonObj payload_json;
+    int queued = 0;
+    int entered = 0;
+    int total = 0;
+    ehsm_status_t ret = EH_OK;
+
+    case_number++;
+
+    payload_json.addData_uint32("keyspec", EH_RSA_3072);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    g_async_test_entered = 0;
+    g_async_test_done = 0;
+    g_async_test_released = false;
+    for (int i = 0; i < ASYNC_REQUEST_NUM * 4; i++)
+    {
+        if (EHSM_FFI_CALL_ASYNC((param_json.toString()).c_str(), test_async_blocking_callback, NULL) != EH_OK)
+            break;
+        queued++;
+    }
+
+    ret = Finalize();
+
+    pthread_mutex_lock(&g_async_test_lock);
+    entered = g_async_test_entered;
+    g_async_test_released = true;
+    pthread_cond_broadcast(&g_async_test_cond);
+    while (g_async_test_done < g_async_test_entered)
+        pthread_cond_wait(&g_async_test_cond, &g_async_test_lock);
+    pthread_mutex_unlock(&g_async_test_lock);
+
+    // no callback may start once Finalize returned
+    usleep(100 * 1000);
+    pthread_mutex_lock(&g_async_test_lock);
+    total = g_async_test_entered;
+    pthread_mutex_unlock(&g_async_test_lock);
+
+    printf("%d queued, %d called back before finalize, %d in total\n", queued, entered, total);
+    if (ret == EH_OK && queued > 0 && entered == total && entered <= queued)
+    {
+        success_number++;
+        printf("Finalize with queued async requests SUCCESSFULLY!\n");
+    }
+
+    ret = Initialize();
+    if (ret != EH_OK)
+        printf("Initialize after finalize failed %d\n", ret);
+
+    printf("============test_finalize_async_queued end==========\n");
+}
+
+/*
+ * the counters are only kept where the enclave may run rdtsc, the previous tests
+ * encrypted with EH_AES_GCM_128 and signed with EH_RSA_2048 keys
+ */
+void test_enclave_stats()
+{
+    printf("============test_enclave_stats start==========\n");
+    ehsm_enclave_stats_t *stats = (ehsm_enclave_stats_t *)calloc(1, sizeof(ehsm_enclave_stats_t));
+    ehsm_status_t ret = EH_OK;
+
+    case_number++;
+
+    if (stats == NULL)
+        goto cleanup;
+
+    ret = GetEnclaveStats(stats);
+    if (ret != EH_OK)
+    {
+        printf("GetEnclaveStats failed, error code: %d\n", ret);
+        goto cleanup;
+    }
+    if (stats->enabled &&
+        (stats->counters[EH_STATS_ENCRYPT][EH_AES_GCM_128].count == 0 ||
+         stats->counters[EH_STATS_ENCRYPT][EH_AES_GCM_128].cycles == 0 ||
+         stats->counters[EH_STATS_CRYPTO][EH_AES_GCM_128].count == 0 ||
+         stats->counters[EH_STATS_READ_RAND][EH_AES_GCM_128].count == 0 ||
+         stats->counters[EH_STATS_SIGN][EH_RSA_2048].count == 0))
+    {
+        printf("GetEnclaveStats failed, the counters are missing operations\n");
+        goto cleanup;
+    }
+
+    success_number++;
+    printf("GetEnclaveStats SUCCESSFULLY, %s!\n", stats->enabled ? "enabled" : "disabled");
+
+cleanup:
+    SAFE_FREE(stats);
+    printf("============test_enclave_stats end==========\n");
+}
+
+/*
+
+step1. create an aes-gcm-128 key and wrap an api key with it and the appid as aad, as Enroll stores it in user_info
+
+step2. verify a request sign without the wrapped api key, the enclave has not cached it yet
+
+step3. the wrapped api key is refused for another appid
+
+step4. verify the sign with the wrapped api key, then again without it from the cache
+
+step5. a wrong sign is rejected
+
+step6. once the api key is invalidated it is not cached anymore
+
+*/
+void test_verify_request_sign()
+{
+    printf("============test_verify_request_sign start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    char *cmk_base64 = nullptr;
+    char *apikey_base64 = nullptr;
+    /* HMAC-SHA256 test case 2 of RFC 4231 */
+    const char apikey[] = "Jefe";
+    const char sign_string[] = "what do ya want for nothing?";
+    const uint8_t hmac[] = {0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+                            0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43};
+    uint8_t wrong_hmac[sizeof(hmac)];
+    std::string appid = "00000000-0000-4000-8000-0000000001a9";
+    std::string other_appid = "00000000-0000-4000-8000-0000000001aa";
+
+    memcpy(wrong_hmac, hmac, sizeof(hmac));
+    wrong_hmac[0] ^= 1;
+
+    case_number++;
+
+    payload_json.addData_uint32("keyspec", EH_AES_GCM_128);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("Createkey with aes-gcm-128 failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    cmk_base64 = retJsonObj.readData_cstr("cmk");
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.clear();
+    payload_json.addData_string("cmk", cmk_base64);
+    payload_json.addData_string("plaintext", base64_encode((const uint8_t *)apikey, strlen(apikey)));
+    payload_json.addData_string("aad", base64_encode((const uint8_t *)appid.data(), appid.size()));
+    param_json.addData_uint32("action", EH_ENCRYPT);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("Failed to Encrypt the api key, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    apikey_base64 = retJsonObj.readData_cstr("ciphertext");
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.clear();
+    payload_json.addData_string("appid", appid);
+    payload_json.addData_string("sign_string", sign_string);
+    payload_json.addData_string("sign", base64_encode(hmac, sizeof(hmac)));
+    param_json.addData_uint32("action", EH_VERIFY_REQUEST_SIGN);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200 || retJsonObj.readData_bool("cached"))
+    {
+        printf("VerifyRequestSign without the api key failed: %s \n", returnJsonChar);
+        goto cleanup;
+    }
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.clear();
+    payload_json.addData_string("appid", other_appid);
+    payload_json.addData_string("sign_string", sign_string);
+    payload_json.addData_string("sign", base64_encode(hmac, sizeof(hmac)));
+    payload_json.addData_string("cmk", cmk_base64);
+    payload_json.addData_string("apikey", apikey_base64);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() == 200)
+    {
+        printf("VerifyRequestSign unwrapped the api key of another appid: %s \n", returnJsonChar);
+        goto cleanup;
+    }
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.clear();
+    payload_json.addData_string("appid", appid);
+    payload_json.addData_string("sign_string", sign_string);
+    payload_json.addData_string("sign", base64_encode(hmac, sizeof(hmac)));
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (i == 0)
+        {
+            payload_json.addData_string("cmk", cmk_base64);
+            payload_json.addData_string("apikey", apikey_base64);
+        }
+        else
+        {
+            payload_json.clear();
+            payload_json.addData_string("appid", appid);
+            payload_json.addData_string("sign_string", sign_string);
+            payload_json.addData_string("sign", base64_encode(hmac, sizeof(hmac)));
+        }
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200 || !retJsonObj.readData_bool("cached") || !retJsonObj.readData_bool("result"))
+        {
+            printf("VerifyRequestSign failed: %s \n", returnJsonChar);
+            goto cleanup;
+        }
+        SAFE_FREE(returnJsonChar);
+    }
+
+    payload_json.addData_string("sign", base64_encode(wrong_hmac, sizeof(wrong_hmac)));
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200 || retJsonObj.readData_bool("result"))
+    {
+        printf("VerifyRequestSign accepted a wrong sign: %s \n", returnJsonChar);
+        goto cleanup;
+    }
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.clear();
+    payload_json.addData_string("appid", appid);
+    param_json.addData_uint32("action", EH_INVALIDATE_API_KEY);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("InvalidateApiKey failed: %s \n", returnJsonChar);
+        goto cleanup;
+    }
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.addData_string("sign_string", sign_string);
+    payload_json.addData_string("sign", base64_encode(hmac, sizeof(hmac)));
+    param_json.addData_uint32("action", EH_VERIFY_REQUEST_SIGN);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200 || retJsonObj.readData_bool("cached"))
+    {
+        printf("VerifyRequestSign used an invalidated api key: %s \n", returnJsonChar);
+        goto cleanup;
+    }
+
+    success_number++;
+    printf("VerifyRequestSign SUCCESSFULLY!\n");
+
+cleanup:
+    SAFE_FREE(cmk_base64);
+    SAFE_FREE(apikey_base64);
+    SAFE_FREE(returnJsonChar);
+    printf("============test_verify_request_sign end==========\n");
+}
+
+/*
+ * the previous tests went through EH_ENCRYPT on both the json and the binary entry,
+ * so their phases must show up in the metrics
+ */
+void test_get_metrics()
+{
+    printf("============test_get_metrics start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    Json::Value metrics;
+    std::string prometheus;
+
+    case_number++;
+
+    param_json.addData_uint32("action", EH_GET_METRICS);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("GetMetrics failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    metrics = retJsonObj.readData_JsonValue("metrics");
+    if (metrics["json"]["encrypt"]["total"]["count"].asUInt64() == 0 ||
+        metrics["json"]["encrypt"]["base64_decode"]["count"].asUInt64() == 0 ||
+        metrics["json"]["encrypt"]["ecall"]["count"].asUInt64() == 0 ||
+        metrics["json"]["encrypt"]["serialize"]["count"].asUInt64() == 0 ||
+        metrics["bin"]["encrypt"]["ecall"]["count"].asUInt64() == 0 ||
+        metrics["bin"]["encrypt"].isMember("base64_decode"))
+    {
+        printf("GetMetrics failed, unexpected metrics: %s\n", metrics.toStyledString().c_str());
+        goto cleanup;
+    }
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.addData_string("format", "prometheus");
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("GetMetrics failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    prometheus = retJsonObj.readData_string("metrics");
+    if (prometheus.find("# TYPE ehsm_ffi_phase_seconds histogram") == std::string::npos ||
+        prometheus.find("ehsm_ffi_phase_seconds_count{api=\"json\",action=\"encrypt\",phase=\"ecall\"}") == std::string::npos)
+    {
+        printf("GetMetrics failed, unexpected prometheus text:\n%s\n", prometheus.c_str());
+        goto cleanup;
+    }
+
+    success_number++;
+    printf("GetMetrics SUCCESSFULLY!\n");
+
+cleanup:
+    SAFE_FREE(returnJsonChar);
+    printf("============test_get_metrics end==========\n");
+}
+
+/*
+
+step1. raise the level to error through EH_SET_LOG_LEVEL, an unknown level is refused
+
+step2. log more ERROR lines than the ring holds with stdout redirected to a file,
+none of them may be dropped
+
+*/
+void test_log_level()
+{
+    printf("============test_log_level start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    int level = ehsm_log_get_level();
+    const int count = 10000;
+    int written = 0;
+    int saved_stdout = -1;
+    FILE *out = nullptr;
+    char line[1024];
+
+    case_number++;
+
+    param_json.addData_uint32("action", EH_SET_LOG_LEVEL);
+    payload_json.addData_string("level", "verbose");
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() == 200 || ehsm_log_get_level() != level)
+    {
+        printf("SetLogLevel failed, an unknown level is accepted\n");
+        goto cleanup;
+    }
+    SAFE_FREE(returnJsonChar);
+
+    payload_json.addData_string("level", "error");
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("SetLogLevel failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    if (ehsm_log_get_level() != EHSM_LOG_ERROR || ehsm_log_enabled(EHSM_LOG_WARN))
+    {
+        printf("SetLogLevel failed, the level is %d\n", ehsm_log_get_level());
+        goto cleanup;
+    }
+
+    out = tmpfile();
+    if (out == nullptr)
+    {
+        printf("SetLogLevel failed, tmpfile failed\n");
+        goto cleanup;
+    }
+    ehsm_log_flush();
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    dup2(fileno(out), STDOUT_FILENO);
+    for (int i = 0; i < count; i++)
+        log_e("test_log_level line %d", i);
+    ehsm_log_flush();
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != nullptr)
+    {
+        if (strstr(line, "test_log_level line ") != nullptr)
+            written++;
+    }
+    if (written != count)
+    {
+        printf("SetLogLevel failed, %d of %d error lines written\n", written, count);
+        goto cleanup;
+    }
+
+    success_number++;
+    printf("SetLogLevel SUCCESSFULLY!\n");
+
+cleanup:
+    if (out != nullptr)
+        fclose(out);
+    ehsm_log_set_level(level);
+    SAFE_FREE(returnJsonChar);
+    printf("============test_log_level end==========\n");
+}
+
+/*
+
+step1. re-initialize the provider with two enclave instances
+
+step2. create an aes-gcm-128 key, then encrypt and decrypt with it a few times,
+the calls alternate between the instances so a ciphertext of one instance is
+decrypted by the other one
+
+*/
+void test_enclave_instances()
+{
+    printf("============test_enclave_instances start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    std::string cmk_base64;
+    std::string ciphertext_base64;
+    char plaintext[] = "Test1234-EnclaveInstances";
+    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext));
+    ehsm_status_t ret = EH_OK;
+
+    case_number++;
+
+    Finalize();
+    setenv("EHSM_CONFIG_ENCLAVE_INSTANCES", "2", 1);
+    ret = Initialize();
+    unsetenv("EHSM_CONFIG_ENCLAVE_INSTANCES");
+    if (ret != EH_OK)
+    {
+        printf("Initialize with 2 enclave instances failed %d\n", ret);
+        goto cleanup;
+    }
+
+    payload_json.addData_uint32("keyspec", EH_AES_GCM_128);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
+
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("Createkey with aes-gcm-128 failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+    cmk_base64 = retJsonObj.readData_string("cmk");
+    SAFE_FREE(returnJsonChar);
+
+    for (int i = 0; i < 4; i++)
+    {
+        payload_json.clear();
+        payload_json.addData_string("cmk", cmk_base64);
+        payload_json.addData_string("plaintext", input_plaintext_base64);
+        param_json.addData_uint32("action", EH_ENCRYPT);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200)
+        {
+            printf("Failed to Encrypt the plaittext data, error message: %s \n", retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        ciphertext_base64 = retJsonObj.readData_string("ciphertext");
+        SAFE_FREE(returnJsonChar);
+
+        payload_json.clear();
+        payload_json.addData_string("cmk", cmk_base64);
+        payload_json.addData_string("ciphertext", ciphertext_base64);
+        param_json.addData_uint32("action", EH_DECRYPT);
+        param_json.addData_JsonValue("payload", payload_json.getJson());
+
+        returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+        retJsonObj.parse(returnJsonChar);
+        if (retJsonObj.getCode() != 200 || retJsonObj.readData_string("plaintext") != input_plaintext_base64)
+        {
+            printf("Failed to Decrypt the data on another instance, error message: %s \n", retJsonObj.getMessage().c_str());
+            goto cleanup;
+        }
+        SAFE_FREE(returnJsonChar);
     }
+
+    success_number++;
+    printf("Enclave instances SUCCESSFULLY!\n");
+
 cleanup:
     SAFE_FREE(returnJsonChar);
-    SAFE_FREE(cmk_base64);
-    SAFE_FREE(ukey_base64);
-    SAFE_FREE(olddatakey_base64);
-    SAFE_FREE(newdatakey_base64);
-    SAFE_FREE(olddatakeyplaintext_base64);
-    SAFE_FREE(newdatakeyplaintext_base64);
-    SAFE_FREE(plaintext_base64);
-    SAFE_FREE(ciphertext_base64);
-    printf("============test_export_datakey end==========\n");
+    printf("============test_enclave_instances end==========\n");
 }
 
-void test_GenerateQuote_and_VerifyQuote()
+/*
+ * the vectorized codec must match the RFC 4648 vectors, round trip every
+ * tail length of the vector loops and stop at the first padding character
+ */
+void test_base64()
 {
-    printf("============test_GenerateQuote_and_VerifyQuote start==========\n");
-    JsonObj param_json;
-    JsonObj payload_json;
-
-    RetJsonObj retJsonObj;
-    char *returnJsonChar = nullptr;
-    char *quote_base64 = nullptr;
-
-    char challenge[32] = "challenge123456";
-    char nonce[16] = "nonce123456";
+    printf("============test_base64 start==========\n");
+    const char *vectors[][2] = {
+        {"", ""}, {"f", "Zg=="}, {"fo", "Zm8="}, {"foo", "Zm9v"},
+        {"foob", "Zm9vYg=="}, {"fooba", "Zm9vYmE="}, {"foobar", "Zm9vYmFy"}};
+    uint8_t data[256];
+    std::string encoded;
+    std::string decoded;
 
-    std::string input_challenge_base64 = base64_encode((const uint8_t *)challenge, sizeof(challenge) / sizeof(challenge[0]));
-    std::string input_nonce_base64 = base64_encode((const uint8_t *)nonce, sizeof(nonce) / sizeof(nonce[0]));
+    case_number++;
 
-    // the string generated after converting the value of mr_signer and mr_enclave to hexadecimal
-    // notice: these 2 values will be changed if our enclave has been updated. then the case may be failed.
-    // you can get mr_signer and mr_enclave through cmd:
-    // "/opt/intel/sgxsdk/bin/x64/sgx_sign dump -enclave libenclave-ehsm-core.signed.so -dumpfile out.log"
-    std::string mr_enclave;
-    std::string mr_signer;
-    std::string signedEnclaveFileName = SIGNED_ENCLAVE_FILENAME;
-    std::string sgxSignFileName = SGX_SIGNING_TOOL;
-    std::string tmpFileName = "ehsm_enclave_out.log";
-    printf("NAPI_GenerateQuote signedEnclaveFileName : %s\n", signedEnclaveFileName.c_str());
-    printf("NAPI_GenerateQuote sgxSignFileName : %s\n", sgxSignFileName.c_str());
-    std::string delTmpFileCMD = "rm " + tmpFileName;
-    std::string CMD1 = " dump -enclave ";
-    std::string CMD2 = " -dumpfile " + tmpFileName;
-    std::string splicedCMD = sgxSignFileName + CMD1 + signedEnclaveFileName + CMD2;
-    const char *dumpFileCMD = splicedCMD.data();
-    system(dumpFileCMD);
-    std::fstream ifs;
-    std::string line;
-    u_int32_t readEnclaveLineNum = 0;
-    u_int32_t readSignerLineNum = 0;
-    ifs.open(tmpFileName, std::ios::in);
-    if (!ifs.is_open())
-    {
-        printf("load mr_signer & mr_enclave faild. \n");
-        goto cleanup;
-    }
-    while (getline(ifs, line))
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
     {
-        if (readEnclaveLineNum > 0)
-        {
-            readEnclaveLineNum -= 1;
-            mr_enclave += line;
-        }
-        if (readSignerLineNum > 0)
-        {
-            readSignerLineNum -= 1;
-            mr_signer += line;
-        }
-        if (line.compare("metadata->enclave_css.body.enclave_hash.m:") == 0)
-        {
-            if (mr_enclave.length() == 0)
-            {
-                readEnclaveLineNum = 2;
-            }
-        }
-        if (line.compare("mrsigner->value:") == 0)
+        encoded = base64_encode((const uint8_t *)vectors[i][0], strlen(vectors[i][0]));
+        decoded = base64_decode(vectors[i][1]);
+        if (encoded != vectors[i][1] || decoded != vectors[i][0])
         {
-            if (mr_signer.length() == 0)
-            {
-                readSignerLineNum = 2;
-            }
+            printf("base64 failed, vector %zu: %s/%s\n", i, encoded.c_str(), decoded.c_str());
+            goto cleanup;
         }
     }
-    while (mr_enclave.find("0x") != -1)
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 167 + 13);
+    for (uint32_t len = 0; len <= sizeof(data); len++)
     {
-        mr_enclave = mr_enclave.replace(mr_enclave.find("0x"), 2, "");
+        encoded = base64_encode(data, len);
+        decoded = base64_decode(encoded);
+        if (encoded.size() != base64_encoded_size(len) ||
+            decoded.size() != len || memcmp(decoded.data(), data, len) != 0)
+        {
+            printf("base64 failed, round trip of %u bytes\n", len);
+            goto cleanup;
+        }
     }
-    while (mr_enclave.find(" ") != -1)
+
+    encoded = base64_encode(data, 48);
+    encoded[40] = '=';
+    if (base64_decode(encoded) != std::string((const char *)data, 30))
     {
-        mr_enclave = mr_enclave.replace(mr_enclave.find(" "), 1, "");
+        printf("base64 failed, decoding did not stop at the padding\n");
+        goto cleanup;
     }
-    while (mr_signer.find("0x") != -1)
+
+    success_number++;
+    printf("base64 SUCCESSFULLY!\n");
+
+cleanup:
+    printf("============test_base64 end==========\n");
+}
+
+#define PARALLEL_THREAD_NUM 100
+#define PARALLEL_REQUEST_NUM 8
+
+static std::string g_parallel_request;
+static int g_parallel_success = 0;
+static int g_parallel_busy = 0;
+static int g_parallel_failed = 0;
+
+static void *test_parallel_worker(void *arg)
+{
+    RetJsonObj retJsonObj;
+    char *returnJsonChar = nullptr;
+
+    for (int i = 0; i < PARALLEL_REQUEST_NUM; i++)
     {
-        mr_signer = mr_signer.replace(mr_signer.find("0x"), 2, "");
+        returnJsonChar = EHSM_FFI_CALL(g_parallel_request.c_str());
+        retJsonObj.parse(returnJsonChar);
+        SAFE_FREE(returnJsonChar);
+
+        pthread_mutex_lock(&g_async_test_lock);
+        if (retJsonObj.getCode() == 200)
+            g_parallel_success++;
+        else if (retJsonObj.getCode() == retJsonObj.CODE_BUSY)
+            g_parallel_busy++;
+        else
+            g_parallel_failed++;
+        pthread_mutex_unlock(&g_async_test_lock);
     }
-    while (mr_signer.find(" ") != -1)
+
+    return NULL;
+}
+
+/*
+ * far more callers than the enclave has TCSs, a request must either succeed or be
+ * refused as busy by the admission control, never fail inside the enclave
+ */
+void test_parallel_encrypt()
+{
+    printf("============test_parallel_encrypt start==========\n");
+    RetJsonObj retJsonObj;
+    JsonObj param_json;
+    JsonObj payload_json;
+    char *returnJsonChar = nullptr;
+    char plaintext[] = "Test1234-Parallel";
+    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext));
+    pthread_t threads[PARALLEL_THREAD_NUM];
+    int started = 0;
+    ehsm_status_t ret = EH_OK;
+
+    case_number++;
+
+    // a short queue, so the busy path may be taken as well
+    Finalize();
+    setenv("EHSM_CONFIG_ADMISSION_QUEUE_SIZE", "16", 1);
+    ret = Initialize();
+    unsetenv("EHSM_CONFIG_ADMISSION_QUEUE_SIZE");
+    if (ret != EH_OK)
     {
-        mr_signer = mr_signer.replace(mr_signer.find(" "), 1, "");
+        printf("Initialize with a short admission queue failed %d\n", ret);
+        goto cleanup;
     }
-    system(delTmpFileCMD.data());
 
-    payload_json.addData_string("challenge", input_challenge_base64);
-    param_json.addData_uint32("action", EH_GENERATE_QUOTE);
+    payload_json.addData_uint32("keyspec", EH_AES_GCM_128);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
     param_json.addData_JsonValue("payload", payload_json.getJson());
 
     returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
     retJsonObj.parse(returnJsonChar);
     if (retJsonObj.getCode() != 200)
     {
-        printf("FFI_GenerateQuote failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        printf("Createkey failed, error message: %s \n", retJsonObj.getMessage().c_str());
         goto cleanup;
     }
-    printf("FFI_GenerateQuote Json : %s\n", returnJsonChar);
-    printf("FFI_GenerateQuote SUCCESSFULLY!\n");
-
-    quote_base64 = retJsonObj.readData_cstr("quote");
-    printf("quote_base64 : %s\n", quote_base64);
 
     payload_json.clear();
-    param_json.clear();
-    payload_json.addData_string("quote", quote_base64);
-    payload_json.addData_string("mr_signer", mr_signer);
-    payload_json.addData_string("mr_enclave", mr_enclave);
-    payload_json.addData_string("nonce", input_nonce_base64);
-    param_json.addData_uint32("action", EH_VERIFY_QUOTE);
+    payload_json.addData_string("cmk", retJsonObj.readData_string("cmk"));
+    payload_json.addData_string("plaintext", input_plaintext_base64);
+    param_json.addData_uint32("action", EH_ENCRYPT);
     param_json.addData_JsonValue("payload", payload_json.getJson());
-    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
-    retJsonObj.parse(returnJsonChar);
-    if (retJsonObj.getCode() != 200)
+    g_parallel_request = param_json.toString();
+
+    g_parallel_success = 0;
+    g_parallel_busy = 0;
+    g_parallel_failed = 0;
+    for (started = 0; started < PARALLEL_THREAD_NUM; started++)
     {
-        printf("FFI_VerifyQuote failed, error message: %s \n", retJsonObj.getMessage().c_str());
-        goto cleanup;
+        if (pthread_create(&threads[started], NULL, test_parallel_worker, NULL) != 0)
+            break;
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    printf("%d threads: %d succeeded, %d busy, %d failed\n",
+           started, g_parallel_success, g_parallel_busy, g_parallel_failed);
+    if (started == PARALLEL_THREAD_NUM && g_parallel_failed == 0 && g_parallel_success > 0)
+    {
+        success_number++;
+        printf("Parallel encrypt SUCCESSFULLY!\n");
     }
-    printf("FFI_VerifyQuote Json : %s\n", returnJsonChar);
-    printf("FFI_VerifyQuote SUCCESSFULLY!\n");
 
 cleanup:
     SAFE_FREE(returnJsonChar);
-    printf("============test_GenerateQuote_and_VerifyQuote end==========\n");
+    printf("============test_parallel_encrypt end==========\n");
 }
 
-void test_Enroll()
+/*
+
+step1. re-initialize the provider with a single slot and no admission queue
+
+step2. hold the only slot, an encrypt must be refused with EH_BUSY without waiting
+
+step3. give the slot back, the same encrypt must succeed
+
+*/
+void test_admission_busy()
 {
-    printf("============test_Enroll start==========\n");
+    printf("============test_admission_busy start==========\n");
     RetJsonObj retJsonObj;
-    char *returnJsonChar = nullptr;
-    char *appid = nullptr;
-    char *apikey = nullptr;
-
     JsonObj param_json;
     JsonObj payload_json;
-    param_json.addData_uint32("action", EH_ENROLL);
+    char *returnJsonChar = nullptr;
+    char plaintext[] = "Test1234-AdmissionBusy";
+    std::string input_plaintext_base64 = base64_encode((const uint8_t *)plaintext, sizeof(plaintext));
+    void *slot = nullptr;
+    ehsm_status_t ret = EH_OK;
+
+    case_number++;
+
+    Finalize();
+    setenv("EHSM_CONFIG_ENCLAVE_TCS_SLOTS", "1", 1);
+    setenv("EHSM_CONFIG_ADMISSION_QUEUE_SIZE", "0", 1);
+    ret = Initialize();
+    unsetenv("EHSM_CONFIG_ENCLAVE_TCS_SLOTS");
+    unsetenv("EHSM_CONFIG_ADMISSION_QUEUE_SIZE");
+    if (ret != EH_OK)
+    {
+        printf("Initialize with a single slot failed %d\n", ret);
+        goto cleanup;
+    }
+
+    payload_json.addData_uint32("keyspec", EH_AES_GCM_128);
+    payload_json.addData_uint32("origin", EH_INTERNAL_KEY);
+    param_json.addData_uint32("action", EH_CREATE_KEY);
     param_json.addData_JsonValue("payload", payload_json.getJson());
 
-    returnJsonChar = EHSM_FFI_CALL(param_json.toString().c_str());
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
     retJsonObj.parse(returnJsonChar);
     if (retJsonObj.getCode() != 200)
     {
-        printf("FFI_Enroll failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        printf("Createkey failed, error message: %s \n", retJsonObj.getMessage().c_str());
         goto cleanup;
     }
-    printf("FFI_Enroll Json : %s\n", returnJsonChar);
-    printf("FFI_Enroll SUCCESSFULLY!\n");
+    SAFE_FREE(returnJsonChar);
 
-    appid = retJsonObj.readData_cstr("appid");
-    apikey = retJsonObj.readData_cstr("apikey");
-    printf("appid : %s\n", appid);
-    printf("apikey : %s\n", apikey);
+    payload_json.clear();
+    payload_json.addData_string("cmk", retJsonObj.readData_string("cmk"));
+    payload_json.addData_string("plaintext", input_plaintext_base64);
+    param_json.addData_uint32("action", EH_ENCRYPT);
+    param_json.addData_JsonValue("payload", payload_json.getJson());
 
-cleanup:
+    ret = HoldEnclaveSlot(&slot);
+    if (ret != EH_OK)
+    {
+        printf("HoldEnclaveSlot failed %d\n", ret);
+        goto cleanup;
+    }
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != retJsonObj.CODE_BUSY)
+    {
+        printf("Encrypt with the slot held returned %d, expected busy\n", retJsonObj.getCode());
+        goto cleanup;
+    }
     SAFE_FREE(returnJsonChar);
-    printf("============test_Enroll end==========\n");
-}
 
-void test_performance()
-{
-    test_perf_createkey();
-    test_perf_encrypt();
-    test_perf_decrypt();
-    test_perf_sign_verify();
-    test_perf_asymmetricencrypt();
-    test_perf_asymmetricdecrypt();
+    ReleaseEnclaveSlot(slot);
+    slot = nullptr;
+    returnJsonChar = EHSM_FFI_CALL((param_json.toString()).c_str());
+    retJsonObj.parse(returnJsonChar);
+    if (retJsonObj.getCode() != 200)
+    {
+        printf("Encrypt after the slot was released failed, error message: %s \n", retJsonObj.getMessage().c_str());
+        goto cleanup;
+    }
+
+    success_number++;
+    printf("Admission busy SUCCESSFULLY!\n");
+
+cleanup:
+    ReleaseEnclaveSlot(slot);
+    SAFE_FREE(returnJsonChar);
+    printf("============test_admission_busy end==========\n");
 }
 
 int main(int argc, char *argv[])
@@ -2010,10 +3120,6 @@ int main(int argc, char *argv[])
     }
     printf("Initialize done\n");
 
-#if ENABLE_PERFORMANCE_TEST
-    test_performance();
-#endif
-
     test_symmertric_encrypt_decrypt();
 
     test_symmertric_encrypt_decrypt_without_aad();
@@ -2038,6 +3144,42 @@ int main(int argc, char *argv[])
 
     test_Enroll();
 
+    test_key_cache();
+
+    test_verify_request_sign();
+
+    test_key_pool();
+
+    test_upgrade_keyblob();
+
+    test_upgrade_v1_keyblob();
+
+    test_batch();
+
+    test_hmac_generate_verify();
+
+    test_ffi_call_bin();
+
+    test_stream_encrypt_decrypt();
+
+    test_ffi_call_async();
+
+    test_finalize_async_queued();
+
+    test_enclave_stats();
+
+    test_get_metrics();
+
+    test_log_level();
+
+    test_base64();
+
+    test_enclave_instances();
+
+    test_parallel_encrypt();
+
+    test_admission_busy();
+
     Finalize();
 
     printf("All of tests done. %d/%d success\n", success_number, case_number);
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2021-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <time.h>
+#include <new>
+#include <atomic>
+#include <vector>
+#include <sstream>
+
+#include "ehsm_provider.h"
+#include "ehsm_metrics.h"
+
+/*
+ * A shard is written by a single thread only, so the counters are bumped with a relaxed
+ * load and store instead of a locked read-modify-write, and a reader summing up the shards
+ * may see a request half recorded at worst. The shard of an exited thread keeps its counts
+ * and is handed over to the next new thread.
+ */
+typedef struct
+{
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+    std::atomic<uint64_t> buckets[EH_METRICS_BUCKETS];
+} metrics_histogram_t;
+
+typedef struct metrics_shard
+{
+    metrics_histogram_t hist[EH_METRICS_API_NUM][EH_METRICS_ACTION_MAX][EH_METRICS_PHASE_NUM];
+    std::atomic<bool> in_use;
+    struct metrics_shard *next;
+} metrics_shard_t;
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[EH_METRICS_BUCKETS];
+} metrics_sum_t;
+
+struct metrics_thread_t
+{
+    metrics_shard_t *shard;
+    /* the phases of the request tracked by this thread, NULL when there is none */
+    metrics_histogram_t *current;
+
+    ~metrics_thread_t()
+    {
+        if (shard != NULL)
+            shard->in_use.store(false, std::memory_order_release);
+    }
+};
+
+/* shards are never freed, the list only grows up to the peak number of threads */
+static std::atomic<metrics_shard_t *> g_metrics_shards(NULL);
+static thread_local metrics_thread_t t_metrics = {NULL, NULL};
+
+static const char *g_metrics_api_names[] = {"json", "bin"};
+
+static const char *g_metrics_phase_names[] = {
+    "json_parse",
+    "base64_decode",
+    "alloc",
+    "ecall",
+    "base64_encode",
+    "serialize",
+    "total",
+};
+
+static const char *g_metrics_action_names[] = {
+    "initialize",
+    "finalize",
+    "create_key",
+    "encrypt",
+    "decrypt",
+    "asymmetric_encrypt",
+    "asymmetric_decrypt",
+    "sign",
+    "verify",
+    "generate_datakey",
+    "generate_datakey_without_plaintext",
+    "export_datakey",
+    "get_version",
+    "enroll",
+    "generate_quote",
+    "verify_quote",
+    "upgrade_keyblob",
+    "batch",
+    "encrypt_init",
+    "encrypt_update",
+    "encrypt_final",
+    "decrypt_init",
+    "decrypt_update",
+    "decrypt_final",
+    "stream_abort",
+    "get_metrics",
+    "verify_request_sign",
+    "generate_mac",
+    "verify_mac",
+    "set_log_level",
+    "invalidate_api_key",
+};
+
+static const char *g_metrics_enclave_op_names[] = {
+    "create_key",
+    "encrypt",
+    "decrypt",
+    "asymmetric_encrypt",
+    "asymmetric_decrypt",
+    "sign",
+    "verify",
+    "generate_datakey",
+    "export_datakey",
+    "generate_mac",
+    "verify_mac",
+    "parse_keyblob",
+    "parse_key",
+    "crypto",
+    "read_rand",
+};
+
+static_assert(sizeof(g_metrics_enclave_op_names) / sizeof(g_metrics_enclave_op_names[0]) == EH_STATS_NUM,
+              "g_metrics_enclave_op_names does not match ehsm_stats_op_t");
+static_assert(sizeof(g_metrics_api_names) / sizeof(g_metrics_api_names[0]) == EH_METRICS_API_NUM,
+              "g_metrics_api_names does not match ehsm_metrics_api_t");
+static_assert(sizeof(g_metrics_phase_names) / sizeof(g_metrics_phase_names[0]) == EH_METRICS_PHASE_NUM,
+              "g_metrics_phase_names does not match ehsm_metrics_phase_t");
+static_assert(sizeof(g_metrics_action_names) / sizeof(g_metrics_action_names[0]) == EH_INVALIDATE_API_KEY + 1,
+              "g_metrics_action_names does not match ehsm_action_t");
+static_assert(EH_INVALIDATE_API_KEY < EH_METRICS_ACTION_MAX, "EH_METRICS_ACTION_MAX is too small");
+
+uint64_t metrics_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static metrics_shard_t *metrics_shard_claim()
+{
+    metrics_shard_t *shard = NULL;
+
+    for (shard = g_metrics_shards.load(std::memory_order_acquire); shard != NULL; shard = shard->next)
+    {
+        bool expected = false;
+        if (!shard->in_use.load(std::memory_order_relaxed) &&
+            shard->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return shard;
+    }
+
+    // value-initialized, so all the counters start at zero
+    shard = new (std::nothrow) metrics_shard_t();
+    if (shard == NULL)
+        return NULL;
+    shard->in_use.store(true, std::memory_order_relaxed);
+    shard->next = g_metrics_shards.load(std::memory_order_relaxed);
+    while (!g_metrics_shards.compare_exchange_weak(shard->next, shard,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed))
+        ;
+    return shard;
+}
+
+static void metrics_add(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static void metrics_record(metrics_histogram_t *hist, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    uint32_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+    if (bucket > EH_METRICS_BUCKETS - 1)
+        bucket = EH_METRICS_BUCKETS - 1;
+
+    metrics_add(hist->count, 1);
+    metrics_add(hist->sum_ns, ns);
+    metrics_add(hist->buckets[bucket], 1);
+}
+
+void metrics_request_begin(ehsm_metrics_api_t api, uint32_t action)
+{
+    t_metrics.current = NULL;
+    if (api >= EH_METRICS_API_NUM || action >= EH_METRICS_ACTION_MAX)
+        return;
+
+    if (t_metrics.shard == NULL)
+        t_metrics.shard = metrics_shard_claim();
+    if (t_metrics.shard != NULL)
+        t_metrics.current = t_metrics.shard->hist[api][action];
+}
+
+void metrics_request_end(uint64_t start)
+{
+    if (t_metrics.current != NULL && start != 0)
+        metrics_record(&t_metrics.current[EH_METRICS_PHASE_TOTAL], metrics_now() - start);
+    t_metrics.current = NULL;
+}
+
+uint64_t metrics_phase_begin()
+{
+    return t_metrics.current == NULL ? 0 : metrics_now();
+}
+
+void metrics_phase_end(ehsm_metrics_phase_t phase, uint64_t start)
+{
+    if (t_metrics.current == NULL || start == 0 || phase >= EH_METRICS_PHASE_NUM)
+        return;
+    metrics_record(&t_metrics.current[phase], metrics_now() - start);
+}
+
+static metrics_sum_t &metrics_sum_at(std::vector<metrics_sum_t> &sums, uint32_t api, uint32_t action, uint32_t phase)
+{
+    return sums[(api * EH_METRICS_ACTION_MAX + action) * EH_METRICS_PHASE_NUM + phase];
+}
+
+static void metrics_collect(std::vector<metrics_sum_t> &sums)
+{
+    sums.assign(EH_METRICS_API_NUM * EH_METRICS_ACTION_MAX * EH_METRICS_PHASE_NUM, metrics_sum_t());
+
+    for (metrics_shard_t *shard = g_metrics_shards.load(std::memory_order_acquire);
+         shard != NULL; shard = shard->next)
+    {
+        for (uint32_t api = 0; api < EH_METRICS_API_NUM; api++)
+            for (uint32_t action = 0; action < EH_METRICS_ACTION_MAX; action++)
+                for (uint32_t phase = 0; phase < EH_METRICS_PHASE_NUM; phase++)
+                {
+                    metrics_histogram_t &hist = shard->hist[api][action][phase];
+                    metrics_sum_t &sum = metrics_sum_at(sums, api, action, phase);
+
+                    sum.count += hist.count.load(std::memory_order_relaxed);
+                    sum.sum_ns += hist.sum_ns.load(std::memory_order_relaxed);
+                    for (uint32_t i = 0; i < EH_METRICS_BUCKETS; i++)
+                        sum.buckets[i] += hist.buckets[i].load(std::memory_order_relaxed);
+                }
+    }
+}
+
+static std::string metrics_action_name(uint32_t action)
+{
+    if (action < sizeof(g_metrics_action_names) / sizeof(g_metrics_action_names[0]))
+        return g_metrics_action_names[action];
+    return "action_" + std::to_string(action);
+}
+
+Json::Value metrics_to_json()
+{
+    std::vector<metrics_sum_t> sums;
+    Json::Value metrics(Json::objectValue);
+
+    metrics_collect(sums);
+    for (uint32_t api = 0; api < EH_METRICS_API_NUM; api++)
+        for (uint32_t action = 0; action < EH_METRICS_ACTION_MAX; action++)
+            for (uint32_t phase = 0; phase < EH_METRICS_PHASE_NUM; phase++)
+            {
+                const metrics_sum_t &sum = metrics_sum_at(sums, api, action, phase);
+                if (sum.count == 0)
+                    continue;
+
+                Json::Value item;
+                item["count"] = (Json::UInt64)sum.count;
+                item["sum_us"] = (Json::UInt64)(sum.sum_ns / 1000);
+                item["buckets"] = Json::Value(Json::arrayValue);
+                for (uint32_t i = 0; i < EH_METRICS_BUCKETS; i++)
+                    item["buckets"].append((Json::UInt64)sum.buckets[i]);
+                metrics[g_metrics_api_names[api]][metrics_action_name(action)][g_metrics_phase_names[phase]] = item;
+            }
+    return metrics;
+}
+
+std::string metrics_to_prometheus()
+{
+    std::vector<metrics_sum_t> sums;
+    std::ostringstream text;
+
+    metrics_collect(sums);
+    text << "# HELP ehsm_ffi_phase_seconds Latency of each phase of the ehsm ffi requests.\n"
+         << "# TYPE ehsm_ffi_phase_seconds histogram\n";
+    for (uint32_t api = 0; api < EH_METRICS_API_NUM; api++)
+        for (uint32_t action = 0; action < EH_METRICS_ACTION_MAX; action++)
+            for (uint32_t phase = 0; phase < EH_METRICS_PHASE_NUM; phase++)
+            {
+                const metrics_sum_t &sum = metrics_sum_at(sums, api, action, phase);
+                if (sum.count == 0)
+                    continue;
+
+                std::string labels = std::string("api=\"") + g_metrics_api_names[api] +
+                                     "\",action=\"" + metrics_action_name(action) +
+                                     "\",phase=\"" + g_metrics_phase_names[phase] + "\"";
+                // the count is taken from the buckets so that it matches the +Inf bucket
+                uint64_t cumulative = 0;
+                for (uint32_t i = 0; i < EH_METRICS_BUCKETS - 1; i++)
+                {
+                    cumulative += sum.buckets[i];
+                    text << "ehsm_ffi_phase_seconds_bucket{" << labels << ",le=\""
+                         << (double)(1ULL << i) / 1e6 << "\"} " << cumulative << "\n";
+                }
+                cumulative += sum.buckets[EH_METRICS_BUCKETS - 1];
+                text << "ehsm_ffi_phase_seconds_bucket{" << labels << ",le=\"+Inf\"} " << cumulative << "\n"
+                     << "ehsm_ffi_phase_seconds_sum{" << labels << "} " << (double)sum.sum_ns / 1e9 << "\n"
+                     << "ehsm_ffi_phase_seconds_count{" << labels << "} " << cumulative << "\n";
+            }
+    return text.str();
+}
+
+static std::string metrics_keyspec_name(uint32_t keyspec)
+{
+    switch (keyspec)
+    {
+    case EH_AES_GCM_128:
+        return "aes_gcm_128";
+    case EH_AES_GCM_192:
+        return "aes_gcm_192";
+    case EH_AES_GCM_256:
+        return "aes_gcm_256";
+    case EH_RSA_2048:
+        return "rsa_2048";
+    case EH_RSA_3072:
+        return "rsa_3072";
+    case EH_RSA_4096:
+        return "rsa_4096";
+    case EH_EC_P224:
+        return "ec_p224";
+    case EH_EC_P256:
+        return "ec_p256";
+    case EH_EC_P384:
+        return "ec_p384";
+    case EH_EC_P521:
+        return "ec_p521";
+    case EH_SM2:
+        return "sm2";
+    case EH_SM4_CTR:
+        return "sm4_ctr";
+    case EH_SM4_CBC:
+        return "sm4_cbc";
+    case EH_HMAC:
+        return "hmac";
+    default:
+        return "keyspec_" + std::to_string(keyspec);
+    }
+}
+
+Json::Value metrics_enclave_to_json(const ehsm_enclave_stats_t *stats)
+{
+    Json::Value metrics(Json::objectValue);
+
+    metrics["enabled"] = stats->enabled != 0;
+    for (uint32_t op = 0; op < EH_STATS_NUM; op++)
+        for (uint32_t keyspec = 0; keyspec < EH_STATS_KEYSPEC_NUM; keyspec++)
+        {
+            const ehsm_stats_counter_t &counter = stats->counters[op][keyspec];
+            if (counter.count == 0)
+                continue;
+
+            Json::Value item;
+            item["count"] = (Json::UInt64)counter.count;
+            item["cycles"] = (Json::UInt64)counter.cycles;
+            item["max_cycles"] = (Json::UInt64)counter.max_cycles;
+            metrics[g_metrics_enclave_op_names[op]][metrics_keyspec_name(keyspec)] = item;
+        }
+    return metrics;
+}
+
+std::string metrics_enclave_to_prometheus(const ehsm_enclave_stats_t *stats)
+{
+    static const struct
+    {
+        const char *name;
+        const char *type;
+        const char *help;
+    } families[] = {
+        {"ehsm_enclave_ops_total", "counter", "Operations counted inside the enclave."},
+        {"ehsm_enclave_cycles_total", "counter", "TSC cycles spent inside the enclave."},
+        {"ehsm_enclave_max_cycles", "gauge", "Longest operation inside the enclave in TSC cycles."},
+    };
+    std::ostringstream text;
+
+    text << "# HELP ehsm_enclave_stats_enabled Whether the in-enclave counters are enabled.\n"
+         << "# TYPE ehsm_enclave_stats_enabled gauge\n"
+         << "ehsm_enclave_stats_enabled " << (stats->enabled != 0 ? 1 : 0) << "\n";
+    for (uint32_t family = 0; family < sizeof(families) / sizeof(families[0]); family++)
+    {
+        text << "# HELP " << families[family].name << " " << families[family].help << "\n"
+             << "# TYPE " << families[family].name << " " << families[family].type << "\n";
+        for (uint32_t op = 0; op < EH_STATS_NUM; op++)
+            for (uint32_t keyspec = 0; keyspec < EH_STATS_KEYSPEC_NUM; keyspec++)
+            {
+                const ehsm_stats_counter_t &counter = stats->counters[op][keyspec];
+                if (counter.count == 0)
+                    continue;
+
+                text << families[family].name << "{op=\"" << g_metrics_enclave_op_names[op]
+                     << "\",keyspec=\"" << metrics_keyspec_name(keyspec) << "\"} "
+                     << (family == 0 ? counter.count : family == 1 ? counter.cycles : counter.max_cycles) << "\n";
+            }
+    }
+    return text.str();
+}
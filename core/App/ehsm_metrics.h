@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2021-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _EHSM_METRICS_H_
+#define _EHSM_METRICS_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "datatypes.h"
+#include "json_utils.h"
+
+/*
+ * Per-action latency metrics of the ffi entries. Every thread records into its own
+ * shard without taking any lock, the shards are only summed up when the metrics
+ * are read through the EH_GET_METRICS action.
+ */
+
+typedef enum
+{
+    EH_METRICS_API_JSON = 0,    /* EHSM_FFI_CALL and EHSM_FFI_CALL_ASYNC */
+    EH_METRICS_API_BIN,         /* EHSM_FFI_CALL_BIN */
+    EH_METRICS_API_NUM
+} ehsm_metrics_api_t;
+
+typedef enum
+{
+    EH_METRICS_PHASE_JSON_PARSE = 0,
+    EH_METRICS_PHASE_BASE64_DECODE,
+    EH_METRICS_PHASE_ALLOC,
+    EH_METRICS_PHASE_ECALL,
+    EH_METRICS_PHASE_BASE64_ENCODE,
+    EH_METRICS_PHASE_SERIALIZE,
+    EH_METRICS_PHASE_TOTAL,     /* the whole request, from entering the ffi entry until it returns */
+    EH_METRICS_PHASE_NUM
+} ehsm_metrics_phase_t;
+
+/* actions with a larger id are not recorded */
+#define EH_METRICS_ACTION_MAX   32
+
+/* log2 latency buckets, bucket i counts latencies below 2^i us and the last one the rest */
+#define EH_METRICS_BUCKETS      21
+
+/*
+ * @return the monotonic time in nanoseconds
+ */
+uint64_t metrics_now();
+
+/*
+ * Start tracking a request of `action` on the calling thread, the phases recorded
+ * from now on are accounted to it.
+ */
+void metrics_request_begin(ehsm_metrics_api_t api, uint32_t action);
+
+/*
+ * Record the total latency of the tracked request and stop tracking it.
+ *  @param start : metrics_now() taken when the request entered the ffi entry
+ */
+void metrics_request_end(uint64_t start);
+
+/*
+ * Start timing a phase of the tracked request.
+ *  @return the start time, or 0 when the calling thread is not tracking a request
+ */
+uint64_t metrics_phase_begin();
+
+/*
+ * Record the latency of a phase started by metrics_phase_begin, nothing is recorded for a 0 start.
+ */
+void metrics_phase_end(ehsm_metrics_phase_t phase, uint64_t start);
+
+/*
+ * Sum up the shards of all the threads.
+ *  @return the metrics in the form of
+ *      {
+ *          "<api>" : {
+ *              "<action>" : {
+ *                  "<phase>" : {
+ *                      "count" : int,
+ *                      "sum_us" : int,
+ *                      "buckets" : array(int)
+ *                  }
+ *              }
+ *          }
+ *      }
+ *  only the actions and phases which have been recorded are listed.
+ */
+Json::Value metrics_to_json();
+
+/*
+ * Sum up the shards of all the threads in the Prometheus text exposition format.
+ */
+std::string metrics_to_prometheus();
+
+/*
+ * The in-enclave performance counters read by GetEnclaveStats.
+ *  @return the counters in the form of
+ *      {
+ *          "enabled" : bool,
+ *          "<op>" : {
+ *              "<keyspec>" : {
+ *                  "count" : int,
+ *                  "cycles" : int,
+ *                  "max_cycles" : int
+ *              }
+ *          }
+ *      }
+ *  only the ops and keyspecs which have been counted are listed.
+ */
+Json::Value metrics_enclave_to_json(const ehsm_enclave_stats_t *stats);
+
+/*
+ * The in-enclave performance counters in the Prometheus text exposition format.
+ */
+std::string metrics_enclave_to_prometheus(const ehsm_enclave_stats_t *stats);
+
+#endif
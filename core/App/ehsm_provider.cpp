@@ -39,9 +39,19 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <chrono>
+#include <cpuid.h>
 #include <sgx_error.h>
 #include <sgx_eid.h>
 #include <sgx_urts.h>
+#include <sgx_uswitchless.h>
 
 #include "enclave_hsm_u.h"
 #include "ehsm_provider.h"
@@ -54,6 +64,7 @@
 #include "log_utils.h"
 #include "json_utils.h"
 #include "ffi_operation.h"
+#include "ehsm_metrics.h"
 
 #include "openssl/rsa.h"
 #include "openssl/evp.h"
@@ -79,7 +90,226 @@ errno_t memcpy_s(
 
 sgx_ra_context_t g_context = INT_MAX;
 
-sgx_enclave_id_t g_enclave_id;
+/*
+ * Pool of enclave instances, EHSM_CONFIG_ENCLAVE_INSTANCES (default 1) of them are
+ * created by Initialize, each with its own TCSs and its own domain key provisioned
+ * by the dkeycache. The data plane calls go to the instance with the fewest calls
+ * in flight, a stream stays on the instance which opened it. The remote attestation
+ * and the quote flows keep their state in the primary instance 0.
+ */
+#define EH_ENCLAVE_MAX_INSTANCES 32
+
+/*
+ * Admission control in front of the data plane ecalls. An instance runs at most
+ * EHSM_CONFIG_ENCLAVE_TCS_SLOTS calls at once, one more would fail in the enclave with
+ * SGX_ERROR_OUT_OF_TCS. The default is the TCSNum of enclave_hsm.config.xml minus the TCS
+ * of the key pool refill thread and the switchless trusted workers. A call finding every
+ * slot taken waits, with at most EHSM_CONFIG_ADMISSION_QUEUE_SIZE others, until a slot is
+ * released or its deadline passes, EHSM_CONFIG_ADMISSION_TIMEOUT_MS after the request
+ * entered the provider. It is then refused with EH_BUSY, without entering the enclave.
+ */
+#ifndef EH_ENCLAVE_TCS_NUM
+#error "EH_ENCLAVE_TCS_NUM must be the TCSNum of enclave_hsm.config.xml, see core/Makefile"
+#elif EH_ENCLAVE_TCS_NUM < 2
+#error "the enclave needs a TCS for the key pool refill thread and one for the requests"
+#endif
+#define EH_ADMISSION_DEFAULT_QUEUE_SIZE 1024
+#define EH_ADMISSION_DEFAULT_TIMEOUT_MS 1000
+
+typedef std::chrono::steady_clock admission_clock_t;
+
+typedef struct
+{
+    sgx_enclave_id_t eid;
+    std::atomic<uint32_t> inflight;
+} ehsm_enclave_instance_t;
+
+static ehsm_enclave_instance_t g_enclaves[EH_ENCLAVE_MAX_INSTANCES];
+static uint32_t g_enclave_num = 0;
+static std::atomic<uint32_t> g_enclave_next(0);
+
+static uint32_t g_enclave_slots = EH_ENCLAVE_TCS_NUM - 1;
+static uint32_t g_admission_queue_size = EH_ADMISSION_DEFAULT_QUEUE_SIZE;
+static uint32_t g_admission_timeout_ms = EH_ADMISSION_DEFAULT_TIMEOUT_MS;
+static std::mutex g_admission_lock;
+static std::condition_variable g_admission_cond;
+static std::atomic<uint32_t> g_admission_waiters(0);
+static uint32_t g_admission_pinned_waiters = 0;
+
+/* the deadline of the request served by the calling thread, unset outside of the ffi entries */
+static thread_local admission_clock_t::time_point t_admission_deadline;
+
+/* set the deadline of the request entering on this thread, a nested entry keeps the outer one */
+struct admission_deadline_t
+{
+    bool owner;
+
+    explicit admission_deadline_t(admission_clock_t::time_point deadline)
+        : owner(t_admission_deadline == admission_clock_t::time_point())
+    {
+        if (owner)
+            t_admission_deadline = deadline;
+    }
+    ~admission_deadline_t()
+    {
+        if (owner)
+            t_admission_deadline = admission_clock_t::time_point();
+    }
+
+private:
+    admission_deadline_t(const admission_deadline_t &);
+    admission_deadline_t &operator=(const admission_deadline_t &);
+};
+
+static admission_clock_t::time_point admission_deadline()
+{
+    return admission_clock_t::now() + std::chrono::milliseconds(g_admission_timeout_ms);
+}
+
+static sgx_enclave_id_t primary_enclave_id()
+{
+    return g_enclaves[0].eid;
+}
+
+static bool enclave_take_slot(ehsm_enclave_instance_t *instance)
+{
+    uint32_t inflight = instance->inflight.load();
+
+    while (inflight < g_enclave_slots)
+    {
+        if (instance->inflight.compare_exchange_weak(inflight, inflight + 1))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Take a slot of the least loaded instance, the scan starts at a rotating one to spread
+ * the ties. NULL when every instance is full.
+ */
+static ehsm_enclave_instance_t *enclave_try_acquire(ehsm_enclave_instance_t *pinned)
+{
+    uint32_t start = 0;
+    ehsm_enclave_instance_t *best = NULL;
+
+    if (pinned != NULL)
+        return enclave_take_slot(pinned) ? pinned : NULL;
+
+    if (g_enclave_num > 1)
+        start = g_enclave_next.fetch_add(1, std::memory_order_relaxed) % g_enclave_num;
+
+    for (uint32_t i = 0; i < g_enclave_num; i++)
+    {
+        ehsm_enclave_instance_t *instance = &g_enclaves[(start + i) % g_enclave_num];
+        if (best == NULL || instance->inflight.load(std::memory_order_relaxed) < best->inflight.load(std::memory_order_relaxed))
+            best = instance;
+    }
+    if (best != NULL && enclave_take_slot(best))
+        return best;
+
+    // the least loaded one was taken meanwhile, any free slot will do
+    for (uint32_t i = 0; i < g_enclave_num; i++)
+    {
+        if (enclave_take_slot(&g_enclaves[(start + i) % g_enclave_num]))
+            return &g_enclaves[(start + i) % g_enclave_num];
+    }
+    return NULL;
+}
+
+static ehsm_enclave_instance_t *enclave_acquire(ehsm_enclave_instance_t *pinned)
+{
+    ehsm_enclave_instance_t *instance = NULL;
+    admission_clock_t::time_point deadline = t_admission_deadline;
+
+    // before Initialize the ecall simply fails on the invalid enclave id
+    if (g_enclave_num == 0)
+    {
+        g_enclaves[0].inflight.fetch_add(1);
+        return &g_enclaves[0];
+    }
+
+    instance = enclave_try_acquire(pinned);
+    if (instance != NULL)
+        return instance;
+
+    if (deadline == admission_clock_t::time_point())
+        deadline = admission_deadline();
+
+    std::unique_lock<std::mutex> lock(g_admission_lock);
+    if (g_admission_waiters.load() >= g_admission_queue_size || admission_clock_t::now() >= deadline)
+        return NULL;
+
+    // announced before the retry, so a release either sees the waiter or frees the slot first
+    g_admission_waiters.fetch_add(1);
+    if (pinned != NULL)
+        g_admission_pinned_waiters++;
+    for (;;)
+    {
+        instance = enclave_try_acquire(pinned);
+        if (instance != NULL)
+            break;
+        if (g_admission_cond.wait_until(lock, deadline) == std::cv_status::timeout)
+        {
+            instance = enclave_try_acquire(pinned);
+            break;
+        }
+    }
+    if (pinned != NULL)
+        g_admission_pinned_waiters--;
+    g_admission_waiters.fetch_sub(1);
+    return instance;
+}
+
+static void enclave_release(ehsm_enclave_instance_t *instance)
+{
+    instance->inflight.fetch_sub(1);
+    if (g_admission_waiters.load() == 0)
+        return;
+
+    // a waiter pinned to another instance can not use the slot, wake them all then
+    std::lock_guard<std::mutex> lock(g_admission_lock);
+    if (g_admission_pinned_waiters != 0)
+        g_admission_cond.notify_all();
+    else
+        g_admission_cond.notify_one();
+}
+
+/* holds a slot of an instance for the ecalls of one provider call */
+struct enclave_ref_t
+{
+    ehsm_enclave_instance_t *instance;
+
+    enclave_ref_t() : instance(enclave_acquire(NULL)) {}
+    explicit enclave_ref_t(ehsm_enclave_instance_t *pinned) : instance(enclave_acquire(pinned)) {}
+    ~enclave_ref_t()
+    {
+        if (instance != NULL)
+            enclave_release(instance);
+    }
+    /* false when the admission control refused the call, it must return EH_BUSY */
+    bool admitted() const
+    {
+        return instance != NULL;
+    }
+    sgx_enclave_id_t eid() const
+    {
+        return instance->eid;
+    }
+
+private:
+    enclave_ref_t(const enclave_ref_t &);
+    enclave_ref_t &operator=(const enclave_ref_t &);
+};
+
+/* the owner of a stream, its number is tagged into the top byte of the handle */
+static ehsm_enclave_instance_t *stream_instance(uint64_t handle)
+{
+    uint64_t index = handle >> EH_STREAM_HANDLE_INSTANCE_SHIFT;
+
+    if (index >= g_enclave_num)
+        return NULL;
+    return &g_enclaves[index];
+}
 
 static ehsm_status_t SetupSecureChannel(sgx_enclave_id_t eid)
 {
@@ -170,6 +400,8 @@ static bool validate_params(const char *data, size_t max_size, bool required = t
     }
 }
 
+static char *ffi_call(const char *paramJson, bool async);
+
 /**
  * @brief The unique ffi entry for the ehsm provider libaray.
  *
@@ -192,6 +424,12 @@ static bool validate_params(const char *data, size_t max_size, bool required = t
     }
  */
 char *EHSM_FFI_CALL(const char *paramJson)
+{
+    return ffi_call(paramJson, false);
+}
+
+/* the enclave lifecycle actions are refused by the async workers, see ffi_async_stop */
+static char *ffi_call(const char *paramJson, bool async)
 {
     log_d("paramJson = %s", paramJson);
     char *resp = nullptr;
@@ -199,7 +437,9 @@ char *EHSM_FFI_CALL(const char *paramJson)
     RetJsonObj retJsonObj;
     uint32_t action = -1;
     JsonObj payloadJson;
-    if (!validate_params(paramJson, EH_PAYLOAD_MAX_SIZE))
+    uint64_t request_start = metrics_now();
+    admission_deadline_t deadline(admission_deadline());
+    if (!validate_params(paramJson, EH_BATCH_PAYLOAD_MAX_SIZE))
     {
         retJsonObj.setCode(retJsonObj.CODE_FAILED);
         retJsonObj.setMessage("Argument bad.");
@@ -207,6 +447,7 @@ char *EHSM_FFI_CALL(const char *paramJson)
     }
     // parse paramJson into paramJsonObj
     JsonObj paramJsonObj;
+    uint64_t parse_start = metrics_now();
     if (!paramJsonObj.parse(paramJson))
     {
         retJsonObj.setCode(retJsonObj.CODE_FAILED);
@@ -215,7 +456,22 @@ char *EHSM_FFI_CALL(const char *paramJson)
     }
 
     action = paramJsonObj.readData_uint32("action");
-    payloadJson.setJson(paramJsonObj.readData_JsonValue("payload"));
+    // only a batch may carry more than a single request
+    if (action != EH_BATCH && !validate_params(paramJson, EH_PAYLOAD_MAX_SIZE))
+    {
+        retJsonObj.setCode(retJsonObj.CODE_FAILED);
+        retJsonObj.setMessage("Argument bad.");
+        return retJsonObj.toChar();
+    }
+    if (async && (action == EH_INITIALIZE || action == EH_FINALIZE))
+    {
+        retJsonObj.setCode(retJsonObj.CODE_FAILED);
+        retJsonObj.setMessage("Argument bad.");
+        return retJsonObj.toChar();
+    }
+    metrics_request_begin(EH_METRICS_API_JSON, action);
+    payloadJson.setJson(paramJsonObj.takeData_JsonValue("payload"));
+    metrics_phase_end(EH_METRICS_PHASE_JSON_PARSE, parse_start);
     switch (action)
     {
     case EH_INITIALIZE:
@@ -266,6 +522,30 @@ char *EHSM_FFI_CALL(const char *paramJson)
     case EH_VERIFY_QUOTE:
         resp = ffi_verifyQuote(payloadJson);
         break;
+    case EH_UPGRADE_KEYBLOB:
+        resp = ffi_upgradeKeyBlob(payloadJson);
+        break;
+    case EH_BATCH:
+        resp = ffi_batch(payloadJson);
+        break;
+    case EH_GET_METRICS:
+        resp = ffi_getMetrics(payloadJson);
+        break;
+    case EH_VERIFY_REQUEST_SIGN:
+        resp = ffi_verifyRequestSign(payloadJson);
+        break;
+    case EH_GENERATE_MAC:
+        resp = ffi_generateMac(payloadJson);
+        break;
+    case EH_VERIFY_MAC:
+        resp = ffi_verifyMac(payloadJson);
+        break;
+    case EH_SET_LOG_LEVEL:
+        resp = ffi_setLogLevel(payloadJson);
+        break;
+    case EH_INVALIDATE_API_KEY:
+        resp = ffi_invalidateApiKey(payloadJson);
+        break;
     default:
         RetJsonObj retJsonObj;
         retJsonObj.setCode(retJsonObj.CODE_FAILED);
@@ -273,37 +553,941 @@ char *EHSM_FFI_CALL(const char *paramJson)
         resp = retJsonObj.toChar();
         break;
     }
+    metrics_request_end(request_start);
     return resp;
 }
 
+/* take the next packed ehsm_keyblob_t of a binary request, the provider api only reads it */
+static ehsm_keyblob_t *bin_pop_keyblob(const uint8_t **cur, const uint8_t *end)
+{
+    const ehsm_keyblob_t *keyblob = (const ehsm_keyblob_t *)*cur;
+
+    if ((size_t)(end - *cur) < sizeof(ehsm_keyblob_t) ||
+        (size_t)(end - *cur) - sizeof(ehsm_keyblob_t) < keyblob->keybloblen)
+        return NULL;
+
+    *cur += APPEND_SIZE_TO_KEYBLOB_T(keyblob->keybloblen);
+    return (ehsm_keyblob_t *)keyblob;
+}
+
+/* take the next packed ehsm_data_t of a binary request, the provider api only reads it */
+static ehsm_data_t *bin_pop_data(const uint8_t **cur, const uint8_t *end)
+{
+    const ehsm_data_t *data = (const ehsm_data_t *)*cur;
+
+    if ((size_t)(end - *cur) < sizeof(ehsm_data_t) ||
+        (size_t)(end - *cur) - sizeof(ehsm_data_t) < data->datalen)
+        return NULL;
+
+    *cur += APPEND_SIZE_TO_DATA_T(data->datalen);
+    return (ehsm_data_t *)data;
+}
+
+/*
+ * reserve an ehsm_data_t of datalen bytes at the end of a binary response, out_size
+ * keeps growing past the capacity so that the caller learns the size needed
+ */
+static ehsm_data_t *bin_push_data(uint8_t *out, size_t out_capacity, size_t *out_size, uint32_t datalen)
+{
+    size_t size = APPEND_SIZE_TO_DATA_T((size_t)datalen);
+    ehsm_data_t *data = NULL;
+
+    if (*out_size > out_capacity || out_capacity - *out_size < size)
+    {
+        *out_size += size;
+        return NULL;
+    }
+
+    data = (ehsm_data_t *)(out + *out_size);
+    data->datalen = datalen;
+    *out_size += size;
+    return data;
+}
+
+/* take the packed handle of a binary stream request, an ehsm_data_t of 8 bytes */
+static bool bin_pop_handle(const uint8_t **cur, const uint8_t *end, uint64_t *handle)
+{
+    ehsm_data_t *data = bin_pop_data(cur, end);
+
+    if (data == NULL || data->datalen != sizeof(uint64_t))
+        return false;
+
+    memcpy(handle, data->data, sizeof(uint64_t));
+    return *handle != 0;
+}
+
+/**
+ * @brief Serve the stream actions of the binary ffi, they are keyed by a handle
+ * rather than a cmk once the stream is open.
+ *
+ * @param request the request header and payload
+ * @param out the payload of the response
+ * @param out_capacity the capacity of out
+ * @param out_size bytes of out used, or needed when it returns EH_BUFFER_TOO_SMALL
+ * @return ehsm_status_t
+ */
+static ehsm_status_t ffi_bin_stream_process(const ehsm_ffi_bin_t *request,
+                                            uint8_t *out, size_t out_capacity,
+                                            size_t *out_size)
+{
+    ehsm_status_t ret = EH_ARGUMENTS_BAD;
+    const uint8_t *cur = request->payload;
+    const uint8_t *end = request->payload + request->size;
+    ehsm_keyblob_t *cmk = NULL;
+    ehsm_data_t *aad = NULL;
+    ehsm_data_t *in = NULL;
+    ehsm_data_t *header = NULL;
+    ehsm_data_t *handle_out = NULL;
+    ehsm_data_t *result = NULL;
+    uint32_t result_len = 0;
+    uint64_t handle = 0;
+
+    switch (request->action)
+    {
+    case EH_ENCRYPT_INIT:
+    case EH_DECRYPT_INIT:
+        cmk = bin_pop_keyblob(&cur, end);
+        aad = bin_pop_data(&cur, end);
+        if (request->action == EH_DECRYPT_INIT)
+            header = bin_pop_data(&cur, end);
+        if (cmk == NULL || aad == NULL || cur != end ||
+            (request->action == EH_DECRYPT_INIT && header == NULL))
+            return EH_ARGUMENTS_BAD;
+
+        handle_out = bin_push_data(out, out_capacity, out_size, sizeof(uint64_t));
+        if (request->action == EH_ENCRYPT_INIT)
+            header = bin_push_data(out, out_capacity, out_size, EH_STREAM_HEADER_SIZE);
+        if (handle_out == NULL || header == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        if (request->action == EH_ENCRYPT_INIT)
+            ret = EncryptInit(cmk, aad, header, &handle);
+        else
+            ret = DecryptInit(cmk, aad, header, &handle);
+        memcpy(handle_out->data, &handle, sizeof(uint64_t));
+        break;
+    case EH_ENCRYPT_UPDATE:
+    case EH_ENCRYPT_FINAL:
+    case EH_DECRYPT_UPDATE:
+    case EH_DECRYPT_FINAL:
+        if (!bin_pop_handle(&cur, end, &handle))
+            return EH_ARGUMENTS_BAD;
+        in = bin_pop_data(&cur, end);
+        if (in == NULL || cur != end || in->datalen == 0)
+            return EH_ARGUMENTS_BAD;
+
+        // the keyspec stays in the enclave, so size for the largest chunk overhead
+        if (request->action == EH_ENCRYPT_UPDATE || request->action == EH_ENCRYPT_FINAL)
+            result_len = ehsm_get_stream_chunk_size(EH_SM4_CBC, in->datalen);
+        else
+            result_len = in->datalen;
+
+        result = bin_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        switch (request->action)
+        {
+        case EH_ENCRYPT_UPDATE:
+            ret = EncryptUpdate(handle, in, result);
+            break;
+        case EH_ENCRYPT_FINAL:
+            ret = EncryptFinal(handle, in, result);
+            break;
+        case EH_DECRYPT_UPDATE:
+            ret = DecryptUpdate(handle, in, result);
+            break;
+        default:
+            ret = DecryptFinal(handle, in, result);
+            break;
+        }
+        if (ret == EH_OK)
+            *out_size = APPEND_SIZE_TO_DATA_T(result->datalen);
+        break;
+    case EH_STREAM_ABORT:
+        if (!bin_pop_handle(&cur, end, &handle) || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        ret = StreamAbort(handle);
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Serve one binary request straight from its packed inputs into the response
+ * buffer, see ehsm_ffi_bin_t for the layouts. The outputs are sized by the table in
+ * datatypes.h, nothing is allocated apart from the plaintext of a datakey which is
+ * not returned.
+ *
+ * @param request the request header and payload
+ * @param out the payload of the response
+ * @param out_capacity the capacity of out
+ * @param out_size bytes of out used, or needed when it returns EH_BUFFER_TOO_SMALL
+ * @return ehsm_status_t
+ */
+static ehsm_status_t ffi_bin_process(const ehsm_ffi_bin_t *request,
+                                     uint8_t *out, size_t out_capacity,
+                                     size_t *out_size)
+{
+    ehsm_status_t ret = EH_ARGUMENTS_BAD;
+    const uint8_t *cur = request->payload;
+    const uint8_t *end = request->payload + request->size;
+    ehsm_keyblob_t *cmk = NULL;
+    ehsm_keyblob_t *ukey = NULL;
+    ehsm_keyblob_t *key = NULL;
+    ehsm_data_t *aad = NULL;
+    ehsm_data_t *in = NULL;
+    ehsm_data_t *signature = NULL;
+    ehsm_data_t *plaintext = NULL;
+    ehsm_data_t *result = NULL;
+    uint32_t result_len = 0;
+    bool verified = false;
+
+    *out_size = 0;
+
+    if (request->action >= EH_ENCRYPT_INIT && request->action <= EH_STREAM_ABORT)
+        return ffi_bin_stream_process(request, out, out_capacity, out_size);
+
+    cmk = bin_pop_keyblob(&cur, end);
+    if (cmk == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    switch (request->action)
+    {
+    case EH_CREATE_KEY:
+        result_len = ehsm_get_keyblob_max_size(cmk->metadata.keyspec);
+        if (cur != end || cmk->keybloblen != 0 || result_len == 0)
+            return EH_ARGUMENTS_BAD;
+
+        // an ehsm_keyblob_t is reserved the same way, only its header is larger
+        *out_size = APPEND_SIZE_TO_KEYBLOB_T((size_t)result_len);
+        if (out_capacity < *out_size)
+            return EH_BUFFER_TOO_SMALL;
+
+        key = (ehsm_keyblob_t *)out;
+        memcpy(&key->metadata, &cmk->metadata, sizeof(ehsm_keymetadata_t));
+        key->keybloblen = result_len;
+
+        ret = CreateKey(key);
+        if (ret == EH_OK)
+            *out_size = APPEND_SIZE_TO_KEYBLOB_T(key->keybloblen);
+        break;
+    case EH_ENCRYPT:
+    case EH_DECRYPT:
+        aad = bin_pop_data(&cur, end);
+        in = bin_pop_data(&cur, end);
+        if (aad == NULL || in == NULL || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        if (request->action == EH_ENCRYPT)
+            result_len = ehsm_get_ciphertext_size(cmk->metadata.keyspec, in->datalen);
+        else
+            result_len = ehsm_get_plaintext_size(cmk->metadata.keyspec, in->datalen);
+        if (result_len == 0)
+            return EH_ARGUMENTS_BAD;
+
+        result = bin_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        if (request->action == EH_ENCRYPT)
+            ret = Encrypt(cmk, in, aad, result);
+        else
+            ret = Decrypt(cmk, in, aad, result);
+        break;
+    case EH_ASYMMETRIC_ENCRYPT:
+    case EH_ASYMMETRIC_DECRYPT:
+        in = bin_pop_data(&cur, end);
+        if (in == NULL || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        if (request->action == EH_ASYMMETRIC_ENCRYPT)
+            result_len = ehsm_get_asymmetric_ciphertext_max_size(cmk->metadata.keyspec, in->datalen);
+        else
+            result_len = ehsm_get_asymmetric_plaintext_max_size(cmk->metadata.keyspec, in->datalen);
+        if (result_len == 0)
+            return EH_ARGUMENTS_BAD;
+
+        result = bin_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        if (request->action == EH_ASYMMETRIC_ENCRYPT)
+            ret = AsymmetricEncrypt(cmk, in, result);
+        else
+            ret = AsymmetricDecrypt(cmk, in, result);
+        // the exact length may be shorter than the bound
+        if (ret == EH_OK)
+            *out_size = APPEND_SIZE_TO_DATA_T(result->datalen);
+        break;
+    case EH_SIGN:
+        in = bin_pop_data(&cur, end);
+        if (in == NULL || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        result_len = ehsm_get_signature_max_size(cmk->metadata.keyspec);
+        if (result_len == 0)
+            return EH_ARGUMENTS_BAD;
+
+        result = bin_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        ret = Sign(cmk, in, result);
+        // ecc and sm2 signatures may come out shorter than the longest one
+        if (ret == EH_OK)
+            *out_size = APPEND_SIZE_TO_DATA_T(result->datalen);
+        break;
+    case EH_VERIFY:
+        in = bin_pop_data(&cur, end);
+        signature = bin_pop_data(&cur, end);
+        if (in == NULL || signature == NULL || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        result = bin_push_data(out, out_capacity, out_size, 1);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        ret = Verify(cmk, in, signature, &verified);
+        result->data[0] = verified ? 1 : 0;
+        break;
+    case EH_GENERATE_MAC:
+        in = bin_pop_data(&cur, end);
+        if (in == NULL || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        result_len = ehsm_get_mac_size(cmk->metadata.digest_mode);
+        if (cmk->metadata.keyspec != EH_HMAC || result_len == 0)
+            return EH_ARGUMENTS_BAD;
+
+        result = bin_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        ret = GenerateMac(cmk, in, result);
+        break;
+    case EH_VERIFY_MAC:
+        in = bin_pop_data(&cur, end);
+        signature = bin_pop_data(&cur, end);
+        if (in == NULL || signature == NULL || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        result = bin_push_data(out, out_capacity, out_size, 1);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        ret = VerifyMac(cmk, in, signature, &verified);
+        result->data[0] = verified ? 1 : 0;
+        break;
+    case EH_GENERATE_DATAKEY:
+    case EH_GENERATE_DATAKEY_WITHOUT_PLAINTEXT:
+        aad = bin_pop_data(&cur, end);
+        if (aad == NULL || cur != end || request->param == 0)
+            return EH_ARGUMENTS_BAD;
+
+        result_len = ehsm_get_ciphertext_size(cmk->metadata.keyspec, request->param);
+        if (result_len == 0)
+            return EH_ARGUMENTS_BAD;
+
+        if (request->action == EH_GENERATE_DATAKEY)
+            plaintext = bin_push_data(out, out_capacity, out_size, request->param);
+        result = bin_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL || (request->action == EH_GENERATE_DATAKEY && plaintext == NULL))
+            return EH_BUFFER_TOO_SMALL;
+
+        if (request->action == EH_GENERATE_DATAKEY)
+        {
+            ret = GenerateDataKey(cmk, aad, plaintext, result);
+            break;
+        }
+
+        plaintext = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T((size_t)request->param));
+        if (plaintext == NULL)
+            return EH_DEVICE_MEMORY;
+        plaintext->datalen = request->param;
+
+        ret = GenerateDataKeyWithoutPlaintext(cmk, aad, plaintext, result);
+
+        memset(plaintext->data, 0, request->param);
+        SAFE_FREE(plaintext);
+        break;
+    case EH_EXPORT_DATAKEY:
+        ukey = bin_pop_keyblob(&cur, end);
+        aad = bin_pop_data(&cur, end);
+        in = bin_pop_data(&cur, end);
+        if (ukey == NULL || aad == NULL || in == NULL || cur != end)
+            return EH_ARGUMENTS_BAD;
+
+        result_len = ehsm_get_asymmetric_ciphertext_max_size(ukey->metadata.keyspec,
+                                                             ehsm_get_plaintext_size(cmk->metadata.keyspec, in->datalen));
+        if (result_len == 0)
+            return EH_ARGUMENTS_BAD;
+
+        result = bin_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return EH_BUFFER_TOO_SMALL;
+
+        ret = ExportDataKey(cmk, ukey, aad, in, result);
+        if (ret == EH_OK)
+            *out_size = APPEND_SIZE_TO_DATA_T(result->datalen);
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+/* the stream chunks are far larger than the other binary requests */
+static size_t ffi_bin_max_size(uint32_t action)
+{
+    if (action >= EH_ENCRYPT_INIT && action <= EH_STREAM_ABORT)
+        return sizeof(ehsm_ffi_bin_t) + 2 * sizeof(ehsm_data_t) + sizeof(uint64_t) +
+               ehsm_get_stream_chunk_size(EH_SM4_CBC, EH_STREAM_CHUNK_MAX_SIZE);
+
+    return EH_PAYLOAD_MAX_SIZE;
+}
+
+int32_t EHSM_FFI_CALL_BIN(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len)
+{
+    const ehsm_ffi_bin_t *request = (const ehsm_ffi_bin_t *)req;
+    ehsm_ffi_bin_t *response = (ehsm_ffi_bin_t *)resp;
+    size_t out_capacity = 0;
+    size_t out_size = 0;
+    ehsm_status_t ret = EH_OK;
+    uint64_t request_start = metrics_now();
+    admission_deadline_t deadline(admission_deadline());
+
+    if (req == NULL ||
+        req_len < sizeof(ehsm_ffi_bin_t) ||
+        req_len > ffi_bin_max_size(request->action) ||
+        request->magic != EH_FFI_BIN_MAGIC ||
+        request->version != EH_FFI_BIN_VERSION ||
+        request->size != req_len - sizeof(ehsm_ffi_bin_t))
+        return EH_ARGUMENTS_BAD;
+
+    if (resp == NULL || resp_len == NULL || *resp_len < sizeof(ehsm_ffi_bin_t))
+        return EH_ARGUMENTS_BAD;
+
+    out_capacity = *resp_len - sizeof(ehsm_ffi_bin_t);
+    metrics_request_begin(EH_METRICS_API_BIN, request->action);
+    ret = ffi_bin_process(request, response->payload, out_capacity, &out_size);
+    metrics_request_end(request_start);
+    if (ret == EH_BUFFER_TOO_SMALL)
+    {
+        *resp_len = sizeof(ehsm_ffi_bin_t) + out_size;
+        out_size = 0;
+    }
+    else
+    {
+        if (ret != EH_OK)
+        {
+            // never hand out partial results, e.g. the plaintext of a datakey
+            memset(response->payload, 0, out_size < out_capacity ? out_size : out_capacity);
+            out_size = 0;
+        }
+        *resp_len = sizeof(ehsm_ffi_bin_t) + out_size;
+    }
+
+    response->magic = EH_FFI_BIN_MAGIC;
+    response->version = EH_FFI_BIN_VERSION;
+    response->action = request->action;
+    response->param = request->param;
+    response->status = ret;
+    response->size = out_size;
+
+    return ret;
+}
+
+/* read an unsigned integer setting from the environment, or its default when unset */
+static uint32_t get_config_uint32(const char *name, uint32_t default_value)
+{
+    const char *value = getenv(name);
+    char *end = NULL;
+    unsigned long number = 0;
+
+    if (value == NULL || *value == '\0')
+        return default_value;
+
+    number = strtoul(value, &end, 0);
+    if (*end != '\0' || number > UINT32_MAX)
+    {
+        log_w("ignore invalid %s=%s", name, value);
+        return default_value;
+    }
+    return (uint32_t)number;
+}
+
+/*
+ * Worker pool of EHSM_FFI_CALL_ASYNC. The default worker count matches the
+ * TCSNum of enclave_hsm.config.xml minus the TCS of the key pool refill
+ * thread, per enclave instance, more workers would only wait for a free TCS.
+ * Both settings can be overridden by EHSM_CONFIG_ASYNC_WORKERS and
+ * EHSM_CONFIG_ASYNC_QUEUE_SIZE.
+ */
+#define EH_ASYNC_DEFAULT_WORKERS    (EH_ENCLAVE_TCS_NUM - 1)
+#define EH_ASYNC_DEFAULT_QUEUE_SIZE 256
+
+typedef struct {
+    std::string                     paramJson;
+    ehsm_ffi_callback_t             callback;
+    void                            *ctx;
+    admission_clock_t::time_point   deadline;
+} ffi_async_job_t;
+
+static std::mutex g_async_lock;
+static std::condition_variable g_async_cond;
+static std::deque<ffi_async_job_t> g_async_queue;
+static std::vector<std::thread> g_async_workers;
+static std::vector<char> g_async_calling; /* per worker, set while it runs a callback */
+static uint32_t g_async_queue_size = 0;
+static uint64_t g_async_generation = 0;
+static bool g_async_stopping = false;
+
+/*
+ * The callbacks may only be able to run on the thread which calls EH_FINALIZE,
+ * e.g. the JS main thread with ffi-napi. So once stopping, a worker never calls
+ * back: the queued jobs are dropped and a finished job drops its response.
+ */
+static void ffi_async_worker(uint32_t index, uint64_t generation)
+{
+    ffi_async_job_t job;
+    char *resp = NULL;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(g_async_lock);
+            g_async_cond.wait(lock, [] { return g_async_stopping || !g_async_queue.empty(); });
+            if (g_async_stopping)
+                return;
+            job = std::move(g_async_queue.front());
+            g_async_queue.pop_front();
+        }
+
+        // a job which waited past its deadline in the queue is shed without parsing it
+        if (admission_clock_t::now() >= job.deadline)
+        {
+            RetJsonObj retJsonObj;
+            retJsonObj.setCode(retJsonObj.CODE_BUSY);
+            retJsonObj.setMessage("Server busy.");
+            resp = retJsonObj.toChar();
+        }
+        else
+        {
+            admission_deadline_t deadline(job.deadline);
+            resp = ffi_call(job.paramJson.c_str(), true);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(g_async_lock);
+            if (g_async_stopping)
+            {
+                SAFE_FREE(resp);
+                return;
+            }
+            g_async_calling[index] = 1;
+        }
+        job.callback(resp, job.ctx);
+        SAFE_FREE(resp);
+
+        std::lock_guard<std::mutex> lock(g_async_lock);
+        // detached by ffi_async_stop while in the callback, the slot may be reused
+        if (generation != g_async_generation)
+            return;
+        g_async_calling[index] = 0;
+    }
+}
+
+/* start the workers on the first async call, g_async_lock must be held */
+static void ffi_async_start()
+{
+    uint32_t workers = get_config_uint32("EHSM_CONFIG_ASYNC_WORKERS",
+                                         EH_ASYNC_DEFAULT_WORKERS * std::max(g_enclave_num, 1u));
+
+    g_async_queue_size = get_config_uint32("EHSM_CONFIG_ASYNC_QUEUE_SIZE", EH_ASYNC_DEFAULT_QUEUE_SIZE);
+    if (workers == 0)
+        workers = 1;
+
+    g_async_calling.assign(workers, 0);
+    for (uint32_t i = 0; i < workers; i++)
+        g_async_workers.push_back(std::thread(ffi_async_worker, i, g_async_generation));
+
+    log_i("async ffi calls enabled, workers=%u, queue_size=%u", workers, g_async_queue_size);
+}
+
+/*
+ * Drop the queued jobs and join the workers, called before the enclave is
+ * destroyed. A worker blocked in a callback has already left the enclave, it is
+ * detached as joining it could wait on the calling thread itself.
+ */
+static void ffi_async_stop()
+{
+    std::vector<std::thread> workers;
+    std::vector<char> calling;
+    std::deque<ffi_async_job_t> dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(g_async_lock);
+        g_async_stopping = true;
+        g_async_generation++;
+        workers.swap(g_async_workers);
+        calling.swap(g_async_calling);
+        dropped.swap(g_async_queue);
+    }
+    g_async_cond.notify_all();
+
+    if (!dropped.empty())
+        log_w("async ffi stopped, %zu queued call(s) dropped", dropped.size());
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        if (calling[i])
+            workers[i].detach();
+        else
+            workers[i].join();
+    }
+
+    std::lock_guard<std::mutex> lock(g_async_lock);
+    g_async_stopping = false;
+}
+
+/*
+ * Background refill of the in-enclave key pool. The thread sleeps while every
+ * pool is full, it is woken up by CreateKey and checks again periodically.
+ * The watermarks of each keyspec can be overridden with
+ * EHSM_CONFIG_KEY_POOL_<KEYSPEC>_LOW and EHSM_CONFIG_KEY_POOL_<KEYSPEC>_HIGH,
+ * e.g. EHSM_CONFIG_KEY_POOL_RSA_4096_HIGH=0 disables the RSA-4096 pool.
+ */
+#define EH_KEY_POOL_REFILL_INTERVAL 1 /* seconds */
+
+static const struct
+{
+    ehsm_keyspec_t keyspec;
+    const char *name;
+} g_key_pool_keyspecs[] = {
+    {EH_RSA_2048, "RSA_2048"},
+    {EH_RSA_3072, "RSA_3072"},
+    {EH_RSA_4096, "RSA_4096"},
+    {EH_EC_P224, "EC_P224"},
+    {EH_EC_P256, "EC_P256"},
+    {EH_EC_P384, "EC_P384"},
+    {EH_EC_P521, "EC_P521"},
+    {EH_SM2, "SM2"},
+};
+
+static std::mutex g_key_pool_lock;
+static std::condition_variable g_key_pool_cond;
+static std::thread g_key_pool_thread;
+static bool g_key_pool_stopping = false;
+static bool g_key_pool_wakeup = false;
+
+static void key_pool_wakeup()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_key_pool_lock);
+        g_key_pool_wakeup = true;
+    }
+    g_key_pool_cond.notify_one();
+}
+
+static void key_pool_refill_worker()
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint32_t pending = 0;
+    uint32_t instance_pending = 0;
+    std::unique_lock<std::mutex> lock(g_key_pool_lock);
+
+    while (!g_key_pool_stopping)
+    {
+        g_key_pool_wakeup = false;
+        lock.unlock();
+
+        // one key pair per ecall and instance, so that a TCS is not held for a whole refill
+        pending = 0;
+        for (uint32_t i = 0; i < g_enclave_num; i++)
+        {
+            ret = enclave_key_pool_refill(g_enclaves[i].eid, &sgxStatus, &instance_pending);
+            if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+            {
+                log_w("key pool refill of enclave %u failed(%d, %d)", i, ret, sgxStatus);
+                continue;
+            }
+            pending += instance_pending;
+        }
+
+        lock.lock();
+        if (pending == 0)
+            g_key_pool_cond.wait_for(lock, std::chrono::seconds(EH_KEY_POOL_REFILL_INTERVAL),
+                                     [] { return g_key_pool_stopping || g_key_pool_wakeup; });
+    }
+}
+
+static void key_pool_start()
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    ehsm_key_pool_stats_t stats;
+    uint32_t low_watermark = 0;
+    uint32_t high_watermark = 0;
+    char name[64];
+
+    for (size_t i = 0; i < sizeof(g_key_pool_keyspecs) / sizeof(g_key_pool_keyspecs[0]); i++)
+    {
+        ret = enclave_get_key_pool_stats(primary_enclave_id(), &sgxStatus, g_key_pool_keyspecs[i].keyspec, &stats);
+        if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+            continue;
+
+        snprintf(name, sizeof(name), "EHSM_CONFIG_KEY_POOL_%s_LOW", g_key_pool_keyspecs[i].name);
+        low_watermark = get_config_uint32(name, stats.low_watermark);
+        snprintf(name, sizeof(name), "EHSM_CONFIG_KEY_POOL_%s_HIGH", g_key_pool_keyspecs[i].name);
+        high_watermark = get_config_uint32(name, stats.high_watermark);
+        if (low_watermark > high_watermark)
+            low_watermark = high_watermark;
+
+        if (low_watermark == stats.low_watermark && high_watermark == stats.high_watermark)
+            continue;
+
+        for (uint32_t j = 0; j < g_enclave_num; j++)
+        {
+            ret = enclave_key_pool_set_watermarks(g_enclaves[j].eid, &sgxStatus, g_key_pool_keyspecs[i].keyspec,
+                                                  low_watermark, high_watermark);
+            if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+            {
+                log_w("ignore invalid key pool watermarks %u/%u of %s",
+                      low_watermark, high_watermark, g_key_pool_keyspecs[i].name);
+                break;
+            }
+        }
+    }
+
+    g_key_pool_stopping = false;
+    g_key_pool_thread = std::thread(key_pool_refill_worker);
+}
+
+/* the refill thread must be joined before the enclave is destroyed */
+static void key_pool_stop()
+{
+    if (!g_key_pool_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(g_key_pool_lock);
+        g_key_pool_stopping = true;
+    }
+    g_key_pool_cond.notify_one();
+
+    g_key_pool_thread.join();
+}
+
+int32_t EHSM_FFI_CALL_ASYNC(const char *paramJson, ehsm_ffi_callback_t callback, void *ctx)
+{
+    ffi_async_job_t job;
+
+    if (callback == NULL || !validate_params(paramJson, EH_BATCH_PAYLOAD_MAX_SIZE))
+        return EH_ARGUMENTS_BAD;
+
+    job.paramJson = paramJson;
+    job.callback = callback;
+    job.ctx = ctx;
+    job.deadline = admission_deadline();
+
+    {
+        std::lock_guard<std::mutex> lock(g_async_lock);
+        if (g_async_stopping)
+            return EH_BUSY;
+        if (g_async_workers.empty())
+            ffi_async_start();
+        if (g_async_queue.size() >= g_async_queue_size)
+            return EH_BUSY;
+        g_async_queue.push_back(std::move(job));
+    }
+    g_async_cond.notify_one();
+
+    return EH_OK;
+}
+
+/*
+ * The in-enclave performance counters are timed by rdtsc, which an enclave may only run
+ * from SGX2 on, CPUID.(EAX=12H,ECX=0):EAX[1]. EHSM_CONFIG_ENCLAVE_STATS set to 0 keeps
+ * them off, set to 2 it turns them on regardless, e.g. for the simulation mode.
+ */
+static void enclave_stats_start(sgx_enclave_id_t eid)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    uint32_t mode = get_config_uint32("EHSM_CONFIG_ENCLAVE_STATS", 1);
+    bool enabled = false;
+
+    if (mode == 2)
+        enabled = true;
+    else if (mode == 1)
+        enabled = __get_cpuid_count(0x12, 0, &eax, &ebx, &ecx, &edx) && (eax & 0x2);
+
+    ret = enclave_set_stats_enabled(eid, &sgxStatus, enabled);
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+    {
+        log_w("failed(%d, %d) to set the enclave stats", ret, sgxStatus);
+        return;
+    }
+    log_i("enclave stats %s", enabled ? "enabled" : "disabled");
+}
+
+/*
+ * Create the enclave, with switchless calls when EHSM_CONFIG_SWITCHLESS=true.
+ * The hot crypto ecalls and ocall_print_string are declared with
+ * transition_using_threads, they fall back to regular ecalls/ocalls when the
+ * switchless mode is off or when no worker picks a call up in time.
+ * The number of trusted workers is returned in tworkers, it is capped so that the
+ * regular ecalls and the key pool refill keep at least as many TCSs as the workers.
+ */
+#define EH_SWITCHLESS_MAX_TWORKERS ((EH_ENCLAVE_TCS_NUM - 1) / 2)
+
+static sgx_status_t create_enclave(sgx_enclave_id_t *eid, uint32_t *tworkers)
+{
+    const char *switchless = getenv("EHSM_CONFIG_SWITCHLESS");
+    sgx_uswitchless_config_t us_config = SGX_USWITCHLESS_CONFIG_INITIALIZER;
+    const void *enclave_ex_p[32] = {0};
+
+    *tworkers = 0;
+    if (switchless == NULL || strcmp(switchless, "true") != 0)
+        return sgx_create_enclave(_T(ENCLAVE_PATH),
+                                  SGX_DEBUG_FLAG,
+                                  NULL,
+                                  NULL,
+                                  eid, NULL);
+
+    // every trusted worker occupies a TCS of the enclave for its whole lifetime
+    us_config.num_tworkers = get_config_uint32("EHSM_CONFIG_SWITCHLESS_TWORKERS", 2);
+    us_config.num_uworkers = get_config_uint32("EHSM_CONFIG_SWITCHLESS_UWORKERS", 1);
+    if (us_config.num_tworkers > EH_SWITCHLESS_MAX_TWORKERS)
+    {
+        log_w("EHSM_CONFIG_SWITCHLESS_TWORKERS=%u would leave too few TCSs for the ecalls, using %u",
+              us_config.num_tworkers, EH_SWITCHLESS_MAX_TWORKERS);
+        us_config.num_tworkers = EH_SWITCHLESS_MAX_TWORKERS;
+    }
+    us_config.retries_before_fallback = get_config_uint32("EHSM_CONFIG_SWITCHLESS_RETRIES_BEFORE_FALLBACK",
+                                                          us_config.retries_before_fallback);
+    us_config.retries_before_sleep = get_config_uint32("EHSM_CONFIG_SWITCHLESS_RETRIES_BEFORE_SLEEP",
+                                                       us_config.retries_before_sleep);
+    enclave_ex_p[SGX_CREATE_ENCLAVE_EX_SWITCHLESS_BIT_IDX] = &us_config;
+    *tworkers = us_config.num_tworkers;
+
+    log_i("switchless calls enabled, tworkers=%u, uworkers=%u, retries_before_fallback=%u, retries_before_sleep=%u",
+          us_config.num_tworkers, us_config.num_uworkers,
+          us_config.retries_before_fallback, us_config.retries_before_sleep);
+
+    return sgx_create_enclave_ex(_T(ENCLAVE_PATH),
+                                 SGX_DEBUG_FLAG,
+                                 NULL,
+                                 NULL,
+                                 eid, NULL,
+                                 SGX_CREATE_ENCLAVE_EX_SWITCHLESS,
+                                 enclave_ex_p);
+}
+
+/* size the admission control of the data plane ecalls, see enclave_acquire */
+static void admission_start(uint32_t tworkers)
+{
+    uint32_t reserved = 1 + tworkers;
+
+    g_enclave_slots = get_config_uint32("EHSM_CONFIG_ENCLAVE_TCS_SLOTS",
+                                        EH_ENCLAVE_TCS_NUM > reserved ? EH_ENCLAVE_TCS_NUM - reserved : 1);
+    if (g_enclave_slots == 0)
+    {
+        log_w("ignore invalid EHSM_CONFIG_ENCLAVE_TCS_SLOTS=0");
+        g_enclave_slots = 1;
+    }
+    g_admission_queue_size = get_config_uint32("EHSM_CONFIG_ADMISSION_QUEUE_SIZE", EH_ADMISSION_DEFAULT_QUEUE_SIZE);
+    g_admission_timeout_ms = get_config_uint32("EHSM_CONFIG_ADMISSION_TIMEOUT_MS", EH_ADMISSION_DEFAULT_TIMEOUT_MS);
+
+    log_i("admission control, tcs_slots=%u per instance, queue_size=%u, timeout=%ums",
+          g_enclave_slots, g_admission_queue_size, g_admission_timeout_ms);
+}
+
+/* destroy the instances created so far, every worker using them must be stopped */
+static sgx_status_t destroy_enclaves()
+{
+    sgx_status_t ret = SGX_SUCCESS;
+
+    for (uint32_t i = 0; i < g_enclave_num; i++)
+    {
+        if (sgx_destroy_enclave(g_enclaves[i].eid) != SGX_SUCCESS)
+            ret = SGX_ERROR_UNEXPECTED;
+    }
+    g_enclave_num = 0;
+
+    return ret;
+}
+
 ehsm_status_t Initialize()
 {
     ehsm_status_t rc = EH_OK;
     sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint32_t instances = get_config_uint32("EHSM_CONFIG_ENCLAVE_INSTANCES", 1);
+    uint32_t tworkers = 0;
 
-    ret = sgx_create_enclave(_T(ENCLAVE_PATH),
-                             SGX_DEBUG_FLAG,
-                             NULL,
-                             NULL,
-                             &g_enclave_id, NULL);
-    if (ret != SGX_SUCCESS)
+    if (instances == 0 || instances > EH_ENCLAVE_MAX_INSTANCES)
     {
-        printf("failed(%d) to create enclave.\n", ret);
-        return EH_DEVICE_ERROR;
+        log_w("ignore invalid EHSM_CONFIG_ENCLAVE_INSTANCES=%u", instances);
+        instances = 1;
     }
 
-    rc = SetupSecureChannel(g_enclave_id);
-    if (rc != EH_OK)
+    for (g_enclave_num = 0; g_enclave_num < instances; g_enclave_num++)
     {
+        ehsm_enclave_instance_t *instance = &g_enclaves[g_enclave_num];
+
+        ret = create_enclave(&instance->eid, &tworkers);
+        if (ret != SGX_SUCCESS)
+        {
+            printf("failed(%d) to create enclave.\n", ret);
+            rc = EH_DEVICE_ERROR;
+            break;
+        }
+        instance->inflight = 0;
+
+        ret = enclave_set_instance(instance->eid, &sgxStatus, g_enclave_num);
+        if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        {
+            printf("failed(%d, %d) to set the enclave instance.\n", ret, sgxStatus);
+            sgx_destroy_enclave(instance->eid);
+            rc = EH_DEVICE_ERROR;
+            break;
+        }
+        enclave_stats_start(instance->eid);
+
+        // each instance gets the domain key over a secure channel of its own
+        rc = SetupSecureChannel(instance->eid);
+        if (rc != EH_OK)
+        {
 #if EHSM_DEFAULT_DOMAIN_KEY_FALLBACK
-        printf("failed(%d) to setup secure channel, but continue to use the default domainkey...\n", rc);
-        return EH_OK;
+            printf("failed(%d) to setup secure channel, but continue to use the default domainkey...\n", rc);
+            rc = EH_OK;
+            continue;
 #endif
-        printf("failed(%d) to setup secure channel\n", rc);
-        sgx_destroy_enclave(g_enclave_id);
+            printf("failed(%d) to setup secure channel\n", rc);
+            sgx_destroy_enclave(instance->eid);
+            break;
+        }
+    }
+
+    if (rc != EH_OK)
+    {
+        destroy_enclaves();
+        return rc;
     }
 
+    admission_start(tworkers);
+    key_pool_start();
+    log_i("%u enclave instance(s) created", g_enclave_num);
+
     return rc;
 }
 
@@ -311,7 +1495,10 @@ ehsm_status_t Finalize()
 {
     sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
 
-    sgxStatus = sgx_destroy_enclave(g_enclave_id);
+    ffi_async_stop();
+    key_pool_stop();
+
+    sgxStatus = destroy_enclaves();
 
     if (sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -324,10 +1511,158 @@ ehsm_status_t CreateKey(ehsm_keyblob_t *cmk)
     sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
 
-    if (cmk == NULL)
+    if (cmk == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_create_key(enclave.eid(), &sgxStatus, cmk, APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+
+    // a key pair may have been taken from the key pool
+    key_pool_wakeup();
+
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    else
+        return EH_OK;
+}
+
+ehsm_status_t UpgradeKeyBlob(ehsm_keyblob_t *cmk)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (!validate_params(cmk, EH_CMK_MAX_SIZE))
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_upgrade_keyblob(enclave.eid(), &sgxStatus, cmk, APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    else
+        return EH_OK;
+}
+
+ehsm_status_t Encrypt(ehsm_keyblob_t *cmk,
+                      ehsm_data_t *plaintext,
+                      ehsm_data_t *aad,
+                      ehsm_data_t *ciphertext)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    /* only support to directly encrypt data of less than 6 KB */
+    if (!validate_params(cmk, EH_CMK_MAX_SIZE) ||
+        !validate_params(plaintext, EH_PLAINTEXT_MAX_SIZE) ||
+        !validate_params(aad, EH_AAD_MAX_SIZE, false))
+        return EH_ARGUMENTS_BAD;
+
+    if (ciphertext == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_encrypt(enclave.eid(),
+                          &sgxStatus,
+                          cmk,
+                          APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
+                          aad,
+                          APPEND_SIZE_TO_DATA_T(aad->datalen),
+                          plaintext,
+                          APPEND_SIZE_TO_DATA_T(plaintext->datalen),
+                          ciphertext,
+                          APPEND_SIZE_TO_DATA_T(ciphertext->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    else
+        return EH_OK;
+}
+
+ehsm_status_t Decrypt(ehsm_keyblob_t *cmk,
+                      ehsm_data_t *ciphertext,
+                      ehsm_data_t *aad,
+                      ehsm_data_t *plaintext)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (!validate_params(cmk, EH_CMK_MAX_SIZE) ||
+        !validate_params(aad, EH_AAD_MAX_SIZE, false) ||
+        !validate_params(ciphertext, EH_PLAINTEXT_MAX_SIZE + EH_AAD_MAX_SIZE))
+        return EH_ARGUMENTS_BAD;
+        
+    if (plaintext == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_decrypt(enclave.eid(),
+                          &sgxStatus,
+                          cmk,
+                          APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
+                          aad,
+                          APPEND_SIZE_TO_DATA_T(aad->datalen),
+                          ciphertext,
+                          APPEND_SIZE_TO_DATA_T(ciphertext->datalen),
+                          plaintext,
+                          APPEND_SIZE_TO_DATA_T(plaintext->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    else
+        return EH_OK;
+}
+
+static ehsm_status_t stream_init(uint32_t encrypt,
+                                 ehsm_keyblob_t *cmk,
+                                 ehsm_data_t *aad,
+                                 ehsm_data_t *header,
+                                 uint64_t *handle)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (!validate_params(cmk, EH_CMK_MAX_SIZE) ||
+        !validate_params(aad, EH_AAD_MAX_SIZE, false))
+        return EH_ARGUMENTS_BAD;
+
+    if (aad == NULL || header == NULL || handle == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    if (encrypt ? header->datalen < EH_STREAM_HEADER_SIZE : header->datalen != EH_STREAM_HEADER_SIZE)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_create_key(g_enclave_id, &sgxStatus, cmk, APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen));
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_stream_init(enclave.eid(),
+                              &sgxStatus,
+                              encrypt,
+                              cmk,
+                              APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
+                              aad,
+                              APPEND_SIZE_TO_DATA_T(aad->datalen),
+                              header,
+                              APPEND_SIZE_TO_DATA_T(header->datalen),
+                              handle,
+                              (uint64_t)time(NULL));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
 
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -335,33 +1670,45 @@ ehsm_status_t CreateKey(ehsm_keyblob_t *cmk)
         return EH_OK;
 }
 
-ehsm_status_t Encrypt(ehsm_keyblob_t *cmk,
-                      ehsm_data_t *plaintext,
-                      ehsm_data_t *aad,
-                      ehsm_data_t *ciphertext)
+static ehsm_status_t stream_update(uint64_t handle,
+                                   bool last,
+                                   ehsm_data_t *in,
+                                   ehsm_data_t *out)
 {
     sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    ehsm_enclave_instance_t *instance = stream_instance(handle);
 
-    /* only support to directly encrypt data of less than 6 KB */
-    if (!validate_params(cmk, EH_CMK_MAX_SIZE) ||
-        !validate_params(plaintext, EH_PLAINTEXT_MAX_SIZE) ||
-        !validate_params(aad, EH_AAD_MAX_SIZE, false))
+    // a sealed chunk is at most an iv, a mac and a padding block larger than its plaintext
+    if (!validate_params(in, EH_STREAM_CHUNK_MAX_SIZE + 64))
         return EH_ARGUMENTS_BAD;
 
-    if (ciphertext == NULL)
+    if (handle == 0 || out == NULL || instance == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_encrypt(g_enclave_id,
-                          &sgxStatus,
-                          cmk,
-                          APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
-                          aad,
-                          APPEND_SIZE_TO_DATA_T(aad->datalen),
-                          plaintext,
-                          APPEND_SIZE_TO_DATA_T(plaintext->datalen),
-                          ciphertext,
-                          APPEND_SIZE_TO_DATA_T(ciphertext->datalen));
+    enclave_ref_t enclave(instance);
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    if (last)
+        ret = enclave_stream_final(enclave.eid(),
+                                   &sgxStatus,
+                                   handle,
+                                   in,
+                                   APPEND_SIZE_TO_DATA_T(in->datalen),
+                                   out,
+                                   APPEND_SIZE_TO_DATA_T(out->datalen),
+                                   (uint64_t)time(NULL));
+    else
+        ret = enclave_stream_update(enclave.eid(),
+                                    &sgxStatus,
+                                    handle,
+                                    in,
+                                    APPEND_SIZE_TO_DATA_T(in->datalen),
+                                    out,
+                                    APPEND_SIZE_TO_DATA_T(out->datalen),
+                                    (uint64_t)time(NULL));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
 
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -369,32 +1716,65 @@ ehsm_status_t Encrypt(ehsm_keyblob_t *cmk,
         return EH_OK;
 }
 
-ehsm_status_t Decrypt(ehsm_keyblob_t *cmk,
-                      ehsm_data_t *ciphertext,
-                      ehsm_data_t *aad,
-                      ehsm_data_t *plaintext)
+ehsm_status_t EncryptInit(ehsm_keyblob_t *cmk,
+                          ehsm_data_t *aad,
+                          ehsm_data_t *header,
+                          uint64_t *handle)
+{
+    return stream_init(1, cmk, aad, header, handle);
+}
+
+ehsm_status_t EncryptUpdate(uint64_t handle,
+                            ehsm_data_t *plaintext,
+                            ehsm_data_t *ciphertext)
+{
+    return stream_update(handle, false, plaintext, ciphertext);
+}
+
+ehsm_status_t EncryptFinal(uint64_t handle,
+                           ehsm_data_t *plaintext,
+                           ehsm_data_t *ciphertext)
+{
+    return stream_update(handle, true, plaintext, ciphertext);
+}
+
+ehsm_status_t DecryptInit(ehsm_keyblob_t *cmk,
+                          ehsm_data_t *aad,
+                          ehsm_data_t *header,
+                          uint64_t *handle)
+{
+    return stream_init(0, cmk, aad, header, handle);
+}
+
+ehsm_status_t DecryptUpdate(uint64_t handle,
+                            ehsm_data_t *ciphertext,
+                            ehsm_data_t *plaintext)
+{
+    return stream_update(handle, false, ciphertext, plaintext);
+}
+
+ehsm_status_t DecryptFinal(uint64_t handle,
+                           ehsm_data_t *ciphertext,
+                           ehsm_data_t *plaintext)
+{
+    return stream_update(handle, true, ciphertext, plaintext);
+}
+
+ehsm_status_t StreamAbort(uint64_t handle)
 {
     sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    ehsm_enclave_instance_t *instance = stream_instance(handle);
 
-    if (!validate_params(cmk, EH_CMK_MAX_SIZE) ||
-        !validate_params(aad, EH_AAD_MAX_SIZE, false) ||
-        !validate_params(ciphertext, EH_PLAINTEXT_MAX_SIZE + EH_AAD_MAX_SIZE))
-        return EH_ARGUMENTS_BAD;
-        
-    if (plaintext == NULL)
+    if (handle == 0 || instance == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_decrypt(g_enclave_id,
-                          &sgxStatus,
-                          cmk,
-                          APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
-                          aad,
-                          APPEND_SIZE_TO_DATA_T(aad->datalen),
-                          ciphertext,
-                          APPEND_SIZE_TO_DATA_T(ciphertext->datalen),
-                          plaintext,
-                          APPEND_SIZE_TO_DATA_T(plaintext->datalen));
+    enclave_ref_t enclave(instance);
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_stream_abort(enclave.eid(), &sgxStatus, handle);
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
 
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -416,7 +1796,11 @@ ehsm_status_t AsymmetricEncrypt(ehsm_keyblob_t *cmk,
     if (ciphertext == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_asymmetric_encrypt(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_asymmetric_encrypt(enclave.eid(),
                                      &sgxStatus,
                                      cmk,
                                      APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
@@ -424,6 +1808,7 @@ ehsm_status_t AsymmetricEncrypt(ehsm_keyblob_t *cmk,
                                      APPEND_SIZE_TO_DATA_T(plaintext->datalen),
                                      ciphertext,
                                      APPEND_SIZE_TO_DATA_T(ciphertext->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
 
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -445,7 +1830,11 @@ ehsm_status_t AsymmetricDecrypt(ehsm_keyblob_t *cmk,
     if (plaintext == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_asymmetric_decrypt(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_asymmetric_decrypt(enclave.eid(),
                                      &sgxStatus,
                                      cmk,
                                      APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
@@ -453,6 +1842,7 @@ ehsm_status_t AsymmetricDecrypt(ehsm_keyblob_t *cmk,
                                      APPEND_SIZE_TO_DATA_T(ciphertext->datalen),
                                      plaintext,
                                      APPEND_SIZE_TO_DATA_T(plaintext->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
 
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -482,7 +1872,11 @@ ehsm_status_t Sign(ehsm_keyblob_t *cmk,
     if (signature == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_sign(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_sign(enclave.eid(),
                        &sgxStatus,
                        cmk,
                        APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
@@ -490,6 +1884,7 @@ ehsm_status_t Sign(ehsm_keyblob_t *cmk,
                        APPEND_SIZE_TO_DATA_T(digest->datalen),
                        signature,
                        APPEND_SIZE_TO_DATA_T(signature->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
 
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -519,7 +1914,11 @@ ehsm_status_t Verify(ehsm_keyblob_t *cmk,
         !validate_params(signature, MAX_SIGNATURE_SIZE))
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_verify(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_verify(enclave.eid(),
                          &sgxStatus,
                          cmk,
                          APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
@@ -528,6 +1927,94 @@ ehsm_status_t Verify(ehsm_keyblob_t *cmk,
                          signature,
                          APPEND_SIZE_TO_DATA_T(signature->datalen),
                          result);
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    else
+        return EH_OK;
+}
+
+/**
+ * @brief compute the mac of a message with an EH_HMAC cmk
+ *
+ * @param cmk storage the key metadata and keyblob
+ * @param message message to be authenticated
+ * @param mac generated mac, ehsm_get_mac_size() of the digest mode of the cmk
+ * @return ehsm_status_t
+ */
+ehsm_status_t GenerateMac(ehsm_keyblob_t *cmk,
+                          ehsm_data_t *message,
+                          ehsm_data_t *mac)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (!validate_params(cmk, EH_CMK_MAX_SIZE) ||
+        !validate_params(message, EH_MAC_MESSAGE_MAX_SIZE))
+        return EH_ARGUMENTS_BAD;
+
+    if (mac == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_generate_mac(enclave.eid(),
+                               &sgxStatus,
+                               cmk,
+                               APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
+                               message,
+                               APPEND_SIZE_TO_DATA_T(message->datalen),
+                               mac,
+                               APPEND_SIZE_TO_DATA_T(mac->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    else
+        return EH_OK;
+}
+
+/**
+ * @brief check the mac of a message with an EH_HMAC cmk
+ *
+ * @param cmk storage the key metadata and keyblob
+ * @param message authenticated message
+ * @param mac the mac to check
+ * @param result mac match result
+ * @return ehsm_status_t
+ */
+ehsm_status_t VerifyMac(ehsm_keyblob_t *cmk,
+                        ehsm_data_t *message,
+                        ehsm_data_t *mac,
+                        bool *result)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (!validate_params(cmk, EH_CMK_MAX_SIZE) ||
+        !validate_params(message, EH_MAC_MESSAGE_MAX_SIZE) ||
+        !validate_params(mac, EH_MAC_MAX_SIZE))
+        return EH_ARGUMENTS_BAD;
+
+    if (result == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_verify_mac(enclave.eid(),
+                             &sgxStatus,
+                             cmk,
+                             APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
+                             message,
+                             APPEND_SIZE_TO_DATA_T(message->datalen),
+                             mac,
+                             APPEND_SIZE_TO_DATA_T(mac->datalen),
+                             result);
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
     else
@@ -558,7 +2045,11 @@ ehsm_status_t GenerateDataKey(ehsm_keyblob_t *cmk,
     if (plaintext == NULL || ciphertext == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_generate_datakey(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_generate_datakey(enclave.eid(),
                                    &sgxStatus,
                                    cmk,
                                    APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
@@ -568,6 +2059,7 @@ ehsm_status_t GenerateDataKey(ehsm_keyblob_t *cmk,
                                    APPEND_SIZE_TO_DATA_T(plaintext->datalen),
                                    ciphertext,
                                    APPEND_SIZE_TO_DATA_T(ciphertext->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
     else
@@ -589,7 +2081,11 @@ ehsm_status_t GenerateDataKeyWithoutPlaintext(ehsm_keyblob_t *cmk,
     if (plaintext == NULL || ciphertext == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_generate_datakey(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_generate_datakey(enclave.eid(),
                                    &sgxStatus,
                                    cmk,
                                    APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
@@ -599,6 +2095,7 @@ ehsm_status_t GenerateDataKeyWithoutPlaintext(ehsm_keyblob_t *cmk,
                                    APPEND_SIZE_TO_DATA_T(plaintext->datalen),
                                    ciphertext,
                                    APPEND_SIZE_TO_DATA_T(ciphertext->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
     else
@@ -633,7 +2130,11 @@ ehsm_status_t ExportDataKey(ehsm_keyblob_t *cmk,
     if (newdatakey == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_export_datakey(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_export_datakey(enclave.eid(),
                                  &sgxStatus,
                                  cmk,
                                  APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
@@ -645,6 +2146,7 @@ ehsm_status_t ExportDataKey(ehsm_keyblob_t *cmk,
                                  APPEND_SIZE_TO_KEYBLOB_T(ukey->keybloblen),
                                  newdatakey,
                                  APPEND_SIZE_TO_DATA_T(newdatakey->datalen));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
 out:
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
@@ -668,16 +2170,323 @@ ehsm_status_t Enroll(ehsm_data_t *appid, ehsm_data_t *apikey)
     uuid_generate(uu);
     uuid_unparse(uu, (char *)appid->data);
 
-    ret = enclave_get_apikey(g_enclave_id,
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_get_apikey(enclave.eid(),
                              &sgxStatus,
                              apikey->data,
                              apikey->datalen);
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    else
+        return EH_OK;
+}
+
+ehsm_status_t VerifyRequestSign(ehsm_data_t *appid,
+                                ehsm_data_t *sign_string,
+                                ehsm_data_t *sign,
+                                ehsm_keyblob_t *cmk,
+                                ehsm_data_t *cipherapikey,
+                                bool *cached,
+                                bool *result)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (!validate_params(appid, UUID_STR_LEN) ||
+        !validate_params(sign_string, EH_PAYLOAD_MAX_SIZE, false) ||
+        !validate_params(sign, MAX_SIGNATURE_SIZE) ||
+        !validate_params(cmk, EH_CMK_MAX_SIZE, false) ||
+        !validate_params(cipherapikey, EH_ENCRYPT_MAX_SIZE, false))
+        return EH_ARGUMENTS_BAD;
+
+    if (sign_string == NULL || (cmk == NULL) != (cipherapikey == NULL) ||
+        cached == NULL || result == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_verify_request_sign(enclave.eid(),
+                                      &sgxStatus,
+                                      appid,
+                                      APPEND_SIZE_TO_DATA_T(appid->datalen),
+                                      sign_string,
+                                      APPEND_SIZE_TO_DATA_T(sign_string->datalen),
+                                      sign,
+                                      APPEND_SIZE_TO_DATA_T(sign->datalen),
+                                      cmk,
+                                      cmk == NULL ? 0 : APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen),
+                                      cipherapikey,
+                                      cipherapikey == NULL ? 0 : APPEND_SIZE_TO_DATA_T(cipherapikey->datalen),
+                                      cached,
+                                      result,
+                                      (uint64_t)time(NULL));
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
         return EH_FUNCTION_FAILED;
     else
         return EH_OK;
 }
 
+ehsm_status_t InvalidateApiKey(ehsm_data_t *appid)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (!validate_params(appid, UUID_STR_LEN))
+        return EH_ARGUMENTS_BAD;
+
+    if (g_enclave_num == 0)
+        return EH_FUNCTION_FAILED;
+
+    // every instance may have cached the api key
+    for (uint32_t i = 0; i < g_enclave_num; i++)
+    {
+        ret = enclave_invalidate_api_key(g_enclaves[i].eid,
+                                         &sgxStatus,
+                                         appid,
+                                         APPEND_SIZE_TO_DATA_T(appid->datalen));
+        if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+            return EH_FUNCTION_FAILED;
+    }
+
+    return EH_OK;
+}
+
+ehsm_status_t GetKeyCacheStats(ehsm_key_cache_stats_t *stats)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    ehsm_key_cache_stats_t instance_stats;
+
+    if (stats == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    if (g_enclave_num == 0)
+        return EH_FUNCTION_FAILED;
+
+    // every instance has a cache of its own, report their sums
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t i = 0; i < g_enclave_num; i++)
+    {
+        ret = enclave_get_key_cache_stats(g_enclaves[i].eid, &sgxStatus, &instance_stats);
+        if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+            return EH_FUNCTION_FAILED;
+
+        stats->hits += instance_stats.hits;
+        stats->misses += instance_stats.misses;
+        stats->evictions += instance_stats.evictions;
+        stats->entries += instance_stats.entries;
+        stats->bytes += instance_stats.bytes;
+        stats->max_entries += instance_stats.max_entries;
+        stats->max_bytes += instance_stats.max_bytes;
+    }
+
+    return EH_OK;
+}
+
+ehsm_status_t GetKeyPoolStats(uint32_t keyspec, ehsm_key_pool_stats_t *stats)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    ehsm_key_pool_stats_t instance_stats;
+
+    if (stats == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    if (g_enclave_num == 0)
+        return EH_FUNCTION_FAILED;
+
+    // the watermarks are the same on every instance, the counters are summed
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t i = 0; i < g_enclave_num; i++)
+    {
+        ret = enclave_get_key_pool_stats(g_enclaves[i].eid, &sgxStatus, keyspec, &instance_stats);
+        if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+            return EH_FUNCTION_FAILED;
+
+        stats->hits += instance_stats.hits;
+        stats->misses += instance_stats.misses;
+        stats->generated += instance_stats.generated;
+        stats->available += instance_stats.available;
+        stats->low_watermark = instance_stats.low_watermark;
+        stats->high_watermark = instance_stats.high_watermark;
+    }
+
+    return EH_OK;
+}
+
+ehsm_status_t GetEnclaveStats(ehsm_enclave_stats_t *stats)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    ehsm_enclave_stats_t *instance_stats = NULL;
+    ehsm_status_t rc = EH_OK;
+
+    if (stats == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    if (g_enclave_num == 0)
+        return EH_FUNCTION_FAILED;
+
+    ret = enclave_get_stats(g_enclaves[0].eid, &sgxStatus, stats);
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+    if (g_enclave_num == 1)
+        return EH_OK;
+
+    instance_stats = (ehsm_enclave_stats_t *)malloc(sizeof(ehsm_enclave_stats_t));
+    if (instance_stats == NULL)
+        return EH_DEVICE_MEMORY;
+
+    // fold the counters of the other instances into those of the primary one
+    for (uint32_t i = 1; i < g_enclave_num; i++)
+    {
+        ret = enclave_get_stats(g_enclaves[i].eid, &sgxStatus, instance_stats);
+        if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        {
+            rc = EH_FUNCTION_FAILED;
+            goto out;
+        }
+
+        for (uint32_t op = 0; op < EH_STATS_NUM; op++)
+        {
+            for (uint32_t keyspec = 0; keyspec < EH_STATS_KEYSPEC_NUM; keyspec++)
+            {
+                ehsm_stats_counter_t *total = &stats->counters[op][keyspec];
+                const ehsm_stats_counter_t *counter = &instance_stats->counters[op][keyspec];
+
+                total->count += counter->count;
+                total->cycles += counter->cycles;
+                if (counter->max_cycles > total->max_cycles)
+                    total->max_cycles = counter->max_cycles;
+            }
+        }
+    }
+
+out:
+    SAFE_FREE(instance_stats);
+    return rc;
+}
+
+ehsm_status_t HoldEnclaveSlot(void **slot)
+{
+    ehsm_enclave_instance_t *instance = NULL;
+
+    if (slot == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    if (g_enclave_num == 0)
+        return EH_FUNCTION_FAILED;
+
+    instance = enclave_try_acquire(NULL);
+    if (instance == NULL)
+        return EH_BUSY;
+
+    *slot = instance;
+    return EH_OK;
+}
+
+void ReleaseEnclaveSlot(void *slot)
+{
+    if (slot != NULL)
+        enclave_release((ehsm_enclave_instance_t *)slot);
+}
+
+/* the largest response a packed batch can produce, 0 if the batch is malformed */
+static size_t batch_response_bound(const ehsm_data_t *requests)
+{
+    const ehsm_batch_t *batch = (const ehsm_batch_t *)requests->data;
+    const uint8_t *cur = NULL;
+    const uint8_t *end = requests->data + requests->datalen;
+    size_t bound = requests->datalen;
+
+    if (requests->datalen < sizeof(ehsm_batch_t) ||
+        batch->count == 0 ||
+        batch->count > EH_BATCH_MAX_ITEMS)
+        return 0;
+
+    cur = batch->items;
+    for (uint32_t i = 0; i < batch->count; i++)
+    {
+        const ehsm_batch_item_t *item = (const ehsm_batch_item_t *)cur;
+
+        if ((size_t)(end - cur) < sizeof(ehsm_batch_item_t) ||
+            (size_t)(end - cur) - sizeof(ehsm_batch_item_t) < item->size)
+            return 0;
+
+        bound += EH_BATCH_ITEM_MAX_OVERHEAD + 2 * (size_t)item->param;
+        cur += sizeof(ehsm_batch_item_t) + item->size;
+    }
+
+    if (cur != end || bound > EH_BATCH_RESPONSE_MAX_SIZE)
+        return 0;
+
+    return bound;
+}
+
+/**
+ * @brief process a packed batch of encrypt/decrypt/sign/verify/generate datakey requests
+ * by a single ecall
+ *
+ * @param requests an ehsm_batch_t followed by its items
+ * @param responses the packed responses, call it with datalen 0 to get the capacity needed,
+ * which is computed without entering the enclave
+ * @return ehsm_status_t only reports a malformed batch, each item carries its own status
+ */
+ehsm_status_t Batch(ehsm_data_t *requests, ehsm_data_t *responses)
+{
+    sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    size_t resp_len = 0;
+    size_t bound = 0;
+
+    if (!validate_params(requests, EH_BATCH_MAX_SIZE))
+        return EH_ARGUMENTS_BAD;
+
+    if (responses == NULL)
+        return EH_ARGUMENTS_BAD;
+
+    bound = batch_response_bound(requests);
+    if (bound == 0)
+        return EH_ARGUMENTS_BAD;
+
+    if (responses->datalen == 0)
+    {
+        responses->datalen = bound;
+        return EH_OK;
+    }
+
+    if (responses->datalen < bound)
+        return EH_ARGUMENTS_BAD;
+
+    enclave_ref_t enclave;
+    if (!enclave.admitted())
+        return EH_BUSY;
+    uint64_t ecall_start = metrics_phase_begin();
+    ret = enclave_batch(enclave.eid(),
+                        &sgxStatus,
+                        requests->data,
+                        requests->datalen,
+                        responses->data,
+                        responses->datalen,
+                        &resp_len);
+    metrics_phase_end(EH_METRICS_PHASE_ECALL, ecall_start);
+    if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
+        return EH_FUNCTION_FAILED;
+
+    responses->datalen = resp_len;
+    return EH_OK;
+}
+
 ehsm_status_t generate_apikey(ehsm_data_t *apikey, ehsm_data_t *cipherapikey)
 {
     sgx_status_t sgxStatus = SGX_ERROR_UNEXPECTED;
@@ -689,7 +2498,7 @@ ehsm_status_t generate_apikey(ehsm_data_t *apikey, ehsm_data_t *cipherapikey)
     if (cipherapikey == NULL || cipherapikey->datalen < EH_API_KEY_SIZE + EH_AES_GCM_IV_SIZE + EH_AES_GCM_MAC_SIZE)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_generate_apikey(g_enclave_id,
+    ret = enclave_generate_apikey(primary_enclave_id(),
                                   &sgxStatus,
                                   g_context,
                                   apikey->data,
@@ -718,14 +2527,6 @@ ehsm_status_t GenerateQuote(ehsm_data_t *quote)
     if (quote == NULL)
         return EH_ARGUMENTS_BAD;
 
-    dcap_ret = sgx_qe_get_target_info(&qe_target_info);
-    if (SGX_QL_SUCCESS != dcap_ret)
-    {
-        log_e("Error in sgx_qe_get_target_info. 0x%04x\n", dcap_ret);
-        return EH_FUNCTION_FAILED;
-    }
-    log_d("sgx_qe_get_target_info successfully returned\n");
-
     dcap_ret = sgx_qe_get_quote_size(&quote_size);
     if (SGX_QL_SUCCESS != dcap_ret)
     {
@@ -740,10 +2541,19 @@ ehsm_status_t GenerateQuote(ehsm_data_t *quote)
         return EH_OK;
     }
 
-    if (quote->datalen != quote_size)
+    // any buffer which fits the quote will do, e.g. EH_QUOTE_MAX_SIZE
+    if (quote->datalen < quote_size)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_create_report(g_enclave_id,
+    dcap_ret = sgx_qe_get_target_info(&qe_target_info);
+    if (SGX_QL_SUCCESS != dcap_ret)
+    {
+        log_e("Error in sgx_qe_get_target_info. 0x%04x\n", dcap_ret);
+        return EH_FUNCTION_FAILED;
+    }
+    log_d("sgx_qe_get_target_info successfully returned\n");
+
+    ret = enclave_create_report(primary_enclave_id(),
                                 &sgxStatus,
                                 &qe_target_info,
                                 &app_report);
@@ -758,7 +2568,7 @@ ehsm_status_t GenerateQuote(ehsm_data_t *quote)
 
     // Get the Quote
     dcap_ret = sgx_qe_get_quote(&app_report,
-                                quote->datalen,
+                                quote_size,
                                 quote->data);
     if (SGX_QL_SUCCESS != dcap_ret)
     {
@@ -766,6 +2576,7 @@ ehsm_status_t GenerateQuote(ehsm_data_t *quote)
         return EH_FUNCTION_FAILED;
     }
     log_d("sgx_qe_get_quote successfully returned\n");
+    quote->datalen = quote_size;
 
     return EH_OK;
 }
@@ -800,7 +2611,7 @@ ehsm_status_t VerifyQuote(ehsm_data_t *quote,
     if (quote == NULL)
         return EH_ARGUMENTS_BAD;
 
-    ret = enclave_get_rand(g_enclave_id,
+    ret = enclave_get_rand(primary_enclave_id(),
                            &sgxStatus,
                            nonce, sizeof(nonce));
     if (ret != SGX_SUCCESS)
@@ -809,7 +2620,7 @@ ehsm_status_t VerifyQuote(ehsm_data_t *quote,
     // set nonce
     memcpy(qve_report_info.nonce.rand, nonce, sizeof(nonce));
 
-    ret = enclave_get_target_info(g_enclave_id,
+    ret = enclave_get_target_info(primary_enclave_id(),
                                   &sgxStatus,
                                   &qve_report_info.app_enclave_target_info);
     if (ret != SGX_SUCCESS || sgxStatus != SGX_SUCCESS)
@@ -852,7 +2663,7 @@ ehsm_status_t VerifyQuote(ehsm_data_t *quote,
     if ((mr_signer != NULL && strncmp(mr_signer, " ", strlen(mr_signer)) != 0) ||
         (mr_enclave != NULL && strncmp(mr_enclave, " ", strlen(mr_enclave)) != 0))
     {
-        ret = enclave_verify_quote_policy(g_enclave_id,
+        ret = enclave_verify_quote_policy(primary_enclave_id(),
                                           &sgxStatus,
                                           quote->data,
                                           quote->datalen, mr_signer,
@@ -886,7 +2697,7 @@ ehsm_status_t VerifyQuote(ehsm_data_t *quote,
     log_d("sgx_qv_verify_quote successfully returned\n");
 
     // call sgx_dcap_tvl API in SampleISVEnclave to verify QvE's report and identity
-    ret = sgx_tvl_verify_qve_report_and_identity(g_enclave_id,
+    ret = sgx_tvl_verify_qve_report_and_identity(primary_enclave_id(),
                                                  &dcap_ret,
                                                  quote->data,
                                                  quote->datalen,
@@ -955,7 +2766,7 @@ ehsm_status_t ra_get_msg1(sgx_ra_msg1_t *msg1)
     int enclave_lost_retry_time = 1;
     do
     {
-        ret = enclave_init_ra(g_enclave_id, &sgxStatus, false, &g_context);
+        ret = enclave_init_ra(primary_enclave_id(), &sgxStatus, false, &g_context);
         // Ideally, this check would be around the full attestation flow.
     } while (SGX_ERROR_ENCLAVE_LOST == ret && enclave_lost_retry_time--);
 
@@ -967,7 +2778,7 @@ ehsm_status_t ra_get_msg1(sgx_ra_msg1_t *msg1)
 
     // get the msg1 from core-enclave
     sgx_att_key_id_t selected_key_id = {0};
-    ret = sgx_ra_get_msg1_ex(&selected_key_id, g_context, g_enclave_id, sgx_ra_get_ga, msg1);
+    ret = sgx_ra_get_msg1_ex(&selected_key_id, g_context, primary_enclave_id(), sgx_ra_get_ga, msg1);
     if (SGX_SUCCESS != ret)
     {
         printf("Error, call sgx_ra_get_msg1_ex failed(%#x)\n", ret);
@@ -999,7 +2810,7 @@ ehsm_status_t ra_get_msg3(sgx_ra_msg2_t *p_msg2, uint32_t msg2_size, sgx_ra_msg3
     {
         ret = sgx_ra_proc_msg2_ex(&selected_key_id,
                                   g_context,
-                                  g_enclave_id,
+                                  primary_enclave_id(),
                                   sgx_ra_proc_msg2_trusted,
                                   sgx_ra_get_msg3_trusted,
                                   p_msg2,
@@ -1035,7 +2846,7 @@ ehsm_status_t verify_att_result_msg(sample_ra_att_result_msg_t *p_att_result_msg
      * Check the MAC using MK on the attestation result message.
      * The format of the attestation result message is specific(sample_ra_att_result_msg_t).
      */
-    ret = enclave_verify_att_result_mac(g_enclave_id,
+    ret = enclave_verify_att_result_mac(primary_enclave_id(),
                                         &sgxStatus,
                                         g_context,
                                         (uint8_t *)&p_att_result_msg->platform_info_blob,
@@ -68,8 +68,87 @@ typedef enum
     EH_ENROLL,
     EH_GENERATE_QUOTE,
     EH_VERIFY_QUOTE,
+    EH_UPGRADE_KEYBLOB,
+    EH_BATCH,
+    EH_ENCRYPT_INIT,
+    EH_ENCRYPT_UPDATE,
+    EH_ENCRYPT_FINAL,
+    EH_DECRYPT_INIT,
+    EH_DECRYPT_UPDATE,
+    EH_DECRYPT_FINAL,
+    EH_STREAM_ABORT,
+    EH_GET_METRICS,
+    EH_VERIFY_REQUEST_SIGN,
+    EH_GENERATE_MAC,
+    EH_VERIFY_MAC,
+    EH_SET_LOG_LEVEL,
+    EH_INVALIDATE_API_KEY,
 } ehsm_action_t;
 
+#define EH_FFI_BIN_MAGIC    0x42534845  /* "EHSB" */
+#define EH_FFI_BIN_VERSION  1
+
+#pragma pack(push, 1)
+
+/*
+ * Header of a EHSM_FFI_CALL_BIN request and response, all fields are little endian.
+ * The payload is a sequence of ehsm_keyblob_t/ehsm_data_t placed back to back, in the request:
+ *   EH_CREATE_KEY                          cmk (keybloblen 0, only the metadata is used)
+ *   EH_ENCRYPT                             cmk | aad | plaintext
+ *   EH_DECRYPT                             cmk | aad | ciphertext
+ *   EH_ASYMMETRIC_ENCRYPT                  cmk | plaintext
+ *   EH_ASYMMETRIC_DECRYPT                  cmk | ciphertext
+ *   EH_SIGN                                cmk | digest
+ *   EH_VERIFY                              cmk | digest | signature
+ *   EH_GENERATE_DATAKEY                    cmk | aad             (param is the datakey length)
+ *   EH_GENERATE_DATAKEY_WITHOUT_PLAINTEXT  cmk | aad             (param is the datakey length)
+ *   EH_EXPORT_DATAKEY                      cmk | ukey | aad | olddatakey
+ *   EH_GENERATE_MAC                        cmk | message
+ *   EH_VERIFY_MAC                          cmk | message | mac
+ *   EH_ENCRYPT_INIT                        cmk | aad
+ *   EH_DECRYPT_INIT                        cmk | aad | header
+ *   EH_ENCRYPT_UPDATE, EH_ENCRYPT_FINAL    handle | plaintext chunk
+ *   EH_DECRYPT_UPDATE, EH_DECRYPT_FINAL    handle | sealed chunk
+ *   EH_STREAM_ABORT                        handle
+ * and in the response:
+ *   EH_CREATE_KEY                          cmk
+ *   EH_ENCRYPT, EH_ASYMMETRIC_ENCRYPT      ciphertext
+ *   EH_DECRYPT, EH_ASYMMETRIC_DECRYPT      plaintext
+ *   EH_SIGN                                signature
+ *   EH_VERIFY                              result (1 byte)
+ *   EH_GENERATE_DATAKEY                    plaintext | ciphertext
+ *   EH_GENERATE_DATAKEY_WITHOUT_PLAINTEXT  ciphertext
+ *   EH_EXPORT_DATAKEY                      newdatakey
+ *   EH_GENERATE_MAC                        mac
+ *   EH_VERIFY_MAC                          result (1 byte)
+ *   EH_ENCRYPT_INIT                        handle | header
+ *   EH_DECRYPT_INIT                        handle
+ *   EH_ENCRYPT_UPDATE, EH_ENCRYPT_FINAL    sealed chunk
+ *   EH_DECRYPT_UPDATE, EH_DECRYPT_FINAL    plaintext chunk
+ *   EH_STREAM_ABORT                        (empty)
+ * A handle is an ehsm_data_t of 8 bytes. The stream requests may carry chunks of up
+ * to EH_STREAM_CHUNK_MAX_SIZE, the other requests are bounded by EH_PAYLOAD_MAX_SIZE.
+ * The response payload is empty when status is not EH_OK.
+ */
+typedef struct {
+    uint32_t    magic;      /* EH_FFI_BIN_MAGIC */
+    uint32_t    version;    /* EH_FFI_BIN_VERSION */
+    uint32_t    action;     /* ehsm_action_t */
+    uint32_t    param;
+    int32_t     status;     /* ehsm_status_t, only valid in the response */
+    uint32_t    size;       /* size of the payload */
+    uint8_t     payload[0];
+} ehsm_ffi_bin_t;
+
+#pragma pack(pop)
+
+/*
+ * Completion callback of EHSM_FFI_CALL_ASYNC, it runs on a worker thread of the
+ * provider. respJson has the same format as the EHSM_FFI_CALL response and is
+ * freed once the callback returns.
+ */
+typedef void (*ehsm_ffi_callback_t)(char *respJson, void *ctx);
+
 extern "C"
 {
     /**
@@ -94,8 +173,60 @@ extern "C"
         }
      */
     char *EHSM_FFI_CALL(const char *paramJson);
+
+    /**
+     * @brief The binary ffi entry for the data plane actions, it skips the json and
+     * base64 conversions of EHSM_FFI_CALL. Initialize/Finalize and the other control
+     * plane actions stay on EHSM_FFI_CALL.
+     *
+     * @param req an ehsm_ffi_bin_t request followed by its payload
+     * @param req_len size of req
+     * @param resp receives the ehsm_ffi_bin_t response followed by its payload
+     * @param resp_len the capacity of resp on input, the bytes used on output. When it
+     * returns EH_BUFFER_TOO_SMALL, the capacity needed.
+     *
+     * @return int32_t the ehsm_status_t of the request, also stored in the response header
+     */
+    int32_t EHSM_FFI_CALL_BIN(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len);
+
+    /**
+     * @brief The asynchronous ffi entry, the request is queued to a worker pool sized
+     * to the TCS number of the enclave, so a slow request such as an RSA-4096 CreateKey
+     * no longer blocks the caller. EH_INITIALIZE and EH_FINALIZE are refused. Finalize
+     * drops the requests still queued without invoking their callback, so a caller
+     * which needs every response waits for them before finalizing.
+     *
+     * @param paramJson the request in the same format as EHSM_FFI_CALL
+     * @param callback invoked with the response once the request is processed
+     * @param ctx passed back to callback as is
+     *
+     * @return int32_t EH_OK when queued, then callback is invoked at most once, exactly
+     * once unless Finalize is called first.
+     * EH_BUSY when the queue is full, EH_ARGUMENTS_BAD for a malformed call.
+     */
+    int32_t EHSM_FFI_CALL_ASYNC(const char *paramJson, ehsm_ffi_callback_t callback, void *ctx);
 } // extern "C"
 
+/*
+Description:
+Create the ehsm-core enclaves and setup their secure channels to the dkeycache.
+EHSM_CONFIG_ENCLAVE_INSTANCES (default 1, at most 32) enclaves are created, the
+calls are spread over them by load so that one process is not capped by the TCSNum
+of a single enclave.
+Switchless calls for Encrypt/Decrypt/Sign/Verify/GenerateDataKey and the enclave
+logging are opt-in through the environment:
+    EHSM_CONFIG_SWITCHLESS=true
+    EHSM_CONFIG_SWITCHLESS_TWORKERS                 (default 2, each one holds a TCS)
+    EHSM_CONFIG_SWITCHLESS_UWORKERS                 (default 1)
+    EHSM_CONFIG_SWITCHLESS_RETRIES_BEFORE_FALLBACK  (default 20000)
+    EHSM_CONFIG_SWITCHLESS_RETRIES_BEFORE_SLEEP     (default 20000)
+The data plane calls are admitted to an enclave only while it has a free TCS, the
+others wait for one and fail with EH_BUSY once the queue is full or their deadline
+has passed:
+    EHSM_CONFIG_ENCLAVE_TCS_SLOTS       (default TCSNum - 1 - the switchless tworkers)
+    EHSM_CONFIG_ADMISSION_QUEUE_SIZE    (default 1024 waiting calls)
+    EHSM_CONFIG_ADMISSION_TIMEOUT_MS    (default 1000, counted from the ffi entry)
+*/
 ehsm_status_t Initialize();
 
 ehsm_status_t Finalize();
@@ -125,9 +256,22 @@ Create a customer master key with the following metadatas
 .createdate
     -Reserved
 Note: the CMK will be wrapped by the DK(DomainKey)
+Note: like every output of this api, keybloblen is the capacity of the buffer on input,
+see ehsm_get_keyblob_max_size() and friends in datatypes.h, and the exact length used
+on output. A zero length still only queries the size.
 */
 ehsm_status_t CreateKey(ehsm_keyblob_t *cmk);
 
+/*
+Description:
+Rewrap a cmk created with the PEM (v1) keyblob layout into the compact DER (v2)
+layout. Symmetric cmks and cmks already in the v2 layout are returned unchanged.
+Input/Output:
+cmk -- the cmk to upgrade, its keybloblen is updated to the new size
+Note: v1 cmks keep working without an upgrade, this only saves space and parsing
+*/
+ehsm_status_t UpgradeKeyBlob(ehsm_keyblob_t *cmk);
+
 /*
 Description:
 Encrypt an arbitrary set of bytes using the CMK.(only support symmetric types)
@@ -160,6 +304,100 @@ ehsm_status_t Decrypt(ehsm_keyblob_t *cmk,
                       ehsm_data_t *aad,
                       ehsm_data_t *plaintext);
 
+/*
+Description:
+Open a stream to encrypt data of any size chunk by chunk with the CMK.(only support
+symmetric types) The cmk is unwrapped once, each chunk is sealed on its own and bound
+to its position, so the decryption rejects dropped, reordered or truncated chunks.
+Input:
+cmk -- A symmetric cmk
+aad -- some extra datas input by the user, authenticated with every chunk
+Output:
+header -- the stream header (EH_STREAM_HEADER_SIZE bytes), to be stored before the chunks
+handle -- the stream, to be passed to EncryptUpdate/EncryptFinal
+Note: a stream is closed by the final chunk, by any failure, or by StreamAbort
+*/
+ehsm_status_t EncryptInit(ehsm_keyblob_t *cmk,
+                          ehsm_data_t *aad,
+                          ehsm_data_t *header,
+                          uint64_t *handle);
+
+/*
+Description:
+Seal the next chunk of a stream opened by EncryptInit.
+Input:
+handle -- the stream
+plaintext -- the chunk, up to EH_STREAM_CHUNK_MAX_SIZE
+Output:
+ciphertext -- the sealed chunk, see ehsm_get_stream_chunk_size
+*/
+ehsm_status_t EncryptUpdate(uint64_t handle,
+                            ehsm_data_t *plaintext,
+                            ehsm_data_t *ciphertext);
+
+/*
+Description:
+Seal the last chunk of a stream opened by EncryptInit and close the stream.
+Input:
+handle -- the stream
+plaintext -- the chunk, up to EH_STREAM_CHUNK_MAX_SIZE
+Output:
+ciphertext -- the sealed chunk, see ehsm_get_stream_chunk_size
+*/
+ehsm_status_t EncryptFinal(uint64_t handle,
+                           ehsm_data_t *plaintext,
+                           ehsm_data_t *ciphertext);
+
+/*
+Description:
+Open a stream to decrypt the chunks sealed by EncryptInit/EncryptUpdate/EncryptFinal.
+Input:
+cmk -- the symmetric cmk of the stream
+aad -- the aad given to EncryptInit
+header -- the stream header returned by EncryptInit
+Output:
+handle -- the stream, to be passed to DecryptUpdate/DecryptFinal
+*/
+ehsm_status_t DecryptInit(ehsm_keyblob_t *cmk,
+                          ehsm_data_t *aad,
+                          ehsm_data_t *header,
+                          uint64_t *handle);
+
+/*
+Description:
+Open the next chunk of a stream opened by DecryptInit, chunks must come in order.
+Input:
+handle -- the stream
+ciphertext -- the sealed chunk
+Output:
+plaintext -- the chunk, see ehsm_get_stream_plaintext_size
+*/
+ehsm_status_t DecryptUpdate(uint64_t handle,
+                            ehsm_data_t *ciphertext,
+                            ehsm_data_t *plaintext);
+
+/*
+Description:
+Open the last chunk of a stream opened by DecryptInit and close the stream. It fails
+when the chunk was not sealed by EncryptFinal, so a truncated stream is detected.
+Input:
+handle -- the stream
+ciphertext -- the sealed chunk
+Output:
+plaintext -- the chunk, see ehsm_get_stream_plaintext_size
+*/
+ehsm_status_t DecryptFinal(uint64_t handle,
+                           ehsm_data_t *ciphertext,
+                           ehsm_data_t *plaintext);
+
+/*
+Description:
+Close a stream without finishing it, e.g. when the client gave up.
+Input:
+handle -- the stream
+*/
+ehsm_status_t StreamAbort(uint64_t handle);
+
 /*
 Description:
 Encrypt an arbitrary set of bytes using the CMK.(only support asymmetric types)
@@ -278,11 +516,55 @@ ehsm_status_t Verify(ehsm_keyblob_t *cmk,
                      ehsm_data_t *signature,
                      bool *result);
 
+/*
+Description:
+Computes the HMAC of a message using an EH_HMAC cmk, the digest mode of the cmk
+(SHA-256/384/512 or SM3) picks the hash.
+Input:
+cmk -- An EH_HMAC cmk,
+message -- the datas to be authenticated, up to EH_MAC_MESSAGE_MAX_SIZE bytes.
+Output:
+mac -- the mac of the message, its length is reported back when mac->datalen is 0
+*/
+ehsm_status_t GenerateMac(ehsm_keyblob_t *cmk,
+                          ehsm_data_t *message,
+                          ehsm_data_t *mac);
+
+/*
+Description:
+Checks the HMAC of a message using an EH_HMAC cmk, in constant time.
+Input:
+cmk -- An EH_HMAC cmk,
+message -- the authenticated datas.
+mac -- the mac to check
+Output:
+result -- true/false
+*/
+ehsm_status_t VerifyMac(ehsm_keyblob_t *cmk,
+                        ehsm_data_t *message,
+                        ehsm_data_t *mac,
+                        bool *result);
+
+/*
+Description:
+Process several Encrypt/Decrypt/Sign/Verify/GenerateDataKey/GenerateMac/VerifyMac requests within a single
+enclave transition. The requests may use different cmks and actions.
+Input:
+requests -- an ehsm_batch_t followed by up to EH_BATCH_MAX_ITEMS packed ehsm_batch_item_t,
+see datatypes.h for the layout of each item
+Output:
+responses -- one ehsm_batch_item_t per request item in the same order, with its own status.
+Call it with datalen 0 first to get the capacity needed, this does not enter the enclave.
+Note: the returned status only reports a malformed batch
+*/
+ehsm_status_t Batch(ehsm_data_t *requests, ehsm_data_t *responses);
+
 /*
 Description:
 Performs quote generation and return the quote.
 Input/Output:
-quote -- the quote for the target encalve.
+quote -- the quote for the target encalve, datalen is the capacity on input
+(EH_QUOTE_MAX_SIZE is enough) and the quote size on output.
 */
 ehsm_status_t GenerateQuote(ehsm_data_t *quote);
 
@@ -308,4 +590,78 @@ apikey -- 32bit random number
 */
 ehsm_status_t Enroll(ehsm_data_t *appid, ehsm_data_t *apikey);
 
+/*
+Description:
+Verify the HMAC-SHA256 sign of a REST request by the api key of its appid inside the
+enclave, which caches the unwrapped api keys for EH_API_KEY_CACHE_TTL seconds. On a
+miss the api key is decrypted from cipherapikey by cmk, both are taken from the user_info
+record and may be NULL, then a miss only reports cached = false.
+Input:
+appid -- the appid of the request
+sign_string -- the canonical string of the request parameters
+sign -- the HMAC-SHA256 sent by the client
+cmk -- optional, the AES-GCM key which wraps the api key
+cipherapikey -- optional, the api key encrypted by cmk with the appid as aad
+Output:
+cached -- whether the api key was available to verify the sign
+result -- true if the sign matches
+*/
+ehsm_status_t VerifyRequestSign(ehsm_data_t *appid,
+                                ehsm_data_t *sign_string,
+                                ehsm_data_t *sign,
+                                ehsm_keyblob_t *cmk,
+                                ehsm_data_t *cipherapikey,
+                                bool *cached,
+                                bool *result);
+
+/*
+Description:
+Drop the api key of an appid from the cache of every enclave instance, to be called
+when the api key is rotated or the appid is deleted
+Input:
+appid -- the appid whose api key is forgotten
+*/
+ehsm_status_t InvalidateApiKey(ehsm_data_t *appid);
+
+/*
+Description:
+Read the counters of the in-enclave cache of unwrapped CMKs
+Output:
+stats -- hits, misses, evictions and the current/maximum entries and bytes
+*/
+ehsm_status_t GetKeyCacheStats(ehsm_key_cache_stats_t *stats);
+
+/*
+Description:
+Read the counters of the in-enclave pool of pre-generated key pairs
+Input:
+keyspec -- an asymmetric keyspec
+Output:
+stats -- hits, misses, generated key pairs, the available key pairs and the watermarks
+*/
+ehsm_status_t GetKeyPoolStats(uint32_t keyspec, ehsm_key_pool_stats_t *stats);
+
+/*
+Description:
+Read the in-enclave performance counters, which are only counted on a platform where
+the enclave may run rdtsc, see EHSM_CONFIG_ENCLAVE_STATS
+Output:
+stats -- the count, TSC cycles and maximum TSC cycles of each ehsm_stats_op_t per keyspec
+*/
+ehsm_status_t GetEnclaveStats(ehsm_enclave_stats_t *stats);
+
+/*
+Description:
+Take an admission slot of the least loaded enclave instance without entering it, as a
+call in flight would, until ReleaseEnclaveSlot gives it back. ehsm_core_test holds the
+slots with it to reach the EH_BUSY path of the admission control deterministically.
+Output:
+slot -- the slot taken, to be given back to ReleaseEnclaveSlot before Finalize
+Return:
+EH_BUSY when every slot is taken
+*/
+ehsm_status_t HoldEnclaveSlot(void **slot);
+
+void ReleaseEnclaveSlot(void *slot);
+
 #endif
\ No newline at end of file
@@ -38,54 +38,107 @@
 #include "ffi_operation.h"
 #include "ehsm_marshal.h"
 #include "ehsm_provider.h"
+#include "ehsm_metrics.h"
 
 using namespace std;
 
 #define JSON2STRUCT(x, y) import_struct_from_json(x, &y, #y)
 #define STRUCT2JSON(x, y) export_json_from_struct(x, y, #y)
 
+/* the helpers below account their time to the phases of the current request, see ehsm_metrics.h */
+static size_t ffi_base64_decode_to(const char *begin, const char *end, uint8_t *out)
+{
+    uint64_t start = metrics_phase_begin();
+    size_t decoded_size = base64_decode_to(begin, end - begin, out);
+    metrics_phase_end(EH_METRICS_PHASE_BASE64_DECODE, start);
+    return decoded_size;
+}
+
+static string ffi_base64_encode(const uint8_t *bytes, uint32_t len)
+{
+    uint64_t start = metrics_phase_begin();
+    string encoded = base64_encode(bytes, len);
+    metrics_phase_end(EH_METRICS_PHASE_BASE64_ENCODE, start);
+    return encoded;
+}
+
+static void *ffi_malloc(size_t size)
+{
+    uint64_t start = metrics_phase_begin();
+    void *ptr = malloc(size);
+    metrics_phase_end(EH_METRICS_PHASE_ALLOC, start);
+    return ptr;
+}
+
+static char *ffi_to_char(RetJsonObj &retJsonObj)
+{
+    uint64_t start = metrics_phase_begin();
+    char *resp = retJsonObj.toChar();
+    metrics_phase_end(EH_METRICS_PHASE_SERIALIZE, start);
+    return resp;
+}
+
+/* a provider call refused by the admission control is reported apart, the caller may retry it */
+static void ffi_set_failure(RetJsonObj &retJsonObj, ehsm_status_t ret)
+{
+    if (ret == EH_BUSY)
+    {
+        retJsonObj.setCode(retJsonObj.CODE_BUSY);
+        retJsonObj.setMessage("Server busy.");
+    }
+    else
+    {
+        retJsonObj.setCode(retJsonObj.CODE_FAILED);
+        retJsonObj.setMessage("Server exception.");
+    }
+}
+
+/*
+ * the characters of the base64 string `key`, they are decoded straight from the
+ * json value into the final buffer. Missing or non string values are empty.
+ */
+static void ffi_base64_string(const JsonObj &json, const string &key, const char **begin, const char **end)
+{
+    const Json::Value &value = json.readData_JsonValue(key);
+
+    if (!value.isString() || !value.getString(begin, end))
+        *begin = *end = "";
+}
+
 template <typename T>
-void import_struct_from_json(JsonObj payloadJson, T **out, string key)
+void import_struct_from_json(const JsonObj &payloadJson, T **out, string key)
 {
     if (key.empty())
         return;
 
     if (typeid(**out) == typeid(ehsm_data_t))
     {
-        string data_str = base64_decode(payloadJson.readData_string(key));
-        size_t data_size = data_str.size();
+        const char *begin = NULL;
+        const char *end = NULL;
+        ffi_base64_string(payloadJson, key, &begin, &end);
 
-        ehsm_data_t *out_data = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(data_size));
+        ehsm_data_t *out_data = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(base64_decoded_size(end - begin)));
         if (out_data == NULL)
             return;
-        out_data->datalen = data_size;
-        memcpy_s(out_data->data, data_size, (uint8_t *)data_str.data(), data_size);
-
-        *out = (T *)malloc(APPEND_SIZE_TO_DATA_T(data_size));
-        if (*out == NULL)
-        {
-            explicit_bzero(out_data, APPEND_SIZE_TO_DATA_T(data_size));
-            return;
-        }
-        memcpy_s(*out, APPEND_SIZE_TO_DATA_T(data_size), out_data, APPEND_SIZE_TO_DATA_T(data_size));
+        out_data->datalen = ffi_base64_decode_to(begin, end, out_data->data);
 
-        explicit_bzero(out_data, APPEND_SIZE_TO_DATA_T(data_size));
-        free(out_data);
+        *out = (T *)out_data;
     }
     else if (typeid(**out) == typeid(ehsm_keyblob_t))
     {
-        string cmk_str = base64_decode(payloadJson.readData_string(key));
-        size_t cmk_size = cmk_str.size();
+        const char *begin = NULL;
+        const char *end = NULL;
+        ffi_base64_string(payloadJson, key, &begin, &end);
 
-        *out = (T *)malloc(cmk_size);
+        *out = (T *)ffi_malloc(base64_decoded_size(end - begin));
         if (*out == NULL)
             return;
 
-        memcpy_s(*out, cmk_size, (ehsm_keyblob_t *)cmk_str.data(), cmk_size);
+        ffi_base64_decode_to(begin, end, (uint8_t *)*out);
     }
     else if (typeid(**out) == typeid(ehsm_keymetadata_t))
     {
-        ehsm_keymetadata_t *out_data = (ehsm_keymetadata_t *)malloc(sizeof(ehsm_keymetadata_t));
+        ehsm_keymetadata_t *out_data = (ehsm_keymetadata_t *)ffi_malloc(sizeof(ehsm_keymetadata_t));
         if (out_data == NULL)
             return;
         out_data->keyspec = (ehsm_keyspec_t)payloadJson.readData_uint32("keyspec");
@@ -94,7 +147,7 @@ void import_struct_from_json(JsonObj payloadJson, T **out, string key)
         out_data->origin = (ehsm_keyorigin_t)payloadJson.readData_uint32("origin");
         out_data->purpose = (ehsm_keypurpose_t)payloadJson.readData_uint32("purpose");
 
-        *out = (T *)malloc(sizeof(ehsm_keymetadata_t));
+        *out = (T *)ffi_malloc(sizeof(ehsm_keymetadata_t));
         if (*out == NULL)
         {
             explicit_bzero(out_data, sizeof(ehsm_keymetadata_t));
@@ -128,12 +181,12 @@ void export_json_from_struct(RetJsonObj &retJsonObj, T *in, string key)
     if (typeid(*in) == typeid(ehsm_keyblob_t))
     {
         data_size = APPEND_SIZE_TO_KEYBLOB_T(((ehsm_keyblob_t *)in)->keybloblen);
-        data_base64 = base64_encode((uint8_t *)in, data_size);
+        data_base64 = ffi_base64_encode((uint8_t *)in, data_size);
     }
     else if (typeid(*in) == typeid(ehsm_data_t))
     {
         data_size = ((ehsm_data_t *)in)->datalen;
-        data_base64 = base64_encode((uint8_t *)((ehsm_data_t *)in)->data, data_size);
+        data_base64 = ffi_base64_encode((uint8_t *)((ehsm_data_t *)in)->data, data_size);
     }
     else
     {
@@ -147,6 +200,189 @@ void export_json_from_struct(RetJsonObj &retJsonObj, T *in, string key)
         retJsonObj.addData_string(key, data_base64);
 }
 
+/* append the base64 encoded keyblob `key` of a batch request item to its packed payload */
+static bool batch_pack_keyblob(string &payload, const JsonObj &itemJson, const char *key)
+{
+    const char *begin = NULL;
+    const char *end = NULL;
+    size_t offset = payload.size();
+    size_t cmk_size = 0;
+
+    ffi_base64_string(itemJson, key, &begin, &end);
+    payload.resize(offset + base64_decoded_size(end - begin));
+    cmk_size = ffi_base64_decode_to(begin, end, (uint8_t *)&payload[offset]);
+    payload.resize(offset + cmk_size);
+
+    if (cmk_size < sizeof(ehsm_keyblob_t) ||
+        cmk_size != APPEND_SIZE_TO_KEYBLOB_T(((const ehsm_keyblob_t *)&payload[offset])->keybloblen))
+        return false;
+
+    return true;
+}
+
+/* append the base64 encoded data `key` of a batch request item to its packed payload */
+static bool batch_pack_data(string &payload, const JsonObj &itemJson, const char *key, bool required)
+{
+    const char *begin = NULL;
+    const char *end = NULL;
+    size_t offset = payload.size() + sizeof(uint32_t);
+    uint32_t datalen = 0;
+
+    ffi_base64_string(itemJson, key, &begin, &end);
+    payload.resize(offset + base64_decoded_size(end - begin));
+    datalen = ffi_base64_decode_to(begin, end, (uint8_t *)&payload[offset]);
+    payload.resize(offset + datalen);
+    memcpy(&payload[offset - sizeof(datalen)], &datalen, sizeof(datalen));
+
+    if (required && datalen == 0)
+        return false;
+
+    return true;
+}
+
+/* pack one json request of a batch as an ehsm_batch_item_t, see datatypes.h */
+static bool batch_pack_item(string &packed, const JsonObj &itemJson)
+{
+    ehsm_batch_item_t item = {0};
+    string payload;
+    bool ok = false;
+
+    switch (itemJson.readData_uint32("action"))
+    {
+    case EH_ENCRYPT:
+        item.action = EH_BATCH_ENCRYPT;
+        ok = batch_pack_keyblob(payload, itemJson, "cmk") &&
+             batch_pack_data(payload, itemJson, "aad", false) &&
+             batch_pack_data(payload, itemJson, "plaintext", true);
+        break;
+    case EH_DECRYPT:
+        item.action = EH_BATCH_DECRYPT;
+        ok = batch_pack_keyblob(payload, itemJson, "cmk") &&
+             batch_pack_data(payload, itemJson, "aad", false) &&
+             batch_pack_data(payload, itemJson, "ciphertext", true);
+        break;
+    case EH_SIGN:
+        item.action = EH_BATCH_SIGN;
+        ok = batch_pack_keyblob(payload, itemJson, "cmk") &&
+             batch_pack_data(payload, itemJson, "digest", true);
+        break;
+    case EH_VERIFY:
+        item.action = EH_BATCH_VERIFY;
+        ok = batch_pack_keyblob(payload, itemJson, "cmk") &&
+             batch_pack_data(payload, itemJson, "digest", true) &&
+             batch_pack_data(payload, itemJson, "signature", true);
+        break;
+    case EH_GENERATE_MAC:
+        item.action = EH_BATCH_GENERATE_MAC;
+        ok = batch_pack_keyblob(payload, itemJson, "cmk") &&
+             batch_pack_data(payload, itemJson, "message", true);
+        break;
+    case EH_VERIFY_MAC:
+        item.action = EH_BATCH_VERIFY_MAC;
+        ok = batch_pack_keyblob(payload, itemJson, "cmk") &&
+             batch_pack_data(payload, itemJson, "message", true) &&
+             batch_pack_data(payload, itemJson, "mac", true);
+        break;
+    case EH_GENERATE_DATAKEY:
+        item.action = EH_BATCH_GENERATE_DATAKEY;
+        item.param = itemJson.readData_uint32("keylen");
+        ok = item.param > 0 &&
+             batch_pack_keyblob(payload, itemJson, "cmk") &&
+             batch_pack_data(payload, itemJson, "aad", false);
+        break;
+    default:
+        break;
+    }
+
+    if (ok)
+    {
+        item.size = payload.size();
+        packed.append((const char *)&item, sizeof(item));
+        packed.append(payload);
+    }
+    if (payload.size() > 0)
+        explicit_bzero(&payload[0], payload.size());
+
+    return ok;
+}
+
+/* export the next ehsm_data_t of a batch response item as a base64 string */
+static bool batch_unpack_data(JsonObj &resultJson, const uint8_t **cur, const uint8_t *end, const char *key)
+{
+    const ehsm_data_t *data = (const ehsm_data_t *)*cur;
+
+    if ((size_t)(end - *cur) < sizeof(ehsm_data_t) ||
+        (size_t)(end - *cur) - sizeof(ehsm_data_t) < data->datalen)
+        return false;
+
+    resultJson.addData_string(key, ffi_base64_encode(data->data, data->datalen));
+    *cur += APPEND_SIZE_TO_DATA_T(data->datalen);
+    return true;
+}
+
+/*
+ * convert one ehsm_batch_item_t of a batch response into its json result, action is
+ * the EH_* action of the matching request, the item only knows its EH_BATCH_* one
+ */
+static Json::Value batch_unpack_item(const ehsm_batch_item_t *item, uint32_t action)
+{
+    RetJsonObj codes;
+    JsonObj resultJson;
+    const uint8_t *cur = item->payload;
+    const uint8_t *end = item->payload + item->size;
+    bool ok = false;
+
+    resultJson.addData_uint32("action", action);
+    if (item->status == SGX_SUCCESS)
+    {
+        switch (item->action)
+        {
+        case EH_BATCH_ENCRYPT:
+            ok = batch_unpack_data(resultJson, &cur, end, "ciphertext");
+            break;
+        case EH_BATCH_DECRYPT:
+            ok = batch_unpack_data(resultJson, &cur, end, "plaintext");
+            break;
+        case EH_BATCH_SIGN:
+            ok = batch_unpack_data(resultJson, &cur, end, "signature");
+            break;
+        case EH_BATCH_GENERATE_MAC:
+            ok = batch_unpack_data(resultJson, &cur, end, "mac");
+            break;
+        case EH_BATCH_VERIFY:
+        case EH_BATCH_VERIFY_MAC:
+            ok = item->size == APPEND_SIZE_TO_DATA_T(1);
+            if (ok)
+                resultJson.addData_bool("result", ((const ehsm_data_t *)cur)->data[0] != 0);
+            break;
+        case EH_BATCH_GENERATE_DATAKEY:
+            ok = batch_unpack_data(resultJson, &cur, end, "plaintext") &&
+                 batch_unpack_data(resultJson, &cur, end, "ciphertext");
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (ok)
+    {
+        resultJson.addData_uint32("code", codes.CODE_SUCCESS);
+        resultJson.addData_string("message", "success!");
+    }
+    else if (item->status == SGX_ERROR_INVALID_PARAMETER)
+    {
+        resultJson.addData_uint32("code", codes.CODE_BAD_REQUEST);
+        resultJson.addData_string("message", "Failed, Please confirm that your parameters are correct.");
+    }
+    else
+    {
+        resultJson.addData_uint32("code", codes.CODE_FAILED);
+        resultJson.addData_string("message", "Server exception.");
+    }
+
+    return resultJson.getJson();
+}
+
 extern "C"
 {
     /*
@@ -174,7 +410,7 @@ extern "C"
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
         }
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /*
@@ -191,7 +427,7 @@ extern "C"
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
         }
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -216,7 +452,7 @@ extern "C"
             }
         }
      */
-    char *ffi_createKey(JsonObj payloadJson)
+    char *ffi_createKey(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
@@ -224,6 +460,7 @@ extern "C"
 
         ehsm_keymetadata_t *key_metadata = NULL;
         ehsm_keyblob_t *master_key = NULL;
+        uint32_t keybloblen = 0;
         JSON2STRUCT(payloadJson, key_metadata);
 
         if (key_metadata == NULL)
@@ -233,7 +470,15 @@ extern "C"
             goto out;
         }
 
-        master_key = (ehsm_keyblob_t *)malloc(sizeof(ehsm_keyblob_t));
+        keybloblen = ehsm_get_keyblob_max_size(key_metadata->keyspec);
+        if (keybloblen == 0)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        master_key = (ehsm_keyblob_t *)ffi_malloc(APPEND_SIZE_TO_KEYBLOB_T(keybloblen));
         if (master_key == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
@@ -241,14 +486,13 @@ extern "C"
             goto out;
         }
 
-        master_key->keybloblen = 0;
+        master_key->keybloblen = keybloblen;
         memcpy(&master_key->metadata, key_metadata, sizeof(ehsm_keymetadata_t));
 
         ret = CreateKey(master_key);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto out;
         }
 
@@ -259,27 +503,58 @@ extern "C"
             goto out;
         }
 
-        master_key = (ehsm_keyblob_t *)realloc(master_key, APPEND_SIZE_TO_KEYBLOB_T(master_key->keybloblen));
-        if (master_key == NULL)
+        export_json_from_struct(retJsonObj, master_key, "cmk");
+    out:
+        SAFE_FREE(key_metadata); 
+        SAFE_FREE(master_key);
+        return ffi_to_char(retJsonObj);
+    }
+
+    /**
+     * @brief Rewrap a PEM (v1) asymmetric cmk into the DER (v2) keyblob layout
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    cmk : a base64 string
+                }
+     *
+     * @return char*
+     * [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                cmk : a base64 string
+            }
+        }
+     */
+    char *ffi_upgradeKeyBlob(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        ehsm_status_t ret = EH_OK;
+        ehsm_keyblob_t *cmk = NULL;
+
+        JSON2STRUCT(payloadJson, cmk);
+
+        if (cmk == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        ret = CreateKey(master_key);
+        ret = UpgradeKeyBlob(cmk);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto out;
         }
 
-        export_json_from_struct(retJsonObj, master_key, "cmk");
+        STRUCT2JSON(retJsonObj, cmk);
+
     out:
-        SAFE_FREE(key_metadata); 
-        SAFE_FREE(master_key);
-        return retJsonObj.toChar();
+        SAFE_FREE(cmk);
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -303,7 +578,7 @@ extern "C"
             }
         }
      */
-    char *ffi_encrypt(JsonObj payloadJson)
+    char *ffi_encrypt(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
@@ -312,6 +587,7 @@ extern "C"
         ehsm_data_t *plaintext = NULL;
         ehsm_data_t *aad = NULL;
         ehsm_data_t *ciphertext = NULL;
+        uint32_t ciphertext_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, plaintext);
@@ -324,43 +600,27 @@ extern "C"
             goto out;
         }
 
-        ciphertext = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-        if (ciphertext == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-        ciphertext->datalen = 0;
-
-        ret = Encrypt(cmk, plaintext, aad, ciphertext);
-        if (ret != EH_OK)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        if (ciphertext->datalen == 0 || ciphertext->datalen > UINT16_MAX)
+        ciphertext_len = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
+        if (ciphertext_len == 0 || ciphertext_len > UINT16_MAX)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        ciphertext = (ehsm_data_t *)realloc(ciphertext, APPEND_SIZE_TO_DATA_T(ciphertext->datalen));
+        ciphertext = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(ciphertext_len));
         if (ciphertext == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
+        ciphertext->datalen = ciphertext_len;
 
         ret = Encrypt(cmk, plaintext, aad, ciphertext);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto out;
         }
 
@@ -371,7 +631,7 @@ extern "C"
         SAFE_FREE(aad);
         SAFE_FREE(plaintext);
         SAFE_FREE(ciphertext);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -395,7 +655,7 @@ extern "C"
             }
         }
      */
-    char *ffi_decrypt(JsonObj payloadJson)
+    char *ffi_decrypt(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
@@ -403,6 +663,7 @@ extern "C"
         ehsm_data_t *ciphertext = NULL;
         ehsm_data_t *aad = NULL;
         ehsm_data_t *plaintext = NULL;
+        uint32_t plaintext_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, ciphertext);
@@ -415,37 +676,22 @@ extern "C"
             goto out;
         }
 
-        plaintext = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-        if (plaintext == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-        plaintext->datalen = 0;
-
-        ret = Decrypt(cmk, ciphertext, aad, plaintext);
-        if (ret != EH_OK)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception");
-            goto out;
-        }
-
-        if (plaintext->datalen == 0 || plaintext->datalen > UINT16_MAX)
+        plaintext_len = ehsm_get_plaintext_size(cmk->metadata.keyspec, ciphertext->datalen);
+        if (plaintext_len == 0 || plaintext_len > UINT16_MAX)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        plaintext = (ehsm_data_t *)realloc(plaintext, plaintext->datalen);
+        plaintext = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(plaintext_len));
         if (plaintext == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
+        plaintext->datalen = plaintext_len;
 
         ret = Decrypt(cmk, ciphertext, aad, plaintext);
         if (ret != EH_OK)
@@ -457,8 +703,7 @@ extern "C"
             }
             else
             {
-                retJsonObj.setCode(retJsonObj.CODE_FAILED);
-                retJsonObj.setMessage("Server exception.");
+                ffi_set_failure(retJsonObj, ret);
             }
             goto out;
         }
@@ -470,7 +715,7 @@ extern "C"
         SAFE_FREE(aad);
         SAFE_FREE(plaintext);
         SAFE_FREE(ciphertext);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -493,13 +738,14 @@ extern "C"
             }
         }
      */
-    char *ffi_asymmetricEncrypt(JsonObj payloadJson)
+    char *ffi_asymmetricEncrypt(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
         ehsm_keyblob_t *cmk = NULL;
         ehsm_data_t *plaintext = NULL;
         ehsm_data_t *ciphertext = NULL;
+        uint32_t ciphertext_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, plaintext);
@@ -511,43 +757,27 @@ extern "C"
             goto out;
         }
 
-        ciphertext = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-        if (ciphertext == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-        ciphertext->datalen = 0;
-
-        ret = AsymmetricEncrypt(cmk, plaintext, ciphertext);
-        if (ret != EH_OK)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        if (ciphertext->datalen == 0 || ciphertext->datalen > UINT16_MAX)
+        ciphertext_len = ehsm_get_asymmetric_ciphertext_max_size(cmk->metadata.keyspec, plaintext->datalen);
+        if (ciphertext_len == 0 || ciphertext_len > UINT16_MAX)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        ciphertext = (ehsm_data_t *)realloc(ciphertext, APPEND_SIZE_TO_DATA_T(ciphertext->datalen));
+        ciphertext = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(ciphertext_len));
         if (ciphertext == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
+        ciphertext->datalen = ciphertext_len;
 
         ret = AsymmetricEncrypt(cmk, plaintext, ciphertext);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto out;
         }
 
@@ -557,7 +787,7 @@ extern "C"
         SAFE_FREE(cmk);
         SAFE_FREE(plaintext);
         SAFE_FREE(ciphertext);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -580,13 +810,14 @@ extern "C"
             }
         }
      */
-    char *ffi_asymmetricDecrypt(JsonObj payloadJson)
+    char *ffi_asymmetricDecrypt(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
         ehsm_keyblob_t *cmk = NULL;
         ehsm_data_t *plaintext = NULL;
         ehsm_data_t *ciphertext = NULL;
+        uint32_t plaintext_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, ciphertext);
@@ -598,43 +829,27 @@ extern "C"
             goto out;
         }
 
-        plaintext = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-        if (plaintext == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-        plaintext->datalen = 0;
-
-        ret = AsymmetricDecrypt(cmk, ciphertext, plaintext);
-        if (ret != EH_OK)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        if (plaintext->datalen == 0 || plaintext->datalen > UINT16_MAX)
+        plaintext_len = ehsm_get_asymmetric_plaintext_max_size(cmk->metadata.keyspec, ciphertext->datalen);
+        if (plaintext_len == 0 || plaintext_len > UINT16_MAX)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        plaintext = (ehsm_data_t *)realloc(plaintext, APPEND_SIZE_TO_DATA_T(plaintext->datalen));
+        plaintext = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(plaintext_len));
         if (plaintext == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
+        plaintext->datalen = plaintext_len;
 
         ret = AsymmetricDecrypt(cmk, ciphertext, plaintext);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto out;
         }
         STRUCT2JSON(retJsonObj, plaintext);
@@ -643,7 +858,7 @@ extern "C"
         SAFE_FREE(cmk);
         SAFE_FREE(plaintext);
         SAFE_FREE(ciphertext);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -668,7 +883,7 @@ extern "C"
             }
         }
      */
-    char *ffi_generateDataKey(JsonObj payloadJson)
+    char *ffi_generateDataKey(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
@@ -677,6 +892,7 @@ extern "C"
         uint32_t keylen = payloadJson.readData_uint32("keylen");
         ehsm_data_t *plain_datakey = NULL;
         ehsm_data_t *cipher_datakey = NULL;
+        uint32_t cipher_datakey_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, aad);
@@ -688,39 +904,24 @@ extern "C"
             goto out;
         }
 
-        plain_datakey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(keylen));
-        cipher_datakey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-        if (plain_datakey == NULL || cipher_datakey == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-        plain_datakey->datalen = keylen;
-        cipher_datakey->datalen = 0;
-
-        ret = GenerateDataKey(cmk, aad, plain_datakey, cipher_datakey);
-        if (ret != EH_OK)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        if (cipher_datakey->datalen == 0 || cipher_datakey->datalen > UINT16_MAX)
+        cipher_datakey_len = ehsm_get_ciphertext_size(cmk->metadata.keyspec, keylen);
+        if (cipher_datakey_len == 0 || cipher_datakey_len > UINT16_MAX)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        cipher_datakey = (ehsm_data_t *)realloc(cipher_datakey, APPEND_SIZE_TO_DATA_T(cipher_datakey->datalen));
-        if (cipher_datakey == NULL)
+        plain_datakey = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(keylen));
+        cipher_datakey = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(cipher_datakey_len));
+        if (plain_datakey == NULL || cipher_datakey == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
+        plain_datakey->datalen = keylen;
+        cipher_datakey->datalen = cipher_datakey_len;
 
         ret = GenerateDataKey(cmk, aad, plain_datakey, cipher_datakey);
         if (ret != EH_OK)
@@ -732,8 +933,7 @@ extern "C"
             }
             else
             {
-                retJsonObj.setCode(retJsonObj.CODE_FAILED);
-                retJsonObj.setMessage("Server exception.");
+                ffi_set_failure(retJsonObj, ret);
             }
             goto out;
         }
@@ -746,7 +946,7 @@ extern "C"
         SAFE_FREE(aad);
         SAFE_FREE(plain_datakey);
         SAFE_FREE(cipher_datakey);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -770,7 +970,7 @@ extern "C"
             }
         }
      */
-    char *ffi_generateDataKeyWithoutPlaintext(JsonObj payloadJson)
+    char *ffi_generateDataKeyWithoutPlaintext(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
@@ -779,6 +979,7 @@ extern "C"
         ehsm_data_t *aad = NULL;
         ehsm_data_t *plain_datakey = NULL;
         ehsm_data_t *cipher_datakey = NULL;
+        uint32_t cipher_datakey_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, aad);
@@ -790,39 +991,24 @@ extern "C"
             goto out;
         }
 
-        plain_datakey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(keylen));
-        cipher_datakey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-        if (plain_datakey == NULL || cipher_datakey == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-        plain_datakey->datalen = keylen;
-        cipher_datakey->datalen = 0;
-
-        ret = GenerateDataKeyWithoutPlaintext(cmk, aad, plain_datakey, cipher_datakey);
-        if (ret != EH_OK)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        if (cipher_datakey->datalen == 0 || cipher_datakey->datalen > UINT16_MAX)
+        cipher_datakey_len = ehsm_get_ciphertext_size(cmk->metadata.keyspec, keylen);
+        if (cipher_datakey_len == 0 || cipher_datakey_len > UINT16_MAX)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        cipher_datakey = (ehsm_data_t *)realloc(cipher_datakey, APPEND_SIZE_TO_DATA_T(cipher_datakey->datalen));
-        if (cipher_datakey == NULL)
+        plain_datakey = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(keylen));
+        cipher_datakey = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(cipher_datakey_len));
+        if (plain_datakey == NULL || cipher_datakey == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
+        plain_datakey->datalen = keylen;
+        cipher_datakey->datalen = cipher_datakey_len;
 
         ret = GenerateDataKeyWithoutPlaintext(cmk, aad, plain_datakey, cipher_datakey);
         if (ret != EH_OK)
@@ -834,8 +1020,7 @@ extern "C"
             }
             else
             {
-                retJsonObj.setCode(retJsonObj.CODE_FAILED);
-                retJsonObj.setMessage("Server exception.");
+                ffi_set_failure(retJsonObj, ret);
             }
             goto out;
         }
@@ -847,7 +1032,7 @@ extern "C"
         SAFE_FREE(aad);
         SAFE_FREE(plain_datakey);
         SAFE_FREE(cipher_datakey);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -872,7 +1057,7 @@ extern "C"
             }
         }
      */
-    char *ffi_exportDataKey(JsonObj payloadJson)
+    char *ffi_exportDataKey(const JsonObj &payloadJson)
     {
         ehsm_status_t ret = EH_OK;
         RetJsonObj retJsonObj;
@@ -881,6 +1066,7 @@ extern "C"
         ehsm_data_t *aad = NULL;
         ehsm_data_t *olddatakey = NULL;
         ehsm_data_t *newdatakey = NULL;
+        uint32_t newdatakey_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, ukey);
@@ -894,19 +1080,27 @@ extern "C"
             goto out;
         }
 
-        newdatakey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
+        newdatakey_len = ehsm_get_asymmetric_ciphertext_max_size(ukey->metadata.keyspec,
+                                                                 ehsm_get_plaintext_size(cmk->metadata.keyspec, olddatakey->datalen));
+        if (newdatakey_len == 0 || newdatakey_len > UINT16_MAX)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        newdatakey = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(newdatakey_len));
         if (newdatakey == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
-        newdatakey->datalen = 0;
+        newdatakey->datalen = newdatakey_len;
 
         ret = ExportDataKey(cmk, ukey, aad, olddatakey, newdatakey);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
             if (ret == EH_ARGUMENTS_BAD)
             {
                 retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
@@ -919,49 +1113,7 @@ extern "C"
             }
             else
             {
-                retJsonObj.setCode(retJsonObj.CODE_FAILED);
-                retJsonObj.setMessage("Server exception.");
-            }
-            goto out;
-        }
-
-        if (newdatakey->datalen == 0 || newdatakey->datalen > UINT16_MAX)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        newdatakey = (ehsm_data_t *)realloc(newdatakey, APPEND_SIZE_TO_DATA_T(newdatakey->datalen));
-        if (newdatakey == NULL)
-        {
-            ret = EH_DEVICE_MEMORY;
-            goto out;
-        }
-
-        if (newdatakey->datalen == 0)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
-            retJsonObj.setMessage("Failed datakeylen unavailable.");
-        }
-
-        ret = ExportDataKey(cmk, ukey, aad, olddatakey, newdatakey);
-        if (ret != EH_OK)
-        {
-            if (ret == EH_ARGUMENTS_BAD)
-            {
-                retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
-                retJsonObj.setMessage("Failed, Please confirm that your parameters are correct.");
-            }
-            else if (ret == EH_KEYSPEC_INVALID)
-            {
-                retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
-                retJsonObj.setMessage("key invalid.");
-            }
-            else
-            {
-                retJsonObj.setCode(retJsonObj.CODE_FAILED);
-                retJsonObj.setMessage("Server exception.");
+                ffi_set_failure(retJsonObj, ret);
             }
             goto out;
         }
@@ -974,7 +1126,7 @@ extern "C"
         SAFE_FREE(aad);
         SAFE_FREE(olddatakey);
         SAFE_FREE(newdatakey);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -1003,13 +1155,14 @@ extern "C"
             }
         }
     */
-    char *ffi_sign(JsonObj payloadJson)
+    char *ffi_sign(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
         ehsm_keyblob_t *cmk = NULL;
         ehsm_data_t *digest = NULL;
         ehsm_data_t *signature = NULL;
+        uint32_t signature_len = 0;
 
         JSON2STRUCT(payloadJson, cmk);
         JSON2STRUCT(payloadJson, digest);
@@ -1021,44 +1174,28 @@ extern "C"
             goto out;
         }
 
-        signature = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-        if (signature == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-        signature->datalen = 0;
-
-        ret = Sign(cmk, digest, signature);
-        if (ret != EH_OK)
+        signature_len = ehsm_get_signature_max_size(cmk->metadata.keyspec);
+        if (signature_len == 0)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        if (signature->datalen == 0 || signature->datalen > UINT16_MAX)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            retJsonObj.setMessage("Invalid Parameter.");
             goto out;
         }
 
-        signature = (ehsm_data_t *)realloc(signature, APPEND_SIZE_TO_DATA_T(signature->datalen));
+        signature = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(signature_len));
         if (signature == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
+        signature->datalen = signature_len;
 
         // sign
         ret = Sign(cmk, digest, signature);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto out;
         }
 
@@ -1068,7 +1205,7 @@ extern "C"
         SAFE_FREE(cmk);
         SAFE_FREE(signature);
         SAFE_FREE(digest);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -1098,7 +1235,7 @@ extern "C"
             }
         }
     */
-    char *ffi_verify(JsonObj payloadJson)
+    char *ffi_verify(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
         ehsm_status_t ret = EH_OK;
@@ -1121,8 +1258,7 @@ extern "C"
         ret = Verify(cmk, digest, signature, &result);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto out;
         }
         retJsonObj.addData_bool("result", result);
@@ -1131,7 +1267,275 @@ extern "C"
         SAFE_FREE(cmk);
         SAFE_FREE(signature);
         SAFE_FREE(digest);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
+    }
+
+    /**
+     * @brief compute the hmac of a message with an EH_HMAC cmk
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    cmk : a base64 string,
+                    message : a base64 string,
+                }
+     *
+     * @return char*
+     * [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                mac : a base64 string
+            }
+        }
+     */
+    char *ffi_generateMac(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        ehsm_status_t ret = EH_OK;
+        ehsm_keyblob_t *cmk = NULL;
+        ehsm_data_t *message = NULL;
+        ehsm_data_t *mac = NULL;
+        uint32_t mac_len = 0;
+
+        JSON2STRUCT(payloadJson, cmk);
+        JSON2STRUCT(payloadJson, message);
+
+        if (cmk == NULL || message == NULL)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        mac_len = ehsm_get_mac_size(cmk->metadata.digest_mode);
+        if (cmk->metadata.keyspec != EH_HMAC || mac_len == 0)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        mac = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(mac_len));
+        if (mac == NULL)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Server exception.");
+            goto out;
+        }
+        mac->datalen = mac_len;
+
+        ret = GenerateMac(cmk, message, mac);
+        if (ret != EH_OK)
+        {
+            ffi_set_failure(retJsonObj, ret);
+            goto out;
+        }
+
+        STRUCT2JSON(retJsonObj, mac);
+
+    out:
+        SAFE_FREE(cmk);
+        SAFE_FREE(message);
+        SAFE_FREE(mac);
+        return ffi_to_char(retJsonObj);
+    }
+
+    /**
+     * @brief verify the hmac of a message with an EH_HMAC cmk
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    cmk : a base64 string,
+                    message : a base64 string,
+                    mac : a base64 string
+                }
+     *
+     * @return char*
+     * [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                result : bool
+            }
+        }
+     */
+    char *ffi_verifyMac(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        ehsm_status_t ret = EH_OK;
+        bool result = false;
+        ehsm_keyblob_t *cmk = NULL;
+        ehsm_data_t *message = NULL;
+        ehsm_data_t *mac = NULL;
+
+        JSON2STRUCT(payloadJson, cmk);
+        JSON2STRUCT(payloadJson, message);
+        JSON2STRUCT(payloadJson, mac);
+
+        if (cmk == NULL || message == NULL || mac == NULL)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        ret = VerifyMac(cmk, message, mac, &result);
+        if (ret != EH_OK)
+        {
+            ffi_set_failure(retJsonObj, ret);
+            goto out;
+        }
+        retJsonObj.addData_bool("result", result);
+
+    out:
+        SAFE_FREE(cmk);
+        SAFE_FREE(message);
+        SAFE_FREE(mac);
+        return ffi_to_char(retJsonObj);
+    }
+
+    /**
+     * @brief process several encrypt/decrypt/sign/verify/generate datakey/mac requests
+     * within a single enclave transition, each request gets its own result code
+     *
+     * @param payload : Pass in the requests in the form of JSON string
+                {
+                    requests : [
+                        {
+                            action : int,
+                            [the same parameters as the unbatched action]
+                        }
+                    ]
+                }
+     *
+     * @return char*
+     * [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                results : [
+                    {
+                        action : int,
+                        code : int,
+                        message : string,
+                        [the same result as the unbatched action]
+                    }
+                ]
+            }
+        }
+     */
+    char *ffi_batch(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        ehsm_status_t ret = EH_OK;
+        const Json::Value &requestsJson = payloadJson.readData_JsonValue("requests");
+        Json::Value resultsJson(Json::arrayValue);
+        JsonObj resultJson;
+        ehsm_batch_t header = {0};
+        string packed;
+        ehsm_data_t *requests = NULL;
+        ehsm_data_t *responses = NULL;
+        const uint8_t *cur = NULL;
+        const uint8_t *end = NULL;
+
+        if (!requestsJson.isArray() ||
+            requestsJson.size() == 0 ||
+            requestsJson.size() > EH_BATCH_MAX_ITEMS)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        header.count = requestsJson.size();
+        packed.append((const char *)&header, sizeof(header));
+        for (Json::ArrayIndex i = 0; i < requestsJson.size(); i++)
+        {
+            JsonObj itemJson;
+            itemJson.setJson(requestsJson[i]);
+            if (!batch_pack_item(packed, itemJson))
+            {
+                retJsonObj.setCode(retJsonObj.CODE_FAILED);
+                retJsonObj.setMessage("Invalid Parameter.");
+                goto out;
+            }
+        }
+
+        requests = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(packed.size()));
+        responses = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(0));
+        if (requests == NULL || responses == NULL)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Server exception.");
+            goto out;
+        }
+        requests->datalen = packed.size();
+        memcpy_s(requests->data, requests->datalen, packed.data(), packed.size());
+        responses->datalen = 0;
+
+        // the response capacity is computed outside the enclave
+        ret = Batch(requests, responses);
+        if (ret != EH_OK)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        responses = (ehsm_data_t *)realloc(responses, APPEND_SIZE_TO_DATA_T(responses->datalen));
+        if (responses == NULL)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Server exception.");
+            goto out;
+        }
+
+        ret = Batch(requests, responses);
+        if (ret != EH_OK)
+        {
+            ffi_set_failure(retJsonObj, ret);
+            goto out;
+        }
+
+        cur = responses->data + sizeof(ehsm_batch_t);
+        end = responses->data + responses->datalen;
+        if (((ehsm_batch_t *)responses->data)->count != header.count)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Server exception.");
+            goto out;
+        }
+        for (uint32_t i = 0; i < header.count; i++)
+        {
+            const ehsm_batch_item_t *item = (const ehsm_batch_item_t *)cur;
+
+            if ((size_t)(end - cur) < sizeof(ehsm_batch_item_t) ||
+                (size_t)(end - cur) - sizeof(ehsm_batch_item_t) < item->size)
+            {
+                retJsonObj.setCode(retJsonObj.CODE_FAILED);
+                retJsonObj.setMessage("Server exception.");
+                goto out;
+            }
+            resultsJson.append(batch_unpack_item(item, requestsJson[i]["action"].asUInt()));
+            cur += sizeof(ehsm_batch_item_t) + item->size;
+        }
+
+        resultJson.addData_JsonValue("results", resultsJson);
+        retJsonObj.setResult(resultJson);
+
+    out:
+        if (packed.size() > 0)
+            explicit_bzero(&packed[0], packed.size());
+        if (requests != NULL)
+            explicit_bzero(requests, APPEND_SIZE_TO_DATA_T(requests->datalen));
+        if (responses != NULL)
+            explicit_bzero(responses, APPEND_SIZE_TO_DATA_T(responses->datalen));
+        SAFE_FREE(requests);
+        SAFE_FREE(responses);
+        return ffi_to_char(retJsonObj);
     }
 
     /*
@@ -1214,7 +1618,7 @@ extern "C"
         //     SAFE_FREE(p_msg1);
         //     log_d("msg1: \n%s", retJsonObj.toChar());
         //     log_d("***ffi_RA_HANDSHAKE_MSG0 end.");
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /*
@@ -1289,7 +1693,7 @@ extern "C"
         //     SAFE_FREE(p_msg3);
         //     log_d("msg3: \n%s", retJsonObj.toChar());
         //     log_d("***ffi_RA_HANDSHAKE_MSG2 end.");
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /*
@@ -1399,7 +1803,7 @@ extern "C"
         //     explicit_bzero(p_apikey.data, p_apikey.datalen);
         //     SAFE_FREE(pt_att_result_msg);
         //     SAFE_FREE(cipherapikey.data);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /*
@@ -1424,7 +1828,7 @@ extern "C"
         ehsm_data_t *apikey = NULL;
         ehsm_data_t *appid = NULL;
 
-        appid = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(UUID_STR_LEN));
+        appid = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(UUID_STR_LEN));
         if (appid == NULL)
         {
             ret = EH_DEVICE_MEMORY;
@@ -1432,7 +1836,7 @@ extern "C"
         }
         appid->datalen = UUID_STR_LEN;
 
-        apikey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(EH_API_KEY_SIZE + 1));
+        apikey = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(EH_API_KEY_SIZE + 1));
         if (apikey == NULL)
         {
             ret = EH_DEVICE_MEMORY;
@@ -1443,8 +1847,7 @@ extern "C"
         ret = Enroll(appid, apikey);
         if (ret != EH_OK)
         {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
+            ffi_set_failure(retJsonObj, ret);
             goto OUT;
         }
 
@@ -1456,7 +1859,7 @@ extern "C"
     OUT:
         SAFE_FREE(apikey);
         SAFE_FREE(appid);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -1478,7 +1881,7 @@ extern "C"
      *          }
      *      }
      */
-    char *ffi_generateQuote(JsonObj payloadJson)
+    char *ffi_generateQuote(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
 
@@ -1488,7 +1891,7 @@ extern "C"
         {
             retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
             retJsonObj.setMessage("paramter invalid.");
-            return retJsonObj.toChar();
+            return ffi_to_char(retJsonObj);
         }
         log_d("challenge: \n %s", challenge_base64);
 
@@ -1496,15 +1899,15 @@ extern "C"
         ehsm_data_t *quote;
         string quote_base64;
 
-        quote = (ehsm_data_t *)malloc(sizeof(ehsm_data_t));
+        quote = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(EH_QUOTE_MAX_SIZE));
         if (quote == NULL)
         {
-            retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
-            retJsonObj.setMessage("The cmk's length is invalid.");
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Server exception.");
             goto out;
         }
 
-        quote->datalen = 0;
+        quote->datalen = EH_QUOTE_MAX_SIZE;
         ret = GenerateQuote(quote);
         if (ret != EH_OK)
         {
@@ -1512,7 +1915,6 @@ extern "C"
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
-        log_d("get the quote size successfuly\n");
 
         if (quote->datalen == 0 || quote->datalen > UINT16_MAX)
         {
@@ -1520,25 +1922,9 @@ extern "C"
             retJsonObj.setMessage("Server exception.");
             goto out;
         }
-
-        quote = (ehsm_data_t *)realloc(quote, APPEND_SIZE_TO_DATA_T(quote->datalen));
-        if (quote == NULL)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
-
-        ret = GenerateQuote(quote);
-        if (ret != EH_OK)
-        {
-            retJsonObj.setCode(retJsonObj.CODE_FAILED);
-            retJsonObj.setMessage("Server exception.");
-            goto out;
-        }
         log_d("GenerateQuote successfuly\n");
 
-        quote_base64 = base64_encode(quote->data, quote->datalen);
+        quote_base64 = ffi_base64_encode(quote->data, quote->datalen);
         if (quote_base64.size() <= 0)
         {
             retJsonObj.setCode(retJsonObj.CODE_FAILED);
@@ -1551,7 +1937,7 @@ extern "C"
 
     out:
         SAFE_FREE(quote);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
     }
 
     /**
@@ -1576,7 +1962,7 @@ extern "C"
      *          }
      *      }
      */
-    char *ffi_verifyQuote(JsonObj payloadJson)
+    char *ffi_verifyQuote(const JsonObj &payloadJson)
     {
         RetJsonObj retJsonObj;
 
@@ -1589,30 +1975,30 @@ extern "C"
         {
             retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
             retJsonObj.setMessage("paramter invalid.");
-            return retJsonObj.toChar();
+            return ffi_to_char(retJsonObj);
         }
 
         ehsm_status_t ret = EH_OK;
         bool result = false;
-        ehsm_data_t *quote;
+        ehsm_data_t *quote = NULL;
+        const char *begin = NULL;
+        const char *end = NULL;
 
-        string quote_str = base64_decode(quote_base64);
-        int quote_size = quote_str.size();
-        if (quote_size == 0 || quote_size > EH_QUOTE_MAX_SIZE)
+        ffi_base64_string(payloadJson, "quote", &begin, &end);
+        quote = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(base64_decoded_size(end - begin)));
+        if (quote == NULL)
         {
             retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
-            retJsonObj.setMessage("The quote's length is invalid.");
+            retJsonObj.setMessage("The cmk's length is invalid.");
             goto out;
         }
-        quote = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(quote_size));
-        if (quote == NULL)
+        quote->datalen = ffi_base64_decode_to(begin, end, quote->data);
+        if (quote->datalen == 0 || quote->datalen > EH_QUOTE_MAX_SIZE)
         {
             retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
-            retJsonObj.setMessage("The cmk's length is invalid.");
+            retJsonObj.setMessage("The quote's length is invalid.");
             goto out;
         }
-        quote->datalen = quote_size;
-        memcpy_s(quote->data, quote_size, (uint8_t *)quote_str.data(), quote_size);
 
         ret = VerifyQuote(quote, mr_signer, mr_enclave, &result);
         if (ret != EH_OK)
@@ -1627,7 +2013,8 @@ extern "C"
         retJsonObj.addData_string("nonce", nonce_base64);
 
     out:
-        return retJsonObj.toChar();
+        SAFE_FREE(quote);
+        return ffi_to_char(retJsonObj);
     }
 
     /*
@@ -1647,7 +2034,216 @@ extern "C"
         RetJsonObj retJsonObj;
         retJsonObj.addData_string("version", EHSM_VERSION);
         retJsonObj.addData_string("git_sha", EHSM_GIT_SHA);
-        return retJsonObj.toChar();
+        return ffi_to_char(retJsonObj);
+    }
+
+    /*
+     * @brief Read the latency metrics of the ffi requests and the in-enclave counters, see ehsm_metrics.h
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    format : string, optional, "prometheus" for the Prometheus text format
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {
+     *              "metrics" : the metrics in json, or a string in the Prometheus text format
+     *                          which also carries the in-enclave counters,
+     *              "enclave" : the in-enclave counters in json
+     *          }
+     *      }
+     */
+    char *ffi_getMetrics(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        JsonObj resultJson;
+        ehsm_enclave_stats_t enclave_stats;
+        bool has_enclave_stats = (GetEnclaveStats(&enclave_stats) == EH_OK);
+
+        if (payloadJson.readData_string("format") == "prometheus")
+        {
+            resultJson.addData_string("metrics", metrics_to_prometheus() +
+                                                     (has_enclave_stats ? metrics_enclave_to_prometheus(&enclave_stats) : ""));
+        }
+        else
+        {
+            resultJson.addData_JsonValue("metrics", metrics_to_json());
+            if (has_enclave_stats)
+                resultJson.addData_JsonValue("enclave", metrics_enclave_to_json(&enclave_stats));
+        }
+        retJsonObj.setResult(resultJson);
+        return ffi_to_char(retJsonObj);
+    }
+
+    /*
+     * @brief Change the level of the asynchronous logger at runtime, see log_utils.h
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    level : string, debug|info|warn|error|none
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {}
+     *      }
+     */
+    char *ffi_setLogLevel(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        int level = ehsm_log_parse_level(payloadJson.readData_string("level").c_str(), -1);
+
+        if (level < 0)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
+            retJsonObj.setMessage("The level is invalid.");
+            return ffi_to_char(retJsonObj);
+        }
+        ehsm_log_set_level(level);
+        return ffi_to_char(retJsonObj);
+    }
+
+    /**
+     * @brief Verify the HMAC-SHA256 sign of a REST request by the api key of its appid,
+     * the api key is unwrapped and cached inside the enclave
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    appid : string,
+                    sign_string : string, the sorted request parameters which are signed
+                    sign : a base64 string,
+                    cmk : a base64 string, optional, the cmk of the appid
+                    apikey : a base64 string, optional, the api key encrypted by cmk with the appid as aad
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {
+     *              cached : bool, false if the api key is not cached and no cmk/apikey is given,
+     *              result : bool
+     *          }
+     *      }
+     */
+    char *ffi_verifyRequestSign(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        ehsm_status_t ret = EH_OK;
+        bool cached = false;
+        bool result = false;
+        ehsm_data_t *appid = NULL;
+        ehsm_data_t *sign_string = NULL;
+        ehsm_data_t *sign = NULL;
+        ehsm_keyblob_t *cmk = NULL;
+        ehsm_data_t *apikey = NULL;
+
+        std::string appid_str = payloadJson.readData_string("appid");
+        std::string sign_string_str = payloadJson.readData_string("sign_string");
+
+        appid = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(appid_str.size()));
+        sign_string = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(sign_string_str.size()));
+        if (appid == NULL || sign_string == NULL)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Server exception.");
+            goto out;
+        }
+        appid->datalen = appid_str.size();
+        memcpy(appid->data, appid_str.data(), appid_str.size());
+        sign_string->datalen = sign_string_str.size();
+        memcpy(sign_string->data, sign_string_str.data(), sign_string_str.size());
+
+        JSON2STRUCT(payloadJson, sign);
+        if (payloadJson.hasOwnProperty("cmk") && payloadJson.hasOwnProperty("apikey"))
+        {
+            JSON2STRUCT(payloadJson, cmk);
+            JSON2STRUCT(payloadJson, apikey);
+            if (cmk == NULL || apikey == NULL)
+            {
+                retJsonObj.setCode(retJsonObj.CODE_FAILED);
+                retJsonObj.setMessage("Server exception.");
+                goto out;
+            }
+        }
+
+        if (appid->datalen == 0 || sign == NULL || sign->datalen == 0)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        ret = VerifyRequestSign(appid, sign_string, sign, cmk, apikey, &cached, &result);
+        if (ret != EH_OK)
+        {
+            ffi_set_failure(retJsonObj, ret);
+            goto out;
+        }
+        retJsonObj.addData_bool("cached", cached);
+        retJsonObj.addData_bool("result", result);
+
+    out:
+        SAFE_FREE(appid);
+        SAFE_FREE(sign_string);
+        SAFE_FREE(sign);
+        SAFE_FREE(cmk);
+        SAFE_FREE(apikey);
+        return ffi_to_char(retJsonObj);
+    }
+
+    /**
+     * @brief Forget the api key cached for an appid, e.g. once it is rotated or deleted
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    appid : string
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {}
+     *      }
+     */
+    char *ffi_invalidateApiKey(const JsonObj &payloadJson)
+    {
+        RetJsonObj retJsonObj;
+        ehsm_status_t ret = EH_OK;
+        ehsm_data_t *appid = NULL;
+
+        std::string appid_str = payloadJson.readData_string("appid");
+
+        appid = (ehsm_data_t *)ffi_malloc(APPEND_SIZE_TO_DATA_T(appid_str.size()));
+        if (appid == NULL)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_FAILED);
+            retJsonObj.setMessage("Server exception.");
+            goto out;
+        }
+        appid->datalen = appid_str.size();
+        memcpy(appid->data, appid_str.data(), appid_str.size());
+
+        if (appid->datalen == 0)
+        {
+            retJsonObj.setCode(retJsonObj.CODE_BAD_REQUEST);
+            retJsonObj.setMessage("Invalid Parameter.");
+            goto out;
+        }
+
+        ret = InvalidateApiKey(appid);
+        if (ret != EH_OK)
+            ffi_set_failure(retJsonObj, ret);
+
+    out:
+        SAFE_FREE(appid);
+        return ffi_to_char(retJsonObj);
     }
 
 } // extern "C"
@@ -75,7 +75,25 @@ extern "C"
             }
         }
      */
-    char *ffi_createKey(JsonObj payloadJson);
+    char *ffi_createKey(const JsonObj &payloadJson);
+
+    /*
+    rewrap a PEM (v1) asymmetric cmk into the compact DER (v2) keyblob layout
+    @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    cmk : a base64 string
+                }
+    @return
+    [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                cmk : a base64 string, unchanged if it needs no upgrade
+            }
+        }
+    */
+    char *ffi_upgradeKeyBlob(const JsonObj &payloadJson);
 
     /**
      * @brief encrypt plaintext with specicied key
@@ -98,7 +116,7 @@ extern "C"
             }
         }
      */
-    char *ffi_encrypt(JsonObj payloadJson);
+    char *ffi_encrypt(const JsonObj &payloadJson);
 
     /**
      * @brief decrypt ciphertext with specicied key
@@ -121,7 +139,7 @@ extern "C"
             }
         }
      */
-    char *ffi_decrypt(JsonObj payloadJson);
+    char *ffi_decrypt(const JsonObj &payloadJson);
 
     /**
      * @brief encrypt plaintext with specicied key
@@ -143,7 +161,7 @@ extern "C"
             }
         }
      */
-    char *ffi_asymmetricEncrypt(JsonObj payloadJson);
+    char *ffi_asymmetricEncrypt(const JsonObj &payloadJson);
 
     /**
      * @brief decrypt ciphertext with specicied key
@@ -165,7 +183,7 @@ extern "C"
             }
         }
      */
-    char *ffi_asymmetricDecrypt(JsonObj payloadJson);
+    char *ffi_asymmetricDecrypt(const JsonObj &payloadJson);
 
     /**
      * @brief generate key and encrypt with specicied function
@@ -189,7 +207,7 @@ extern "C"
             }
         }
      */
-    char *ffi_generateDataKey(JsonObj payloadJson);
+    char *ffi_generateDataKey(const JsonObj &payloadJson);
 
     /**
      * @brief generate key and encrypt with specicied function
@@ -212,7 +230,7 @@ extern "C"
             }
         }
      */
-    char *ffi_generateDataKeyWithoutPlaintext(JsonObj payloadJson);
+    char *ffi_generateDataKeyWithoutPlaintext(const JsonObj &payloadJson);
 
     /**
      * @brief pass in a key to decrypt the data key
@@ -236,7 +254,7 @@ extern "C"
             }
         }
      */
-    char *ffi_exportDataKey(JsonObj payloadJson);
+    char *ffi_exportDataKey(const JsonObj &payloadJson);
 
     /**
      * @brief create key sign with rsa/ec/sm2
@@ -257,7 +275,7 @@ extern "C"
             }
         }
      */
-    char *ffi_sign(JsonObj payloadJson);
+    char *ffi_sign(const JsonObj &payloadJson);
 
     /**
      * @brief verify key sign
@@ -279,7 +297,85 @@ extern "C"
             }
         }
      */
-    char *ffi_verify(JsonObj payloadJson);
+    char *ffi_verify(const JsonObj &payloadJson);
+
+    /**
+     * @brief compute the hmac of a message with an EH_HMAC cmk
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    cmk : a base64 string,
+                    message : a base64 string,
+                }
+     *
+     * @return char*
+     * [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                mac : a base64 string
+            }
+        }
+     */
+    char *ffi_generateMac(const JsonObj &payloadJson);
+
+    /**
+     * @brief verify the hmac of a message with an EH_HMAC cmk
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    cmk : a base64 string,
+                    message : a base64 string,
+                    mac : a base64 string
+                }
+     *
+     * @return char*
+     * [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                result : bool
+            }
+        }
+     */
+    char *ffi_verifyMac(const JsonObj &payloadJson);
+
+    /**
+     * @brief process several requests within a single enclave transition
+     *
+     * @param payload : Pass in the requests in the form of JSON string
+                {
+                    requests : [
+                        {
+                            action : int, one of EH_ENCRYPT, EH_DECRYPT, EH_SIGN, EH_VERIFY, EH_GENERATE_DATAKEY,
+                                     EH_GENERATE_MAC, EH_VERIFY_MAC
+                            [the same parameters as the unbatched action]
+                        },
+                        ...
+                    ]
+                }
+     *
+     * @return char*
+     * [string] json string
+        {
+            code: int,
+            message: string,
+            result: {
+                results : [
+                    {
+                        action : int,
+                        code : int,
+                        message : string,
+                        [the same result as the unbatched action]
+                    },
+                    ...
+                ]
+            }
+        }
+     */
+    char *ffi_batch(const JsonObj &payloadJson);
 
     /*
      *  @param p_msg0 : msg0 json string
@@ -362,7 +458,7 @@ extern "C"
      *          }
      *      }
      */
-    char *ffi_generateQuote(JsonObj payloadJson);
+    char *ffi_generateQuote(const JsonObj &payloadJson);
 
     /**
      * @brief Users are expected already got a valid DCAP format QUOTE.
@@ -386,7 +482,7 @@ extern "C"
      *          }
      *      }
      */
-    char *ffi_verifyQuote(JsonObj payloadJson);
+    char *ffi_verifyQuote(const JsonObj &payloadJson);
 
     /*
      *  @return
@@ -402,6 +498,86 @@ extern "C"
      */
     char *ffi_getVersion();
 
+    /*
+     * @brief Read the latency metrics of the ffi requests and the in-enclave counters, see ehsm_metrics.h
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    format : string, optional, "prometheus" for the Prometheus text format
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {
+     *              "metrics" : the metrics in json, or a string in the Prometheus text format
+     *                          which also carries the in-enclave counters,
+     *              "enclave" : the in-enclave counters in json
+     *          }
+     *      }
+     */
+    char *ffi_getMetrics(const JsonObj &payloadJson);
+
+    /*
+     * @brief Change the level of the asynchronous logger at runtime, see log_utils.h
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    level : string, debug|info|warn|error|none
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {}
+     *      }
+     */
+    char *ffi_setLogLevel(const JsonObj &payloadJson);
+
+    /**
+     * @brief Verify the HMAC-SHA256 sign of a REST request by the api key of its appid,
+     * the api key is unwrapped and cached inside the enclave
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    appid : string,
+                    sign_string : string, the sorted request parameters which are signed
+                    sign : a base64 string,
+                    cmk : a base64 string, optional, the cmk of the appid
+                    apikey : a base64 string, optional, the api key encrypted by cmk with the appid as aad
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {
+     *              cached : bool, false if the api key is not cached and no cmk/apikey is given,
+     *              result : bool
+     *          }
+     *      }
+     */
+    char *ffi_verifyRequestSign(const JsonObj &payloadJson);
+
+    /**
+     * @brief Forget the api key cached for an appid, e.g. once it is rotated or deleted
+     *
+     * @param payload : Pass in the key parameter in the form of JSON string
+                {
+                    appid : string
+                }
+     *  @return
+     *  [string] json string
+     *      {
+     *          code: int,
+     *          message: string,
+     *          result: {}
+     *      }
+     */
+    char *ffi_invalidateApiKey(const JsonObj &payloadJson);
+
 } // extern "C"
 
 #endif
\ No newline at end of file
@@ -34,110 +34,239 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <errno.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "fifo_def.h"
 #include "log_utils.h"
 
-#define SERVER_ADDR "127.0.0.1"
-#define SERVER_PORT 8888
+#define UNIX_DOMAIN "/var/run/ehsm/dkeyprovision.sock"
 
-#define BUFFER_SIZE 1024
+#define CONNECT_RETRY_COUNT 100
+#define CONNECT_RETRY_INTERVAL_US 500000 // 0.5 s
+#define RESPONSE_TIMEOUT_S 30
 
-#define UNIX_DOMAIN "/var/run/ehsm/dkeyprovision.sock"
+/*
+ * All local-attestation traffic of this process to dkeycache shares one
+ * AF_UNIX connection. Each request carries a reqid in its header, a reader
+ * thread hands every response to the caller waiting on that reqid, and so
+ * several LA exchanges can be in flight on the same connection. When the
+ * connection drops, callers still waiting are failed and the next request
+ * reconnects.
+ */
+struct fifo_conn_t
+{
+    int fd;
+    std::mutex send_lock; // keeps frames from interleaving on the socket
 
-/* Function Description: this is for client to send request message and receive response message
- * Parameter Description:
- * [input] fiforequest: this is pointer to request message
- * [input] fiforequest_size: this is request message size
- * [output] fiforesponse: this is pointer fo response message, the buffer is allocated inside this function
- * [output] fiforesponse_size: this is response message size
+    explicit fifo_conn_t(int sockfd) : fd(sockfd) {}
+    ~fifo_conn_t() { close(fd); }
+};
+
+struct fifo_waiter_t
+{
+    fifo_conn_t *conn; // connection the request went out on
+    bool done;
+    FIFO_MSG *response; // NULL if the connection dropped first
+};
+
+static std::mutex g_fifo_connect_lock; // serializes (re)connecting
+static std::mutex g_fifo_lock;         // guards everything below
+static std::condition_variable g_fifo_cond;
+static std::shared_ptr<fifo_conn_t> g_fifo_conn;
+static uint32_t g_fifo_next_reqid = 1;
+static std::map<uint32_t, fifo_waiter_t *> g_fifo_pending;
+
+/* Function Description: stop using a connection and fail every request still waiting on it
+ * The fd itself is closed once the last reference to the connection goes away.
  * */
-int client_send_receive(FIFO_MSG *fiforequest, size_t fiforequest_size, FIFO_MSG **fiforesponse, size_t *fiforesponse_size)
+static void fifo_drop_connection(fifo_conn_t *conn)
+{
+    std::lock_guard<std::mutex> lock(g_fifo_lock);
+
+    if (g_fifo_conn.get() == conn)
+        g_fifo_conn.reset();
+    shutdown(conn->fd, SHUT_RDWR);
+
+    for (auto it = g_fifo_pending.begin(); it != g_fifo_pending.end();)
+    {
+        if (it->second->conn == conn)
+        {
+            it->second->done = true;
+            it = g_fifo_pending.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    g_fifo_cond.notify_all();
+}
+
+static void fifo_reader(std::shared_ptr<fifo_conn_t> conn)
 {
-    int retry_count = 100;
-    int ret = 0;
-    long byte_num;
-    char recv_msg[BUFFER_SIZE + 1] = {0};
     FIFO_MSG *response = NULL;
 
-    struct sockaddr_un server_addr;
-    int server_sock_fd = socket(PF_UNIX, SOCK_STREAM, 0);
-    if (server_sock_fd == -1)
+    while ((response = fifo_recv_msg(conn->fd)) != NULL)
     {
-        log_e("socket error");
-        return -1;
+        std::lock_guard<std::mutex> lock(g_fifo_lock);
+
+        auto it = g_fifo_pending.find(response->header.reqid);
+        if (it == g_fifo_pending.end())
+        {
+            // the caller gave up waiting for it
+            log_w("dropped response for unknown request %u", response->header.reqid);
+            free(response);
+            continue;
+        }
+        it->second->response = response;
+        it->second->done = true;
+        g_fifo_pending.erase(it);
+        g_fifo_cond.notify_all();
     }
 
+    log_w("connection to dkeycache closed.");
+    fifo_drop_connection(conn.get());
+}
+
+static int fifo_connect()
+{
+    int retry_count = CONNECT_RETRY_COUNT;
+    struct sockaddr_un server_addr;
+
+    memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sun_family = AF_UNIX;
-    strcpy(server_addr.sun_path, UNIX_DOMAIN);
+    strncpy(server_addr.sun_path, UNIX_DOMAIN, sizeof(server_addr.sun_path) - 1);
 
     do
     {
-        if (connect(server_sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) >= 0)
-            break;
-        else if (retry_count > 0)
+        int sockfd = socket(PF_UNIX, SOCK_STREAM, 0);
+        if (sockfd == -1)
         {
-            log_w("failed to connect, sleep 0.5s and try again...");
-            usleep(500000); // 0.5 s
+            log_e("socket error, %s.", strerror(errno));
+            return -1;
         }
-        else
+        if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) >= 0)
+            return sockfd;
+        close(sockfd);
+
+        if (retry_count > 0)
         {
-            log_e("connection error, %s, line %d.", strerror(errno), __LINE__);
-            goto CLEAN;
+            log_w("failed to connect, sleep 0.5s and try again...");
+            usleep(CONNECT_RETRY_INTERVAL_US);
         }
     } while (retry_count-- > 0);
 
-    if ((byte_num = send(server_sock_fd, reinterpret_cast<char *>(fiforequest), static_cast<int>(fiforequest_size), 0)) == -1)
+    log_e("connection error, %s, line %d.", strerror(errno), __LINE__);
+    return -1;
+}
+
+/* Function Description: return the shared connection to dkeycache, connecting first if there is none */
+static std::shared_ptr<fifo_conn_t> fifo_get_connection()
+{
+    std::lock_guard<std::mutex> connect_lock(g_fifo_connect_lock);
     {
-        log_e("connection error, %s, line %d..", strerror(errno), __LINE__);
-        ret = -1;
-        goto CLEAN;
+        std::lock_guard<std::mutex> lock(g_fifo_lock);
+        if (g_fifo_conn)
+            return g_fifo_conn;
     }
 
-    byte_num = recv(server_sock_fd, reinterpret_cast<char *>(recv_msg), BUFFER_SIZE, 0);
-    if (byte_num > 0)
+    int sockfd = fifo_connect();
+    if (sockfd < 0)
+        return nullptr;
+
+    std::shared_ptr<fifo_conn_t> conn = std::make_shared<fifo_conn_t>(sockfd);
     {
-        if (byte_num > BUFFER_SIZE)
-        {
-            byte_num = BUFFER_SIZE;
-        }
+        std::lock_guard<std::mutex> lock(g_fifo_lock);
+        g_fifo_conn = conn;
+    }
+    std::thread(fifo_reader, conn).detach();
 
-        recv_msg[byte_num] = '\0';
+    return conn;
+}
+
+/* Function Description: this is for client to send request message and receive response message
+ * Parameter Description:
+ * [input] fiforequest: this is pointer to request message, header.size bytes of msgbuf are sent
+ * [input] fiforequest_size: this is request message size
+ * [output] fiforesponse: this is pointer fo response message, the buffer is allocated inside this function
+ * [output] fiforesponse_size: this is response message size
+ * */
+int client_send_receive(FIFO_MSG *fiforequest, size_t fiforequest_size, FIFO_MSG **fiforesponse, size_t *fiforesponse_size)
+{
+    fifo_waiter_t waiter = {NULL, false, NULL};
+    uint32_t reqid = 0;
+    bool sent = false;
+
+    if (fiforequest == NULL || fiforesponse == NULL || fiforesponse_size == NULL)
+        return -1;
+    if (fiforequest_size < sizeof(FIFO_MSG_HEADER) + fiforequest->header.size)
+    {
+        log_e("request message is shorter than its header claims.");
+        return -1;
+    }
+
+    // a request that never made it out is retried once on a fresh connection
+    for (int attempt = 0; attempt < 2 && !sent; attempt++)
+    {
+        std::shared_ptr<fifo_conn_t> conn = fifo_get_connection();
+        if (!conn)
+            return -1;
 
-        response = (FIFO_MSG *)malloc((size_t)byte_num);
-        if (!response)
         {
-            printf("memory allocation failure.\n");
-            ret = -1;
-            goto CLEAN;
+            std::lock_guard<std::mutex> lock(g_fifo_lock);
+            reqid = g_fifo_next_reqid++;
+            waiter.conn = conn.get();
+            g_fifo_pending[reqid] = &waiter;
         }
-        memset(response, 0, (size_t)byte_num);
+        fiforequest->header.reqid = reqid;
 
-        memcpy(response, recv_msg, (size_t)byte_num);
-
-        *fiforesponse = response;
-        *fiforesponse_size = (size_t)byte_num;
+        {
+            std::lock_guard<std::mutex> send_lock(conn->send_lock);
+            sent = (fifo_send_msg(conn->fd, fiforequest) == 0);
+        }
+        if (!sent)
+        {
+            log_w("failed to send to dkeycache, %s, reconnecting.", strerror(errno));
+            {
+                std::lock_guard<std::mutex> lock(g_fifo_lock);
+                g_fifo_pending.erase(reqid);
+            }
+            fifo_drop_connection(conn.get());
+        }
+    }
+    if (!sent)
+        return -1;
 
-        ret = 0;
+    std::unique_lock<std::mutex> lock(g_fifo_lock);
+    if (!g_fifo_cond.wait_for(lock, std::chrono::seconds(RESPONSE_TIMEOUT_S), [&waiter]
+                              { return waiter.done; }))
+    {
+        g_fifo_pending.erase(reqid);
+        log_e("timed out waiting for dkeycache response.");
+        return -1;
     }
-    else if (byte_num < 0)
+    if (waiter.response == NULL)
     {
-        printf("server error, error message is %s!\n", strerror(errno));
-        ret = -1;
+        log_e("connection to dkeycache lost before the response arrived.");
+        return -1;
     }
-    else
+    if (waiter.response->header.type == FIFO_DH_ERROR_RESP)
     {
-        printf("server exit!\n");
-        ret = -1;
+        log_e("dkeycache failed to process request %u.", reqid);
+        free(waiter.response);
+        return -1;
     }
 
-CLEAN:
-    close(server_sock_fd);
+    *fiforesponse = waiter.response;
+    *fiforesponse_size = sizeof(FIFO_MSG_HEADER) + waiter.response->header.size;
 
-    return ret;
+    return 0;
 }
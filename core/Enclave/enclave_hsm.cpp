@@ -31,9 +31,15 @@
 
 #include "enclave_hsm_t.h"
 #include "openssl/rand.h"
+#include "openssl/hmac.h"
+#include "openssl/crypto.h"
 #include "datatypes.h"
 #include "key_factory.h"
 #include "key_operation.h"
+#include "key_cache.h"
+#include "key_pool.h"
+#include "key_stream.h"
+#include "enclave_stats.h"
 
 using namespace std;
 
@@ -84,31 +90,6 @@ static uint32_t get_asymmetric_max_encrypt_plaintext_size(ehsm_keyspec_t keyspec
     }
 }
 
-static size_t get_signature_length(ehsm_keyspec_t keyspec)
-{
-    switch (keyspec)
-    {
-    case EH_RSA_2048:
-        return RSA_OAEP_2048_SIGNATURE_SIZE;
-    case EH_RSA_3072:
-        return RSA_OAEP_3072_SIGNATURE_SIZE;
-    case EH_RSA_4096:
-        return RSA_OAEP_4096_SIGNATURE_SIZE;
-    case EH_EC_P256:
-        return EC_P256_SIGNATURE_MAX_SIZE;
-    case EH_EC_P224:
-        return EC_P224_SIGNATURE_MAX_SIZE;
-    case EH_EC_P384:
-        return EC_P384_SIGNATURE_MAX_SIZE;
-    case EH_EC_P521:
-        return EC_P521_SIGNATURE_MAX_SIZE;
-    case EH_SM2:
-        return EC_SM2_SIGNATURE_MAX_SIZE;
-    default:
-        return -1;
-    }
-}
-
 sgx_status_t enclave_create_key(ehsm_keyblob_t *cmk, size_t cmk_size)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
@@ -120,6 +101,8 @@ sgx_status_t enclave_create_key(ehsm_keyblob_t *cmk, size_t cmk_size)
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
+    uint64_t stats_start = ehsm_stats_begin();
+
     switch (cmk->metadata.keyspec)
     {
     case EH_AES_GCM_128:
@@ -145,13 +128,29 @@ sgx_status_t enclave_create_key(ehsm_keyblob_t *cmk, size_t cmk_size)
     case EH_SM4_CBC:
         ret = ehsm_create_sm4_key(cmk);
         break;
+    case EH_HMAC:
+        ret = ehsm_create_hmac_key(cmk);
+        break;
     default:
         ret = SGX_ERROR_INVALID_PARAMETER;
     }
 
+    ehsm_stats_end(EH_STATS_CREATE_KEY, cmk->metadata.keyspec, stats_start);
     return ret;
 }
 
+sgx_status_t enclave_upgrade_keyblob(ehsm_keyblob_t *cmk, size_t cmk_size)
+{
+    if (cmk == NULL ||
+        cmk_size != APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen) ||
+        cmk->metadata.origin != EH_INTERNAL_KEY)
+    {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    return ehsm_upgrade_keyblob(cmk);
+}
+
 sgx_status_t enclave_encrypt(ehsm_keyblob_t *cmk, size_t cmk_size,
                              ehsm_data_t *aad, size_t aad_size,
                              ehsm_data_t *plaintext, size_t plaintext_size,
@@ -182,6 +181,8 @@ sgx_status_t enclave_encrypt(ehsm_keyblob_t *cmk, size_t cmk_size,
         ciphertext_size != APPEND_SIZE_TO_DATA_T(ciphertext->datalen))
         return SGX_ERROR_INVALID_PARAMETER;
 
+    uint64_t stats_start = ehsm_stats_begin();
+
     switch (cmk->metadata.keyspec)
     {
     case EH_AES_GCM_128:
@@ -199,6 +200,7 @@ sgx_status_t enclave_encrypt(ehsm_keyblob_t *cmk, size_t cmk_size,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
+    ehsm_stats_end(EH_STATS_ENCRYPT, cmk->metadata.keyspec, stats_start);
     return ret;
 }
 
@@ -230,6 +232,8 @@ sgx_status_t enclave_decrypt(ehsm_keyblob_t *cmk, size_t cmk_size,
         ciphertext->datalen == 0)
         return SGX_ERROR_INVALID_PARAMETER;
 
+    uint64_t stats_start = ehsm_stats_begin();
+
     switch (cmk->metadata.keyspec)
     {
     case EH_AES_GCM_128:
@@ -247,6 +251,7 @@ sgx_status_t enclave_decrypt(ehsm_keyblob_t *cmk, size_t cmk_size,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
+    ehsm_stats_end(EH_STATS_DECRYPT, cmk->metadata.keyspec, stats_start);
     return ret;
 }
 
@@ -273,6 +278,8 @@ sgx_status_t enclave_asymmetric_encrypt(const ehsm_keyblob_t *cmk, size_t cmk_si
         ciphertext_size != APPEND_SIZE_TO_DATA_T(ciphertext->datalen))
         return SGX_ERROR_INVALID_PARAMETER;
 
+    uint64_t stats_start = ehsm_stats_begin();
+
     switch (cmk->metadata.keyspec)
     {
     case EH_RSA_2048:
@@ -286,6 +293,7 @@ sgx_status_t enclave_asymmetric_encrypt(const ehsm_keyblob_t *cmk, size_t cmk_si
     default:
         return SGX_ERROR_INVALID_PARAMETER;
     }
+    ehsm_stats_end(EH_STATS_ASYMMETRIC_ENCRYPT, cmk->metadata.keyspec, stats_start);
     return ret;
 }
 
@@ -310,6 +318,8 @@ sgx_status_t enclave_asymmetric_decrypt(const ehsm_keyblob_t *cmk, size_t cmk_si
         ciphertext->datalen == 0)
         return SGX_ERROR_INVALID_PARAMETER;
 
+    uint64_t stats_start = ehsm_stats_begin();
+
     switch (cmk->metadata.keyspec)
     {
     case EH_RSA_2048:
@@ -323,6 +333,7 @@ sgx_status_t enclave_asymmetric_decrypt(const ehsm_keyblob_t *cmk, size_t cmk_si
     default:
         return SGX_ERROR_INVALID_PARAMETER;
     }
+    ehsm_stats_end(EH_STATS_ASYMMETRIC_DECRYPT, cmk->metadata.keyspec, stats_start);
     return ret;
 }
 
@@ -359,11 +370,12 @@ sgx_status_t enclave_sign(const ehsm_keyblob_t *cmk, size_t cmk_size,
     // Set signature data length
     if (signature->datalen == 0)
     {
-        signature->datalen = get_signature_length(cmk->metadata.keyspec);
+        signature->datalen = ehsm_get_signature_max_size(cmk->metadata.keyspec);
         return SGX_SUCCESS;
     }
-    if (signature->datalen == -1 ||
-        signature->datalen != get_signature_length(cmk->metadata.keyspec))
+    // any buffer which fits the longest signature will do, the exact length is reported back
+    if (ehsm_get_signature_max_size(cmk->metadata.keyspec) == 0 ||
+        signature->datalen < ehsm_get_signature_max_size(cmk->metadata.keyspec))
     {
         log_d("ecall sign cant get signature length or ecall sign signature length error.\n");
         return SGX_ERROR_INVALID_PARAMETER;
@@ -376,6 +388,8 @@ sgx_status_t enclave_sign(const ehsm_keyblob_t *cmk, size_t cmk_size,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
+    uint64_t stats_start = ehsm_stats_begin();
+
     switch (cmk->metadata.keyspec)
     {
     case EH_RSA_2048:
@@ -403,6 +417,7 @@ sgx_status_t enclave_sign(const ehsm_keyblob_t *cmk, size_t cmk_size,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
+    ehsm_stats_end(EH_STATS_SIGN, cmk->metadata.keyspec, stats_start);
     return ret;
 }
 
@@ -451,12 +466,14 @@ sgx_status_t enclave_verify(const ehsm_keyblob_t *cmk, size_t cmk_size,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
+    uint64_t stats_start = ehsm_stats_begin();
+
     switch (cmk->metadata.keyspec)
     {
     case EH_RSA_2048:
     case EH_RSA_3072:
     case EH_RSA_4096:
-        if (signature->datalen != get_signature_length(cmk->metadata.keyspec))
+        if (signature->datalen != ehsm_get_signature_max_size(cmk->metadata.keyspec))
         {
             log_d("ecall verify cant get signature length or ecall sign signature length error.\n");
             return SGX_ERROR_INVALID_PARAMETER;
@@ -488,6 +505,99 @@ sgx_status_t enclave_verify(const ehsm_keyblob_t *cmk, size_t cmk_size,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
+    ehsm_stats_end(EH_STATS_VERIFY, cmk->metadata.keyspec, stats_start);
+    return ret;
+}
+
+/**
+ * @brief compute the mac of a message with an EH_HMAC cmk
+ *
+ * @param cmk storage the key metadata and keyblob
+ * @param cmk_size size of input cmk
+ * @param message message to be authenticated
+ * @param message_size size of input message
+ * @param mac generated mac, its length is reported back when mac->datalen is 0
+ * @param mac_size size of input mac
+ * @return ehsm_status_t
+ */
+sgx_status_t enclave_generate_mac(const ehsm_keyblob_t *cmk, size_t cmk_size,
+                                  const ehsm_data_t *message, size_t message_size,
+                                  ehsm_data_t *mac, size_t mac_size)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (cmk == NULL ||
+        cmk_size != APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen) ||
+        cmk->keybloblen == 0 ||
+        cmk->metadata.origin != EH_INTERNAL_KEY ||
+        cmk->metadata.keyspec != EH_HMAC)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (mac == NULL ||
+        mac_size != APPEND_SIZE_TO_DATA_T(mac->datalen))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (mac->datalen == 0)
+    {
+        mac->datalen = ehsm_get_mac_size(cmk->metadata.digest_mode);
+        return SGX_SUCCESS;
+    }
+
+    if (message == NULL ||
+        message_size != APPEND_SIZE_TO_DATA_T(message->datalen) ||
+        message->datalen == 0 ||
+        message->datalen > EH_MAC_MESSAGE_MAX_SIZE)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    uint64_t stats_start = ehsm_stats_begin();
+    ret = ehsm_hmac_generate(cmk, message, mac);
+    ehsm_stats_end(EH_STATS_GENERATE_MAC, cmk->metadata.keyspec, stats_start);
+
+    return ret;
+}
+
+/**
+ * @brief check the mac of a message with an EH_HMAC cmk
+ *
+ * @param cmk storage the key metadata and keyblob
+ * @param cmk_size size of input cmk
+ * @param message authenticated message
+ * @param message_size size of input message
+ * @param mac the mac to check
+ * @param mac_size size of input mac
+ * @param result mac match result
+ * @return ehsm_status_t
+ */
+sgx_status_t enclave_verify_mac(const ehsm_keyblob_t *cmk, size_t cmk_size,
+                                const ehsm_data_t *message, size_t message_size,
+                                const ehsm_data_t *mac, size_t mac_size,
+                                bool *result)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (cmk == NULL ||
+        cmk_size != APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen) ||
+        cmk->keybloblen == 0 ||
+        cmk->metadata.origin != EH_INTERNAL_KEY ||
+        cmk->metadata.keyspec != EH_HMAC)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (message == NULL ||
+        message_size != APPEND_SIZE_TO_DATA_T(message->datalen) ||
+        message->datalen == 0 ||
+        message->datalen > EH_MAC_MESSAGE_MAX_SIZE)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (mac == NULL ||
+        mac_size != APPEND_SIZE_TO_DATA_T(mac->datalen) ||
+        mac->datalen == 0 ||
+        result == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    uint64_t stats_start = ehsm_stats_begin();
+    ret = ehsm_hmac_verify(cmk, message, mac, result);
+    ehsm_stats_end(EH_STATS_VERIFY_MAC, cmk->metadata.keyspec, stats_start);
+
     return ret;
 }
 
@@ -535,40 +645,25 @@ sgx_status_t enclave_generate_datakey(ehsm_keyblob_t *cmk, size_t cmk_size,
 
     if (ciphertext->datalen == 0)
     {
-        switch (cmk->metadata.keyspec)
-        {
-        case EH_AES_GCM_128:
-        case EH_AES_GCM_192:
-        case EH_AES_GCM_256:
-            ciphertext->datalen = plaintext->datalen + EH_AES_GCM_IV_SIZE + EH_AES_GCM_MAC_SIZE;
-            return SGX_SUCCESS;
-        case EH_SM4_CBC:
-            if (plaintext->datalen % 16 != 0)
-            {
-                ciphertext->datalen = (plaintext->datalen / 16 + 1) * 16 + SGX_SM4_IV_SIZE;
-                return SGX_SUCCESS;
-            }
-            ciphertext->datalen = plaintext->datalen + SGX_SM4_IV_SIZE;
-            return SGX_SUCCESS;
-        case EH_SM4_CTR:
-            ciphertext->datalen = plaintext->datalen + SGX_SM4_IV_SIZE;
-            return SGX_SUCCESS;
-        default:
-            return SGX_ERROR_INVALID_PARAMETER;
-        }
+        ciphertext->datalen = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
+        return ciphertext->datalen != 0 ? SGX_SUCCESS : SGX_ERROR_INVALID_PARAMETER;
     }
 
     uint8_t *temp_datakey = NULL;
+    uint64_t stats_start = ehsm_stats_begin();
+    uint64_t rand_start = 0;
 
     temp_datakey = (uint8_t *)malloc(plaintext->datalen);
     if (temp_datakey == NULL)
         return SGX_ERROR_OUT_OF_MEMORY;
 
+    rand_start = ehsm_stats_begin();
     if (sgx_read_rand(temp_datakey, plaintext->datalen) != SGX_SUCCESS)
     {
         free(temp_datakey);
         return SGX_ERROR_OUT_OF_MEMORY;
     }
+    ehsm_stats_end(EH_STATS_READ_RAND, cmk->metadata.keyspec, rand_start);
 
     memcpy_s(plaintext->data, plaintext->datalen, temp_datakey, plaintext->datalen);
 
@@ -597,6 +692,7 @@ sgx_status_t enclave_generate_datakey(ehsm_keyblob_t *cmk, size_t cmk_size,
     }
     memset_s(temp_datakey, plaintext->datalen, 0, plaintext->datalen);
     free(temp_datakey);
+    ehsm_stats_end(EH_STATS_GENERATE_DATAKEY, cmk->metadata.keyspec, stats_start);
     return ret;
 }
 
@@ -634,39 +730,26 @@ sgx_status_t enclave_export_datakey(ehsm_keyblob_t *cmk, size_t cmk_size,
 
     ehsm_data_t *tmp_datakey = NULL;
     size_t tmp_datakey_size = 0;
-    tmp_datakey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(0));
-    if (tmp_datakey == NULL)
-    {
-        ret = SGX_ERROR_INVALID_PARAMETER;
-        goto out;
-    }
+    uint32_t tmp_datakey_len = 0;
+    uint64_t stats_start = ehsm_stats_begin();
 
     // datakey plaintext
-    // to calc the plaintext len
-    switch (cmk->metadata.keyspec)
+    tmp_datakey_len = ehsm_get_plaintext_size(cmk->metadata.keyspec, olddatakey->datalen);
+    if (tmp_datakey_len == 0)
     {
-    case EH_AES_GCM_128:
-    case EH_AES_GCM_192:
-    case EH_AES_GCM_256:
-        tmp_datakey->datalen = olddatakey->datalen - EH_AES_GCM_IV_SIZE - EH_AES_GCM_MAC_SIZE;
-        tmp_datakey_size = APPEND_SIZE_TO_DATA_T(tmp_datakey->datalen);
-        break;
-    case EH_SM4_CBC:
-    case EH_SM4_CTR:
-        tmp_datakey->datalen = olddatakey->datalen - SGX_SM4_IV_SIZE;
-        tmp_datakey_size = APPEND_SIZE_TO_DATA_T(tmp_datakey->datalen);
-        break;
-    default:
         ret = SGX_ERROR_INVALID_PARAMETER;
         goto out;
     }
-    tmp_datakey = (ehsm_data_t *)realloc(tmp_datakey, APPEND_SIZE_TO_DATA_T(tmp_datakey->datalen));
+
+    tmp_datakey = (ehsm_data_t *)malloc(APPEND_SIZE_TO_DATA_T(tmp_datakey_len));
     if (tmp_datakey == NULL)
     {
-        tmp_datakey_size = 0;
-        ret = SGX_ERROR_INVALID_PARAMETER;
+        ret = SGX_ERROR_OUT_OF_MEMORY;
         goto out;
     }
+    tmp_datakey->datalen = tmp_datakey_len;
+    tmp_datakey_size = APPEND_SIZE_TO_DATA_T(tmp_datakey_len);
+
     // decrypt olddatakey using cmk
     switch (cmk->metadata.keyspec)
     {
@@ -710,9 +793,390 @@ out:
         memset_s(tmp_datakey, tmp_datakey_size, 0, tmp_datakey_size);
 
     SAFE_FREE(tmp_datakey);
+    ehsm_stats_end(EH_STATS_EXPORT_DATAKEY, cmk->metadata.keyspec, stats_start);
+    return ret;
+}
+
+/* take the next packed ehsm_keyblob_t of a batch item payload */
+static ehsm_keyblob_t *batch_pop_keyblob(uint8_t **cur, const uint8_t *end, size_t *size)
+{
+    ehsm_keyblob_t *keyblob = (ehsm_keyblob_t *)*cur;
+
+    if ((size_t)(end - *cur) < sizeof(ehsm_keyblob_t) ||
+        (size_t)(end - *cur) - sizeof(ehsm_keyblob_t) < keyblob->keybloblen)
+        return NULL;
+
+    *size = APPEND_SIZE_TO_KEYBLOB_T(keyblob->keybloblen);
+    *cur += *size;
+    return keyblob;
+}
+
+/* take the next packed ehsm_data_t of a batch item payload */
+static ehsm_data_t *batch_pop_data(uint8_t **cur, const uint8_t *end, size_t *size)
+{
+    ehsm_data_t *data = (ehsm_data_t *)*cur;
+
+    if ((size_t)(end - *cur) < sizeof(ehsm_data_t) ||
+        (size_t)(end - *cur) - sizeof(ehsm_data_t) < data->datalen)
+        return NULL;
+
+    *size = APPEND_SIZE_TO_DATA_T(data->datalen);
+    *cur += *size;
+    return data;
+}
+
+/* reserve an ehsm_data_t of datalen bytes at the end of a batch item response */
+static ehsm_data_t *batch_push_data(uint8_t *out, size_t out_capacity, size_t *out_size, uint32_t datalen)
+{
+    ehsm_data_t *data = (ehsm_data_t *)(out + *out_size);
+
+    if (out_capacity - *out_size < APPEND_SIZE_TO_DATA_T((size_t)datalen))
+        return NULL;
+
+    data->datalen = datalen;
+    *out_size += APPEND_SIZE_TO_DATA_T((size_t)datalen);
+    return data;
+}
+
+/**
+ * @brief Process one item of a batch by the same ecall implementation which serves it
+ * unbatched, the outputs are sized from the shared size table so each item runs once
+ *
+ * @param item the packed request item
+ * @param out the payload of the response item
+ * @param out_capacity free space left in the response
+ * @param out_size bytes of out written by this item, also set when it fails
+ * @return sgx_status_t
+ */
+static sgx_status_t batch_process_item(const ehsm_batch_item_t *item,
+                                       uint8_t *out, size_t out_capacity,
+                                       size_t *out_size)
+{
+    sgx_status_t ret = SGX_ERROR_INVALID_PARAMETER;
+    uint8_t *cur = (uint8_t *)item->payload;
+    const uint8_t *end = item->payload + item->size;
+    size_t cmk_size = 0, aad_size = 0, in_size = 0, signature_size = 0;
+    ehsm_keyblob_t *cmk = NULL;
+    ehsm_data_t *aad = NULL;
+    ehsm_data_t *in = NULL;
+    ehsm_data_t *signature = NULL;
+    ehsm_data_t *result = NULL;
+    ehsm_data_t *plaintext = NULL;
+    uint32_t result_len = 0;
+    bool verified = false;
+
+    *out_size = 0;
+
+    cmk = batch_pop_keyblob(&cur, end, &cmk_size);
+    if (cmk == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    switch (item->action)
+    {
+    case EH_BATCH_ENCRYPT:
+    case EH_BATCH_DECRYPT:
+        aad = batch_pop_data(&cur, end, &aad_size);
+        in = batch_pop_data(&cur, end, &in_size);
+        if (aad == NULL || in == NULL || cur != end)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        if (item->action == EH_BATCH_ENCRYPT)
+            result_len = ehsm_get_ciphertext_size(cmk->metadata.keyspec, in->datalen);
+        else
+            result_len = ehsm_get_plaintext_size(cmk->metadata.keyspec, in->datalen);
+        if (result_len == 0)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result = batch_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        if (item->action == EH_BATCH_ENCRYPT)
+            ret = enclave_encrypt(cmk, cmk_size, aad, aad_size, in, in_size,
+                                  result, *out_size);
+        else
+            ret = enclave_decrypt(cmk, cmk_size, aad, aad_size, in, in_size,
+                                  result, *out_size);
+        break;
+    case EH_BATCH_SIGN:
+        in = batch_pop_data(&cur, end, &in_size);
+        if (in == NULL || cur != end)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result_len = ehsm_get_signature_max_size(cmk->metadata.keyspec);
+        if (result_len == 0)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result = batch_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        ret = enclave_sign(cmk, cmk_size, in, in_size, result, *out_size);
+        // ecc and sm2 signatures may come out shorter than the longest one
+        if (ret == SGX_SUCCESS)
+            *out_size = APPEND_SIZE_TO_DATA_T(result->datalen);
+        break;
+    case EH_BATCH_VERIFY:
+        in = batch_pop_data(&cur, end, &in_size);
+        signature = batch_pop_data(&cur, end, &signature_size);
+        if (in == NULL || signature == NULL || cur != end)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result = batch_push_data(out, out_capacity, out_size, 1);
+        if (result == NULL)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        ret = enclave_verify(cmk, cmk_size, in, in_size, signature, signature_size, &verified);
+        result->data[0] = verified ? 1 : 0;
+        break;
+    case EH_BATCH_GENERATE_MAC:
+        in = batch_pop_data(&cur, end, &in_size);
+        if (in == NULL || cur != end)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result_len = ehsm_get_mac_size(cmk->metadata.digest_mode);
+        if (result_len == 0)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result = batch_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        ret = enclave_generate_mac(cmk, cmk_size, in, in_size, result, *out_size);
+        break;
+    case EH_BATCH_VERIFY_MAC:
+        in = batch_pop_data(&cur, end, &in_size);
+        signature = batch_pop_data(&cur, end, &signature_size);
+        if (in == NULL || signature == NULL || cur != end)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result = batch_push_data(out, out_capacity, out_size, 1);
+        if (result == NULL)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        ret = enclave_verify_mac(cmk, cmk_size, in, in_size, signature, signature_size, &verified);
+        result->data[0] = verified ? 1 : 0;
+        break;
+    case EH_BATCH_GENERATE_DATAKEY:
+        aad = batch_pop_data(&cur, end, &aad_size);
+        if (aad == NULL || cur != end)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        plaintext = batch_push_data(out, out_capacity, out_size, item->param);
+        if (plaintext == NULL)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result_len = ehsm_get_ciphertext_size(cmk->metadata.keyspec, item->param);
+        if (result_len == 0)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result = batch_push_data(out, out_capacity, out_size, result_len);
+        if (result == NULL)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        ret = enclave_generate_datakey(cmk, cmk_size, aad, aad_size,
+                                       plaintext, APPEND_SIZE_TO_DATA_T((size_t)item->param),
+                                       result, APPEND_SIZE_TO_DATA_T((size_t)result_len));
+        break;
+    default:
+        break;
+    }
+
     return ret;
 }
 
+/**
+ * @brief Process a packed batch of heterogeneous requests within a single ecall
+ *
+ * @param req the packed requests, an ehsm_batch_t followed by its items
+ * @param req_size size of req
+ * @param resp the packed responses, one item with its own status per request item
+ * @param resp_size capacity of resp, see EH_BATCH_ITEM_MAX_OVERHEAD for a safe value
+ * @param resp_len bytes of resp actually used
+ * @return sgx_status_t only reports a malformed batch, the result of each item is in its status
+ */
+sgx_status_t enclave_batch(uint8_t *req, size_t req_size,
+                           uint8_t *resp, size_t resp_size,
+                           size_t *resp_len)
+{
+    ehsm_batch_t *requests = (ehsm_batch_t *)req;
+    ehsm_batch_t *responses = (ehsm_batch_t *)resp;
+    uint8_t *cur = NULL;
+    const uint8_t *end = req + req_size;
+    size_t offset = sizeof(ehsm_batch_t);
+
+    if (req == NULL ||
+        req_size < sizeof(ehsm_batch_t) ||
+        req_size > EH_BATCH_MAX_SIZE)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (resp == NULL ||
+        resp_size < sizeof(ehsm_batch_t) ||
+        resp_size > EH_BATCH_RESPONSE_MAX_SIZE ||
+        resp_len == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (requests->count == 0 || requests->count > EH_BATCH_MAX_ITEMS)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    responses->count = 0;
+    cur = requests->items;
+    for (uint32_t i = 0; i < requests->count; i++)
+    {
+        ehsm_batch_item_t *item = (ehsm_batch_item_t *)cur;
+        ehsm_batch_item_t *result = (ehsm_batch_item_t *)(resp + offset);
+        size_t out_size = 0;
+
+        if ((size_t)(end - cur) < sizeof(ehsm_batch_item_t) ||
+            (size_t)(end - cur) - sizeof(ehsm_batch_item_t) < item->size)
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        if (resp_size - offset < sizeof(ehsm_batch_item_t))
+            return SGX_ERROR_INVALID_PARAMETER;
+
+        result->action = item->action;
+        result->param = item->param;
+        result->status = batch_process_item(item,
+                                            result->payload,
+                                            resp_size - offset - sizeof(ehsm_batch_item_t),
+                                            &out_size);
+        if (result->status != SGX_SUCCESS)
+        {
+            // never hand out partial results, e.g. the plaintext of a datakey
+            memset_s(result->payload, out_size, 0, out_size);
+            out_size = 0;
+        }
+        result->size = out_size;
+
+        offset += sizeof(ehsm_batch_item_t) + out_size;
+        cur += sizeof(ehsm_batch_item_t) + item->size;
+        responses->count++;
+    }
+
+    if (cur != end)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    *resp_len = offset;
+    return SGX_SUCCESS;
+}
+
+sgx_status_t enclave_stream_init(uint32_t encrypt,
+                                 ehsm_keyblob_t *cmk, size_t cmk_size,
+                                 ehsm_data_t *aad, size_t aad_size,
+                                 ehsm_data_t *header, size_t header_size,
+                                 uint64_t *handle,
+                                 uint64_t now)
+{
+    if (cmk == NULL ||
+        cmk_size != APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen) ||
+        cmk->keybloblen == 0 ||
+        cmk->metadata.origin != EH_INTERNAL_KEY)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (aad == NULL ||
+        aad_size != APPEND_SIZE_TO_DATA_T(aad->datalen) ||
+        aad->datalen > EH_AAD_MAX_SIZE)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (header == NULL ||
+        header_size != APPEND_SIZE_TO_DATA_T(header->datalen))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    return ehsm_stream_init(encrypt != 0, cmk, aad, header, handle, now);
+}
+
+static sgx_status_t enclave_stream_process(uint64_t handle, bool last,
+                                           ehsm_data_t *in, size_t in_size,
+                                           ehsm_data_t *out, size_t out_size,
+                                           uint64_t now)
+{
+    if (in == NULL ||
+        in_size != APPEND_SIZE_TO_DATA_T(in->datalen) ||
+        in->datalen == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (out == NULL ||
+        out_size != APPEND_SIZE_TO_DATA_T(out->datalen))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    return ehsm_stream_update(handle, last, in, out, now);
+}
+
+sgx_status_t enclave_stream_update(uint64_t handle,
+                                   ehsm_data_t *in, size_t in_size,
+                                   ehsm_data_t *out, size_t out_size,
+                                   uint64_t now)
+{
+    return enclave_stream_process(handle, false, in, in_size, out, out_size, now);
+}
+
+sgx_status_t enclave_stream_final(uint64_t handle,
+                                  ehsm_data_t *in, size_t in_size,
+                                  ehsm_data_t *out, size_t out_size,
+                                  uint64_t now)
+{
+    return enclave_stream_process(handle, true, in, in_size, out, out_size, now);
+}
+
+sgx_status_t enclave_stream_abort(uint64_t handle)
+{
+    return ehsm_stream_abort(handle);
+}
+
+sgx_status_t enclave_get_key_cache_stats(ehsm_key_cache_stats_t *stats)
+{
+    if (stats == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ehsm_key_cache_get_stats(stats);
+
+    return SGX_SUCCESS;
+}
+
+sgx_status_t enclave_key_pool_refill(uint32_t *pending)
+{
+    return ehsm_key_pool_refill(pending);
+}
+
+sgx_status_t enclave_key_pool_set_watermarks(uint32_t keyspec,
+                                             uint32_t low_watermark,
+                                             uint32_t high_watermark)
+{
+    return ehsm_key_pool_set_watermarks((ehsm_keyspec_t)keyspec, low_watermark, high_watermark);
+}
+
+sgx_status_t enclave_get_key_pool_stats(uint32_t keyspec, ehsm_key_pool_stats_t *stats)
+{
+    return ehsm_key_pool_get_stats((ehsm_keyspec_t)keyspec, stats);
+}
+
+sgx_status_t enclave_set_stats_enabled(uint32_t enabled)
+{
+    ehsm_stats_enable(enabled != 0);
+
+    return SGX_SUCCESS;
+}
+
+sgx_status_t enclave_set_instance(uint32_t instance)
+{
+    if (instance > (UINT64_MAX >> EH_STREAM_HANDLE_INSTANCE_SHIFT))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ehsm_stream_set_instance(instance);
+
+    return SGX_SUCCESS;
+}
+
+sgx_status_t enclave_get_stats(ehsm_enclave_stats_t *stats)
+{
+    if (stats == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ehsm_stats_get(stats);
+
+    return SGX_SUCCESS;
+}
+
 sgx_status_t enclave_get_target_info(sgx_target_info_t *target_info)
 {
     return sgx_self_target(target_info);
@@ -819,6 +1283,127 @@ sgx_status_t enclave_get_apikey(uint8_t *apikey, uint32_t keylen)
     memset_s(temp, keylen, 0, keylen);
     return ret;
 }
+
+/*
+ * decrypt the api key stored in the user_info record, cipherapikey is an AES-GCM
+ * ciphertext of cmk with the appid as aad, so a record only unwraps for its own appid
+ */
+static sgx_status_t unwrap_api_key(const ehsm_data_t *appid, ehsm_keyblob_t *cmk, ehsm_data_t *cipherapikey,
+                                   uint8_t *api_key, uint32_t *api_key_size)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    ehsm_data_t *plaintext = NULL;
+    size_t plaintext_size = APPEND_SIZE_TO_DATA_T(*api_key_size);
+
+    if (cmk->metadata.keyspec != EH_AES_GCM_128 &&
+        cmk->metadata.keyspec != EH_AES_GCM_192 &&
+        cmk->metadata.keyspec != EH_AES_GCM_256)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    plaintext = (ehsm_data_t *)malloc(plaintext_size);
+    if (plaintext == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+    plaintext->datalen = *api_key_size;
+
+    ret = ehsm_aes_gcm_decrypt((ehsm_data_t *)appid, cmk, cipherapikey, plaintext);
+    if (ret == SGX_SUCCESS)
+    {
+        memcpy_s(api_key, *api_key_size, plaintext->data, plaintext->datalen);
+        *api_key_size = plaintext->datalen;
+    }
+
+    memset_s(plaintext, plaintext_size, 0, plaintext_size);
+    SAFE_FREE(plaintext);
+    return ret;
+}
+
+/*
+ * Verify the HMAC-SHA256 sign of a REST request by the api key of its appid, the
+ * plaintext api key never leaves the enclave. The unwrapped api key is cached for
+ * EH_API_KEY_CACHE_TTL seconds of the host time now, on a miss it is decrypted from
+ * cipherapikey by cmk, which are both optional: without them a miss only reports
+ * cached = false and the caller retries with them.
+ */
+sgx_status_t enclave_verify_request_sign(const ehsm_data_t *appid, size_t appid_size,
+                                         const ehsm_data_t *sign_string, size_t sign_string_size,
+                                         const ehsm_data_t *sign, size_t sign_size,
+                                         ehsm_keyblob_t *cmk, size_t cmk_size,
+                                         ehsm_data_t *cipherapikey, size_t cipherapikey_size,
+                                         bool *cached,
+                                         bool *result,
+                                         uint64_t now)
+{
+    sgx_status_t ret = SGX_SUCCESS;
+    uint8_t api_key[EH_API_KEY_SIZE];
+    uint32_t api_key_size = sizeof(api_key);
+    uint8_t mac[EVP_MAX_MD_SIZE];
+    unsigned int mac_size = 0;
+
+    if (appid == NULL ||
+        appid_size != APPEND_SIZE_TO_DATA_T(appid->datalen) ||
+        appid->datalen == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (sign_string == NULL ||
+        sign_string_size != APPEND_SIZE_TO_DATA_T(sign_string->datalen) ||
+        sign == NULL ||
+        sign_size != APPEND_SIZE_TO_DATA_T(sign->datalen))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if ((cmk == NULL) != (cipherapikey == NULL))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (cmk != NULL &&
+        (cmk_size != APPEND_SIZE_TO_KEYBLOB_T(cmk->keybloblen) ||
+         cmk->keybloblen == 0 ||
+         cipherapikey_size != APPEND_SIZE_TO_DATA_T(cipherapikey->datalen) ||
+         cipherapikey->datalen == 0))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (cached == NULL || result == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    *cached = false;
+    *result = false;
+
+    if (!ehsm_cache_get_api_key(appid, api_key, &api_key_size, now))
+    {
+        if (cmk == NULL)
+            return SGX_SUCCESS;
+
+        ret = unwrap_api_key(appid, cmk, cipherapikey, api_key, &api_key_size);
+        if (ret != SGX_SUCCESS)
+            goto out;
+        ehsm_cache_put_api_key(appid, api_key, api_key_size, now);
+    }
+    *cached = true;
+
+    if (HMAC(EVP_sha256(), api_key, api_key_size,
+             sign_string->data, sign_string->datalen,
+             mac, &mac_size) == NULL)
+    {
+        ret = SGX_ERROR_UNEXPECTED;
+        goto out;
+    }
+    *result = (sign->datalen == mac_size && CRYPTO_memcmp(mac, sign->data, mac_size) == 0);
+
+out:
+    memset_s(api_key, sizeof(api_key), 0, sizeof(api_key));
+    memset_s(mac, sizeof(mac), 0, sizeof(mac));
+    return ret;
+}
+
+/* forget the api key cached for an appid, the next request unwraps it from its record again */
+sgx_status_t enclave_invalidate_api_key(const ehsm_data_t *appid, size_t appid_size)
+{
+    if (appid == NULL ||
+        appid_size != APPEND_SIZE_TO_DATA_T(appid->datalen) ||
+        appid->datalen == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ehsm_cache_drop_api_key(appid);
+    return SGX_SUCCESS;
+}
 // This ecall is a wrapper of sgx_ra_init to create the trusted
 // KE exchange key context needed for the remote attestation
 // SIGMA API's. Input pointers aren't checked since the trusted stubs
@@ -45,6 +45,7 @@
 #include "enclave_hsm_t.h"
 #include "marshal.h"
 #include "enclave_msg_exchange.h"
+#include "key_cache.h"
 
 extern void printf(const char *fmt, ...);
 
@@ -467,6 +468,9 @@ uint32_t enclave_la_message_exchange()
     }
     memcpy(g_domain_key, secret, secret_len);
 
+    // keys unwrapped by the previous domain key must not be served anymore
+    ehsm_key_cache_flush();
+
 out:
     SAFE_FREE(marshalled_inp_buff);
     SAFE_FREE(out_buff);
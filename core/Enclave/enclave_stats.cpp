@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "enclave_hsm_t.h"
+
+#include "datatypes.h"
+#include "enclave_stats.h"
+
+static bool g_stats_enabled = false;
+
+static ehsm_stats_counter_t g_stats[EH_STATS_NUM][EH_STATS_KEYSPEC_NUM];
+
+static inline uint64_t stats_rdtsc()
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void ehsm_stats_enable(bool enable)
+{
+    __atomic_store_n(&g_stats_enabled, enable, __ATOMIC_RELAXED);
+}
+
+uint64_t ehsm_stats_begin()
+{
+    if (!__atomic_load_n(&g_stats_enabled, __ATOMIC_RELAXED))
+        return 0;
+    return stats_rdtsc();
+}
+
+void ehsm_stats_end(ehsm_stats_op_t op, uint32_t keyspec, uint64_t start)
+{
+    ehsm_stats_counter_t *counter = NULL;
+    uint64_t cycles = 0;
+    uint64_t max_cycles = 0;
+
+    if (start == 0 || op >= EH_STATS_NUM)
+        return;
+
+    // an unknown keyspec is accounted to 0, which no keyspec uses
+    if (keyspec >= EH_STATS_KEYSPEC_NUM)
+        keyspec = 0;
+
+    cycles = stats_rdtsc() - start;
+    counter = &g_stats[op][keyspec];
+    __atomic_fetch_add(&counter->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->cycles, cycles, __ATOMIC_RELAXED);
+
+    max_cycles = __atomic_load_n(&counter->max_cycles, __ATOMIC_RELAXED);
+    while (cycles > max_cycles &&
+           !__atomic_compare_exchange_n(&counter->max_cycles, &max_cycles, cycles,
+                                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void ehsm_stats_get(ehsm_enclave_stats_t *stats)
+{
+    stats->enabled = __atomic_load_n(&g_stats_enabled, __ATOMIC_RELAXED);
+    stats->reserved = 0;
+    for (uint32_t op = 0; op < EH_STATS_NUM; op++)
+    {
+        for (uint32_t keyspec = 0; keyspec < EH_STATS_KEYSPEC_NUM; keyspec++)
+        {
+            stats->counters[op][keyspec].count = __atomic_load_n(&g_stats[op][keyspec].count, __ATOMIC_RELAXED);
+            stats->counters[op][keyspec].cycles = __atomic_load_n(&g_stats[op][keyspec].cycles, __ATOMIC_RELAXED);
+            stats->counters[op][keyspec].max_cycles = __atomic_load_n(&g_stats[op][keyspec].max_cycles, __ATOMIC_RELAXED);
+        }
+    }
+}
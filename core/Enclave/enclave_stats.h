@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "datatypes.h"
+
+#ifndef _ENCLAVE_STATS_H_
+#define _ENCLAVE_STATS_H_
+
+/*
+ * Performance counters kept in enclave memory, per ehsm_stats_op_t and keyspec.
+ * They are timed with rdtsc and updated with atomics, so the hot path costs no
+ * OCALL and no lock, and they are only read by enclave_get_stats.
+ *
+ * rdtsc raises #UD inside an SGX1 enclave, so counting stays off until the
+ * provider, which can tell the platform supports it, turns it on.
+ */
+void ehsm_stats_enable(bool enable);
+
+// the start of a measurement, 0 while counting is off
+uint64_t ehsm_stats_begin();
+
+// count the cycles elapsed since start, nothing is counted for a 0 start
+void ehsm_stats_end(ehsm_stats_op_t op, uint32_t keyspec, uint64_t start);
+
+void ehsm_stats_get(ehsm_enclave_stats_t *stats);
+
+#endif
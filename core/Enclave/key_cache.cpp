@@ -0,0 +1,635 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "enclave_hsm_t.h"
+#include "sgx_tcrypto.h"
+#include "sgx_spinlock.h"
+
+#include <map>
+#include <list>
+
+#include "datatypes.h"
+#include "key_factory.h"
+#include "key_operation.h"
+#include "key_cache.h"
+#include "enclave_stats.h"
+#include "openssl_operation.h"
+
+#include "openssl/pem.h"
+#include "openssl/x509.h"
+
+/* approximate EPC footprint of one parsed key, on top of the entry itself */
+#define KEY_CACHE_ENTRY_OVERHEAD    256
+#define KEY_CACHE_RSA_COST_FACTOR   10
+#define KEY_CACHE_EC_KEY_COST       2048
+
+typedef enum {
+    EH_CACHED_SYMMETRIC_KEY = 0,
+    EH_CACHED_RSA_PUBKEY,
+    EH_CACHED_RSA_PRIVKEY,
+    EH_CACHED_EC_PUBKEY,
+    EH_CACHED_EC_PRIVKEY,
+    EH_CACHED_SM2_PUBKEY,
+    EH_CACHED_SM2_PRIVKEY,
+    EH_CACHED_API_KEY       /* looked up by the SHA-256 of the appid */
+} ehsm_cached_type_t;
+
+typedef struct _key_cache_id_t
+{
+    sgx_sha256_hash_t digest;
+    uint32_t type;
+
+    bool operator<(const _key_cache_id_t &other) const
+    {
+        int r = memcmp(digest, other.digest, sizeof(digest));
+        return r != 0 ? r < 0 : type < other.type;
+    }
+} key_cache_id_t;
+
+typedef struct
+{
+    key_cache_id_t id;
+    uint32_t cost;
+    uint32_t key_size; /* only valid for symmetric and api keys */
+    uint64_t cached_at; /* only valid for api keys, host time of the unwrap */
+    union
+    {
+        uint8_t *raw;
+        void *obj; /* RSA, EC_KEY or EVP_PKEY depending on id.type */
+    } key;
+} key_cache_entry_t;
+
+typedef std::list<key_cache_entry_t> key_cache_list_t;
+
+/* the front of the list is the most recently used entry */
+static key_cache_list_t g_key_cache_lru;
+static std::map<key_cache_id_t, key_cache_list_t::iterator> g_key_cache_index;
+static sgx_spinlock_t g_key_cache_lock = SGX_SPINLOCK_INITIALIZER;
+static ehsm_key_cache_stats_t g_key_cache_stats = {0, 0, 0, 0, 0,
+                                                   EH_KEY_CACHE_MAX_ENTRIES,
+                                                   EH_KEY_CACHE_MAX_BYTES};
+
+static bool key_up_ref(uint32_t type, void *obj)
+{
+    switch (type)
+    {
+    case EH_CACHED_RSA_PUBKEY:
+    case EH_CACHED_RSA_PRIVKEY:
+        return RSA_up_ref((RSA *)obj) == 1;
+    case EH_CACHED_EC_PUBKEY:
+    case EH_CACHED_EC_PRIVKEY:
+        return EC_KEY_up_ref((EC_KEY *)obj) == 1;
+    case EH_CACHED_SM2_PUBKEY:
+    case EH_CACHED_SM2_PRIVKEY:
+        return EVP_PKEY_up_ref((EVP_PKEY *)obj) == 1;
+    default:
+        return false;
+    }
+}
+
+/* the private components of RSA and EC keys are cleared by openssl on free */
+static void key_cache_release(key_cache_entry_t &entry)
+{
+    switch (entry.id.type)
+    {
+    case EH_CACHED_SYMMETRIC_KEY:
+    case EH_CACHED_API_KEY:
+        SAFE_MEMSET(entry.key.raw, entry.key_size, 0, entry.key_size);
+        SAFE_FREE(entry.key.raw);
+        break;
+    case EH_CACHED_RSA_PUBKEY:
+    case EH_CACHED_RSA_PRIVKEY:
+        RSA_free((RSA *)entry.key.obj);
+        break;
+    case EH_CACHED_EC_PUBKEY:
+    case EH_CACHED_EC_PRIVKEY:
+        EC_KEY_free((EC_KEY *)entry.key.obj);
+        break;
+    case EH_CACHED_SM2_PUBKEY:
+    case EH_CACHED_SM2_PRIVKEY:
+        EVP_PKEY_free((EVP_PKEY *)entry.key.obj);
+        break;
+    default:
+        break;
+    }
+    entry.key.obj = NULL;
+}
+
+static sgx_status_t key_cache_calc_id(const ehsm_keyblob_t *cmk,
+                                      ehsm_cached_type_t type,
+                                      key_cache_id_t &id)
+{
+    if (cmk == NULL || cmk->keybloblen < sizeof(sgx_aes_gcm_data_ex_t))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    id.type = type;
+    return sgx_sha256_msg(cmk->keyblob, cmk->keybloblen, &id.digest);
+}
+
+/**
+ * @brief Look up an entry and take a reference to its key while holding the lock
+ * @param id the digest and type of the wanted key
+ * @param entry receives the entry, holding a new reference to the key object
+ * @param key receives a copy of a symmetric or api key, may be NULL for other types
+ * @param key_size the size of the key buffer, it must match a symmetric key and hold an api key
+ * @param now the host time, an api key older than EH_API_KEY_CACHE_TTL is not returned
+ * @return true if the key was found in the cache
+ */
+static bool key_cache_acquire(const key_cache_id_t &id,
+                              key_cache_entry_t &entry,
+                              uint8_t *key,
+                              uint32_t key_size,
+                              uint64_t now = 0)
+{
+    bool found = false;
+
+    sgx_spin_lock(&g_key_cache_lock);
+
+    std::map<key_cache_id_t, key_cache_list_t::iterator>::iterator it = g_key_cache_index.find(id);
+    if (it != g_key_cache_index.end())
+    {
+        key_cache_list_t::iterator node = it->second;
+        if (id.type == EH_CACHED_SYMMETRIC_KEY)
+        {
+            if (key != NULL && node->key_size == key_size)
+                found = (memcpy_s(key, key_size, node->key.raw, key_size) == 0);
+        }
+        else if (id.type == EH_CACHED_API_KEY)
+        {
+            if (key != NULL && node->key_size <= key_size &&
+                now >= node->cached_at && now - node->cached_at < EH_API_KEY_CACHE_TTL)
+                found = (memcpy_s(key, key_size, node->key.raw, node->key_size) == 0);
+        }
+        else
+        {
+            found = key_up_ref(id.type, node->key.obj);
+        }
+
+        if (found)
+        {
+            entry = *node;
+            g_key_cache_lru.splice(g_key_cache_lru.begin(), g_key_cache_lru, node);
+        }
+    }
+
+    if (found)
+        g_key_cache_stats.hits++;
+    else
+        g_key_cache_stats.misses++;
+
+    sgx_spin_unlock(&g_key_cache_lock);
+
+    return found;
+}
+
+/**
+ * @brief Insert an entry, the cache takes the ownership of its key
+ * Least recently used entries are evicted until the new one fits, they are
+ * released after the lock is dropped so that other threads are not stalled.
+ */
+static void key_cache_insert(key_cache_entry_t &entry)
+{
+    key_cache_list_t evicted;
+    bool inserted = false;
+
+    if (entry.cost > EH_KEY_CACHE_MAX_BYTES)
+    {
+        key_cache_release(entry);
+        return;
+    }
+
+    sgx_spin_lock(&g_key_cache_lock);
+
+    /* another thread may have loaded the same key meanwhile */
+    if (g_key_cache_index.find(entry.id) == g_key_cache_index.end())
+    {
+        while (!g_key_cache_lru.empty() &&
+               (g_key_cache_stats.entries >= EH_KEY_CACHE_MAX_ENTRIES ||
+                g_key_cache_stats.bytes + entry.cost > EH_KEY_CACHE_MAX_BYTES))
+        {
+            key_cache_list_t::iterator last = --g_key_cache_lru.end();
+            g_key_cache_index.erase(last->id);
+            g_key_cache_stats.entries--;
+            g_key_cache_stats.bytes -= last->cost;
+            g_key_cache_stats.evictions++;
+            evicted.splice(evicted.begin(), g_key_cache_lru, last);
+        }
+
+        try
+        {
+            g_key_cache_lru.push_front(entry);
+            try
+            {
+                g_key_cache_index[entry.id] = g_key_cache_lru.begin();
+                g_key_cache_stats.entries++;
+                g_key_cache_stats.bytes += entry.cost;
+                inserted = true;
+            }
+            catch (...)
+            {
+                g_key_cache_lru.pop_front();
+            }
+        }
+        catch (...)
+        {
+        }
+    }
+
+    sgx_spin_unlock(&g_key_cache_lock);
+
+    if (!inserted)
+        key_cache_release(entry);
+
+    for (key_cache_list_t::iterator it = evicted.begin(); it != evicted.end(); ++it)
+    {
+        if (it->id.type == EH_CACHED_SYMMETRIC_KEY)
+            ehsm_cipher_ctx_forget(it->key.raw, it->key_size);
+        key_cache_release(*it);
+    }
+}
+
+/* take an entry out of the cache and release it, a no-op if it is not cached */
+static void key_cache_erase(const key_cache_id_t &id)
+{
+    key_cache_list_t erased;
+
+    sgx_spin_lock(&g_key_cache_lock);
+
+    std::map<key_cache_id_t, key_cache_list_t::iterator>::iterator it = g_key_cache_index.find(id);
+    if (it != g_key_cache_index.end())
+    {
+        key_cache_list_t::iterator node = it->second;
+        g_key_cache_index.erase(it);
+        g_key_cache_stats.entries--;
+        g_key_cache_stats.bytes -= node->cost;
+        g_key_cache_stats.evictions++;
+        erased.splice(erased.begin(), g_key_cache_lru, node);
+    }
+
+    sgx_spin_unlock(&g_key_cache_lock);
+
+    for (key_cache_list_t::iterator it = erased.begin(); it != erased.end(); ++it)
+        key_cache_release(*it);
+}
+
+static EVP_PKEY *key_cache_to_sm2_pkey(EC_KEY *ec_key)
+{
+    EVP_PKEY *pkey = NULL;
+
+    if (ec_key == NULL)
+        return NULL;
+
+    pkey = EVP_PKEY_new();
+    if (pkey == NULL ||
+        EVP_PKEY_set1_EC_KEY(pkey, ec_key) != 1 ||
+        EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2) != 1)
+    {
+        EVP_PKEY_free(pkey);
+        pkey = NULL;
+    }
+
+    EC_KEY_free(ec_key);
+    return pkey;
+}
+
+/**
+ * @brief Parse the DER key pair of a v2 keyblob
+ * @param privkey the decrypted private key
+ * @param privkey_size the size of the private key
+ * @param pubkey the public key authenticated as the keyblob aad
+ * @param pubkey_size the size of the public key
+ * @param type which half of the key pair to load
+ * @return void* the RSA, EC_KEY or EVP_PKEY object, NULL on failure
+ */
+static void *key_cache_parse_der(const uint8_t *privkey, uint32_t privkey_size,
+                                 const uint8_t *pubkey, uint32_t pubkey_size,
+                                 ehsm_cached_type_t type)
+{
+    switch (type)
+    {
+    case EH_CACHED_RSA_PUBKEY:
+        return d2i_RSAPublicKey(NULL, &pubkey, pubkey_size);
+    case EH_CACHED_RSA_PRIVKEY:
+        return d2i_RSAPrivateKey(NULL, &privkey, privkey_size);
+    case EH_CACHED_EC_PUBKEY:
+        return d2i_EC_PUBKEY(NULL, &pubkey, pubkey_size);
+    case EH_CACHED_EC_PRIVKEY:
+        return d2i_ECPrivateKey(NULL, &privkey, privkey_size);
+    case EH_CACHED_SM2_PUBKEY:
+        return key_cache_to_sm2_pkey(d2i_EC_PUBKEY(NULL, &pubkey, pubkey_size));
+    case EH_CACHED_SM2_PRIVKEY:
+        return key_cache_to_sm2_pkey(d2i_ECPrivateKey(NULL, &privkey, privkey_size));
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Parse the PEM key pair of a v1 keyblob
+ * @param keypair the decrypted key pair
+ * @param keypair_size the size of the key pair
+ * @param type which half of the key pair to load
+ * @return void* the RSA, EC_KEY or EVP_PKEY object, NULL on failure
+ */
+static void *key_cache_parse_pem(const uint8_t *keypair, uint32_t keypair_size,
+                                 ehsm_cached_type_t type)
+{
+    BIO *bio = NULL;
+    EVP_PKEY *pkey = NULL;
+    void *key = NULL;
+
+    bio = BIO_new_mem_buf(keypair, keypair_size);
+    if (bio == NULL)
+    {
+        log_d("failed to load key pem\n");
+        return NULL;
+    }
+
+    switch (type)
+    {
+    case EH_CACHED_RSA_PUBKEY:
+        key = PEM_read_bio_RSAPublicKey(bio, NULL, NULL, NULL);
+        break;
+    case EH_CACHED_RSA_PRIVKEY:
+        key = PEM_read_bio_RSAPrivateKey(bio, NULL, NULL, NULL);
+        break;
+    case EH_CACHED_EC_PUBKEY:
+        key = PEM_read_bio_EC_PUBKEY(bio, NULL, NULL, NULL);
+        break;
+    case EH_CACHED_EC_PRIVKEY:
+        key = PEM_read_bio_ECPrivateKey(bio, NULL, NULL, NULL);
+        break;
+    case EH_CACHED_SM2_PUBKEY:
+    case EH_CACHED_SM2_PRIVKEY:
+        if (type == EH_CACHED_SM2_PUBKEY)
+            pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+        else
+            pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+        /* set the alias once here, the cached key is shared by all threads */
+        if (pkey != NULL && EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2) != 1)
+        {
+            EVP_PKEY_free(pkey);
+            pkey = NULL;
+        }
+        key = pkey;
+        break;
+    default:
+        break;
+    }
+
+    BIO_free(bio);
+    return key;
+}
+
+/**
+ * @brief Unwrap the keyblob by the domain key and parse the key pair in it
+ * Both the v2 (DER) and the v1 (PEM) keyblob layouts are accepted.
+ * @param cmk the keyblob of an asymmetric key
+ * @param type which half of the key pair to load
+ * @return void* the RSA, EC_KEY or EVP_PKEY object, NULL on failure
+ */
+static void *key_cache_load_key(const ehsm_keyblob_t *cmk, ehsm_cached_type_t type)
+{
+    sgx_aes_gcm_data_ex_t *keyblob_data = (sgx_aes_gcm_data_ex_t *)cmk->keyblob;
+    uint32_t plaintext_size = 0;
+    uint8_t *plaintext = NULL;
+    void *key = NULL;
+    uint64_t stats_start = 0;
+
+    if (!ehsm_check_keyblob_size(cmk) || keyblob_data->ciphertext_size == 0)
+        return NULL;
+
+    plaintext_size = keyblob_data->ciphertext_size;
+    plaintext = (uint8_t *)malloc(plaintext_size);
+    if (plaintext == NULL)
+        return NULL;
+
+    /* this also authenticates the public key of a v2 keyblob */
+    stats_start = ehsm_stats_begin();
+    if (SGX_SUCCESS != ehsm_parse_keyblob(plaintext, keyblob_data))
+        goto out;
+    ehsm_stats_end(EH_STATS_PARSE_KEYBLOB, cmk->metadata.keyspec, stats_start);
+
+    stats_start = ehsm_stats_begin();
+    if (ehsm_get_keyblob_version(keyblob_data) == EH_KEYBLOB_VERSION_2)
+        key = key_cache_parse_der(plaintext, plaintext_size,
+                                  keyblob_data->payload + keyblob_data->ciphertext_size,
+                                  keyblob_data->aad_size,
+                                  type);
+    else
+        key = key_cache_parse_pem(plaintext, plaintext_size, type);
+    ehsm_stats_end(EH_STATS_PARSE_KEY, cmk->metadata.keyspec, stats_start);
+
+    if (key == NULL)
+        log_d("failed to load key\n");
+
+out:
+    SAFE_MEMSET(plaintext, plaintext_size, 0, plaintext_size);
+    SAFE_FREE(plaintext);
+
+    return key;
+}
+
+static uint32_t key_cache_calc_cost(ehsm_cached_type_t type, void *key)
+{
+    switch (type)
+    {
+    case EH_CACHED_RSA_PUBKEY:
+    case EH_CACHED_RSA_PRIVKEY:
+        return KEY_CACHE_ENTRY_OVERHEAD + RSA_size((RSA *)key) * KEY_CACHE_RSA_COST_FACTOR;
+    default:
+        return KEY_CACHE_ENTRY_OVERHEAD + KEY_CACHE_EC_KEY_COST;
+    }
+}
+
+static void *key_cache_get_key(const ehsm_keyblob_t *cmk, ehsm_cached_type_t type)
+{
+    key_cache_entry_t entry;
+    void *key = NULL;
+
+    if (key_cache_calc_id(cmk, type, entry.id) != SGX_SUCCESS)
+        return NULL;
+
+    if (key_cache_acquire(entry.id, entry, NULL, 0))
+        return entry.key.obj;
+
+    key = key_cache_load_key(cmk, type);
+    if (key == NULL)
+        return NULL;
+
+    /* one reference for the caller and one for the cache */
+    if (key_up_ref(type, key))
+    {
+        entry.key.obj = key;
+        entry.key_size = 0;
+        entry.cost = key_cache_calc_cost(type, key);
+        key_cache_insert(entry);
+    }
+
+    return key;
+}
+
+sgx_status_t ehsm_cache_get_symmetric_key(const ehsm_keyblob_t *cmk,
+                                          uint8_t *key,
+                                          uint32_t key_size)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    key_cache_entry_t entry;
+
+    if (cmk == NULL || key == NULL || key_size == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ret = key_cache_calc_id(cmk, EH_CACHED_SYMMETRIC_KEY, entry.id);
+    if (ret != SGX_SUCCESS)
+        return ret;
+
+    if (key_cache_acquire(entry.id, entry, key, key_size))
+        return SGX_SUCCESS;
+
+    if (!ehsm_check_keyblob_size(cmk) ||
+        ehsm_get_gcm_ciphertext_size((sgx_aes_gcm_data_ex_t *)cmk->keyblob) != key_size)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    uint64_t stats_start = ehsm_stats_begin();
+    ret = ehsm_parse_keyblob(key, (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ehsm_stats_end(EH_STATS_PARSE_KEYBLOB, cmk->metadata.keyspec, stats_start);
+    if (ret != SGX_SUCCESS)
+        return ret;
+
+    entry.key.raw = (uint8_t *)malloc(key_size);
+    if (entry.key.raw == NULL)
+        return SGX_SUCCESS; // the key is still usable, just not cached
+
+    memcpy_s(entry.key.raw, key_size, key, key_size);
+    entry.key_size = key_size;
+    entry.cost = KEY_CACHE_ENTRY_OVERHEAD + key_size;
+    key_cache_insert(entry);
+
+    return SGX_SUCCESS;
+}
+
+RSA *ehsm_cache_get_rsa_key(const ehsm_keyblob_t *cmk, bool is_private)
+{
+    return (RSA *)key_cache_get_key(cmk, is_private ? EH_CACHED_RSA_PRIVKEY : EH_CACHED_RSA_PUBKEY);
+}
+
+EC_KEY *ehsm_cache_get_ec_key(const ehsm_keyblob_t *cmk, bool is_private)
+{
+    return (EC_KEY *)key_cache_get_key(cmk, is_private ? EH_CACHED_EC_PRIVKEY : EH_CACHED_EC_PUBKEY);
+}
+
+EVP_PKEY *ehsm_cache_get_sm2_pkey(const ehsm_keyblob_t *cmk, bool is_private)
+{
+    return (EVP_PKEY *)key_cache_get_key(cmk, is_private ? EH_CACHED_SM2_PRIVKEY : EH_CACHED_SM2_PUBKEY);
+}
+
+static sgx_status_t key_cache_calc_api_key_id(const ehsm_data_t *appid, key_cache_id_t &id)
+{
+    if (appid == NULL || appid->datalen == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    id.type = EH_CACHED_API_KEY;
+    return sgx_sha256_msg(appid->data, appid->datalen, &id.digest);
+}
+
+bool ehsm_cache_get_api_key(const ehsm_data_t *appid, uint8_t *key, uint32_t *key_size, uint64_t now)
+{
+    key_cache_entry_t entry;
+
+    if (key == NULL || key_size == NULL ||
+        key_cache_calc_api_key_id(appid, entry.id) != SGX_SUCCESS)
+        return false;
+
+    if (!key_cache_acquire(entry.id, entry, key, *key_size, now))
+        return false;
+
+    *key_size = entry.key_size;
+    return true;
+}
+
+void ehsm_cache_put_api_key(const ehsm_data_t *appid, const uint8_t *key, uint32_t key_size, uint64_t now)
+{
+    key_cache_entry_t entry;
+
+    if (key == NULL || key_size == 0 ||
+        key_cache_calc_api_key_id(appid, entry.id) != SGX_SUCCESS)
+        return;
+
+    // an expired or rotated api key may still be cached, it would win over the new one
+    key_cache_erase(entry.id);
+
+    entry.key.raw = (uint8_t *)malloc(key_size);
+    if (entry.key.raw == NULL)
+        return;
+
+    memcpy_s(entry.key.raw, key_size, key, key_size);
+    entry.key_size = key_size;
+    entry.cached_at = now;
+    entry.cost = KEY_CACHE_ENTRY_OVERHEAD + key_size;
+    key_cache_insert(entry);
+}
+
+void ehsm_cache_drop_api_key(const ehsm_data_t *appid)
+{
+    key_cache_id_t id;
+
+    if (key_cache_calc_api_key_id(appid, id) == SGX_SUCCESS)
+        key_cache_erase(id);
+}
+
+void ehsm_key_cache_flush()
+{
+    key_cache_list_t flushed;
+
+    sgx_spin_lock(&g_key_cache_lock);
+    flushed.swap(g_key_cache_lru);
+    g_key_cache_index.clear();
+    g_key_cache_stats.evictions += g_key_cache_stats.entries;
+    g_key_cache_stats.entries = 0;
+    g_key_cache_stats.bytes = 0;
+    sgx_spin_unlock(&g_key_cache_lock);
+
+    for (key_cache_list_t::iterator it = flushed.begin(); it != flushed.end(); ++it)
+        key_cache_release(*it);
+
+    // the cipher contexts hold key schedules of the flushed keys and of the domain key
+    ehsm_cipher_ctx_flush();
+}
+
+void ehsm_key_cache_get_stats(ehsm_key_cache_stats_t *stats)
+{
+    if (stats == NULL)
+        return;
+
+    sgx_spin_lock(&g_key_cache_lock);
+    *stats = g_key_cache_stats;
+    sgx_spin_unlock(&g_key_cache_lock);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "openssl/rsa.h"
+#include "openssl/ec.h"
+#include "openssl/evp.h"
+
+#include "datatypes.h"
+
+#ifndef _KEY_CACHE_H_
+#define _KEY_CACHE_H_
+
+/*
+ * The key cache keeps the unwrapped form of recently used CMKs inside the
+ * enclave, so that a hot key is decrypted by the domain key and parsed only
+ * once instead of on every request. Entries are looked up by the SHA-256 of
+ * the whole keyblob and evicted in LRU order once either bound below is hit.
+ * Both bounds can be overridden at build time to fit the EPC budget.
+ */
+#ifndef EH_KEY_CACHE_MAX_ENTRIES
+#define EH_KEY_CACHE_MAX_ENTRIES    512
+#endif
+
+#ifndef EH_KEY_CACHE_MAX_BYTES
+#define EH_KEY_CACHE_MAX_BYTES      (1024*1024)
+#endif
+
+// get the plaintext symmetric key of the cmk, key_size must match the keyspec
+sgx_status_t ehsm_cache_get_symmetric_key(const ehsm_keyblob_t *cmk,
+                                          uint8_t *key,
+                                          uint32_t key_size);
+
+// the following return a new reference, the caller must release it with the
+// matching *_free(), or NULL if the keyblob could not be unwrapped
+RSA *ehsm_cache_get_rsa_key(const ehsm_keyblob_t *cmk, bool is_private);
+
+EC_KEY *ehsm_cache_get_ec_key(const ehsm_keyblob_t *cmk, bool is_private);
+
+// the returned key has already been set to the EVP_PKEY_SM2 alias type
+EVP_PKEY *ehsm_cache_get_sm2_pkey(const ehsm_keyblob_t *cmk, bool is_private);
+
+/*
+ * Api keys are looked up by their appid. An entry expires EH_API_KEY_CACHE_TTL
+ * seconds after its api key was unwrapped, so that a rotated or deleted api key
+ * is not accepted for longer than that even if it is never invalidated. now is
+ * the time of the host in seconds, an entry cached in its future is expired too.
+ */
+#ifndef EH_API_KEY_CACHE_TTL
+#define EH_API_KEY_CACHE_TTL    300
+#endif
+
+// the unwrapped api key of an appid, key_size is the size of key and receives the
+// size of the api key, false if it is not cached or has expired
+bool ehsm_cache_get_api_key(const ehsm_data_t *appid, uint8_t *key, uint32_t *key_size, uint64_t now);
+
+// cache the api key unwrapped for an appid, it is copied and replaces any older one
+void ehsm_cache_put_api_key(const ehsm_data_t *appid, const uint8_t *key, uint32_t key_size, uint64_t now);
+
+// drop the api key cached for an appid, e.g. when it is rotated or deleted
+void ehsm_cache_drop_api_key(const ehsm_data_t *appid);
+
+// drop and zeroize all entries and the cipher contexts, e.g. when the domain key changes
+void ehsm_key_cache_flush();
+
+void ehsm_key_cache_get_stats(ehsm_key_cache_stats_t *stats);
+
+#endif
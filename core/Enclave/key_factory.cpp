@@ -38,48 +38,22 @@
 #include "key_factory.h"
 #include "key_operation.h"
 #include "openssl_operation.h"
+#include "key_pool.h"
 
 #define DUMMY_SIZE 128
 
+static_assert(sizeof(sgx_aes_gcm_data_ex_t) == EH_KEYBLOB_HEADER_SIZE,
+              "the keyblob header size is shared with the provider");
+
 sgx_aes_gcm_128bit_key_t g_domain_key = {0};
 
 using namespace std;
 
 sgx_status_t ehsm_calc_keyblob_size(const uint32_t keyspec, uint32_t &key_size)
 {
-    switch (keyspec)
-    {
-    case EH_RSA_2048:
-        key_size = PEM_BUFSIZE * 3 + sizeof(sgx_aes_gcm_data_ex_t);
-        break;
-    case EH_RSA_3072:
-        key_size = PEM_BUFSIZE * 4 + sizeof(sgx_aes_gcm_data_ex_t);
-        break;
-    case EH_RSA_4096:
-        key_size = PEM_BUFSIZE * 5 + sizeof(sgx_aes_gcm_data_ex_t);
-        break;
-    case EH_EC_P256:
-    case EH_EC_P224:
-    case EH_EC_P384:
-    case EH_EC_P521:
-    case EH_SM2:
-        key_size = PEM_BUFSIZE + sizeof(sgx_aes_gcm_data_ex_t);
-        break;
-    case EH_AES_GCM_128:
-    case EH_SM4_CTR:
-    case EH_SM4_CBC:
-        key_size = 16 + sizeof(sgx_aes_gcm_data_ex_t);
-        break;
-    case EH_AES_GCM_192:
-        key_size = 24 + sizeof(sgx_aes_gcm_data_ex_t);
-        break;
-    case EH_AES_GCM_256:
-        key_size = 32 + sizeof(sgx_aes_gcm_data_ex_t);
-        break;
-    default:
+    key_size = ehsm_get_keyblob_max_size(keyspec);
+    if (key_size == 0)
         return SGX_ERROR_UNEXPECTED;
-        break;
-    }
 
     return SGX_SUCCESS;
 }
@@ -120,23 +94,86 @@ sgx_status_t ehsm_create_keyblob(uint8_t *plaintext,
     {
         keyblob_data->ciphertext_size = plaintext_size;
         keyblob_data->aad_size = 0;
+        keyblob_data->version = EH_KEYBLOB_VERSION_1;
+    }
+
+    return ret;
+}
+
+// use the g_domain_key to encrypt the private key and authenticate the public key
+sgx_status_t ehsm_create_keyblob_v2(const uint8_t *privkey, uint32_t privkey_size,
+                                    const uint8_t *pubkey, uint32_t pubkey_size,
+                                    sgx_aes_gcm_data_ex_t *keyblob_data)
+{
+    if (keyblob_data == NULL || privkey == NULL || pubkey == NULL ||
+        privkey_size == 0 || pubkey_size == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    sgx_status_t ret = sgx_read_rand(keyblob_data->iv, sizeof(keyblob_data->iv));
+    if (ret != SGX_SUCCESS)
+    {
+        log_d("error generating iv.\n");
+        return ret;
+    }
+
+    uint8_t *aad = keyblob_data->payload + privkey_size;
+    memmove(aad, pubkey, pubkey_size);
+
+    ret = aes_gcm_encrypt((uint8_t *)g_domain_key,
+                          keyblob_data->payload, EVP_aes_128_gcm(),
+                          (uint8_t *)privkey, privkey_size,
+                          aad, pubkey_size,
+                          keyblob_data->iv, SGX_AESGCM_IV_SIZE,
+                          keyblob_data->mac, SGX_AESGCM_MAC_SIZE);
+
+    if (SGX_SUCCESS != ret)
+        printf("gcm encrypting failed.\n");
+    else
+    {
+        keyblob_data->ciphertext_size = privkey_size;
+        keyblob_data->aad_size = pubkey_size;
+        keyblob_data->version = EH_KEYBLOB_VERSION_2;
     }
 
     return ret;
 }
 
+uint32_t ehsm_get_keyblob_version(const sgx_aes_gcm_data_ex_t *keyblob_data)
+{
+    if (keyblob_data != NULL &&
+        keyblob_data->aad_size != 0 &&
+        keyblob_data->version == EH_KEYBLOB_VERSION_2)
+        return EH_KEYBLOB_VERSION_2;
+
+    return EH_KEYBLOB_VERSION_1;
+}
+
+bool ehsm_check_keyblob_size(const ehsm_keyblob_t *cmk)
+{
+    if (cmk == NULL || cmk->keybloblen < sizeof(sgx_aes_gcm_data_ex_t))
+        return false;
+
+    const sgx_aes_gcm_data_ex_t *keyblob_data = (const sgx_aes_gcm_data_ex_t *)cmk->keyblob;
+    uint64_t payload_size = (uint64_t)keyblob_data->ciphertext_size + keyblob_data->aad_size;
+
+    return payload_size <= cmk->keybloblen - sizeof(sgx_aes_gcm_data_ex_t);
+}
+
 // use the g_domain_key to decrypt the cmk and get it plaintext
 sgx_status_t ehsm_parse_keyblob(uint8_t *plaintext, sgx_aes_gcm_data_ex_t *keyblob_data)
 {
     if (NULL == keyblob_data || NULL == plaintext)
         return SGX_ERROR_INVALID_PARAMETER;
 
+    // v1 keyblobs have no aad, v2 keyblobs authenticate the public key as aad
+    uint8_t *aad = keyblob_data->aad_size ? keyblob_data->payload + keyblob_data->ciphertext_size : NULL;
+
     sgx_status_t ret = aes_gcm_decrypt((uint8_t *)g_domain_key,
                                        plaintext, EVP_aes_128_gcm(),
                                        keyblob_data->payload,
                                        keyblob_data->ciphertext_size,
-                                       NULL,
-                                       0,
+                                       aad,
+                                       keyblob_data->aad_size,
                                        keyblob_data->iv,
                                        SGX_AESGCM_IV_SIZE,
                                        keyblob_data->mac,
@@ -163,6 +200,9 @@ bool ehsm_get_symmetric_key_size(ehsm_keyspec_t key_spec, uint32_t &key_size)
     case EH_AES_GCM_256:
         key_size = 32;
         break;
+    case EH_HMAC:
+        key_size = EH_HMAC_KEY_SIZE;
+        break;
     default:
         return false;
     }
@@ -196,6 +236,9 @@ sgx_status_t ehsm_create_aes_key(ehsm_keyblob_t *cmk)
     if (!ehsm_get_symmetric_key_size(cmk->metadata.keyspec, keysize))
         return SGX_ERROR_UNEXPECTED;
 
+    if (cmk->keybloblen < keysize + sizeof(sgx_aes_gcm_data_ex_t))
+        return SGX_ERROR_INVALID_PARAMETER;
+
     uint8_t *key = (uint8_t *)malloc(keysize);
     if (key == NULL)
         return SGX_ERROR_OUT_OF_MEMORY;
@@ -210,6 +253,8 @@ sgx_status_t ehsm_create_aes_key(ehsm_keyblob_t *cmk)
     ret = ehsm_create_keyblob(key,
                               keysize,
                               (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    if (ret == SGX_SUCCESS)
+        cmk->keybloblen = keysize + sizeof(sgx_aes_gcm_data_ex_t);
 
     SAFE_MEMSET(key, keysize, 0, keysize);
     free(key);
@@ -217,102 +262,165 @@ sgx_status_t ehsm_create_aes_key(ehsm_keyblob_t *cmk)
     return ret;
 }
 
-sgx_status_t ehsm_create_rsa_key(ehsm_keyblob_t *cmk)
+/**
+ * @brief wrap the rsa key pair into a v2 keyblob
+ * @param rsa the key pair
+ * @param cmk receives the keyblob, keybloblen is the capacity on input and
+ * the exact size on output
+ * @return sgx_status_t
+ */
+static sgx_status_t ehsm_wrap_rsa_key(RSA *rsa, ehsm_keyblob_t *cmk)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint8_t *der_keypair = NULL;
+    uint8_t *p = NULL;
+    int privkey_size = 0;
+    int pubkey_size = 0;
+    uint32_t keyblob_size = 0;
 
-    if (cmk == NULL)
-        return ret;
+    privkey_size = i2d_RSAPrivateKey(rsa, NULL);
+    pubkey_size = i2d_RSAPublicKey(rsa, NULL);
+    if (privkey_size <= 0 || pubkey_size <= 0)
+        goto out;
 
-    if (cmk->keybloblen == 0)
-        return ehsm_calc_keyblob_size(cmk->metadata.keyspec, cmk->keybloblen);
+    keyblob_size = sizeof(sgx_aes_gcm_data_ex_t) + privkey_size + pubkey_size;
+    if (keyblob_size > cmk->keybloblen)
+    {
+        ret = SGX_ERROR_INVALID_PARAMETER;
+        goto out;
+    }
 
-    RSA *rsa_keypair = NULL;
-    BIO *bio = NULL;
-    uint8_t *pem_keypair = NULL;
-    uint32_t key_size = 0;
-    BIGNUM *e = NULL;
+    der_keypair = (uint8_t *)malloc(privkey_size + pubkey_size);
+    if (der_keypair == NULL)
+    {
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+        goto out;
+    }
 
-    e = BN_new();
-    if (!e)
+    p = der_keypair;
+    if (i2d_RSAPrivateKey(rsa, &p) != privkey_size ||
+        i2d_RSAPublicKey(rsa, &p) != pubkey_size)
         goto out;
 
-    if (!BN_set_word(e, (BN_ULONG)RSA_F4))
+    ret = ehsm_create_keyblob_v2(der_keypair, privkey_size,
+                                 der_keypair + privkey_size, pubkey_size,
+                                 (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    if (ret == SGX_SUCCESS)
+        cmk->keybloblen = keyblob_size;
+
+out:
+    SAFE_MEMSET(der_keypair, privkey_size + pubkey_size, 0, privkey_size + pubkey_size);
+    SAFE_FREE(der_keypair);
+    return ret;
+}
+
+/**
+ * @brief wrap the ec (or sm2) key pair into a v2 keyblob
+ * the public point is left out of the private key, it is stored once as the
+ * SubjectPublicKeyInfo and recomputed by openssl when the private key is loaded
+ * @param ec_key the key pair
+ * @param cmk receives the keyblob, keybloblen is the capacity on input and
+ * the exact size on output
+ * @return sgx_status_t
+ */
+static sgx_status_t ehsm_wrap_ec_key(EC_KEY *ec_key, ehsm_keyblob_t *cmk)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint8_t *der_keypair = NULL;
+    uint8_t *p = NULL;
+    int privkey_size = 0;
+    int pubkey_size = 0;
+    uint32_t keyblob_size = 0;
+
+    EC_KEY_set_asn1_flag(ec_key, OPENSSL_EC_NAMED_CURVE);
+
+    pubkey_size = i2d_EC_PUBKEY(ec_key, NULL);
+    EC_KEY_set_enc_flags(ec_key, EC_KEY_get_enc_flags(ec_key) | EC_PKEY_NO_PUBKEY);
+    privkey_size = i2d_ECPrivateKey(ec_key, NULL);
+    if (privkey_size <= 0 || pubkey_size <= 0)
         goto out;
 
-    rsa_keypair = RSA_new();
-    if (rsa_keypair == NULL)
+    keyblob_size = sizeof(sgx_aes_gcm_data_ex_t) + privkey_size + pubkey_size;
+    if (keyblob_size > cmk->keybloblen)
+    {
+        ret = SGX_ERROR_INVALID_PARAMETER;
         goto out;
+    }
 
-    switch (cmk->metadata.keyspec)
+    der_keypair = (uint8_t *)malloc(privkey_size + pubkey_size);
+    if (der_keypair == NULL)
+    {
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    p = der_keypair;
+    if (i2d_ECPrivateKey(ec_key, &p) != privkey_size ||
+        i2d_EC_PUBKEY(ec_key, &p) != pubkey_size)
+        goto out;
+
+    ret = ehsm_create_keyblob_v2(der_keypair, privkey_size,
+                                 der_keypair + privkey_size, pubkey_size,
+                                 (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    if (ret == SGX_SUCCESS)
+        cmk->keybloblen = keyblob_size;
+
+out:
+    SAFE_MEMSET(der_keypair, privkey_size + pubkey_size, 0, privkey_size + pubkey_size);
+    SAFE_FREE(der_keypair);
+    return ret;
+}
+
+RSA *ehsm_generate_rsa_keypair(ehsm_keyspec_t keyspec)
+{
+    RSA *rsa_keypair = NULL;
+    BIGNUM *e = NULL;
+    int bits = 0;
+
+    switch (keyspec)
     {
     case EH_RSA_2048:
-        RSA_generate_key_ex(rsa_keypair, RSA_2048_KEY_BITS, e, NULL);
+        bits = RSA_2048_KEY_BITS;
         break;
     case EH_RSA_3072:
-        RSA_generate_key_ex(rsa_keypair, RSA_3072_KEY_BITS, e, NULL);
+        bits = RSA_3072_KEY_BITS;
         break;
     case EH_RSA_4096:
-        RSA_generate_key_ex(rsa_keypair, RSA_4096_KEY_BITS, e, NULL);
+        bits = RSA_4096_KEY_BITS;
         break;
     default:
-        goto out;
+        return NULL;
     }
-    if (rsa_keypair == NULL)
-        goto out;
-
-    bio = BIO_new(BIO_s_mem());
-    if (bio == NULL)
-        goto out;
 
-    if (!PEM_write_bio_RSAPublicKey(bio, rsa_keypair))
-        goto out;
-
-    if (!PEM_write_bio_RSAPrivateKey(bio, rsa_keypair, NULL, NULL, 0, NULL, NULL))
-        goto out;
-
-    key_size = BIO_pending(bio);
-    if (key_size <= 0)
+    e = BN_new();
+    if (!e)
         goto out;
 
-    pem_keypair = (uint8_t *)malloc(key_size);
-    if (pem_keypair == NULL)
+    if (!BN_set_word(e, (BN_ULONG)RSA_F4))
         goto out;
 
-    if (BIO_read(bio, pem_keypair, key_size) < 0)
+    rsa_keypair = RSA_new();
+    if (rsa_keypair == NULL)
         goto out;
 
-    ret = ehsm_create_keyblob(pem_keypair, key_size, (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
-
-    if (ret != SGX_SUCCESS)
-        goto out;
+    if (!RSA_generate_key_ex(rsa_keypair, bits, e, NULL))
+    {
+        RSA_free(rsa_keypair);
+        rsa_keypair = NULL;
+    }
 
 out:
-    if (rsa_keypair)
-        RSA_free(rsa_keypair);
-    if (bio)
-        BIO_free(bio);
+    if (e)
+        BN_free(e);
 
-    SAFE_MEMSET(pem_keypair, key_size, 0, key_size);
-    SAFE_FREE(pem_keypair);
-    return ret;
+    return rsa_keypair;
 }
 
-sgx_status_t ehsm_create_ecc_key(ehsm_keyblob_t *cmk) // https://github.com/intel/linux-sgx/blob/master/SampleCode/SampleAttestedTLS/common/utility.cpp
+EC_KEY *ehsm_generate_ecc_keypair(ehsm_keyspec_t keyspec) // https://github.com/intel/linux-sgx/blob/master/SampleCode/SampleAttestedTLS/common/utility.cpp
 {
-    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
-
-    if (cmk == NULL)
-        return ret;
-
-    if (cmk->keybloblen == 0)
-        return ehsm_calc_keyblob_size(cmk->metadata.keyspec, cmk->keybloblen);
-
     EVP_PKEY_CTX *pkey_ctx = NULL;
     EVP_PKEY *pkey = NULL;
-    BIO *bio = NULL;
-    uint8_t *pem_keypair = NULL;
-    uint32_t key_size = 0;
+    EC_KEY *ec_key = NULL;
 
     pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
     if (pkey_ctx == NULL)
@@ -322,7 +430,7 @@ sgx_status_t ehsm_create_ecc_key(ehsm_keyblob_t *cmk) // https://github.com/inte
         goto out;
 
     uint32_t nid;
-    switch (cmk->metadata.keyspec)
+    switch (keyspec)
     {
     case EH_EC_P224:
         nid = NID_secp224r1;
@@ -346,58 +454,23 @@ sgx_status_t ehsm_create_ecc_key(ehsm_keyblob_t *cmk) // https://github.com/inte
     if (EVP_PKEY_keygen(pkey_ctx, &pkey) <= 0)
         goto out;
 
-    bio = BIO_new(BIO_s_mem());
-    if (bio == NULL)
-        goto out;
-
-    if (!PEM_write_bio_PUBKEY(bio, pkey))
-        goto out;
-
-    if (!PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0, NULL, NULL))
-        goto out;
-
-    key_size = BIO_pending(bio);
-    if (key_size <= 0)
-        goto out;
-
-    pem_keypair = (uint8_t *)malloc(key_size);
-    if (pem_keypair == NULL)
-        goto out;
-
-    if (BIO_read(bio, pem_keypair, key_size) < 0)
-        goto out;
-
-    ret = ehsm_create_keyblob(pem_keypair, key_size, (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ec_key = EVP_PKEY_get1_EC_KEY(pkey);
 
 out:
     if (pkey_ctx)
         EVP_PKEY_CTX_free(pkey_ctx);
     if (pkey)
         EVP_PKEY_free(pkey);
-    if (bio)
-        BIO_free(bio);
 
-    SAFE_MEMSET(pem_keypair, key_size, 0, key_size);
-    SAFE_FREE(pem_keypair);
-    return ret;
+    return ec_key;
 }
 
-sgx_status_t ehsm_create_sm2_key(ehsm_keyblob_t *cmk)
+EC_KEY *ehsm_generate_sm2_keypair()
 // https://github.com/intel/intel-sgx-ssl/blob/master/Linux/sgx/test_app/enclave/tests/evp_smx.c
 {
-    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
-
-    if (cmk == NULL)
-        return ret;
-
-    if (cmk->keybloblen == 0)
-        return ehsm_calc_keyblob_size(cmk->metadata.keyspec, cmk->keybloblen);
-
-    BIO *bio = NULL;
-    uint8_t *pem_keypair = NULL;
-    uint32_t key_size = 0;
     EC_GROUP *ec_group = NULL;
     EC_KEY *ec_key = NULL;
+    EC_KEY *keypair = NULL;
 
     ec_group = EC_GROUP_new_by_curve_name(NID_sm2);
     if (ec_group == NULL)
@@ -425,40 +498,174 @@ sgx_status_t ehsm_create_sm2_key(ehsm_keyblob_t *cmk)
         goto out;
     }
 
-    bio = BIO_new(BIO_s_mem());
-    if (bio == NULL)
-        goto out;
+    keypair = ec_key;
+    ec_key = NULL;
 
-    if (!PEM_write_bio_EC_PUBKEY(bio, ec_key))
-        goto out;
+out:
+    if (ec_key)
+        EC_KEY_free(ec_key);
+    if (ec_group)
+        EC_GROUP_free(ec_group);
 
-    if (!PEM_write_bio_ECPrivateKey(bio, ec_key, NULL, NULL, 0, NULL, NULL))
-        goto out;
+    return keypair;
+}
 
-    key_size = BIO_pending(bio);
-    if (key_size <= 0)
-        goto out;
+/* the key pair comes from the pool when it has one, otherwise it is generated inline */
+sgx_status_t ehsm_create_rsa_key(ehsm_keyblob_t *cmk)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    RSA *rsa_keypair = NULL;
+
+    if (cmk == NULL)
+        return ret;
+
+    if (cmk->keybloblen == 0)
+        return ehsm_calc_keyblob_size(cmk->metadata.keyspec, cmk->keybloblen);
+
+    switch (cmk->metadata.keyspec)
+    {
+    case EH_RSA_2048:
+    case EH_RSA_3072:
+    case EH_RSA_4096:
+        break;
+    default:
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    rsa_keypair = ehsm_key_pool_get_rsa_key(cmk->metadata.keyspec);
+    if (rsa_keypair == NULL)
+        rsa_keypair = ehsm_generate_rsa_keypair(cmk->metadata.keyspec);
+    if (rsa_keypair == NULL)
+        return ret;
+
+    ret = ehsm_wrap_rsa_key(rsa_keypair, cmk);
+
+    RSA_free(rsa_keypair);
+
+    return ret;
+}
+
+sgx_status_t ehsm_create_ecc_key(ehsm_keyblob_t *cmk)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    EC_KEY *ec_key = NULL;
+
+    if (cmk == NULL)
+        return ret;
+
+    if (cmk->keybloblen == 0)
+        return ehsm_calc_keyblob_size(cmk->metadata.keyspec, cmk->keybloblen);
+
+    ec_key = ehsm_key_pool_get_ec_key(cmk->metadata.keyspec);
+    if (ec_key == NULL)
+        ec_key = ehsm_generate_ecc_keypair(cmk->metadata.keyspec);
+    if (ec_key == NULL)
+        return ret;
+
+    ret = ehsm_wrap_ec_key(ec_key, cmk);
+
+    EC_KEY_free(ec_key);
+
+    return ret;
+}
+
+sgx_status_t ehsm_create_sm2_key(ehsm_keyblob_t *cmk)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    EC_KEY *ec_key = NULL;
+
+    if (cmk == NULL)
+        return ret;
+
+    if (cmk->keybloblen == 0)
+        return ehsm_calc_keyblob_size(cmk->metadata.keyspec, cmk->keybloblen);
+
+    ec_key = ehsm_key_pool_get_ec_key(EH_SM2);
+    if (ec_key == NULL)
+        ec_key = ehsm_generate_sm2_keypair();
+    if (ec_key == NULL)
+        return ret;
+
+    ret = ehsm_wrap_ec_key(ec_key, cmk);
+
+    EC_KEY_free(ec_key);
+
+    return ret;
+}
+
+sgx_status_t ehsm_upgrade_keyblob(ehsm_keyblob_t *cmk)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint8_t *pem_keypair = NULL;
+    uint32_t pem_size = 0;
+    BIO *bio = NULL;
+    RSA *rsa_keypair = NULL;
+    EC_KEY *ec_key = NULL;
+
+    if (cmk == NULL || !ehsm_check_keyblob_size(cmk))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    sgx_aes_gcm_data_ex_t *keyblob_data = (sgx_aes_gcm_data_ex_t *)cmk->keyblob;
+
+    // symmetric keys are already stored raw at the exact size
+    switch (cmk->metadata.keyspec)
+    {
+    case EH_RSA_2048:
+    case EH_RSA_3072:
+    case EH_RSA_4096:
+    case EH_EC_P224:
+    case EH_EC_P256:
+    case EH_EC_P384:
+    case EH_EC_P521:
+    case EH_SM2:
+        break;
+    default:
+        return SGX_SUCCESS;
+    }
+
+    if (ehsm_get_keyblob_version(keyblob_data) == EH_KEYBLOB_VERSION_2)
+        return SGX_SUCCESS;
 
-    pem_keypair = (uint8_t *)malloc(key_size);
+    pem_size = keyblob_data->ciphertext_size;
+    pem_keypair = (uint8_t *)malloc(pem_size);
     if (pem_keypair == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    ret = ehsm_parse_keyblob(pem_keypair, keyblob_data);
+    if (ret != SGX_SUCCESS)
         goto out;
 
-    if (BIO_read(bio, pem_keypair, key_size) < 0)
+    ret = SGX_ERROR_UNEXPECTED;
+    bio = BIO_new_mem_buf(pem_keypair, pem_size);
+    if (bio == NULL)
         goto out;
 
-    ret = ehsm_create_keyblob(pem_keypair, key_size, (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    // the DER encoding is always shorter than the PEM one, so it fits in place
+    if (cmk->metadata.keyspec == EH_RSA_2048 ||
+        cmk->metadata.keyspec == EH_RSA_3072 ||
+        cmk->metadata.keyspec == EH_RSA_4096)
+    {
+        rsa_keypair = PEM_read_bio_RSAPrivateKey(bio, NULL, NULL, NULL);
+        if (rsa_keypair == NULL)
+            goto out;
+
+        ret = ehsm_wrap_rsa_key(rsa_keypair, cmk);
+    }
+    else
+    {
+        ec_key = PEM_read_bio_ECPrivateKey(bio, NULL, NULL, NULL);
+        if (ec_key == NULL)
+            goto out;
+
+        ret = ehsm_wrap_ec_key(ec_key, cmk);
+    }
 
-    if (ret != SGX_SUCCESS)
-        goto out;
 out:
-    if (ec_key)
-        EC_KEY_free(ec_key);
-    if (bio)
-        BIO_free(bio);
-    if (ec_group)
-        EC_GROUP_free(ec_group);
+    RSA_free(rsa_keypair);
+    EC_KEY_free(ec_key);
+    BIO_free(bio);
 
-    SAFE_MEMSET(pem_keypair, key_size, 0, key_size);
+    SAFE_MEMSET(pem_keypair, pem_size, 0, pem_size);
     SAFE_FREE(pem_keypair);
     return ret;
 }
@@ -481,6 +688,9 @@ sgx_status_t ehsm_create_sm4_key(ehsm_keyblob_t *cmk)
     if (!ehsm_get_symmetric_key_size(cmk->metadata.keyspec, keysize))
         return SGX_ERROR_UNEXPECTED;
 
+    if (cmk->keybloblen < keysize + sizeof(sgx_aes_gcm_data_ex_t))
+        return SGX_ERROR_INVALID_PARAMETER;
+
     uint8_t *key = (uint8_t *)malloc(keysize);
     if (key == NULL)
         return SGX_ERROR_OUT_OF_MEMORY;
@@ -494,9 +704,59 @@ sgx_status_t ehsm_create_sm4_key(ehsm_keyblob_t *cmk)
     ret = ehsm_create_keyblob(key,
                               keysize,
                               (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    if (ret == SGX_SUCCESS)
+        cmk->keybloblen = keysize + sizeof(sgx_aes_gcm_data_ex_t);
 
     SAFE_MEMSET(key, keysize, 0, keysize);
 
     free(key);
     return ret;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief generate a random hmac key, the digest mode of the cmk picks the hash
+ * @param cmk storage key information
+ * @return sgx_status_t
+ */
+sgx_status_t ehsm_create_hmac_key(ehsm_keyblob_t *cmk)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    if (cmk == NULL)
+        return ret;
+
+    if (cmk->keybloblen == 0)
+        return ehsm_calc_keyblob_size(cmk->metadata.keyspec, cmk->keybloblen);
+
+    if (cmk->metadata.keyspec != EH_HMAC ||
+        ehsm_get_mac_size(cmk->metadata.digest_mode) == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    uint32_t keysize = 0;
+    if (!ehsm_get_symmetric_key_size(cmk->metadata.keyspec, keysize))
+        return SGX_ERROR_UNEXPECTED;
+
+    if (cmk->keybloblen < keysize + sizeof(sgx_aes_gcm_data_ex_t))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    uint8_t *key = (uint8_t *)malloc(keysize);
+    if (key == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    ret = sgx_read_rand(key, keysize);
+    if (ret != SGX_SUCCESS)
+    {
+        free(key);
+        return ret;
+    }
+    ret = ehsm_create_keyblob(key,
+                              keysize,
+                              (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    if (ret == SGX_SUCCESS)
+        cmk->keybloblen = keysize + sizeof(sgx_aes_gcm_data_ex_t);
+
+    SAFE_MEMSET(key, keysize, 0, keysize);
+
+    free(key);
+    return ret;
+}
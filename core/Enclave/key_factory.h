@@ -44,11 +44,22 @@
 #ifndef _KEY_FACTORY_H_
 #define _KEY_FACTORY_H_
 
+/*
+ * Versions of the keyblob layout, the version is only meaningful when aad_size
+ * is not 0 since v1 never wrote the field:
+ * v1: the raw symmetric key or the PEM key pair is encrypted, there is no aad.
+ * v2: asymmetric keys only, the DER private key is encrypted and the DER
+ *     public key follows it in clear as the aad, so both are exactly sized.
+ */
+#define EH_KEYBLOB_VERSION_1    1
+#define EH_KEYBLOB_VERSION_2    2
+
 typedef struct _aes_gcm_data_ex_t
 {
     uint32_t ciphertext_size;
     uint32_t aad_size;
-    uint8_t reserve1[8];
+    uint8_t version;
+    uint8_t reserve1[7];
     uint8_t iv[SGX_AESGCM_IV_SIZE];
     uint8_t reserve2[4];
     uint8_t mac[SGX_AESGCM_MAC_SIZE];
@@ -63,6 +74,21 @@ sgx_status_t ehsm_parse_keyblob(uint8_t *plaintext,
 sgx_status_t ehsm_create_keyblob(uint8_t *plaintext, uint32_t plaintext_size,
                                  sgx_aes_gcm_data_ex_t *keyblob_data);
 
+// use the g_domain_key to encrypt the DER private key, the DER public key is
+// stored right after it and authenticated as the aad (keyblob v2)
+sgx_status_t ehsm_create_keyblob_v2(const uint8_t *privkey, uint32_t privkey_size,
+                                    const uint8_t *pubkey, uint32_t pubkey_size,
+                                    sgx_aes_gcm_data_ex_t *keyblob_data);
+
+uint32_t ehsm_get_keyblob_version(const sgx_aes_gcm_data_ex_t *keyblob_data);
+
+// check the ciphertext and aad recorded in the header fit in the keyblob
+bool ehsm_check_keyblob_size(const ehsm_keyblob_t *cmk);
+
+// rewrap a v1 (PEM) asymmetric keyblob as v2 in place, the keybloblen is
+// updated to the new exact size. Other keyblobs are left unchanged.
+sgx_status_t ehsm_upgrade_keyblob(ehsm_keyblob_t *cmk);
+
 // calculate the keyblob size based on the key metadata infomations.
 sgx_status_t ehsm_calc_keyblob_size(const uint32_t keyspec, uint32_t &key_size);
 
@@ -80,4 +106,6 @@ sgx_status_t ehsm_create_sm2_key(ehsm_keyblob_t *cmk);
 
 sgx_status_t ehsm_create_sm4_key(ehsm_keyblob_t *cmk);
 
+sgx_status_t ehsm_create_hmac_key(ehsm_keyblob_t *cmk);
+
 #endif
\ No newline at end of file
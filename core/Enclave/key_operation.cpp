@@ -33,7 +33,12 @@
 #include "datatypes.h"
 #include "key_operation.h"
 #include "key_factory.h"
+#include "key_cache.h"
 #include "openssl_operation.h"
+#include "enclave_stats.h"
+
+#include "openssl/hmac.h"
+#include "openssl/crypto.h"
 
 using namespace std;
 
@@ -111,6 +116,7 @@ sgx_status_t ehsm_aes_gcm_encrypt(ehsm_data_t *aad,
                                   ehsm_data_t *cipherblob)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     /* this api only support for symmetric keys */
     if (cmk->metadata.keyspec != EH_AES_GCM_128 &&
@@ -121,7 +127,7 @@ sgx_status_t ehsm_aes_gcm_encrypt(ehsm_data_t *aad,
     /* calculate the ciphertext length */
     if (cipherblob->datalen == 0)
     {
-        cipherblob->datalen = plaintext->datalen + EH_AES_GCM_IV_SIZE + EH_AES_GCM_MAC_SIZE;
+        cipherblob->datalen = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
         return SGX_SUCCESS;
     }
 
@@ -155,21 +161,23 @@ sgx_status_t ehsm_aes_gcm_encrypt(ehsm_data_t *aad,
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = sgx_read_rand(iv, SGX_AESGCM_IV_SIZE);
+    ehsm_stats_end(EH_STATS_READ_RAND, cmk->metadata.keyspec, stats_start);
     if (ret != SGX_SUCCESS)
     {
         log_d("error generating IV\n");
         goto out;
     }
 
-    ret = ehsm_parse_keyblob(key,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ret = ehsm_cache_get_symmetric_key(cmk, key, keysize);
     if (ret != SGX_SUCCESS)
     {
         log_d("failed to decrypt key\n");
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = aes_gcm_encrypt(key,
                           cipherblob->data,
                           block_mode,
@@ -181,9 +189,12 @@ sgx_status_t ehsm_aes_gcm_encrypt(ehsm_data_t *aad,
                           SGX_AESGCM_IV_SIZE,
                           mac,
                           EH_AES_GCM_MAC_SIZE);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (ret == SGX_SUCCESS)
+        cipherblob->datalen = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
 
 out:
-    SAFE_MEMSET(&key, sizeof(key), 0, sizeof(key));
+    SAFE_MEMSET(key, keysize, 0, keysize);
     SAFE_FREE(key);
     return ret;
 }
@@ -202,6 +213,7 @@ sgx_status_t ehsm_aes_gcm_decrypt(ehsm_data_t *aad,
                                   ehsm_data_t *plaintext)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
     uint8_t l_tag[SGX_AESGCM_MAC_SIZE];
 
     /* this api only support for symmetric keys */
@@ -210,10 +222,11 @@ sgx_status_t ehsm_aes_gcm_decrypt(ehsm_data_t *aad,
         cmk->metadata.keyspec != EH_AES_GCM_256)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    /* calculate the ciphertext length */
+    /* calculate the plaintext length */
+    uint32_t plaintext_len = ehsm_get_plaintext_size(cmk->metadata.keyspec, cipherblob->datalen);
     if (plaintext->datalen == 0)
     {
-        plaintext->datalen = cipherblob->datalen - EH_AES_GCM_IV_SIZE - EH_AES_GCM_MAC_SIZE;
+        plaintext->datalen = plaintext_len;
         return SGX_SUCCESS;
     }
 
@@ -228,14 +241,15 @@ sgx_status_t ehsm_aes_gcm_decrypt(ehsm_data_t *aad,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    if (plaintext->datalen > EH_ENCRYPT_MAX_SIZE)
+    if (plaintext_len == 0 || plaintext_len > EH_ENCRYPT_MAX_SIZE)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    if (cipherblob->datalen < plaintext->datalen + SGX_AESGCM_IV_SIZE + SGX_AESGCM_MAC_SIZE)
+    /* the plaintext buffer may be larger, the exact length is reported back */
+    if (plaintext->datalen < plaintext_len)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    uint8_t *iv = (uint8_t *)(cipherblob->data + plaintext->datalen);
-    uint8_t *mac = (uint8_t *)(cipherblob->data + plaintext->datalen + SGX_AESGCM_IV_SIZE);
+    uint8_t *iv = (uint8_t *)(cipherblob->data + plaintext_len);
+    uint8_t *mac = (uint8_t *)(cipherblob->data + plaintext_len + SGX_AESGCM_IV_SIZE);
     uint8_t *key = (uint8_t *)malloc(keysize);
     if (key == NULL)
         return SGX_ERROR_OUT_OF_MEMORY;
@@ -247,8 +261,7 @@ sgx_status_t ehsm_aes_gcm_decrypt(ehsm_data_t *aad,
         goto out;
     }
 
-    ret = ehsm_parse_keyblob(key,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ret = ehsm_cache_get_symmetric_key(cmk, key, keysize);
     if (ret != SGX_SUCCESS)
         goto out;
 
@@ -256,20 +269,24 @@ sgx_status_t ehsm_aes_gcm_decrypt(ehsm_data_t *aad,
     SAFE_MEMSET(&l_tag, SGX_AESGCM_MAC_SIZE, 0, SGX_AESGCM_MAC_SIZE);
     memcpy_s(l_tag, SGX_AESGCM_MAC_SIZE, mac, SGX_AESGCM_MAC_SIZE);
 
+    stats_start = ehsm_stats_begin();
     ret = aes_gcm_decrypt(key,
                           plaintext->data,
                           block_mode,
                           cipherblob->data,
-                          cipherblob->datalen - EH_AES_GCM_IV_SIZE - EH_AES_GCM_MAC_SIZE,
+                          plaintext_len,
                           aad->data,
                           aad->datalen,
                           iv,
                           SGX_AESGCM_IV_SIZE,
                           l_tag,
                           SGX_AESGCM_MAC_SIZE);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (ret == SGX_SUCCESS)
+        plaintext->datalen = plaintext_len;
 out:
     SAFE_MEMSET(&l_tag, SGX_AESGCM_MAC_SIZE, 0, SGX_AESGCM_MAC_SIZE);
-    SAFE_MEMSET(key, sizeof(key), 0, sizeof(key));
+    SAFE_MEMSET(key, keysize, 0, keysize);
     SAFE_FREE(key);
     return ret;
 }
@@ -285,6 +302,7 @@ sgx_status_t ehsm_sm4_ctr_encrypt(ehsm_keyblob_t *cmk,
                                   ehsm_data_t *cipherblob)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     /* this api only support for symmetric keys */
     if (cmk->metadata.keyspec != EH_SM4_CTR)
@@ -293,7 +311,7 @@ sgx_status_t ehsm_sm4_ctr_encrypt(ehsm_keyblob_t *cmk,
     /* calculate the ciphertext length */
     if (cipherblob->datalen == 0)
     {
-        cipherblob->datalen = plaintext->datalen + SGX_SM4_IV_SIZE;
+        cipherblob->datalen = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
         return SGX_SUCCESS;
     }
 
@@ -319,28 +337,33 @@ sgx_status_t ehsm_sm4_ctr_encrypt(ehsm_keyblob_t *cmk,
     if (key == NULL)
         return SGX_ERROR_OUT_OF_MEMORY;
 
+    stats_start = ehsm_stats_begin();
     ret = sgx_read_rand(iv, SGX_SM4_IV_SIZE);
+    ehsm_stats_end(EH_STATS_READ_RAND, cmk->metadata.keyspec, stats_start);
     if (ret != SGX_SUCCESS)
     {
         log_d("error generating IV\n");
         goto out;
     }
 
-    ret = ehsm_parse_keyblob(key,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ret = ehsm_cache_get_symmetric_key(cmk, key, keysize);
     if (ret != SGX_SUCCESS)
     {
         log_d("failed to decrypt key\n");
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = sm4_ctr_encrypt(key,
                           cipherblob->data,
                           plaintext->data,
                           plaintext->datalen,
                           iv);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (ret == SGX_SUCCESS)
+        cipherblob->datalen = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
 out:
-    SAFE_MEMSET(&key, sizeof(key), 0, sizeof(key));
+    SAFE_MEMSET(key, keysize, 0, keysize);
     SAFE_FREE(key);
     return ret;
 }
@@ -350,15 +373,17 @@ sgx_status_t ehsm_sm4_ctr_decrypt(ehsm_keyblob_t *cmk,
                                   ehsm_data_t *plaintext)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     /* this api only support for symmetric keys */
     if (cmk->metadata.keyspec != EH_SM4_CTR)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    /* calculate the ciphertext length */
+    /* calculate the plaintext length */
+    uint32_t plaintext_len = ehsm_get_plaintext_size(cmk->metadata.keyspec, cipherblob->datalen);
     if (plaintext->datalen == 0)
     {
-        plaintext->datalen = cipherblob->datalen - SGX_SM4_IV_SIZE;
+        plaintext->datalen = plaintext_len;
         return SGX_SUCCESS;
     }
 
@@ -373,29 +398,33 @@ sgx_status_t ehsm_sm4_ctr_decrypt(ehsm_keyblob_t *cmk,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    if (plaintext->datalen > EH_ENCRYPT_MAX_SIZE)
+    if (plaintext_len == 0 || plaintext_len > EH_ENCRYPT_MAX_SIZE)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    if (cipherblob->datalen < plaintext->datalen + SGX_SM4_IV_SIZE)
+    /* the plaintext buffer may be larger, the exact length is reported back */
+    if (plaintext->datalen < plaintext_len)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    uint8_t *iv = (uint8_t *)(cipherblob->data + plaintext->datalen);
+    uint8_t *iv = (uint8_t *)(cipherblob->data + plaintext_len);
     uint8_t *key = (uint8_t *)malloc(keysize);
     if (key == NULL)
         return SGX_ERROR_OUT_OF_MEMORY;
 
-    ret = ehsm_parse_keyblob(key,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ret = ehsm_cache_get_symmetric_key(cmk, key, keysize);
     if (ret != SGX_SUCCESS)
     {
         log_d("error(%d) unsealing key.\n", ret);
         goto out;
     }
 
-    ret = sm4_ctr_decrypt(key, plaintext->data, cipherblob->data, plaintext->datalen, iv);
+    stats_start = ehsm_stats_begin();
+    ret = sm4_ctr_decrypt(key, plaintext->data, cipherblob->data, plaintext_len, iv);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (ret == SGX_SUCCESS)
+        plaintext->datalen = plaintext_len;
 
 out:
-    SAFE_MEMSET(key, sizeof(key), 0, sizeof(key));
+    SAFE_MEMSET(key, keysize, 0, keysize);
     SAFE_FREE(key);
     return ret;
 }
@@ -405,6 +434,7 @@ sgx_status_t ehsm_sm4_cbc_encrypt(ehsm_keyblob_t *cmk,
                                   ehsm_data_t *cipherblob)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
     uint8_t *iv = NULL;
 
     /* this api only support for symmetric keys */
@@ -414,12 +444,7 @@ sgx_status_t ehsm_sm4_cbc_encrypt(ehsm_keyblob_t *cmk,
     /* calculate the ciphertext length */
     if (cipherblob->datalen == 0)
     {
-        if (plaintext->datalen % 16 != 0)
-        {
-            cipherblob->datalen = (plaintext->datalen / 16 + 1) * 16 + SGX_SM4_IV_SIZE;
-            return SGX_SUCCESS;
-        }
-        cipherblob->datalen = plaintext->datalen + SGX_SM4_IV_SIZE;
+        cipherblob->datalen = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
         return SGX_SUCCESS;
     }
 
@@ -456,29 +481,34 @@ sgx_status_t ehsm_sm4_cbc_encrypt(ehsm_keyblob_t *cmk,
     if (key == NULL)
         return SGX_ERROR_OUT_OF_MEMORY;
 
+    stats_start = ehsm_stats_begin();
     ret = sgx_read_rand(iv, SGX_SM4_IV_SIZE);
+    ehsm_stats_end(EH_STATS_READ_RAND, cmk->metadata.keyspec, stats_start);
     if (ret != SGX_SUCCESS)
     {
         log_d("error generating IV\n");
         goto out;
     }
 
-    ret = ehsm_parse_keyblob(key,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ret = ehsm_cache_get_symmetric_key(cmk, key, keysize);
     if (ret != SGX_SUCCESS)
     {
         log_d("failed to decrypt key\n");
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = sm4_cbc_encrypt(key,
                           cipherblob->data,
                           plaintext->data,
                           plaintext->datalen,
                           iv);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (ret == SGX_SUCCESS)
+        cipherblob->datalen = ehsm_get_ciphertext_size(cmk->metadata.keyspec, plaintext->datalen);
 
 out:
-    SAFE_MEMSET(&key, sizeof(key), 0, sizeof(key));
+    SAFE_MEMSET(key, keysize, 0, keysize);
     SAFE_FREE(key);
     return ret;
 }
@@ -488,15 +518,17 @@ sgx_status_t ehsm_sm4_cbc_decrypt(ehsm_keyblob_t *cmk,
                                   ehsm_data_t *plaintext)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     /* this api only support for symmetric keys */
     if (cmk->metadata.keyspec != EH_SM4_CBC)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    /* calculate the ciphertext length */
+    /* calculate the plaintext length */
+    uint32_t plaintext_len = ehsm_get_plaintext_size(cmk->metadata.keyspec, cipherblob->datalen);
     if (plaintext->datalen == 0)
     {
-        plaintext->datalen = cipherblob->datalen - SGX_SM4_IV_SIZE;
+        plaintext->datalen = plaintext_len;
         return SGX_SUCCESS;
     }
 
@@ -511,10 +543,11 @@ sgx_status_t ehsm_sm4_cbc_decrypt(ehsm_keyblob_t *cmk,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    if (plaintext->datalen > EH_ENCRYPT_MAX_SIZE)
+    if (plaintext_len == 0 || plaintext_len > EH_ENCRYPT_MAX_SIZE)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    if (cipherblob->datalen < plaintext->datalen + SGX_SM4_IV_SIZE)
+    /* the plaintext buffer may be larger, the exact length is reported back */
+    if (plaintext->datalen < plaintext_len)
         return SGX_ERROR_INVALID_PARAMETER;
 
     uint8_t *iv = (uint8_t *)(cipherblob->data + cipherblob->datalen - SGX_SM4_IV_SIZE);
@@ -529,19 +562,22 @@ sgx_status_t ehsm_sm4_cbc_decrypt(ehsm_keyblob_t *cmk,
         goto out;
     }
 
-    ret = ehsm_parse_keyblob(key,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
+    ret = ehsm_cache_get_symmetric_key(cmk, key, keysize);
     if (ret != SGX_SUCCESS)
         goto out;
 
+    stats_start = ehsm_stats_begin();
     ret = sm4_cbc_decrypt(key,
                           plaintext->data,
                           cipherblob->data,
                           cipherblob->datalen,
                           iv);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (ret == SGX_SUCCESS)
+        plaintext->datalen = plaintext_len;
 
 out:
-    SAFE_MEMSET(key, sizeof(key), 0, sizeof(key));
+    SAFE_MEMSET(key, keysize, 0, keysize);
     SAFE_FREE(key);
     return ret;
 }
@@ -551,33 +587,16 @@ sgx_status_t ehsm_rsa_encrypt(const ehsm_keyblob_t *cmk,
                               ehsm_data_t *ciphertext)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     // verify padding mode
     if (cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1 && cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1_OAEP)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    uint8_t *rsa_keypair = NULL;
-    BIO *bio = NULL;
     RSA *rsa_pubkey = NULL;
 
     // load rsa public key
-    rsa_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (rsa_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(rsa_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(rsa_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load public key pem\n");
-        goto out;
-    }
-
-    // make encryption
-    PEM_read_bio_RSAPublicKey(bio, &rsa_pubkey, NULL, NULL);
+    rsa_pubkey = ehsm_cache_get_rsa_key(cmk, false);
     if (rsa_pubkey == NULL)
     {
         log_d("failed to load rsa key\n");
@@ -590,6 +609,14 @@ sgx_status_t ehsm_rsa_encrypt(const ehsm_keyblob_t *cmk,
         ret = SGX_SUCCESS;
         goto out;
     }
+
+    if (ciphertext->datalen < (uint32_t)RSA_size(rsa_pubkey))
+    {
+        ret = SGX_ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    stats_start = ehsm_stats_begin();
     if (RSA_public_encrypt(plaintext->datalen,
                            plaintext->data,
                            ciphertext->data,
@@ -599,15 +626,13 @@ sgx_status_t ehsm_rsa_encrypt(const ehsm_keyblob_t *cmk,
         log_d("failed to make rsa encryption\n");
         goto out;
     }
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    ciphertext->datalen = RSA_size(rsa_pubkey);
 
     ret = SGX_SUCCESS;
 out:
-    BIO_free(bio);
     RSA_free(rsa_pubkey);
 
-    SAFE_MEMSET(rsa_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(rsa_keypair);
-
     return ret;
 }
 
@@ -616,38 +641,20 @@ sgx_status_t ehsm_sm2_encrypt(const ehsm_keyblob_t *cmk,
                               ehsm_data_t *ciphertext)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
-    uint8_t *sm2_keypair = NULL;
-    BIO *bio = NULL;
     EVP_PKEY *pkey = NULL;
     EVP_PKEY_CTX *ectx = NULL;
 
     // load sm2 public key
-    sm2_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (sm2_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(sm2_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(sm2_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load public key pem\n");
-        goto out;
-    }
-
-    // make encryption
-    pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+    pkey = ehsm_cache_get_sm2_pkey(cmk, false);
     if (pkey == NULL)
     {
         log_d("failed to load sm2 key\n");
         goto out;
     }
-    if (EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2) != 1)
-        goto out;
 
+    // make encryption
     ectx = EVP_PKEY_CTX_new(pkey, NULL);
     if (ectx == NULL)
         goto out;
@@ -666,8 +673,15 @@ sgx_status_t ehsm_sm2_encrypt(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    if (ciphertext->datalen < strLen)
+    {
+        ret = SGX_ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+
     if (plaintext->data != NULL)
     {
+        stats_start = ehsm_stats_begin();
         if (EVP_PKEY_encrypt(ectx,
                              ciphertext->data,
                              &strLen,
@@ -677,6 +691,8 @@ sgx_status_t ehsm_sm2_encrypt(const ehsm_keyblob_t *cmk,
             log_d("failed to make sm2 encryption\n");
             goto out;
         }
+        ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+        ciphertext->datalen = strLen;
     }
     else
     {
@@ -686,13 +702,9 @@ sgx_status_t ehsm_sm2_encrypt(const ehsm_keyblob_t *cmk,
 
     ret = SGX_SUCCESS;
 out:
-    BIO_free(bio);
     EVP_PKEY_free(pkey);
     EVP_PKEY_CTX_free(ectx);
 
-    SAFE_MEMSET(sm2_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(sm2_keypair);
-
     return ret;
 }
 
@@ -701,34 +713,17 @@ sgx_status_t ehsm_rsa_decrypt(const ehsm_keyblob_t *cmk,
                               ehsm_data_t *plaintext)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     // verify padding mode
     if (cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1 && cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1_OAEP)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    uint8_t *rsa_keypair = NULL;
-    BIO *bio = NULL;
     RSA *rsa_prikey = NULL;
+    int plaintext_len = 0;
 
     // load private key
-    rsa_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (rsa_keypair == NULL)
-        goto out;
-
-    ret = ehsm_parse_keyblob(rsa_keypair,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
-    if (ret != SGX_SUCCESS)
-        goto out;
-
-    bio = BIO_new_mem_buf(rsa_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load key pem\n");
-        ret = SGX_ERROR_UNEXPECTED;
-        goto out;
-    }
-
-    PEM_read_bio_RSAPrivateKey(bio, &rsa_prikey, NULL, NULL);
+    rsa_prikey = ehsm_cache_get_rsa_key(cmk, true);
     if (rsa_prikey == NULL)
     {
         log_d("failed to load private key\n");
@@ -736,34 +731,38 @@ sgx_status_t ehsm_rsa_decrypt(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    // the plaintext is never longer than the modulus
     if (plaintext->datalen == 0)
     {
-        uint8_t *temp_plaintext = (uint8_t *)malloc(RSA_size(rsa_prikey));
-        plaintext->datalen = RSA_private_decrypt(ciphertext->datalen,
-                                                 ciphertext->data,
-                                                 temp_plaintext,
-                                                 rsa_prikey,
-                                                 cmk->metadata.padding_mode);
+        plaintext->datalen = RSA_size(rsa_prikey);
         ret = SGX_SUCCESS;
         goto out;
     }
 
-    if (!RSA_private_decrypt(ciphertext->datalen,
-                             ciphertext->data,
-                             plaintext->data,
-                             rsa_prikey,
-                             cmk->metadata.padding_mode))
+    if (plaintext->datalen < (uint32_t)RSA_size(rsa_prikey))
+    {
+        ret = SGX_ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    stats_start = ehsm_stats_begin();
+    plaintext_len = RSA_private_decrypt(ciphertext->datalen,
+                                        ciphertext->data,
+                                        plaintext->data,
+                                        rsa_prikey,
+                                        cmk->metadata.padding_mode);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (plaintext_len < 0)
     {
         log_d("failed to make rsa decrypt\n");
         ret = SGX_ERROR_UNEXPECTED;
         goto out;
     }
+    plaintext->datalen = plaintext_len;
 
+    ret = SGX_SUCCESS;
 out:
-    BIO_free(bio);
     RSA_free(rsa_prikey);
-    SAFE_MEMSET(rsa_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(rsa_keypair);
 
     return ret;
 }
@@ -773,31 +772,13 @@ sgx_status_t ehsm_sm2_decrypt(const ehsm_keyblob_t *cmk,
                               ehsm_data_t *plaintext)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
-    uint8_t *sm2_keypair = NULL;
-    BIO *bio = NULL;
     EVP_PKEY *pkey = NULL;
     EVP_PKEY_CTX *dctx = NULL;
 
     // load private key
-    sm2_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (sm2_keypair == NULL)
-        goto out;
-
-    ret = ehsm_parse_keyblob(sm2_keypair,
-                             (sgx_aes_gcm_data_ex_t *)cmk->keyblob);
-    if (ret != SGX_SUCCESS)
-        goto out;
-
-    bio = BIO_new_mem_buf(sm2_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load key pem\n");
-        ret = SGX_ERROR_UNEXPECTED;
-        goto out;
-    }
-
-    pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    pkey = ehsm_cache_get_sm2_pkey(cmk, true);
     if (pkey == NULL)
     {
         log_d("failed to load sm2 key\n");
@@ -806,12 +787,6 @@ sgx_status_t ehsm_sm2_decrypt(const ehsm_keyblob_t *cmk,
     }
 
     // make decryption and compute plaintext length
-    if (EVP_PKEY_set_alias_type(pkey, EVP_PKEY_SM2) != 1)
-    {
-        ret = SGX_ERROR_UNEXPECTED;
-        goto out;
-    }
-
     if (!(dctx = EVP_PKEY_CTX_new(pkey, NULL)))
     {
         ret = SGX_ERROR_UNEXPECTED;
@@ -844,6 +819,7 @@ sgx_status_t ehsm_sm2_decrypt(const ehsm_keyblob_t *cmk,
     if (ciphertext->data != NULL)
     {
         size_t strLen = plaintext->datalen;
+        stats_start = ehsm_stats_begin();
         if (EVP_PKEY_decrypt(dctx,
                              plaintext->data,
                              &strLen,
@@ -853,6 +829,8 @@ sgx_status_t ehsm_sm2_decrypt(const ehsm_keyblob_t *cmk,
             ret = SGX_ERROR_UNEXPECTED;
             goto out;
         }
+        ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+        plaintext->datalen = strLen;
     }
     else
     {
@@ -860,14 +838,11 @@ sgx_status_t ehsm_sm2_decrypt(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    ret = SGX_SUCCESS;
 out:
-    BIO_free(bio);
     EVP_PKEY_free(pkey);
     EVP_PKEY_CTX_free(dctx);
 
-    SAFE_MEMSET(sm2_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(sm2_keypair);
-
     return ret;
 }
 
@@ -885,13 +860,12 @@ sgx_status_t ehsm_rsa_sign(const ehsm_keyblob_t *cmk,
                            ehsm_data_t *signature)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     // verify padding mode
     if (cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1 && cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1_PSS)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    uint8_t *rsa_keypair = NULL;
-    BIO *bio = NULL;
     RSA *rsa_prikey = NULL;
 
     // Get Digest Mode
@@ -902,28 +876,20 @@ sgx_status_t ehsm_rsa_sign(const ehsm_keyblob_t *cmk,
         return SGX_ERROR_INVALID_PARAMETER;
     }
     // load private key
-    rsa_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (rsa_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(rsa_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(rsa_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load rsa key pem\n");
-        goto out;
-    }
-
-    PEM_read_bio_RSAPrivateKey(bio, &rsa_prikey, NULL, NULL);
+    rsa_prikey = ehsm_cache_get_rsa_key(cmk, true);
     if (rsa_prikey == NULL)
     {
         log_d("failed to load rsa key\n");
         ret = SGX_ERROR_OUT_OF_MEMORY;
         goto out;
     }
+    if (signature->datalen < (uint32_t)RSA_size(rsa_prikey))
+    {
+        ret = SGX_ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+
+    stats_start = ehsm_stats_begin();
     ret = rsa_sign(rsa_prikey,
                    digestMode,
                    cmk->metadata.padding_mode,
@@ -931,13 +897,12 @@ sgx_status_t ehsm_rsa_sign(const ehsm_keyblob_t *cmk,
                    data->datalen,
                    signature->data,
                    signature->datalen);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    if (ret == SGX_SUCCESS)
+        signature->datalen = RSA_size(rsa_prikey);
 
 out:
     RSA_free(rsa_prikey);
-    BIO_free(bio);
-
-    SAFE_MEMSET(rsa_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(rsa_keypair);
 
     return ret;
 }
@@ -958,13 +923,12 @@ sgx_status_t ehsm_rsa_verify(const ehsm_keyblob_t *cmk,
                              bool *result)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
     // verify padding mode
     if (cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1 && cmk->metadata.padding_mode != EH_PAD_RSA_PKCS1_PSS)
         return SGX_ERROR_INVALID_PARAMETER;
 
-    uint8_t *rsa_keypair = NULL;
-    BIO *bio = NULL;
     RSA *rsa_pubkey = NULL;
 
     // get digest mode
@@ -976,22 +940,7 @@ sgx_status_t ehsm_rsa_verify(const ehsm_keyblob_t *cmk,
     }
 
     // load rsa public key
-    rsa_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (rsa_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(rsa_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(rsa_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load rsa key pem\n");
-        goto out;
-    }
-
-    PEM_read_bio_RSAPublicKey(bio, &rsa_pubkey, NULL, NULL);
+    rsa_pubkey = ehsm_cache_get_rsa_key(cmk, false);
     if (rsa_pubkey == NULL)
     {
         log_d("failed to load rsa key\n");
@@ -999,6 +948,7 @@ sgx_status_t ehsm_rsa_verify(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = rsa_verify(rsa_pubkey,
                      digestMode,
                      cmk->metadata.padding_mode,
@@ -1007,12 +957,9 @@ sgx_status_t ehsm_rsa_verify(const ehsm_keyblob_t *cmk,
                      signature->data,
                      signature->datalen,
                      result);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
 out:
     RSA_free(rsa_pubkey);
-    BIO_free(bio);
-
-    SAFE_MEMSET(rsa_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(rsa_keypair);
 
     return ret;
 }
@@ -1031,9 +978,8 @@ sgx_status_t ehsm_ecc_sign(const ehsm_keyblob_t *cmk,
                            ehsm_data_t *signature)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
-    uint8_t *ec_keypair = NULL;
-    BIO *bio = NULL;
     EC_KEY *ec_key = NULL;
 
     const EVP_MD *digestMode = GetDigestMode(cmk->metadata.digest_mode);
@@ -1044,22 +990,7 @@ sgx_status_t ehsm_ecc_sign(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
-    ec_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (ec_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(ec_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(ec_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load ecc key pem\n");
-        goto out;
-    }
-
-    PEM_read_bio_ECPrivateKey(bio, &ec_key, NULL, NULL);
+    ec_key = ehsm_cache_get_ec_key(cmk, true);
     if (ec_key == NULL)
     {
         log_d("failed to load ecc key\n");
@@ -1067,19 +998,17 @@ sgx_status_t ehsm_ecc_sign(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = ecc_sign(ec_key,
                    digestMode,
                    data->data,
                    data->datalen,
                    signature->data,
                    &signature->datalen);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
 
 out:
     EC_KEY_free(ec_key);
-    BIO_free(bio);
-
-    SAFE_MEMSET(ec_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(ec_keypair);
 
     return ret;
 }
@@ -1100,9 +1029,8 @@ sgx_status_t ehsm_ecc_verify(const ehsm_keyblob_t *cmk,
                              bool *result)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
-    uint8_t *ec_keypair = NULL;
-    BIO *bio = NULL;
     EC_KEY *ec_key = NULL;
 
     const EVP_MD *digestMode = GetDigestMode(cmk->metadata.digest_mode);
@@ -1113,22 +1041,7 @@ sgx_status_t ehsm_ecc_verify(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
-    ec_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (ec_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(ec_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(ec_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load ec key pem\n");
-        goto out;
-    }
-
-    PEM_read_bio_EC_PUBKEY(bio, &ec_key, NULL, NULL);
+    ec_key = ehsm_cache_get_ec_key(cmk, false);
     if (ec_key == NULL)
     {
         log_d("failed to load ec key\n");
@@ -1136,6 +1049,7 @@ sgx_status_t ehsm_ecc_verify(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = ecc_verify(ec_key,
                      digestMode,
                      data->data,
@@ -1143,13 +1057,10 @@ sgx_status_t ehsm_ecc_verify(const ehsm_keyblob_t *cmk,
                      signature->data,
                      signature->datalen,
                      result);
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
 
 out:
     EC_KEY_free(ec_key);
-    BIO_free(bio);
-
-    SAFE_MEMSET(ec_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(ec_keypair);
 
     return ret;
 }
@@ -1168,9 +1079,8 @@ sgx_status_t ehsm_sm2_sign(const ehsm_keyblob_t *cmk,
                            ehsm_data_t *signature)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
-    uint8_t *ec_keypair = NULL;
-    BIO *bio = NULL;
     EC_KEY *ec_key = NULL;
 
     const EVP_MD *digestMode = GetDigestMode(cmk->metadata.digest_mode);
@@ -1180,22 +1090,7 @@ sgx_status_t ehsm_sm2_sign(const ehsm_keyblob_t *cmk,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    ec_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (ec_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(ec_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(ec_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load ec key pem\n");
-        goto out;
-    }
-
-    PEM_read_bio_ECPrivateKey(bio, &ec_key, NULL, NULL);
+    ec_key = ehsm_cache_get_ec_key(cmk, true);
     if (ec_key == NULL)
     {
         log_d("failed to load ec key\n");
@@ -1203,6 +1098,7 @@ sgx_status_t ehsm_sm2_sign(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = sm2_sign(ec_key,
                    digestMode,
                    data->data,
@@ -1211,13 +1107,10 @@ sgx_status_t ehsm_sm2_sign(const ehsm_keyblob_t *cmk,
                    &signature->datalen,
                    (uint8_t *)SM2_DEFAULT_USERID,
                    strlen(SM2_DEFAULT_USERID));
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
 
 out:
     EC_KEY_free(ec_key);
-    BIO_free(bio);
-
-    SAFE_MEMSET(ec_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(ec_keypair);
 
     return ret;
 }
@@ -1238,9 +1131,8 @@ sgx_status_t ehsm_sm2_verify(const ehsm_keyblob_t *cmk,
                              bool *result)
 {
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
 
-    uint8_t *ec_keypair = NULL;
-    BIO *bio = NULL;
     EC_KEY *ec_key = NULL;
 
     const EVP_MD *digestMode = GetDigestMode(cmk->metadata.digest_mode);
@@ -1250,22 +1142,7 @@ sgx_status_t ehsm_sm2_verify(const ehsm_keyblob_t *cmk,
         return SGX_ERROR_INVALID_PARAMETER;
     }
 
-    ec_keypair = (uint8_t *)malloc(cmk->keybloblen);
-    if (ec_keypair == NULL)
-        goto out;
-
-    if (SGX_SUCCESS != ehsm_parse_keyblob(ec_keypair,
-                                          (sgx_aes_gcm_data_ex_t *)cmk->keyblob))
-        goto out;
-
-    bio = BIO_new_mem_buf(ec_keypair, -1); // use -1 to auto compute length
-    if (bio == NULL)
-    {
-        log_d("failed to load ec key pem\n");
-        goto out;
-    }
-
-    PEM_read_bio_EC_PUBKEY(bio, &ec_key, NULL, NULL);
+    ec_key = ehsm_cache_get_ec_key(cmk, false);
     if (ec_key == NULL)
     {
         log_d("failed to load ec key\n");
@@ -1273,6 +1150,7 @@ sgx_status_t ehsm_sm2_verify(const ehsm_keyblob_t *cmk,
         goto out;
     }
 
+    stats_start = ehsm_stats_begin();
     ret = sm2_verify(ec_key,
                      digestMode,
                      data->data,
@@ -1282,13 +1160,100 @@ sgx_status_t ehsm_sm2_verify(const ehsm_keyblob_t *cmk,
                      result,
                      (uint8_t *)SM2_DEFAULT_USERID,
                      strlen(SM2_DEFAULT_USERID));
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
 
 out:
     EC_KEY_free(ec_key);
-    BIO_free(bio);
 
-    SAFE_MEMSET(ec_keypair, cmk->keybloblen, 0, cmk->keybloblen);
-    SAFE_FREE(ec_keypair);
+    return ret;
+}
+
+/* HMAC of message by the key of an EH_HMAC cmk, mac must hold EH_MAC_MAX_SIZE bytes */
+static sgx_status_t hmac_compute(const ehsm_keyblob_t *cmk,
+                                 const ehsm_data_t *message,
+                                 uint8_t *mac,
+                                 uint32_t *mac_len)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint64_t stats_start = 0;
+    uint8_t key[EH_HMAC_KEY_SIZE];
+    unsigned int len = 0;
+
+    if (cmk->metadata.keyspec != EH_HMAC ||
+        ehsm_get_mac_size(cmk->metadata.digest_mode) == 0)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    const EVP_MD *digestMode = GetDigestMode(cmk->metadata.digest_mode);
+    if (digestMode == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ret = ehsm_cache_get_symmetric_key(cmk, key, sizeof(key));
+    if (ret != SGX_SUCCESS)
+    {
+        log_d("failed to decrypt key\n");
+        goto out;
+    }
+
+    stats_start = ehsm_stats_begin();
+    if (HMAC(digestMode, key, sizeof(key), message->data, message->datalen, mac, &len) == NULL)
+        ret = SGX_ERROR_UNEXPECTED;
+    ehsm_stats_end(EH_STATS_CRYPTO, cmk->metadata.keyspec, stats_start);
+    *mac_len = len;
 
+out:
+    memset_s(key, sizeof(key), 0, sizeof(key));
     return ret;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief compute the mac of a message with an EH_HMAC cmk, the digest mode
+ * of the cmk picks the hash
+ * @param cmk cipher block for storing keys
+ * @param message data to be authenticated
+ * @param mac used to receive the mac
+ * @return sgx_status_t
+ */
+sgx_status_t ehsm_hmac_generate(const ehsm_keyblob_t *cmk,
+                                const ehsm_data_t *message,
+                                ehsm_data_t *mac)
+{
+    uint8_t buf[EH_MAC_MAX_SIZE];
+    uint32_t buf_len = 0;
+
+    if (mac->datalen < ehsm_get_mac_size(cmk->metadata.digest_mode))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    sgx_status_t ret = hmac_compute(cmk, message, buf, &buf_len);
+    if (ret == SGX_SUCCESS)
+    {
+        memcpy_s(mac->data, mac->datalen, buf, buf_len);
+        mac->datalen = buf_len;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief check the mac of a message with an EH_HMAC cmk in constant time
+ * @param cmk cipher block for storing keys
+ * @param message authenticated data
+ * @param mac the mac to check
+ * @param result match result
+ * @return sgx_status_t
+ */
+sgx_status_t ehsm_hmac_verify(const ehsm_keyblob_t *cmk,
+                              const ehsm_data_t *message,
+                              const ehsm_data_t *mac,
+                              bool *result)
+{
+    uint8_t buf[EH_MAC_MAX_SIZE];
+    uint32_t buf_len = 0;
+
+    *result = false;
+
+    sgx_status_t ret = hmac_compute(cmk, message, buf, &buf_len);
+    if (ret == SGX_SUCCESS)
+        *result = mac->datalen == buf_len && CRYPTO_memcmp(mac->data, buf, buf_len) == 0;
+
+    return ret;
+}
@@ -114,4 +114,13 @@ sgx_status_t ehsm_sm2_verify(const ehsm_keyblob_t *cmk,
                              const ehsm_data_t *signature,
                              bool *result);
 
+sgx_status_t ehsm_hmac_generate(const ehsm_keyblob_t *cmk,
+                                const ehsm_data_t *message,
+                                ehsm_data_t *mac);
+
+sgx_status_t ehsm_hmac_verify(const ehsm_keyblob_t *cmk,
+                              const ehsm_data_t *message,
+                              const ehsm_data_t *mac,
+                              bool *result);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "enclave_hsm_t.h"
+#include "sgx_spinlock.h"
+
+#include "datatypes.h"
+#include "key_pool.h"
+
+typedef struct
+{
+    ehsm_keyspec_t keyspec;
+    bool refilling;      /* set below the low watermark, cleared at the high one */
+    uint32_t generating; /* key pairs being generated outside of the lock */
+    void *keys[EH_KEY_POOL_MAX_SIZE]; /* RSA or EC_KEY depending on the keyspec */
+    ehsm_key_pool_stats_t stats;
+} key_pool_t;
+
+#define KEY_POOL_INITIALIZER(spec)                                          \
+    {                                                                       \
+        spec, true, 0, {NULL},                                              \
+        {                                                                   \
+            0, 0, 0, 0,                                                     \
+            EH_KEY_POOL_DEFAULT_LOW_WATERMARK,                              \
+            EH_KEY_POOL_DEFAULT_HIGH_WATERMARK                              \
+        }                                                                   \
+    }
+
+static key_pool_t g_key_pools[] = {
+    KEY_POOL_INITIALIZER(EH_RSA_2048),
+    KEY_POOL_INITIALIZER(EH_RSA_3072),
+    KEY_POOL_INITIALIZER(EH_RSA_4096),
+    KEY_POOL_INITIALIZER(EH_EC_P224),
+    KEY_POOL_INITIALIZER(EH_EC_P256),
+    KEY_POOL_INITIALIZER(EH_EC_P384),
+    KEY_POOL_INITIALIZER(EH_EC_P521),
+    KEY_POOL_INITIALIZER(EH_SM2),
+};
+
+static sgx_spinlock_t g_key_pool_lock = SGX_SPINLOCK_INITIALIZER;
+
+static key_pool_t *key_pool_find(ehsm_keyspec_t keyspec)
+{
+    for (size_t i = 0; i < sizeof(g_key_pools) / sizeof(g_key_pools[0]); i++)
+    {
+        if (g_key_pools[i].keyspec == keyspec)
+            return &g_key_pools[i];
+    }
+    return NULL;
+}
+
+static bool key_pool_is_rsa(ehsm_keyspec_t keyspec)
+{
+    return keyspec == EH_RSA_2048 || keyspec == EH_RSA_3072 || keyspec == EH_RSA_4096;
+}
+
+static void key_pool_release(ehsm_keyspec_t keyspec, void *key)
+{
+    if (key == NULL)
+        return;
+
+    // the private components are cleared by openssl on free
+    if (key_pool_is_rsa(keyspec))
+        RSA_free((RSA *)key);
+    else
+        EC_KEY_free((EC_KEY *)key);
+}
+
+static void *key_pool_generate(ehsm_keyspec_t keyspec)
+{
+    if (key_pool_is_rsa(keyspec))
+        return ehsm_generate_rsa_keypair(keyspec);
+    if (keyspec == EH_SM2)
+        return ehsm_generate_sm2_keypair();
+    return ehsm_generate_ecc_keypair(keyspec);
+}
+
+/* the number of key pairs the pool still misses, g_key_pool_lock must be held */
+static uint32_t key_pool_missing(const key_pool_t *pool)
+{
+    uint32_t target = pool->stats.available + pool->generating;
+
+    if (!pool->refilling || target >= pool->stats.high_watermark)
+        return 0;
+    return pool->stats.high_watermark - target;
+}
+
+static void *key_pool_get(ehsm_keyspec_t keyspec)
+{
+    key_pool_t *pool = key_pool_find(keyspec);
+    void *key = NULL;
+
+    if (pool == NULL)
+        return NULL;
+
+    sgx_spin_lock(&g_key_pool_lock);
+    if (pool->stats.available > 0)
+    {
+        key = pool->keys[--pool->stats.available];
+        pool->keys[pool->stats.available] = NULL;
+        pool->stats.hits++;
+    }
+    else
+    {
+        pool->stats.misses++;
+    }
+    if (pool->stats.available < pool->stats.low_watermark)
+        pool->refilling = true;
+    sgx_spin_unlock(&g_key_pool_lock);
+
+    return key;
+}
+
+RSA *ehsm_key_pool_get_rsa_key(ehsm_keyspec_t keyspec)
+{
+    if (!key_pool_is_rsa(keyspec))
+        return NULL;
+
+    return (RSA *)key_pool_get(keyspec);
+}
+
+EC_KEY *ehsm_key_pool_get_ec_key(ehsm_keyspec_t keyspec)
+{
+    if (key_pool_is_rsa(keyspec))
+        return NULL;
+
+    return (EC_KEY *)key_pool_get(keyspec);
+}
+
+/**
+ * @brief Generate one key pair for the first pool that misses some
+ * The generation runs outside of the lock, so CreateKey requests keep being
+ * served from the pool meanwhile.
+ */
+sgx_status_t ehsm_key_pool_refill(uint32_t *pending)
+{
+    sgx_status_t ret = SGX_SUCCESS;
+    key_pool_t *pool = NULL;
+    void *key = NULL;
+    uint32_t missing = 0;
+
+    if (pending == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    sgx_spin_lock(&g_key_pool_lock);
+    for (size_t i = 0; i < sizeof(g_key_pools) / sizeof(g_key_pools[0]); i++)
+    {
+        if (pool == NULL && key_pool_missing(&g_key_pools[i]) > 0)
+        {
+            pool = &g_key_pools[i];
+            pool->generating++;
+        }
+    }
+    sgx_spin_unlock(&g_key_pool_lock);
+
+    if (pool != NULL)
+    {
+        key = key_pool_generate(pool->keyspec);
+        if (key == NULL)
+            ret = SGX_ERROR_UNEXPECTED;
+    }
+
+    sgx_spin_lock(&g_key_pool_lock);
+    if (pool != NULL)
+    {
+        pool->generating--;
+        // the watermarks may have been lowered during the generation
+        if (key != NULL && pool->stats.available < pool->stats.high_watermark)
+        {
+            pool->keys[pool->stats.available++] = key;
+            pool->stats.generated++;
+            key = NULL;
+        }
+        if (pool->stats.available >= pool->stats.high_watermark)
+            pool->refilling = false;
+    }
+    for (size_t i = 0; i < sizeof(g_key_pools) / sizeof(g_key_pools[0]); i++)
+        missing += key_pool_missing(&g_key_pools[i]);
+    sgx_spin_unlock(&g_key_pool_lock);
+
+    if (key != NULL)
+        key_pool_release(pool->keyspec, key);
+
+    *pending = missing;
+
+    return ret;
+}
+
+sgx_status_t ehsm_key_pool_set_watermarks(ehsm_keyspec_t keyspec,
+                                          uint32_t low_watermark,
+                                          uint32_t high_watermark)
+{
+    key_pool_t *pool = key_pool_find(keyspec);
+    void *dropped[EH_KEY_POOL_MAX_SIZE] = {NULL};
+    uint32_t dropped_num = 0;
+
+    if (pool == NULL || high_watermark > EH_KEY_POOL_MAX_SIZE || low_watermark > high_watermark)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    sgx_spin_lock(&g_key_pool_lock);
+    pool->stats.low_watermark = low_watermark;
+    pool->stats.high_watermark = high_watermark;
+    while (pool->stats.available > high_watermark)
+    {
+        dropped[dropped_num++] = pool->keys[--pool->stats.available];
+        pool->keys[pool->stats.available] = NULL;
+    }
+    pool->refilling = pool->stats.available < high_watermark;
+    sgx_spin_unlock(&g_key_pool_lock);
+
+    for (uint32_t i = 0; i < dropped_num; i++)
+        key_pool_release(keyspec, dropped[i]);
+
+    return SGX_SUCCESS;
+}
+
+sgx_status_t ehsm_key_pool_get_stats(ehsm_keyspec_t keyspec, ehsm_key_pool_stats_t *stats)
+{
+    key_pool_t *pool = key_pool_find(keyspec);
+
+    if (pool == NULL || stats == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    sgx_spin_lock(&g_key_pool_lock);
+    *stats = pool->stats;
+    sgx_spin_unlock(&g_key_pool_lock);
+
+    return SGX_SUCCESS;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "openssl/rsa.h"
+#include "openssl/ec.h"
+
+#include "datatypes.h"
+
+#ifndef _KEY_POOL_H_
+#define _KEY_POOL_H_
+
+/*
+ * The key pool keeps freshly generated asymmetric key pairs for each keyspec,
+ * so that CreateKey only has to wrap a ready key pair instead of running the
+ * key generation in the request path. The pool of a keyspec is refilled by
+ * enclave_key_pool_refill, called from a background thread of the provider,
+ * once it drops below the low watermark and until it reaches the high one.
+ * The defaults can be overridden at build time, and at runtime per keyspec
+ * with enclave_key_pool_set_watermarks.
+ */
+#ifndef EH_KEY_POOL_DEFAULT_LOW_WATERMARK
+#define EH_KEY_POOL_DEFAULT_LOW_WATERMARK   2
+#endif
+
+#ifndef EH_KEY_POOL_DEFAULT_HIGH_WATERMARK
+#define EH_KEY_POOL_DEFAULT_HIGH_WATERMARK  4
+#endif
+
+// upper bound of any high watermark
+#define EH_KEY_POOL_MAX_SIZE    64
+
+// generate a new key pair of the keyspec, or NULL on failure
+RSA *ehsm_generate_rsa_keypair(ehsm_keyspec_t keyspec);
+
+EC_KEY *ehsm_generate_ecc_keypair(ehsm_keyspec_t keyspec);
+
+EC_KEY *ehsm_generate_sm2_keypair();
+
+// take a key pair out of the pool, the caller owns it, or NULL if the pool is
+// empty. SM2 key pairs are returned by ehsm_key_pool_get_ec_key as well.
+RSA *ehsm_key_pool_get_rsa_key(ehsm_keyspec_t keyspec);
+
+EC_KEY *ehsm_key_pool_get_ec_key(ehsm_keyspec_t keyspec);
+
+// generate at most one key pair for a pool below its target, pending is set to
+// the number of key pairs still missing in all the pools
+sgx_status_t ehsm_key_pool_refill(uint32_t *pending);
+
+// a high watermark of 0 disables the pool of the keyspec and drops its keys
+sgx_status_t ehsm_key_pool_set_watermarks(ehsm_keyspec_t keyspec,
+                                          uint32_t low_watermark,
+                                          uint32_t high_watermark);
+
+sgx_status_t ehsm_key_pool_get_stats(ehsm_keyspec_t keyspec, ehsm_key_pool_stats_t *stats);
+
+#endif
@@ -0,0 +1,589 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "enclave_hsm_t.h"
+#include "sgx_spinlock.h"
+#include "sgx_trts.h"
+
+#include <map>
+#include <vector>
+
+#include "datatypes.h"
+#include "key_factory.h"
+#include "key_cache.h"
+#include "key_stream.h"
+
+#include "openssl/evp.h"
+#include "openssl/hmac.h"
+#include "openssl/crypto.h"
+
+/*
+ * the nonce of a chunk is {zero|index|last}, it is unique under the subkey of
+ * its stream which is HMAC(cmk, label|salt) with a fresh salt per stream
+ */
+#define STREAM_NONCE_PAD_SIZE       7
+#define STREAM_NONCE_SIZE           (STREAM_NONCE_PAD_SIZE + 4 + 1)
+#define STREAM_KEY_LABEL            "ehsm stream key"
+#define STREAM_MAC_KEY_LABEL        "ehsm stream mac key"
+
+typedef struct
+{
+    bool encrypt;
+    bool busy; /* a chunk is being processed, the stream cannot be used meanwhile */
+    ehsm_keyspec_t keyspec;
+    uint32_t index; /* of the next chunk */
+    EVP_CIPHER_CTX *cipher_ctx; /* keyed once for the whole stream */
+    HMAC_CTX *mac_ctx;          /* SM4 only, keyed and fed with the aad */
+    uint8_t *aad;               /* AES-GCM only, authenticated with every chunk */
+    uint32_t aad_size;
+    uint64_t last_used;         /* host time of the last init or chunk */
+} stream_ctx_t;
+
+static std::map<uint64_t, stream_ctx_t *> g_streams;
+static sgx_spinlock_t g_stream_lock = SGX_SPINLOCK_INITIALIZER;
+static uint64_t g_stream_instance = 0; /* already shifted to the top bits of a handle */
+
+static const EVP_CIPHER *stream_cipher(ehsm_keyspec_t keyspec)
+{
+    switch (keyspec)
+    {
+    case EH_AES_GCM_128:
+        return EVP_aes_128_gcm();
+    case EH_AES_GCM_192:
+        return EVP_aes_192_gcm();
+    case EH_AES_GCM_256:
+        return EVP_aes_256_gcm();
+    case EH_SM4_CTR:
+        return EVP_sm4_ctr();
+    case EH_SM4_CBC:
+        return EVP_sm4_cbc();
+    default:
+        return NULL;
+    }
+}
+
+static bool stream_is_gcm(ehsm_keyspec_t keyspec)
+{
+    return keyspec == EH_AES_GCM_128 || keyspec == EH_AES_GCM_192 || keyspec == EH_AES_GCM_256;
+}
+
+static void stream_free(stream_ctx_t *ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    if (ctx->cipher_ctx)
+        EVP_CIPHER_CTX_free(ctx->cipher_ctx);
+    if (ctx->mac_ctx)
+        HMAC_CTX_free(ctx->mac_ctx);
+    SAFE_MEMSET(ctx->aad, ctx->aad_size, 0, ctx->aad_size);
+    SAFE_FREE(ctx->aad);
+    OPENSSL_cleanse(ctx, sizeof(stream_ctx_t));
+    free(ctx);
+}
+
+/* mark the stream busy so that a concurrent call on the same handle is refused */
+static stream_ctx_t *stream_acquire(uint64_t handle)
+{
+    stream_ctx_t *ctx = NULL;
+    std::map<uint64_t, stream_ctx_t *>::iterator it;
+
+    sgx_spin_lock(&g_stream_lock);
+    it = g_streams.find(handle);
+    if (it != g_streams.end() && !it->second->busy)
+    {
+        ctx = it->second;
+        ctx->busy = true;
+    }
+    sgx_spin_unlock(&g_stream_lock);
+
+    return ctx;
+}
+
+static void stream_release(uint64_t handle, stream_ctx_t *ctx, bool close)
+{
+    sgx_spin_lock(&g_stream_lock);
+    if (close)
+        g_streams.erase(handle);
+    else
+        ctx->busy = false;
+    sgx_spin_unlock(&g_stream_lock);
+
+    if (close)
+        stream_free(ctx);
+}
+
+static void stream_nonce(const stream_ctx_t *ctx, bool last, uint8_t *nonce)
+{
+    memset(nonce, 0, STREAM_NONCE_PAD_SIZE);
+    nonce[STREAM_NONCE_PAD_SIZE] = (uint8_t)(ctx->index >> 24);
+    nonce[STREAM_NONCE_PAD_SIZE + 1] = (uint8_t)(ctx->index >> 16);
+    nonce[STREAM_NONCE_PAD_SIZE + 2] = (uint8_t)(ctx->index >> 8);
+    nonce[STREAM_NONCE_PAD_SIZE + 3] = (uint8_t)ctx->index;
+    nonce[STREAM_NONCE_PAD_SIZE + 4] = last ? 1 : 0;
+}
+
+/* the subkey of a stream, HMAC-SHA256 for AES and HMAC-SM3 for SM4 truncated to the key size */
+static sgx_status_t stream_derive_key(ehsm_keyspec_t keyspec,
+                                      const uint8_t *key,
+                                      uint32_t key_size,
+                                      const uint8_t *salt,
+                                      uint8_t *subkey)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    HMAC_CTX *mac_ctx = NULL;
+    uint8_t digest[EVP_MAX_MD_SIZE] = {0};
+    unsigned int digest_len = 0;
+
+    mac_ctx = HMAC_CTX_new();
+    if (mac_ctx == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    if (!HMAC_Init_ex(mac_ctx, key, key_size, stream_is_gcm(keyspec) ? EVP_sha256() : EVP_sm3(), NULL) ||
+        !HMAC_Update(mac_ctx, (const uint8_t *)STREAM_KEY_LABEL, sizeof(STREAM_KEY_LABEL) - 1) ||
+        !HMAC_Update(mac_ctx, salt, EH_STREAM_SALT_SIZE) ||
+        !HMAC_Final(mac_ctx, digest, &digest_len) ||
+        digest_len < key_size)
+        goto out;
+
+    memcpy(subkey, digest, key_size);
+    ret = SGX_SUCCESS;
+
+out:
+    OPENSSL_cleanse(digest, sizeof(digest));
+    HMAC_CTX_free(mac_ctx);
+    return ret;
+}
+
+/* HMAC-SM3 over {nonce|iv|ciphertext} on top of the aad already fed to the stream */
+static sgx_status_t stream_sm4_mac(const stream_ctx_t *ctx,
+                                   const uint8_t *nonce,
+                                   const uint8_t *iv,
+                                   const uint8_t *ciphertext,
+                                   uint32_t ciphertext_len,
+                                   uint8_t *mac)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    HMAC_CTX *mac_ctx = NULL;
+    uint8_t digest[EVP_MAX_MD_SIZE] = {0};
+    unsigned int digest_len = 0;
+
+    mac_ctx = HMAC_CTX_new();
+    if (mac_ctx == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    if (!HMAC_CTX_copy(mac_ctx, ctx->mac_ctx) ||
+        !HMAC_Update(mac_ctx, nonce, STREAM_NONCE_SIZE) ||
+        !HMAC_Update(mac_ctx, iv, SGX_SM4_IV_SIZE) ||
+        !HMAC_Update(mac_ctx, ciphertext, ciphertext_len) ||
+        !HMAC_Final(mac_ctx, digest, &digest_len) ||
+        digest_len < EH_STREAM_MAC_SIZE)
+        goto out;
+
+    memcpy(mac, digest, EH_STREAM_MAC_SIZE);
+    ret = SGX_SUCCESS;
+
+out:
+    memset(digest, 0, sizeof(digest));
+    HMAC_CTX_free(mac_ctx);
+    return ret;
+}
+
+static sgx_status_t stream_seal_chunk(stream_ctx_t *ctx, bool last, const ehsm_data_t *in, ehsm_data_t *out)
+{
+    uint8_t nonce[STREAM_NONCE_SIZE];
+    uint32_t chunk_len = ehsm_get_stream_chunk_size(ctx->keyspec, in->datalen);
+    uint32_t ciphertext_len = 0;
+    uint8_t *iv = NULL;
+    int len = 0;
+    int final_len = 0;
+
+    if (out->datalen < chunk_len)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    stream_nonce(ctx, last, nonce);
+
+    if (stream_is_gcm(ctx->keyspec))
+    {
+        if (!EVP_EncryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, nonce) ||
+            (ctx->aad_size > 0 && !EVP_EncryptUpdate(ctx->cipher_ctx, NULL, &len, ctx->aad, ctx->aad_size)) ||
+            !EVP_EncryptUpdate(ctx->cipher_ctx, out->data, &len, in->data, in->datalen) ||
+            !EVP_EncryptFinal_ex(ctx->cipher_ctx, out->data + len, &final_len) ||
+            !EVP_CIPHER_CTX_ctrl(ctx->cipher_ctx, EVP_CTRL_GCM_GET_TAG, EH_STREAM_MAC_SIZE, out->data + in->datalen))
+            return SGX_ERROR_UNEXPECTED;
+
+        out->datalen = chunk_len;
+        return SGX_SUCCESS;
+    }
+
+    // the nonce is authenticated by the mac, the iv of SM4 stays random
+    ciphertext_len = chunk_len - SGX_SM4_IV_SIZE - EH_STREAM_MAC_SIZE;
+    iv = out->data + ciphertext_len;
+    if (sgx_read_rand(iv, SGX_SM4_IV_SIZE) != SGX_SUCCESS)
+        return SGX_ERROR_UNEXPECTED;
+
+    if (!EVP_EncryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, iv) ||
+        !EVP_EncryptUpdate(ctx->cipher_ctx, out->data, &len, in->data, in->datalen) ||
+        !EVP_EncryptFinal_ex(ctx->cipher_ctx, out->data + len, &final_len) ||
+        (uint32_t)(len + final_len) != ciphertext_len)
+        return SGX_ERROR_UNEXPECTED;
+
+    if (stream_sm4_mac(ctx, nonce, iv, out->data, ciphertext_len, iv + SGX_SM4_IV_SIZE) != SGX_SUCCESS)
+        return SGX_ERROR_UNEXPECTED;
+
+    out->datalen = chunk_len;
+    return SGX_SUCCESS;
+}
+
+/* nothing is released to the caller unless the chunk is authentic */
+static sgx_status_t stream_open_chunk(stream_ctx_t *ctx, bool last, const ehsm_data_t *in, ehsm_data_t *out)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    uint8_t nonce[STREAM_NONCE_SIZE];
+    uint8_t tag[EH_STREAM_MAC_SIZE];
+    uint32_t plaintext_len = ehsm_get_stream_plaintext_size(ctx->keyspec, in->datalen);
+    const uint8_t *iv = in->data + plaintext_len;
+    int len = 0;
+    int final_len = 0;
+
+    if (plaintext_len == 0 || plaintext_len > ehsm_get_stream_chunk_size(ctx->keyspec, EH_STREAM_CHUNK_MAX_SIZE) ||
+        out->datalen < plaintext_len)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    stream_nonce(ctx, last, nonce);
+
+    if (stream_is_gcm(ctx->keyspec))
+    {
+        memcpy(tag, in->data + plaintext_len, EH_STREAM_MAC_SIZE);
+        if (!EVP_DecryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, nonce) ||
+            (ctx->aad_size > 0 && !EVP_DecryptUpdate(ctx->cipher_ctx, NULL, &len, ctx->aad, ctx->aad_size)) ||
+            !EVP_DecryptUpdate(ctx->cipher_ctx, out->data, &len, in->data, plaintext_len) ||
+            !EVP_CIPHER_CTX_ctrl(ctx->cipher_ctx, EVP_CTRL_GCM_SET_TAG, EH_STREAM_MAC_SIZE, tag) ||
+            EVP_DecryptFinal_ex(ctx->cipher_ctx, out->data + len, &final_len) <= 0)
+        {
+            ret = SGX_ERROR_MAC_MISMATCH;
+            goto out;
+        }
+        out->datalen = plaintext_len;
+        return SGX_SUCCESS;
+    }
+
+    // for SM4 the ciphertext is checked before being decrypted
+    if (stream_sm4_mac(ctx, nonce, iv, in->data, plaintext_len, tag) != SGX_SUCCESS)
+        return SGX_ERROR_UNEXPECTED;
+
+    if (CRYPTO_memcmp(tag, iv + SGX_SM4_IV_SIZE, EH_STREAM_MAC_SIZE) != 0)
+        return SGX_ERROR_MAC_MISMATCH;
+
+    if (!EVP_DecryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, iv) ||
+        !EVP_DecryptUpdate(ctx->cipher_ctx, out->data, &len, in->data, plaintext_len) ||
+        !EVP_DecryptFinal_ex(ctx->cipher_ctx, out->data + len, &final_len))
+        goto out;
+
+    out->datalen = len + final_len;
+    return SGX_SUCCESS;
+
+out:
+    memset(out->data, 0, plaintext_len);
+    return ret;
+}
+
+/* key the cipher with the subkey of the stream, and for SM4 the mac with a key derived from it */
+static sgx_status_t stream_setup(stream_ctx_t *ctx, const uint8_t *key, uint32_t key_size, const ehsm_data_t *aad)
+{
+    uint8_t mac_key[EVP_MAX_MD_SIZE] = {0};
+    unsigned int mac_key_len = 0;
+    uint8_t aad_len[4];
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+
+    ctx->cipher_ctx = EVP_CIPHER_CTX_new();
+    if (ctx->cipher_ctx == NULL)
+        return SGX_ERROR_OUT_OF_MEMORY;
+
+    if (!EVP_CipherInit_ex(ctx->cipher_ctx, stream_cipher(ctx->keyspec), NULL, key, NULL, ctx->encrypt ? 1 : 0))
+        return SGX_ERROR_UNEXPECTED;
+
+    if (stream_is_gcm(ctx->keyspec))
+    {
+        if (aad->datalen == 0)
+            return SGX_SUCCESS;
+
+        ctx->aad = (uint8_t *)malloc(aad->datalen);
+        if (ctx->aad == NULL)
+            return SGX_ERROR_OUT_OF_MEMORY;
+        memcpy(ctx->aad, aad->data, aad->datalen);
+        ctx->aad_size = aad->datalen;
+        return SGX_SUCCESS;
+    }
+
+    if (HMAC(EVP_sm3(), key, key_size,
+             (const uint8_t *)STREAM_MAC_KEY_LABEL, sizeof(STREAM_MAC_KEY_LABEL) - 1,
+             mac_key, &mac_key_len) == NULL)
+        goto out;
+
+    ctx->mac_ctx = HMAC_CTX_new();
+    if (ctx->mac_ctx == NULL)
+    {
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    aad_len[0] = (uint8_t)(aad->datalen >> 24);
+    aad_len[1] = (uint8_t)(aad->datalen >> 16);
+    aad_len[2] = (uint8_t)(aad->datalen >> 8);
+    aad_len[3] = (uint8_t)aad->datalen;
+    if (!HMAC_Init_ex(ctx->mac_ctx, mac_key, mac_key_len, EVP_sm3(), NULL) ||
+        !HMAC_Update(ctx->mac_ctx, aad_len, sizeof(aad_len)) ||
+        !HMAC_Update(ctx->mac_ctx, aad->data, aad->datalen))
+        goto out;
+
+    ret = SGX_SUCCESS;
+
+out:
+    memset(mac_key, 0, sizeof(mac_key));
+    return ret;
+}
+
+/*
+ * take the streams idle for EH_STREAM_IDLE_TIMEOUT out of the table, g_stream_lock
+ * must be held. They are freed by the caller once the lock is dropped.
+ */
+static void stream_reap_idle(uint64_t now, std::vector<stream_ctx_t *> &reaped)
+{
+    std::map<uint64_t, stream_ctx_t *>::iterator it = g_streams.begin();
+
+    while (it != g_streams.end())
+    {
+        stream_ctx_t *ctx = it->second;
+
+        if (ctx->busy || now < ctx->last_used + EH_STREAM_IDLE_TIMEOUT)
+        {
+            ++it;
+            continue;
+        }
+
+        try
+        {
+            reaped.push_back(ctx);
+        }
+        catch (...)
+        {
+            break;
+        }
+        g_streams.erase(it++);
+    }
+}
+
+/* register the stream under a new random handle */
+static sgx_status_t stream_register(stream_ctx_t *ctx, uint64_t *handle, uint64_t now)
+{
+    sgx_status_t ret = SGX_ERROR_OUT_OF_MEMORY;
+    std::vector<stream_ctx_t *> reaped;
+    uint64_t id = 0;
+
+    do
+    {
+        if (sgx_read_rand((uint8_t *)&id, sizeof(id)) != SGX_SUCCESS)
+            return SGX_ERROR_UNEXPECTED;
+        id &= (1ULL << EH_STREAM_HANDLE_INSTANCE_SHIFT) - 1;
+        id |= g_stream_instance;
+    } while (id == 0);
+
+    ctx->last_used = now;
+
+    sgx_spin_lock(&g_stream_lock);
+    if (g_streams.size() >= EH_STREAM_MAX_CONTEXTS)
+        stream_reap_idle(now, reaped);
+    if (g_streams.size() < EH_STREAM_MAX_CONTEXTS && g_streams.find(id) == g_streams.end())
+    {
+        try
+        {
+            g_streams[id] = ctx;
+            ret = SGX_SUCCESS;
+        }
+        catch (...)
+        {
+        }
+    }
+    sgx_spin_unlock(&g_stream_lock);
+
+    for (size_t i = 0; i < reaped.size(); i++)
+        stream_free(reaped[i]);
+
+    if (ret == SGX_SUCCESS)
+        *handle = id;
+    return ret;
+}
+
+sgx_status_t ehsm_stream_init(bool encrypt,
+                              const ehsm_keyblob_t *cmk,
+                              const ehsm_data_t *aad,
+                              ehsm_data_t *header,
+                              uint64_t *handle,
+                              uint64_t now)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    stream_ctx_t *ctx = NULL;
+    uint8_t *key = NULL;
+    uint8_t *subkey = NULL;
+    uint32_t keysize = 0;
+    uint8_t salt[EH_STREAM_SALT_SIZE];
+
+    if (cmk == NULL || aad == NULL || header == NULL || handle == NULL ||
+        stream_cipher(cmk->metadata.keyspec) == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (encrypt && header->datalen < EH_STREAM_HEADER_SIZE)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (!encrypt && (header->datalen != EH_STREAM_HEADER_SIZE || header->data[0] != EH_STREAM_VERSION))
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    if (!ehsm_get_symmetric_key_size(cmk->metadata.keyspec, keysize))
+        return SGX_ERROR_UNEXPECTED;
+
+    if (ehsm_get_gcm_ciphertext_size((const sgx_aes_gcm_data_ex_t *)cmk->keyblob) != keysize)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    key = (uint8_t *)malloc(keysize);
+    subkey = (uint8_t *)malloc(keysize);
+    ctx = (stream_ctx_t *)calloc(1, sizeof(stream_ctx_t));
+    if (key == NULL || subkey == NULL || ctx == NULL)
+    {
+        ret = SGX_ERROR_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    ctx->encrypt = encrypt;
+    ctx->keyspec = cmk->metadata.keyspec;
+
+    if (encrypt)
+    {
+        ret = sgx_read_rand(salt, EH_STREAM_SALT_SIZE);
+        if (ret != SGX_SUCCESS)
+            goto out;
+
+        header->data[0] = EH_STREAM_VERSION;
+        memcpy(header->data + 1, salt, EH_STREAM_SALT_SIZE);
+        header->datalen = EH_STREAM_HEADER_SIZE;
+    }
+    else
+    {
+        memcpy(salt, header->data + 1, EH_STREAM_SALT_SIZE);
+    }
+
+    ret = ehsm_cache_get_symmetric_key(cmk, key, keysize);
+    if (ret != SGX_SUCCESS)
+        goto out;
+
+    ret = stream_derive_key(ctx->keyspec, key, keysize, salt, subkey);
+    if (ret != SGX_SUCCESS)
+        goto out;
+
+    ret = stream_setup(ctx, subkey, keysize, aad);
+    if (ret != SGX_SUCCESS)
+        goto out;
+
+    ret = stream_register(ctx, handle, now);
+    if (ret != SGX_SUCCESS)
+        goto out;
+    ctx = NULL;
+
+out:
+    stream_free(ctx);
+    SAFE_MEMSET(key, keysize, 0, keysize);
+    SAFE_FREE(key);
+    SAFE_MEMSET(subkey, keysize, 0, keysize);
+    SAFE_FREE(subkey);
+    return ret;
+}
+
+sgx_status_t ehsm_stream_update(uint64_t handle,
+                                bool last,
+                                const ehsm_data_t *in,
+                                ehsm_data_t *out,
+                                uint64_t now)
+{
+    sgx_status_t ret = SGX_ERROR_UNEXPECTED;
+    stream_ctx_t *ctx = NULL;
+
+    if (in == NULL || out == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    ctx = stream_acquire(handle);
+    if (ctx == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    // the index must not wrap, a stream holds at most 2^32 - 1 chunks
+    if (in->datalen == 0 || ctx->index == UINT32_MAX)
+        ret = SGX_ERROR_INVALID_PARAMETER;
+    else if (ctx->encrypt)
+        ret = in->datalen <= EH_STREAM_CHUNK_MAX_SIZE ? stream_seal_chunk(ctx, last, in, out) : SGX_ERROR_INVALID_PARAMETER;
+    else
+        ret = stream_open_chunk(ctx, last, in, out);
+
+    if (ret == SGX_SUCCESS)
+    {
+        ctx->index++;
+        ctx->last_used = now;
+    }
+
+    // any failure closes the stream, a broken stream cannot be resumed
+    stream_release(handle, ctx, last || ret != SGX_SUCCESS);
+
+    return ret;
+}
+
+sgx_status_t ehsm_stream_abort(uint64_t handle)
+{
+    stream_ctx_t *ctx = NULL;
+    std::map<uint64_t, stream_ctx_t *>::iterator it;
+
+    sgx_spin_lock(&g_stream_lock);
+    it = g_streams.find(handle);
+    if (it != g_streams.end() && !it->second->busy)
+    {
+        ctx = it->second;
+        g_streams.erase(it);
+    }
+    sgx_spin_unlock(&g_stream_lock);
+
+    if (ctx == NULL)
+        return SGX_ERROR_INVALID_PARAMETER;
+
+    stream_free(ctx);
+    return SGX_SUCCESS;
+}
+
+void ehsm_stream_set_instance(uint32_t instance)
+{
+    g_stream_instance = (uint64_t)instance << EH_STREAM_HANDLE_INSTANCE_SHIFT;
+}
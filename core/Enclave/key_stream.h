@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2020-2022 Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in
+ *      the documentation and/or other materials provided with the
+ *      distribution.
+ *   3. Neither the name of Intel Corporation nor the names of its
+ *      contributors may be used to endorse or promote products derived
+ *      from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "datatypes.h"
+
+#ifndef _KEY_STREAM_H_
+#define _KEY_STREAM_H_
+
+/*
+ * Streams of the Init/Update/Final encryption and decryption. The cmk is
+ * unwrapped and the cipher keyed once in Init, every following chunk only
+ * costs its own encryption. A stream is closed by Final, by any failure, or
+ * by an abort, the number of open streams is bounded to cap the EPC usage.
+ * When the table is full, the streams left unused for EH_STREAM_IDLE_TIMEOUT
+ * seconds are reaped to make room. now is the time of the host in seconds, it
+ * only drives this expiry.
+ */
+#ifndef EH_STREAM_MAX_CONTEXTS
+#define EH_STREAM_MAX_CONTEXTS  64
+#endif
+
+#ifndef EH_STREAM_IDLE_TIMEOUT
+#define EH_STREAM_IDLE_TIMEOUT  300
+#endif
+
+// open a stream on a symmetric cmk. The header is written when encrypting and
+// read when decrypting, it must be exactly EH_STREAM_HEADER_SIZE then.
+sgx_status_t ehsm_stream_init(bool encrypt,
+                              const ehsm_keyblob_t *cmk,
+                              const ehsm_data_t *aad,
+                              ehsm_data_t *header,
+                              uint64_t *handle,
+                              uint64_t now);
+
+// seal or open the next chunk, out->datalen is its capacity on input and the
+// exact length on output. last must be set for the final chunk, it closes the stream.
+sgx_status_t ehsm_stream_update(uint64_t handle,
+                                bool last,
+                                const ehsm_data_t *in,
+                                ehsm_data_t *out,
+                                uint64_t now);
+
+sgx_status_t ehsm_stream_abort(uint64_t handle);
+
+// the instance number of this enclave in the provider's pool, it is tagged into
+// the top bits of the handles so that a stream is routed back to its enclave
+void ehsm_stream_set_instance(uint32_t instance);
+
+#endif
@@ -42,6 +42,9 @@
 #include "sgx_utils.h"
 #include "sgx_tkey_exchange.h"
 
+#include "sgx_thread.h"
+#include "sgx_spinlock.h"
+
 #include "datatypes.h"
 #include "openssl/rsa.h"
 #include "openssl/evp.h"
@@ -49,6 +52,7 @@
 #include "openssl/pem.h"
 #include "openssl/bio.h"
 #include "openssl/err.h"
+#include "openssl/crypto.h"
 
 #include "datatypes.h"
 #include "key_operation.h"
@@ -58,6 +62,301 @@
 #define SM4_NO_PAD 0
 #define SM4_PAD 1
 
+/*
+ * OpenSSL contexts reused across the ecalls served by the same TCS, instead of
+ * allocating and freeing them on every call. The enclave uses TCSPolicy 1 which
+ * reinitializes the thread local storage on every root ecall, so the contexts
+ * are kept in a table indexed by sgx_thread_self(), a TCS only ever touches its
+ * own entry. A cipher context remembers its cipher, direction and key, which
+ * its key schedule holds anyway, and the next call with the same key only sets
+ * the iv. The keyblob wrap/unwrap with g_domain_key goes through here on every
+ * request, so the match is a plain compare with no allocation. The keyed
+ * contexts are cleansed and freed by ehsm_cipher_ctx_flush and
+ * ehsm_cipher_ctx_forget, a context in use at that time is freed on release.
+ */
+#define EH_TCS_CTX_MAX          32
+#define EH_TCS_CIPHER_CTX_NUM   8
+
+typedef struct {
+    EVP_CIPHER_CTX *ctx;
+    const EVP_CIPHER *cipher; // NULL until keyed, and after a failure
+    int enc;
+    uint8_t key[EVP_MAX_KEY_LENGTH];
+    int key_len;
+    bool in_use;
+    bool stale; // dropped while in use, freed on release
+    uint32_t last_used;
+} tcs_cipher_ctx_t;
+
+typedef struct {
+    sgx_thread_t owner;
+    uint32_t clock;
+    sgx_spinlock_t lock; // the cipher slots, shared with the flushes of other TCSs
+    tcs_cipher_ctx_t cipher[EH_TCS_CIPHER_CTX_NUM];
+    EVP_MD_CTX *digest_ctx; // plain digests, EVP_DigestFinal_ex cleanses it
+    EVP_MD_CTX *sign_ctx;   // EVP_DigestSign/Verify, reset after each use
+} tcs_ctx_t;
+
+static tcs_ctx_t g_tcs_ctx[EH_TCS_CTX_MAX];
+static sgx_spinlock_t g_tcs_ctx_lock = SGX_SPINLOCK_INITIALIZER;
+
+// the entry of the calling TCS, or NULL when the table is full
+static tcs_ctx_t *tcs_ctx_get()
+{
+    sgx_thread_t self = sgx_thread_self();
+    tcs_ctx_t *tcs = NULL;
+
+    // only the owner ever writes its own entry, so it can be looked up without the lock
+    for (int i = 0; i < EH_TCS_CTX_MAX; i++)
+    {
+        if (__atomic_load_n(&g_tcs_ctx[i].owner, __ATOMIC_ACQUIRE) == self)
+            return &g_tcs_ctx[i];
+    }
+
+    sgx_spin_lock(&g_tcs_ctx_lock);
+    for (int i = 0; i < EH_TCS_CTX_MAX; i++)
+    {
+        if (g_tcs_ctx[i].owner == 0)
+        {
+            tcs = &g_tcs_ctx[i];
+            __atomic_store_n(&tcs->owner, self, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    sgx_spin_unlock(&g_tcs_ctx_lock);
+
+    return tcs;
+}
+
+// free the context and forget its key, tcs->lock must be held
+static void cipher_slot_wipe(tcs_cipher_ctx_t *slot)
+{
+    // the key schedule is cleansed by EVP_CIPHER_CTX_free
+    EVP_CIPHER_CTX_free(slot->ctx);
+    slot->ctx = NULL;
+    slot->cipher = NULL;
+    slot->stale = false;
+    OPENSSL_cleanse(slot->key, sizeof(slot->key));
+    slot->key_len = 0;
+}
+
+// wipe the slots of every TCS keyed with key, or all of them when key is NULL
+static void cipher_ctx_drop(const uint8_t *key, int key_len)
+{
+    for (int i = 0; i < EH_TCS_CTX_MAX; i++)
+    {
+        tcs_ctx_t *tcs = &g_tcs_ctx[i];
+
+        if (__atomic_load_n(&tcs->owner, __ATOMIC_ACQUIRE) == 0)
+            continue;
+
+        sgx_spin_lock(&tcs->lock);
+        for (int j = 0; j < EH_TCS_CIPHER_CTX_NUM; j++)
+        {
+            tcs_cipher_ctx_t *slot = &tcs->cipher[j];
+
+            // the owner rekeys a slot in use without the lock, it cannot be compared
+            if (slot->in_use)
+                slot->stale = true;
+            else if (key == NULL ||
+                     (slot->cipher != NULL && slot->key_len == key_len &&
+                      CRYPTO_memcmp(slot->key, key, key_len) == 0))
+                cipher_slot_wipe(slot);
+        }
+        sgx_spin_unlock(&tcs->lock);
+    }
+}
+
+void ehsm_cipher_ctx_flush()
+{
+    cipher_ctx_drop(NULL, 0);
+}
+
+void ehsm_cipher_ctx_forget(const uint8_t *key, uint32_t key_size)
+{
+    if (key == NULL || key_size == 0 || key_size > EVP_MAX_KEY_LENGTH)
+        return;
+
+    cipher_ctx_drop(key, (int)key_size);
+}
+
+/**
+ * @brief Take a cipher context of the calling TCS, initialized for cipher and enc.
+ * The caller completes the init with init_key and its iv, init_key is NULL when the
+ * context already holds key.
+ *
+ * @param cipher the cipher
+ * @param enc 1 to encrypt, 0 to decrypt
+ * @param key the key the caller is going to use
+ * @param init_key the key to pass to EVP_CipherInit_ex
+ * @return EVP_CIPHER_CTX* to be given back with cipher_ctx_release
+ */
+static EVP_CIPHER_CTX *cipher_ctx_acquire(const EVP_CIPHER *cipher, int enc,
+                                          const uint8_t *key, const uint8_t **init_key)
+{
+    tcs_ctx_t *tcs = tcs_ctx_get();
+    tcs_cipher_ctx_t *slot = NULL;
+    EVP_CIPHER_CTX *pctx = NULL;
+    int key_len = EVP_CIPHER_key_length(cipher);
+
+    *init_key = key;
+
+    if (tcs != NULL && key_len > 0 && key_len <= EVP_MAX_KEY_LENGTH)
+    {
+        sgx_spin_lock(&tcs->lock);
+        // the context holding this key, otherwise the least recently used free one
+        for (int i = 0; i < EH_TCS_CIPHER_CTX_NUM; i++)
+        {
+            tcs_cipher_ctx_t *cur = &tcs->cipher[i];
+
+            if (cur->in_use)
+                continue;
+            if (cur->cipher == cipher && cur->enc == enc &&
+                CRYPTO_memcmp(cur->key, key, key_len) == 0)
+            {
+                slot = cur;
+                *init_key = NULL;
+                break;
+            }
+            if (slot == NULL || cur->last_used < slot->last_used)
+                slot = cur;
+        }
+        if (slot != NULL)
+        {
+            slot->in_use = true;
+            slot->last_used = ++tcs->clock;
+        }
+        sgx_spin_unlock(&tcs->lock);
+    }
+
+    if (slot == NULL)
+    {
+        pctx = EVP_CIPHER_CTX_new();
+        if (pctx != NULL && EVP_CipherInit_ex(pctx, cipher, NULL, NULL, NULL, enc) != 1)
+        {
+            EVP_CIPHER_CTX_free(pctx);
+            pctx = NULL;
+        }
+        return pctx;
+    }
+
+    if (slot->ctx == NULL)
+        slot->ctx = EVP_CIPHER_CTX_new();
+
+    if (slot->ctx == NULL)
+    {
+        slot->cipher = NULL;
+    }
+    else if (*init_key != NULL)
+    {
+        // passing the same cipher again would free and reallocate its cipher data
+        if (EVP_CipherInit_ex(slot->ctx, slot->cipher == cipher ? NULL : cipher, NULL, NULL, NULL, enc) != 1)
+        {
+            slot->cipher = NULL;
+        }
+        else
+        {
+            slot->cipher = cipher;
+            slot->enc = enc;
+            memcpy(slot->key, key, key_len);
+            slot->key_len = key_len;
+        }
+    }
+
+    if (slot->cipher == NULL)
+    {
+        sgx_spin_lock(&tcs->lock);
+        slot->in_use = false;
+        if (slot->stale)
+        {
+            cipher_slot_wipe(slot);
+        }
+        else
+        {
+            OPENSSL_cleanse(slot->key, sizeof(slot->key));
+            slot->key_len = 0;
+        }
+        sgx_spin_unlock(&tcs->lock);
+        return NULL;
+    }
+
+    return slot->ctx;
+}
+
+// give back a context of cipher_ctx_acquire, a failed one is initialized again on its next use
+static void cipher_ctx_release(EVP_CIPHER_CTX *pctx, bool reusable)
+{
+    tcs_ctx_t *tcs = NULL;
+
+    if (pctx == NULL)
+        return;
+
+    tcs = tcs_ctx_get();
+    if (tcs != NULL)
+    {
+        sgx_spin_lock(&tcs->lock);
+        for (int i = 0; i < EH_TCS_CIPHER_CTX_NUM; i++)
+        {
+            tcs_cipher_ctx_t *slot = &tcs->cipher[i];
+
+            if (slot->in_use && slot->ctx == pctx)
+            {
+                slot->in_use = false;
+                if (slot->stale)
+                {
+                    cipher_slot_wipe(slot);
+                }
+                else if (!reusable)
+                {
+                    slot->cipher = NULL;
+                    OPENSSL_cleanse(slot->key, sizeof(slot->key));
+                    slot->key_len = 0;
+                }
+                pctx = NULL;
+                break;
+            }
+        }
+        sgx_spin_unlock(&tcs->lock);
+    }
+
+    EVP_CIPHER_CTX_free(pctx);
+}
+
+// take the digest (sign false) or the EVP_DigestSign/Verify (sign true) context of the calling TCS
+static EVP_MD_CTX *md_ctx_acquire(bool sign)
+{
+    tcs_ctx_t *tcs = tcs_ctx_get();
+    EVP_MD_CTX **mdctx = NULL;
+
+    if (tcs == NULL)
+        return EVP_MD_CTX_new();
+
+    mdctx = sign ? &tcs->sign_ctx : &tcs->digest_ctx;
+    if (*mdctx == NULL)
+        *mdctx = EVP_MD_CTX_new();
+
+    return *mdctx;
+}
+
+static void md_ctx_release(EVP_MD_CTX *mdctx, bool reusable)
+{
+    tcs_ctx_t *tcs = NULL;
+
+    if (mdctx == NULL)
+        return;
+
+    tcs = tcs_ctx_get();
+    if (tcs != NULL && (mdctx == tcs->digest_ctx || mdctx == tcs->sign_ctx))
+    {
+        // a sign context refers to the key through its EVP_PKEY_CTX, never keep it
+        if (mdctx == tcs->sign_ctx || !reusable)
+            EVP_MD_CTX_reset(mdctx);
+        return;
+    }
+
+    EVP_MD_CTX_free(mdctx);
+}
+
 // https://github.com/openssl/openssl/blob/master/test/aesgcmtest.c#L38
 sgx_status_t aes_gcm_encrypt(uint8_t *key,
                              uint8_t *cipherblob,
@@ -74,20 +373,18 @@ sgx_status_t aes_gcm_encrypt(uint8_t *key,
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
     int temp_len = 0;
     EVP_CIPHER_CTX *pctx = NULL;
+    const uint8_t *init_key = NULL;
 
-    // Create and init ctx
-    if (!(pctx = EVP_CIPHER_CTX_new()))
+    // Take the ctx of this TCS
+    if (!(pctx = cipher_ctx_acquire(block_mode, 1, key, &init_key)))
         goto out;
 
-    if (1 != EVP_EncryptInit_ex(pctx, block_mode, NULL, NULL, NULL))
+    // a reused ctx keeps the iv length of its previous call
+    if (1 != EVP_CIPHER_CTX_ctrl(pctx, EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
         goto out;
 
-    if (iv_len != SGX_AESGCM_IV_SIZE)
-        if (1 != EVP_CIPHER_CTX_ctrl(pctx, EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
-            goto out;
-
     // Initialise encrypt/decrpty, key and IV
-    if (1 != EVP_EncryptInit_ex(pctx, NULL, NULL, key, iv))
+    if (1 != EVP_EncryptInit_ex(pctx, NULL, NULL, init_key, iv))
         goto out;
 
     // Provide AAD data if exist
@@ -118,7 +415,7 @@ sgx_status_t aes_gcm_encrypt(uint8_t *key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_CIPHER_CTX_free(pctx);
+    cipher_ctx_release(pctx, ret == SGX_SUCCESS);
     return ret;
 }
 
@@ -139,19 +436,17 @@ sgx_status_t aes_gcm_decrypt(uint8_t *key,
 
     int temp_len = 0;
     EVP_CIPHER_CTX *pctx = NULL;
-    // Create and initialise the context
-    if (!(pctx = EVP_CIPHER_CTX_new()))
+    const uint8_t *init_key = NULL;
+    // Take the context of this TCS
+    if (!(pctx = cipher_ctx_acquire(block_mode, 0, key, &init_key)))
         goto out;
 
-    if (1 != EVP_EncryptInit_ex(pctx, block_mode, NULL, NULL, NULL))
+    // a reused ctx keeps the iv length of its previous call
+    if (1 != EVP_CIPHER_CTX_ctrl(pctx, EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
         goto out;
 
-    if (iv_len != SGX_AESGCM_IV_SIZE)
-        if (1 != EVP_CIPHER_CTX_ctrl(pctx, EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
-            goto out;
-
     // Initialise decrypt, key and IV
-    if (!EVP_DecryptInit_ex(pctx, NULL, NULL, key, iv))
+    if (!EVP_DecryptInit_ex(pctx, NULL, NULL, init_key, iv))
         goto out;
 
     if (aad != NULL && aad_len > 0)
@@ -185,7 +480,7 @@ sgx_status_t aes_gcm_decrypt(uint8_t *key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_CIPHER_CTX_free(pctx);
+    cipher_ctx_release(pctx, ret == SGX_SUCCESS);
     return ret;
 }
 
@@ -198,15 +493,16 @@ sgx_status_t sm4_ctr_encrypt(uint8_t *key,
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
     int temp_len = 0;
     EVP_CIPHER_CTX *pctx = NULL;
+    const uint8_t *init_key = NULL;
 
-    // Create and initialize pState
-    if (!(pctx = EVP_CIPHER_CTX_new()))
+    // Take the ctx of this TCS
+    if (!(pctx = cipher_ctx_acquire(EVP_sm4_ctr(), 1, key, &init_key)))
     {
         log_d("Error: failed to initialize EVP_CIPHER_CTX\n");
         goto out;
     }
     // Initialize encrypt, key and ctr
-    if (EVP_EncryptInit_ex(pctx, EVP_sm4_ctr(), NULL, key, iv) != 1)
+    if (EVP_EncryptInit_ex(pctx, NULL, NULL, init_key, iv) != 1)
     {
         log_d("Error: failed to initialize encrypt, key and ctr\n");
         goto out;
@@ -229,7 +525,7 @@ sgx_status_t sm4_ctr_encrypt(uint8_t *key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_CIPHER_CTX_free(pctx);
+    cipher_ctx_release(pctx, ret == SGX_SUCCESS);
     return ret;
 }
 
@@ -242,15 +538,16 @@ sgx_status_t sm4_ctr_decrypt(uint8_t *key,
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
     int temp_len = 0;
     EVP_CIPHER_CTX *pctx = NULL;
+    const uint8_t *init_key = NULL;
 
-    // Create and initialize ctx
-    if (!(pctx = EVP_CIPHER_CTX_new()))
+    // Take the ctx of this TCS
+    if (!(pctx = cipher_ctx_acquire(EVP_sm4_ctr(), 0, key, &init_key)))
     {
         log_d("Error: failed to initialize EVP_CIPHER_CTX\n");
         goto out;
     }
     // Initialize decrypt, key and ctr
-    if (!EVP_DecryptInit_ex(pctx, EVP_sm4_ctr(), NULL, (unsigned char *)key, iv))
+    if (!EVP_DecryptInit_ex(pctx, NULL, NULL, init_key, iv))
     {
         log_d("Error: failed to initialize decrypt, key and ctr\n");
         goto out;
@@ -275,7 +572,7 @@ sgx_status_t sm4_ctr_decrypt(uint8_t *key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_CIPHER_CTX_free(pctx);
+    cipher_ctx_release(pctx, ret == SGX_SUCCESS);
     return ret;
 }
 
@@ -289,17 +586,18 @@ sgx_status_t sm4_cbc_encrypt(uint8_t *key,
 
     int temp_len = 0;
     EVP_CIPHER_CTX *pctx = NULL;
+    const uint8_t *init_key = NULL;
     // set padding mode
     int pad = (plaintext_len % 16 == 0) ? SM4_NO_PAD : SM4_PAD;
 
-    // Create and initialize ctx
-    if (!(pctx = EVP_CIPHER_CTX_new()))
+    // Take the ctx of this TCS
+    if (!(pctx = cipher_ctx_acquire(EVP_sm4_cbc(), 1, key, &init_key)))
     {
         log_d("Error: failed to initialize EVP_CIPHER_CTX\n");
         goto out;
     }
     // Initialize encrypt, key and ctr
-    if (EVP_EncryptInit_ex(pctx, EVP_sm4_cbc(), NULL, key, iv) != 1)
+    if (EVP_EncryptInit_ex(pctx, NULL, NULL, init_key, iv) != 1)
     {
         log_d("Error: failed to initialize encrypt, key and ctr\n");
         goto out;
@@ -327,7 +625,7 @@ sgx_status_t sm4_cbc_encrypt(uint8_t *key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_CIPHER_CTX_free(pctx);
+    cipher_ctx_release(pctx, ret == SGX_SUCCESS);
     return ret;
 }
 
@@ -341,16 +639,17 @@ sgx_status_t sm4_cbc_decrypt(uint8_t *key,
 
     int temp_len = 0;
     EVP_CIPHER_CTX *pctx = NULL;
+    const uint8_t *init_key = NULL;
 
     int pad = (ciphertext_len % 16 == 0) ? 0 : 1;
-    // Create and initialize ctx
-    if (!(pctx = EVP_CIPHER_CTX_new()))
+    // Take the ctx of this TCS
+    if (!(pctx = cipher_ctx_acquire(EVP_sm4_cbc(), 0, key, &init_key)))
     {
         log_d("Error: failed to initialize EVP_CIPHER_CTX\n");
         goto out;
     }
     // Initialize decrypt, key and IV
-    if (!EVP_DecryptInit_ex(pctx, EVP_sm4_cbc(), NULL, key, iv))
+    if (!EVP_DecryptInit_ex(pctx, NULL, NULL, init_key, iv))
     {
         log_d("Error: failed to initialize decrypt, key and IV\n");
         goto out;
@@ -385,7 +684,7 @@ sgx_status_t sm4_cbc_decrypt(uint8_t *key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_CIPHER_CTX_free(pctx);
+    cipher_ctx_release(pctx, ret == SGX_SUCCESS);
     return ret;
 }
 
@@ -430,7 +729,7 @@ sgx_status_t rsa_sign(RSA *rsa_prikey,
         }
     }
 
-    mdctx = EVP_MD_CTX_new();
+    mdctx = md_ctx_acquire(true);
     if (mdctx == NULL)
     {
         log_d("ecall rsa_sign failed to create a EVP_MD_CTX.\n");
@@ -491,7 +790,7 @@ sgx_status_t rsa_sign(RSA *rsa_prikey,
 
 out:
     EVP_PKEY_free(evpkey);
-    EVP_MD_CTX_free(mdctx);
+    md_ctx_release(mdctx, ret == SGX_SUCCESS);
     return ret;
 }
 
@@ -505,12 +804,10 @@ sgx_status_t ecc_sign(EC_KEY *ec_key,
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
 
     EVP_MD_CTX *mdctx = NULL;
-    uint8_t *digestMessage = NULL;
+    uint8_t digestMessage[MAX_DIGEST_LENGTH];
     uint32_t digestMessage_len = MAX_DIGEST_LENGTH;
 
-    digestMessage = (uint8_t *)malloc(digestMessage_len);
-
-    mdctx = EVP_MD_CTX_new();
+    mdctx = md_ctx_acquire(false);
     if (mdctx == NULL)
     {
         log_d("ecall ec_sign failed to create a EVP_MD_CTX.\n");
@@ -518,14 +815,8 @@ sgx_status_t ecc_sign(EC_KEY *ec_key,
         goto out;
     }
 
-    if (EVP_MD_CTX_init(mdctx) != 1)
-    {
-        log_d("ecall ec_sign EVP_MD_CTX initialize failed.\n");
-        goto out;
-    }
-
-    // digest message
-    if (EVP_DigestInit(mdctx, digestMode) != 1)
+    // digest message, the _ex variants keep the digest state allocated for the next call
+    if (EVP_DigestInit_ex(mdctx, digestMode, NULL) != 1)
     {
         log_d("ecall ec_sign EVP_DigestInit failed.\n");
         goto out;
@@ -537,7 +828,7 @@ sgx_status_t ecc_sign(EC_KEY *ec_key,
         goto out;
     }
 
-    if (EVP_DigestFinal(mdctx, digestMessage, &digestMessage_len) != 1)
+    if (EVP_DigestFinal_ex(mdctx, digestMessage, &digestMessage_len) != 1)
     {
         log_d("ecall ec_sign EVP_DigestFinal failed.\n");
         goto out;
@@ -552,10 +843,9 @@ sgx_status_t ecc_sign(EC_KEY *ec_key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_MD_CTX_free(mdctx);
+    md_ctx_release(mdctx, ret == SGX_SUCCESS);
 
-    SAFE_MEMSET(digestMessage, digestMessage_len, 0, digestMessage_len);
-    SAFE_FREE(digestMessage);
+    memset_s(digestMessage, sizeof(digestMessage), 0, sizeof(digestMessage));
 
     return ret;
 }
@@ -590,7 +880,7 @@ sgx_status_t sm2_sign(EC_KEY *ec_key,
         goto out;
     }
 
-    mdctx = EVP_MD_CTX_new();
+    mdctx = md_ctx_acquire(true);
     if (mdctx == NULL)
     {
         log_d("ecall sm2_sign failed to create a EVP_MD_CTX.\n");
@@ -656,7 +946,7 @@ sgx_status_t sm2_sign(EC_KEY *ec_key,
 
 out:
     EVP_PKEY_free(evpkey);
-    EVP_MD_CTX_free(mdctx);
+    md_ctx_release(mdctx, ret == SGX_SUCCESS);
     EVP_PKEY_CTX_free(pkey_ctx);
 
     return ret;
@@ -705,7 +995,7 @@ sgx_status_t rsa_verify(RSA *rsa_pubkey,
         }
     }
 
-    mdctx = EVP_MD_CTX_new();
+    mdctx = md_ctx_acquire(true);
     if (mdctx == NULL)
     {
         log_d("ecall rsa_verify failed to create a EVP_MD_CTX.\n");
@@ -780,7 +1070,7 @@ sgx_status_t rsa_verify(RSA *rsa_pubkey,
 
 out:
     EVP_PKEY_free(evpkey);
-    EVP_MD_CTX_free(mdctx);
+    md_ctx_release(mdctx, ret == SGX_SUCCESS);
 
     return ret;
 }
@@ -796,12 +1086,10 @@ sgx_status_t ecc_verify(EC_KEY *ec_key,
     sgx_status_t ret = SGX_ERROR_UNEXPECTED;
 
     EVP_MD_CTX *mdctx = NULL;
-    uint8_t *digestMessage = NULL;
+    uint8_t digestMessage[MAX_DIGEST_LENGTH];
     uint32_t digestMessage_len = MAX_DIGEST_LENGTH;
 
-    digestMessage = (uint8_t *)malloc(digestMessage_len);
-
-    mdctx = EVP_MD_CTX_new();
+    mdctx = md_ctx_acquire(false);
     if (mdctx == NULL)
     {
         log_d("ecall ec_verify failed to create a EVP_MD_CTX.\n");
@@ -809,14 +1097,8 @@ sgx_status_t ecc_verify(EC_KEY *ec_key,
         goto out;
     }
 
-    if (EVP_MD_CTX_init(mdctx) != 1)
-    {
-        log_d("ecall ec_verify EVP_MD_CTX initialize failed.\n");
-        goto out;
-    }
-
-    // digest message
-    if (EVP_DigestInit(mdctx, digestMode) != 1)
+    // digest message, the _ex variants keep the digest state allocated for the next call
+    if (EVP_DigestInit_ex(mdctx, digestMode, NULL) != 1)
     {
         log_d("ecall ec_verify EVP_DigestInit failed.\n");
         goto out;
@@ -828,7 +1110,7 @@ sgx_status_t ecc_verify(EC_KEY *ec_key,
         goto out;
     }
 
-    if (EVP_DigestFinal(mdctx, digestMessage, &digestMessage_len) != 1)
+    if (EVP_DigestFinal_ex(mdctx, digestMessage, &digestMessage_len) != 1)
     {
         log_d("ecall ec_verify EVP_DigestFinal failed.\n");
         goto out;
@@ -851,10 +1133,9 @@ sgx_status_t ecc_verify(EC_KEY *ec_key,
     ret = SGX_SUCCESS;
 
 out:
-    EVP_MD_CTX_free(mdctx);
+    md_ctx_release(mdctx, ret == SGX_SUCCESS);
 
-    SAFE_MEMSET(digestMessage, MAX_DIGEST_LENGTH, 0, MAX_DIGEST_LENGTH);
-    SAFE_FREE(digestMessage);
+    memset_s(digestMessage, sizeof(digestMessage), 0, sizeof(digestMessage));
 
     return ret;
 }
@@ -889,7 +1170,7 @@ sgx_status_t sm2_verify(EC_KEY *ec_key,
         goto out;
     }
 
-    mdctx = EVP_MD_CTX_new();
+    mdctx = md_ctx_acquire(true);
     if (mdctx == NULL)
     {
         log_d("ecall sm2_verify failed to create a EVP_MD_CTX.\n");
@@ -956,7 +1237,7 @@ sgx_status_t sm2_verify(EC_KEY *ec_key,
 
 out:
     EVP_PKEY_free(evpkey);
-    EVP_MD_CTX_free(mdctx);
+    md_ctx_release(mdctx, ret == SGX_SUCCESS);
     EVP_PKEY_CTX_free(pkey_ctx);
 
     return ret;
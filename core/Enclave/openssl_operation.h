@@ -48,6 +48,12 @@
 #include "sgx_utils.h"
 #include "sgx_tkey_exchange.h"
 
+// free the cipher contexts kept for every TCS, e.g. when the domain key changes
+void ehsm_cipher_ctx_flush();
+
+// free the cipher contexts keyed with key, e.g. when its cache entry is evicted
+void ehsm_cipher_ctx_forget(const uint8_t *key, uint32_t key_size);
+
 sgx_status_t aes_gcm_encrypt(uint8_t *key, uint8_t *cipherblob,
                              const EVP_CIPHER *block_mode,
                              uint8_t *plaintext, uint32_t plaintext_len,
@@ -33,19 +33,24 @@
 #include <stdlib.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <sys/un.h>
+#include <new>
+#include <algorithm>
 
 #include "la_server.h"
 #include "log_utils.h"
 
-#define BACKLOG 5     
-#define CONCURRENT_MAX 32   
+#define BACKLOG SOMAXCONN
+#define MAX_EVENTS 64
+#define READ_CHUNK_SIZE 16384
+#define READ_BUDGET (4 * READ_CHUNK_SIZE) /* per connection and wakeup */
 #define SERVER_PORT 8888
-#define BUFFER_SIZE 1024
 
 #define UNIX_DOMAIN "/var/run/ehsm/dkeyprovision.sock"
 
@@ -58,14 +63,16 @@ int LaServer::init()
 {
 	log_i("Initializing ProtocolHandler [\"socket: %s\"]", UNIX_DOMAIN);
     struct sockaddr_un srv_addr;
+    struct epoll_event ev;
     
-    m_server_sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    m_server_sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (m_server_sock_fd == -1)
     {
         log_d("socket initiazation error\n");
         return -1;
     }
 
+    memset(&srv_addr, 0, sizeof(srv_addr));
     srv_addr.sun_family = AF_UNIX;
     strncpy(srv_addr.sun_path, UNIX_DOMAIN, sizeof(srv_addr.sun_path)-1);
     unlink(UNIX_DOMAIN);
@@ -85,6 +92,25 @@ int LaServer::init()
         return -1;
     }
 
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1)
+    {
+        log_d("epoll_create1 error, %s\n", strerror(errno));
+        close(m_server_sock_fd);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = m_server_sock_fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_server_sock_fd, &ev) == -1)
+    {
+        log_d("epoll_ctl error, %s\n", strerror(errno));
+        close(m_epoll_fd);
+        close(m_server_sock_fd);
+        return -1;
+    }
+
     m_shutdown = 0;
 
 	log_i("Starting ProtocolHandler [\"socket: %s\"]", UNIX_DOMAIN);
@@ -92,123 +118,199 @@ int LaServer::init()
 }
 
 /* Function Description:
- * This function is server's major routine, it uses select() to accept new connection and receive messages from clients.
- * When it receives clients' request messages, it would put the message to task queue and wake up worker thread to process the requests.
+ * Accept every pending connection request. The listening socket is edge-triggered,
+ * so it has to be drained until accept() would block.
  * */
-void LaServer::doWork()
+void LaServer::acceptConnections()
 {
-    int client_fds[CONCURRENT_MAX] = {0};
-    fd_set server_fd_set;
-    int max_fd = -1;
-    struct timeval tv;  
-    char input_msg[BUFFER_SIZE];
-    char recv_msg[BUFFER_SIZE];
-    
-    while (!m_shutdown)
+    struct epoll_event ev;
+
+    while (1)
     {
-        // set 20s timeout for select() 
-        tv.tv_sec = 20;
-        tv.tv_usec = 0;
-        FD_ZERO(&server_fd_set);
-
-        FD_SET(STDIN_FILENO, &server_fd_set);
-        if (max_fd <STDIN_FILENO)
-            max_fd = STDIN_FILENO;
-        
-        // listening on server socket
-        FD_SET(m_server_sock_fd, &server_fd_set);
-        if (max_fd < m_server_sock_fd)
-            max_fd = m_server_sock_fd;
-    
-        // listening on all client connections
-        for(int i =0; i < CONCURRENT_MAX; i++) {
-            if(client_fds[i] != 0) {
-                FD_SET(client_fds[i], &server_fd_set);
-                if(max_fd < client_fds[i])
-                    max_fd = client_fds[i];
-            }
+        // the responses are buffered by the connection, see LaConnection
+        int client_sock_fd = accept4(m_server_sock_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sock_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_w("server: accept() return failure, %s.\n", strerror(errno));
+            return;
         }
-        
-        int ret = select(max_fd + 1, &server_fd_set, NULL, NULL, &tv);
-        if(ret < 0) {
-           log_i("Warning: server would shutdown\n");
+
+        memset(&ev, 0, sizeof(ev));
+        // EPOLLOUT fires on the edge where a full socket buffer drains
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = client_sock_fd;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, client_sock_fd, &ev) == -1)
+        {
+            log_w("failed to watch new connection, %s.\n", strerror(errno));
+            close(client_sock_fd);
             continue;
-        } else if(ret == 0) {
-            // timeout 
+        }
+
+        std::shared_ptr<LaConnection> conn(new (std::nothrow) LaConnection(client_sock_fd));
+        if (!conn)
+        {
+            log_e("memory allocation failure\n");
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, client_sock_fd, NULL);
+            close(client_sock_fd);
             continue;
-        } 
+        }
+        m_clients[client_sock_fd] = conn;
+    }
+}
+
+/* Function Description:
+ * Read up to READ_BUDGET bytes of a client connection, and queue each complete request.
+ * A request is a FIFO_MSG_HEADER followed by header.size bytes, it may arrive split
+ * over several reads or together with other requests, so bytes of an incomplete one
+ * are kept in the connection's read buffer until the rest arrives.
+ * Return: 0 if the connection stays open, 1 if it may have more bytes to read once the
+ * other connections had their turn, -1 if it is closed or sent a malformed frame
+ * */
+int LaServer::readConnection(const std::shared_ptr<LaConnection> &conn)
+{
+    unsigned char chunk[READ_CHUNK_SIZE];
+    std::vector<unsigned char> &rbuf = conn->m_rbuf;
+    int closed = 0;
+    int more = 0;
+    size_t off = 0;
+    size_t total = 0;
+
+    while (1)
+    {
+        if (total >= READ_BUDGET)
+        {
+            // the edge was consumed, so the server comes back to it by itself
+            more = 1;
+            break;
+        }
+        ssize_t byte_num = recv(conn->fd(), chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (byte_num > 0)
+        {
+            rbuf.insert(rbuf.end(), chunk, chunk + byte_num);
+            total += (size_t)byte_num;
+            continue;
+        }
+        if (byte_num < 0 && errno == EINTR)
+            continue;
+        if (byte_num < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        // client connect is closed
+        closed = 1;
+        break;
+    }
+
+    while (rbuf.size() - off >= sizeof(FIFO_MSG_HEADER))
+    {
+        FIFO_MSG_HEADER header;
+        memcpy(&header, &rbuf[off], sizeof(header));
+        if (header.size > FIFO_MSG_MAX_SIZE)
+        {
+            log_w("dropping connection with oversized message (%zu bytes).\n", header.size);
+            return -1;
+        }
+
+        size_t frame_size = sizeof(FIFO_MSG_HEADER) + header.size;
+        if (rbuf.size() - off < frame_size)
+            break;
+
+        FIFO_MSG *msg = (FIFO_MSG *)malloc(sizeof(FIFO_MSG) + header.size);
+        if (!msg)
+        {
+            log_e("memory allocation failure\n");
+            return -1;
+        }
+        memset(msg, 0, sizeof(FIFO_MSG) + header.size);
+        memcpy(msg, &rbuf[off], frame_size);
+        msg->header.sockfd = conn->fd();
+
+        // put request message to event queue
+        m_cptask->puttask(conn, msg);
+        off += frame_size;
+    }
+    rbuf.erase(rbuf.begin(), rbuf.begin() + off);
+
+    return closed ? -1 : more;
+}
+
+/* Function Description:
+ * Read from a client connection, it is dropped when closed, or queued to be read
+ * again when it still has bytes beyond its budget.
+ * */
+void LaServer::serveConnection(int fd)
+{
+    auto it = m_clients.find(fd);
+    if (it == m_clients.end())
+        return;
+
+    // errors and hangups show up as a failed read
+    int ret = readConnection(it->second);
+    if (ret < 0)
+        dropConnection(fd);
+    else if (ret > 0 && std::find(m_pending.begin(), m_pending.end(), fd) == m_pending.end())
+        m_pending.push_back(fd);
+}
+
+/* Function Description:
+ * Stop watching a client connection. Its fd is closed once the requests still queued from it are done.
+ * */
+void LaServer::dropConnection(int fd)
+{
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    shutdown(fd, SHUT_RD);
+    m_clients.erase(fd);
+}
+
+/* Function Description:
+ * This function is server's major routine, it uses edge-triggered epoll to accept new connections and receive messages from clients.
+ * When it receives clients' request messages, it would put the message to task queue and wake up worker thread to process the requests.
+ * */
+void LaServer::doWork()
+{
+    struct epoll_event events[MAX_EVENTS];
     
-        if(FD_ISSET(m_server_sock_fd, &server_fd_set)) {
-            // if there is new connection request
-            struct sockaddr_un clt_addr;
-            socklen_t len = sizeof(clt_addr);
-        
-            // accept this connection request
-            int client_sock_fd = accept(m_server_sock_fd, (struct sockaddr *)&clt_addr, &len);
-                
-            if (client_sock_fd > 0) {
-                // add new connection to connection pool if it's not full
-                int index = -1;
-                for(int i = 0; i < CONCURRENT_MAX; i++) {
-                    if(client_fds[i] == 0) {
-                        index = i;
-                        client_fds[i] = client_sock_fd;
-                        break;
-                    }
-                }
-                    
-                if(index < 0) {
-                    log_i("server reach maximum connection!\n");
-                    bzero(input_msg, BUFFER_SIZE);
-                    strcpy(input_msg, "server reach maximum connection\n");
-                    send(client_sock_fd, input_msg, BUFFER_SIZE, 0);
-                }
-                }else if (client_sock_fd < 0) {
-                    log_d("server: accept() return failure, %s, would exit.\n", strerror(errno));
-                close(m_server_sock_fd);
-                break;
-            }
+    while (!m_shutdown)
+    {
+        // set 20s timeout for epoll_wait(), or just poll while connections have bytes left
+        int n = epoll_wait(m_epoll_fd, events, MAX_EVENTS, m_pending.empty() ? 20000 : 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_i("Warning: server would shutdown, %s\n", strerror(errno));
+            break;
         }
-            
-        for(int i =0; i < CONCURRENT_MAX; i++) {
-            if ((client_fds[i] !=0)
-               && (FD_ISSET(client_fds[i], &server_fd_set))) 
-            {
-                // there is request messages from client connectsions
-                FIFO_MSG * msg; 
-
-                bzero(recv_msg, BUFFER_SIZE);
-                long byte_num = recv(client_fds[i], recv_msg, BUFFER_SIZE, 0);
-                if (byte_num > 0) {
-                    if(byte_num > BUFFER_SIZE)
-                        byte_num = BUFFER_SIZE; 
-                            
-                    recv_msg[byte_num] = '\0';
-
-                    msg = (FIFO_MSG *)malloc(byte_num);
-                    if (!msg) {
-                        log_e("memory allocation failure\n");
-                        continue;
-                    }
-                    memset(msg, 0, byte_num);
-                        
-                    memcpy(msg, recv_msg, byte_num);
-
-                    msg->header.sockfd = client_fds[i];
-                    
-                    // put request message to event queue
-                    m_cptask->puttask(msg);
-                }
-                else if(byte_num < 0) {
-                        log_d("failed to receive message.\n");
-                } else {
-                    // client connect is closed
-                    FD_CLR(client_fds[i], &server_fd_set);
-                    close(client_fds[i]);
-                    client_fds[i] = 0;
-                }
+
+        std::vector<int> pending;
+        pending.swap(m_pending);
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == m_server_sock_fd) {
+                // there are new connection requests
+                acceptConnections();
+                continue;
             }
+
+            auto it = m_clients.find(fd);
+            if (it == m_clients.end())
+                continue;
+
+            // the socket drained, send the responses it did not take before
+            if (events[i].events & EPOLLOUT)
+                it->second->flush();
+
+            // there are request messages from a client connection
+            if (events[i].events & ~EPOLLOUT)
+                serveConnection(fd);
         }
+
+        // the connections which used up their budget in the previous round
+        for (size_t i = 0; i < pending.size(); i++)
+            serveConnection(pending[i]);
     }
 }
 
@@ -222,5 +324,7 @@ void LaServer::shutDown()
     m_cptask->shutdown();
         
     close(m_server_sock_fd);
+    if (m_epoll_fd != -1)
+        close(m_epoll_fd);
 }
 
@@ -32,6 +32,10 @@
 #ifndef _LA_SERVER_H_
 #define _LA_SERVER_H_
 
+#include <map>
+#include <memory>
+#include <vector>
+
 #include "la_task.h"
 
 class LaServer
@@ -39,6 +43,7 @@ class LaServer
 	public:
 		LaServer(LaTask* task) : m_cptask(task)
 					, m_server_sock_fd(-1)
+					, m_epoll_fd(-1)
 					, m_shutdown(0)
                 {}
 		~LaServer(){};
@@ -49,9 +54,17 @@ class LaServer
 		void shutDown();
 
 	private:
+		void acceptConnections();
+		int readConnection(const std::shared_ptr<LaConnection> &conn);
+		void serveConnection(int fd);
+		void dropConnection(int fd);
+
 		LaTask *m_cptask; // this is task queue which process received request message
 		int m_server_sock_fd;
+		int m_epoll_fd;
 		int m_shutdown;
+		std::map<int, std::shared_ptr<LaConnection>> m_clients; // open client connections by fd
+		std::vector<int> m_pending; // connections with bytes left over their read budget
 
 	private:
 		LaServer(const LaServer&);
@@ -32,10 +32,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 
 #include <sys/socket.h>
 #include <map>
+#include <new>
 #include <sys/stat.h>
 #include <sched.h>
 
@@ -53,12 +55,79 @@
 
 extern sgx_enclave_id_t g_enclave_id;
 
+// the TCSNum of the dkeycache enclave, see Enclave/enclave.config.xml
+#define LA_WORKERS_MAX 8
+#define LA_SLOW_REQUEST_US 1000000
+#define LA_WORKER_BATCH 16
+
+/* Function Description:
+ *  Send the buffered bytes until the socket would block, m_send_lock must be held.
+ *  The rest is sent by flush() once the edge-triggered EPOLLOUT of the socket fires.
+ * Return: 0 on success, -1 once the connection is cut off
+ * */
+int LaConnection::flushLocked()
+{
+    size_t sent = 0;
+
+    while (sent < m_wbuf.size())
+    {
+        ssize_t n = send(m_fd, &m_wbuf[sent], m_wbuf.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0)
+        {
+            sent += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        m_broken = true;
+        m_wbuf.clear();
+        return -1;
+    }
+    m_wbuf.erase(m_wbuf.begin(), m_wbuf.begin() + sent);
+    return 0;
+}
+
+int LaConnection::sendMsg(const FIFO_MSG *msg)
+{
+    const unsigned char *p = (const unsigned char *)msg;
+    size_t size = sizeof(FIFO_MSG_HEADER) + msg->header.size;
+    std::lock_guard<std::mutex> lock(m_send_lock);
+
+    if (m_broken)
+        return -1;
+
+    if (m_wbuf.size() + size > LA_CONN_WBUF_MAX)
+    {
+        log_w("client on fd %d does not read its responses, closing it.\n", m_fd);
+        m_broken = true;
+        m_wbuf.clear();
+        // the server thread sees the hangup and stops watching the connection
+        shutdown(m_fd, SHUT_RDWR);
+        return -1;
+    }
+
+    m_wbuf.insert(m_wbuf.end(), p, p + size);
+    return flushLocked();
+}
+
+void LaConnection::flush()
+{
+    std::lock_guard<std::mutex> lock(m_send_lock);
+
+    if (!m_broken && !m_wbuf.empty())
+        flushLocked();
+}
+
 /* Function Description:
  *  This function responds to initiator enclave's connection request by generating and sending back ECDH message 1
  * Parameter Description:
- *  [input] clientfd: this is client's connection id. After generating ECDH message 1, server would send back response through this connection id.
+ *  [input] conn: this is client's connection. After generating ECDH message 1, server would send back response through this connection.
+ *  [input] reqid: this is the request id of client's message, it is echoed back in the response
  * */
-int generate_and_send_session_msg1_resp(int clientfd)
+int generate_and_send_session_msg1_resp(LaConnection *conn, uint32_t reqid)
 {
     int retcode = 0;
     uint32_t status = 0;
@@ -88,11 +157,12 @@ int generate_and_send_session_msg1_resp(int clientfd)
 
     fifo_resp->header.type = FIFO_DH_RESP_MSG1;
     fifo_resp->header.size = sizeof(SESSION_MSG1_RESP);
+    fifo_resp->header.reqid = reqid;
     
     memcpy(fifo_resp->msgbuf, &msg1resp, sizeof(SESSION_MSG1_RESP));
     
     //send message 1 to client
-    if (send(clientfd, reinterpret_cast<char *>(fifo_resp), static_cast<int>(respmsgsize), 0) == -1)
+    if (conn->sendMsg(fifo_resp) != 0)
     {
         log_d("fail to send msg1 response.\n");
         retcode = -1;
@@ -104,10 +174,11 @@ int generate_and_send_session_msg1_resp(int clientfd)
 /* Function Description:
  *  This function process ECDH message 2 received from client and send message 3 to client
  * Parameter Description:
- *  [input] clientfd: this is client's connection id
+ *  [input] conn: this is client's connection
+ *  [input] reqid: this is the request id of client's message, it is echoed back in the response
  *  [input] msg2: this contains ECDH message 2 received from client
  * */
-int process_exchange_report(int clientfd, SESSION_MSG2 * msg2)
+int process_exchange_report(LaConnection *conn, uint32_t reqid, SESSION_MSG2 * msg2)
 {
     uint32_t status = 0;
         sgx_status_t ret = SGX_SUCCESS;
@@ -129,6 +200,7 @@ int process_exchange_report(int clientfd, SESSION_MSG2 * msg2)
     
     response->header.type = FIFO_DH_MSG3;
     response->header.size = sizeof(SESSION_MSG3);
+    response->header.reqid = reqid;
     
     msg3 = (SESSION_MSG3 *)response->msgbuf;
     msg3->sessionid = msg2->sessionid; 
@@ -143,7 +215,7 @@ int process_exchange_report(int clientfd, SESSION_MSG2 * msg2)
     }
 
     // send ECDH message 3 to client
-    if (send(clientfd, reinterpret_cast<char *>(response), static_cast<int>(msgsize), 0) == -1)
+    if (conn->sendMsg(response) != 0)
     {
         log_d("server_send() failure.\n");
         free(response);
@@ -158,10 +230,11 @@ int process_exchange_report(int clientfd, SESSION_MSG2 * msg2)
 /* Function Description:
  *  This function process received message communication from client
  * Parameter Description:
- *  [input] clientfd: this is client's connection id
+ *  [input] conn: this is client's connection
+ *  [input] reqid: this is the request id of client's message, it is echoed back in the response
  *  [input] req_msg: this is pointer to received message from client
  * */
-int process_msg_transfer(int clientfd, FIFO_MSGBODY_REQ *req_msg)
+int process_msg_transfer(LaConnection *conn, uint32_t reqid, FIFO_MSGBODY_REQ *req_msg)
 {
     uint32_t status = 0;
     sgx_status_t ret = SGX_SUCCESS;
@@ -204,11 +277,12 @@ int process_msg_transfer(int clientfd, FIFO_MSGBODY_REQ *req_msg)
 
     fifo_resp->header.type = FIFO_DH_MSG_RESP;
     fifo_resp->header.size = resp_message_size;
+    fifo_resp->header.reqid = reqid;
     memcpy(fifo_resp->msgbuf, resp_message, resp_message_size);
 
     free(resp_message);
 
-    if (send(clientfd, reinterpret_cast<char *>(fifo_resp), sizeof(FIFO_MSG) + static_cast<int>(resp_message_size), 0) == -1)
+    if (conn->sendMsg(fifo_resp) != 0)
     {
         log_d("server_send() failure.\n");
         free(fifo_resp);
@@ -221,10 +295,11 @@ int process_msg_transfer(int clientfd, FIFO_MSGBODY_REQ *req_msg)
 
 /* Function Description: This is process session close request from client
  * Parameter Description:
- *  [input] clientfd: this is client connection id
+ *  [input] conn: this is client connection
+ *  [input] reqid: this is the request id of client's message, it is echoed back in the response
  *  [input] close_req: this is pointer to client's session close request
  * */
-int process_close_req(int clientfd, SESSION_CLOSE_REQ * close_req)
+int process_close_req(LaConnection *conn, uint32_t reqid, SESSION_CLOSE_REQ * close_req)
 {
     uint32_t status = 0;
     sgx_status_t ret = SGX_SUCCESS;
@@ -239,10 +314,12 @@ int process_close_req(int clientfd, SESSION_CLOSE_REQ * close_req)
         return -1;
 
     // send back response
+    memset(&close_ack, 0, sizeof(close_ack));
     close_ack.header.type = FIFO_DH_CLOSE_RESP;
     close_ack.header.size = 0;
+    close_ack.header.reqid = reqid;
 
-    if (send(clientfd, reinterpret_cast<char *>(&close_ack), sizeof(FIFO_MSG), 0) == -1)
+    if (conn->sendMsg(&close_ack) != 0)
     {
         log_d("server_send() failure.\n");
         return -1;
@@ -251,106 +328,272 @@ int process_close_req(int clientfd, SESSION_CLOSE_REQ * close_req)
     return 0;
 }
 
-void LaTask::run()
+/* Function Description: tell the client its request failed or was dropped, so that
+ * it does not wait for a response until its timeout
+ * */
+static void la_send_error(LaConnection *conn, uint32_t reqid)
+{
+    FIFO_MSG error_resp;
+
+    memset(&error_resp, 0, sizeof(error_resp));
+    error_resp.header.type = FIFO_DH_ERROR_RESP;
+    error_resp.header.size = 0;
+    error_resp.header.reqid = reqid;
+
+    if (conn->sendMsg(&error_resp) != 0)
+        log_d("failed to send the error response of request %u.\n", reqid);
+}
+
+/* Function Description: check that a received message body is large enough for its type
+ * Messages arrive as header plus exactly header.size bytes, so the body must be checked before it is cast.
+ * */
+static bool la_msg_size_valid(const FIFO_MSG *message)
 {
-    FIFO_MSG * message = NULL;
+    size_t size = message->header.size;
 
-    while (!isStopped())
+    switch (message->header.type)
     {
-        /* receive task frome queue */
-        message  = m_queue.blockingPop();
-        if (isStopped())
-        {
-            free(message);
-            break;
-        }
+        case FIFO_DH_REQ_MSG1:
+            return true;
+        case FIFO_DH_MSG2:
+            return size >= sizeof(SESSION_MSG2);
+        case FIFO_DH_MSG_REQ:
+            return size >= sizeof(FIFO_MSGBODY_REQ)
+                && ((const FIFO_MSGBODY_REQ *)message->msgbuf)->size <= size - sizeof(FIFO_MSGBODY_REQ);
+        case FIFO_DH_CLOSE_REQ:
+            return size >= sizeof(SESSION_CLOSE_REQ);
+        default:
+            return true;
+    }
+}
+
+/* Function Description: return the LA session a request belongs to
+ * Return: false for a session request, which has no session yet
+ * */
+static bool la_msg_session_id(const FIFO_MSG *message, uint32_t *session_id)
+{
+    switch (message->header.type)
+    {
+        case FIFO_DH_MSG2:
+            *session_id = ((const SESSION_MSG2 *)message->msgbuf)->sessionid;
+            return true;
+        case FIFO_DH_MSG_REQ:
+            *session_id = ((const FIFO_MSGBODY_REQ *)message->msgbuf)->session_id;
+            return true;
+        case FIFO_DH_CLOSE_REQ:
+            *session_id = ((const SESSION_CLOSE_REQ *)message->msgbuf)->session_id;
+            return true;
+        default:
+            return false;
+    }
+}
 
-        switch (message->header.type)
+static void la_process_request(LaRequest *request)
+{
+    FIFO_MSG * message = request->msg;
+    int ret = -1;
+
+    switch (message->header.type)
+    {
+        case FIFO_DH_REQ_MSG1:
         {
-            case FIFO_DH_REQ_MSG1:
+            // process ECDH session connection request
+        
+            ret = generate_and_send_session_msg1_resp(request->conn.get(), message->header.reqid);
+            if (ret != 0)
             {
-                // process ECDH session connection request
-                int clientfd = message->header.sockfd;
-            
-                if (generate_and_send_session_msg1_resp(clientfd) != 0)
-                {
-                    log_d("failed to generate and send session msg1 resp.\n");
-                    break;
-                }
-
+                log_d("failed to generate and send session msg1 resp.\n");
+                break;
             }
-            break;
 
-            case FIFO_DH_MSG2:
+        }
+        break;
+
+        case FIFO_DH_MSG2:
+        {
+            // process ECDH message 2
+            SESSION_MSG2 * msg2 = NULL;
+            msg2 = (SESSION_MSG2 *)message->msgbuf;
+
+            ret = process_exchange_report(request->conn.get(), message->header.reqid, msg2);
+            if (ret != 0)
             {
-                // process ECDH message 2
-                int clientfd = message->header.sockfd;
-                SESSION_MSG2 * msg2 = NULL;
-                msg2 = (SESSION_MSG2 *)message->msgbuf;
-
-                if (process_exchange_report(clientfd, msg2) != 0)
-                {
-                    log_d("failed to process exchange_report request.\n");
-                    break;
-                }
+                log_d("failed to process exchange_report request.\n");
+                break;
             }
-            break;
+        }
+        break;
 
-            case FIFO_DH_MSG_REQ:
+        case FIFO_DH_MSG_REQ:
+        {
+            // process message transfer request
+            FIFO_MSGBODY_REQ *msg = NULL;
+
+            msg = (FIFO_MSGBODY_REQ *)message->msgbuf;
+        
+            ret = process_msg_transfer(request->conn.get(), message->header.reqid, msg);
+            if (ret != 0)
             {
-                // process message transfer request
-                int clientfd = message->header.sockfd;
-                FIFO_MSGBODY_REQ *msg = NULL;
-
-                msg = (FIFO_MSGBODY_REQ *)message->msgbuf;
-            
-                if (process_msg_transfer(clientfd, msg) != 0)   
-                {
-                    log_d("failed to process message transfer request.\n");
-                    break;
-                }
+                log_d("failed to process message transfer request.\n");
+                break;
             }
-            break;
+        }
+        break;
 
-            case FIFO_DH_CLOSE_REQ:
-            {
-                // process message close request
-                int clientfd = message->header.sockfd;
-                SESSION_CLOSE_REQ * closereq = NULL;
+        case FIFO_DH_CLOSE_REQ:
+        {
+            // process message close request
+            SESSION_CLOSE_REQ * closereq = NULL;
 
-                closereq = (SESSION_CLOSE_REQ *)message->msgbuf;
+            closereq = (SESSION_CLOSE_REQ *)message->msgbuf;
 
-                process_close_req(clientfd, closereq);
+            ret = process_close_req(request->conn.get(), message->header.reqid, closereq);
 
-            }
-            break;
-        default:
-            {
-                log_d("Unknown message.\n");
-            }
-            break;
         }
+        break;
+    default:
+        {
+            log_d("Unknown message.\n");
+        }
+        break;
+    }
 
-        free(message);
-        message = NULL;
+    if (ret != 0)
+        la_send_error(request->conn.get(), message->header.reqid);
+}
+
+static void la_run_request(LaRequest *request)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    la_process_request(request);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    long long queued_us = std::chrono::duration_cast<std::chrono::microseconds>(start - request->queued).count();
+    long long total_us = std::chrono::duration_cast<std::chrono::microseconds>(end - request->queued).count();
+    if (total_us >= LA_SLOW_REQUEST_US) {
+        log_w("slow LA request, type %d, reqid %u: queued %lldus, total %lldus\n",
+              request->msg->header.type, request->msg->header.reqid, queued_us, total_us);
+    } else {
+        log_d("LA request, type %d, reqid %u: queued %lldus, total %lldus\n",
+              request->msg->header.type, request->msg->header.reqid, queued_us, total_us);
     }
+}
 
+void LaWorker::run()
+{
+    LaRequest * batch[LA_WORKER_BATCH];
+    size_t count = 0;
+
+    /* receive tasks from queue, the ones piled up meanwhile are taken at once.
+     * Once the queue is closed this drains it, failing what is left after stop(). */
+    while ((count = m_queue.popBatch(batch, LA_WORKER_BATCH)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!isStopped())
+                la_run_request(batch[i]);
+            else
+                la_send_error(batch[i]->conn.get(), batch[i]->msg->header.reqid);
+
+            // releases the message and this request's reference to the connection
+            delete batch[i];
+        }
+    }
 }
 
-void LaTask::shutdown()
+void LaWorker::shutdown()
 {
     stop();
     m_queue.close();
     join();
+
+    MpmcQueue<LaRequest>::stats_t stats = m_queue.stats();
+    log_i("LA worker queue: %llu requests, %llu rejected, max depth %llu, wait avg %lluus max %lluus\n",
+          (unsigned long long)stats.popped, (unsigned long long)stats.rejected,
+          (unsigned long long)stats.max_depth,
+          (unsigned long long)(stats.popped ? stats.wait_ns_total / stats.popped / 1000 : 0),
+          (unsigned long long)(stats.wait_ns_max / 1000));
 }
 
-void LaTask::puttask(FIFO_MSG* requestData)
+void LaWorker::puttask(LaRequest* request)
 {
-    if (isStopped()) {
+    if (!m_queue.push(request)) {
+        log_w("LA worker queue is %s, dropped request %u\n",
+              m_queue.closed() ? "closed" : "full", request->msg->header.reqid);
+        la_send_error(request->conn.get(), request->msg->header.reqid);
+        delete request;
+    }
+}
+
+LaTask::~LaTask()
+{
+    for (size_t i = 0; i < m_workers.size(); i++)
+        delete m_workers[i];
+}
+
+/* Function Description:
+ * Start the worker threads. There are EHSM_CONFIG_DKEYCACHE_LA_WORKERS of them, at most
+ * the TCSNum of the dkeycache enclave since every worker may be inside an LA ecall.
+ * */
+void LaTask::start()
+{
+    uint32_t workers = LA_WORKERS_MAX;
+    const char *value = getenv("EHSM_CONFIG_DKEYCACHE_LA_WORKERS");
+
+    if (value != NULL && value[0] != '\0')
+    {
+        char *end = NULL;
+        unsigned long parsed = strtoul(value, &end, 10);
+        if (*end == '\0' && parsed > 0)
+            workers = parsed < LA_WORKERS_MAX ? (uint32_t)parsed : LA_WORKERS_MAX;
+        else
+            log_w("ignoring invalid EHSM_CONFIG_DKEYCACHE_LA_WORKERS=%s\n", value);
+    }
+
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        LaWorker *worker = new (std::nothrow) LaWorker;
+        if (worker == NULL)
+            break;
+        worker->start();
+        m_workers.push_back(worker);
+    }
+    log_i("LA task pool started with %zu workers\n", m_workers.size());
+}
+
+void LaTask::shutdown()
+{
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i]->shutdown();
+}
+
+void LaTask::puttask(const std::shared_ptr<LaConnection> &conn, FIFO_MSG* requestData)
+{
+    uint32_t session_id = 0;
+    size_t index = 0;
+
+    if (m_workers.empty() || !la_msg_size_valid(requestData)) {
+        log_d("dropped malformed message of type %d.\n", requestData->header.type);
+        la_send_error(conn.get(), requestData->header.reqid);
+        free(requestData);
         return;
     }
-    
-    m_queue.push(requestData);
+
+    LaRequest *request = new (std::nothrow) LaRequest(conn, requestData);
+    if (request == NULL) {
+        log_e("memory allocation failure\n");
+        la_send_error(conn.get(), requestData->header.reqid);
+        free(requestData);
+        return;
+    }
+
+    // a session stays on one worker, so its messages are processed in order
+    if (la_msg_session_id(requestData, &session_id))
+        index = session_id % m_workers.size();
+    else
+        index = m_next_worker++ % m_workers.size();
+
+    m_workers[index]->puttask(request);
 }
 
 
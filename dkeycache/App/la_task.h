@@ -32,25 +32,105 @@
 #ifndef _LA_TASK_H_
 #define _LA_TASK_H_
 
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "Thread.h"
-#include "Queue.h"
+#include "mpmc_queue.h"
 #include "fifo_def.h"
 
-class LaTask : public Thread 
+#define LA_WORKER_QUEUE_SIZE 1024
+#define LA_CONN_WBUF_MAX (1024 * 1024)
+
+/* A client connection of the LA server. It is shared by the server and every
+ * request read from it, so the fd is closed only after the last response that
+ * could still be sent on it, and can't be reused by a newer connection meanwhile.
+ * The socket is non-blocking, the part of a response it does not take is kept in
+ * the write buffer and sent by the server thread once the socket is writable again.
+ * A client which lets more than LA_CONN_WBUF_MAX bytes pile up is cut off, so
+ * neither a worker nor the event loop ever waits for a client to read.
+ */
+class LaConnection
 {
     public:
-	LaTask(){}
-	~LaTask(){}
+	explicit LaConnection(int fd) : m_fd(fd), m_broken(false) {}
+	~LaConnection() { close(m_fd); }
 
-	virtual void puttask(FIFO_MSG * request);
-	virtual void shutdown();
+	int fd() const { return m_fd; }
+
+	// queue one framed message and send what the socket takes, frames never interleave
+	int sendMsg(const FIFO_MSG *msg);
+
+	// send the buffered bytes, called by the server thread on EPOLLOUT
+	void flush();
+
+	std::vector<unsigned char> m_rbuf; // bytes of an incomplete frame, only touched by the server thread
+
+    private:
+	int flushLocked();
+
+	int m_fd;
+	bool m_broken; // cut off, every later send fails
+	std::mutex m_send_lock;
+	std::vector<unsigned char> m_wbuf; // bytes the socket did not take yet
+
+	LaConnection& operator=(const LaConnection&);
+	LaConnection(const LaConnection&);
+};
+
+/* a received request message and the connection its response goes back on */
+struct LaRequest
+{
+	LaRequest(const std::shared_ptr<LaConnection> &c, FIFO_MSG *m)
+		: conn(c), msg(m), queued(std::chrono::steady_clock::now()) {}
+	~LaRequest() { free(msg); }
+
+	std::shared_ptr<LaConnection> conn;
+	FIFO_MSG *msg;
+	std::chrono::steady_clock::time_point queued; // for the request's latency
+};
+
+/* one worker of the LaTask pool, it processes the requests of its own queue in order */
+class LaWorker : public Thread
+{
+    public:
+	LaWorker() : m_queue(LA_WORKER_QUEUE_SIZE) {}
+	~LaWorker(){}
+
+	// a request the queue can't take, full or closed, is dropped
+	void puttask(LaRequest * request);
+	void shutdown();
 
     private:
 	virtual void run();
 
+	LaWorker& operator=(const LaWorker&);
+	LaWorker(const LaWorker&);
+	MpmcQueue<LaRequest>  m_queue;
+};
+
+/* LaTask hands the received requests to a pool of LaWorkers, so the LA ecalls of
+ * different clients run in parallel. All requests of one LA session go to the same
+ * worker and keep their order, the session requests which open new sessions are
+ * spread round robin.
+ */
+class LaTask
+{
+    public:
+	LaTask() : m_next_worker(0) {}
+	virtual ~LaTask();
+
+	void start();
+	virtual void puttask(const std::shared_ptr<LaConnection> &conn, FIFO_MSG * request);
+	virtual void shutdown();
+
+    private:
 	LaTask& operator=(const LaTask&);
 	LaTask(const LaTask&);
-	Queue<FIFO_MSG>  m_queue;
+	std::vector<LaWorker *> m_workers;
+	uint32_t m_next_worker; // only used by the server thread
 };
 #endif
 
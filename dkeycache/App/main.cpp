@@ -26,6 +26,7 @@
 
 #define __STDC_FORMAT_MACROS
 #define ENCLAVE_PATH "libenclave-ehsm-dkeycache.signed.so"
+#define TLS_SESSION_FILE "/var/run/ehsm/dkeycache_tls_session.bin"
 #include <inttypes.h>
 
 sgx_enclave_id_t g_enclave_id;
@@ -74,6 +75,51 @@ int ocall_connect(int sockfd, const struct sockaddr *servaddr, socklen_t addrlen
     return -1;
 }
 
+/* the TLS session is sealed by the enclave, a missing or broken file only costs a full handshake */
+int ocall_read_tls_session(uint8_t *sealed, uint32_t sealed_len, uint32_t *sealed_out_len)
+{
+    FILE *file = fopen(TLS_SESSION_FILE, "rb");
+    size_t size = 0;
+
+    if (file == NULL)
+        return -2;
+
+    size = fread(sealed, 1, sealed_len, file);
+    if (ferror(file) || (!feof(file) && fgetc(file) != EOF))
+    {
+        // an error, or a file larger than the buffer
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    *sealed_out_len = (uint32_t)size;
+    return 0;
+}
+
+int ocall_store_tls_session(const uint8_t *sealed, uint32_t sealed_len)
+{
+    std::string tmp_name = std::string(TLS_SESSION_FILE) + ".tmp";
+    FILE *file = fopen(tmp_name.c_str(), "wb");
+
+    if (file == NULL)
+        return -1;
+
+    if (fwrite(sealed, 1, sealed_len, file) != sealed_len)
+    {
+        fclose(file);
+        unlink(tmp_name.c_str());
+        return -1;
+    }
+    if (fclose(file) != 0 || rename(tmp_name.c_str(), TLS_SESSION_FILE) != 0)
+    {
+        unlink(tmp_name.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
 int ocall_set_dkeycache_done()
 {
     return (system("touch /tmp/dkeycache_isready.status"));
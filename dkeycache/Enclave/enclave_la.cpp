@@ -64,6 +64,11 @@ std::map<uint32_t, dh_session_t>g_dest_session_info_map;
 
 std::map<sgx_enclave_id_t, dh_session_t>g_src_session_info_map;
 
+// the LA requests are served by several host workers at once, this guards the
+// session id tracker and the session map. A session itself is only used by the
+// worker which its requests are routed to.
+static sgx_thread_mutex_t g_session_lock = SGX_THREAD_MUTEX_INITIALIZER;
+
 #define UNUSED(val) (void)(val)
 
 
@@ -212,31 +217,37 @@ extern "C" ATTESTATION_STATUS enclave_la_session_request(sgx_dh_msg1_t *dh_msg1,
         return status;
     }
 
-    //get a new SessionID
-    if ((status = (sgx_status_t)generate_session_id(session_id)) != SUCCESS)
-        return status; //no more sessions available
-
-    //Allocate memory for the session id tracker
-    g_session_id_tracker[*session_id] = (session_id_tracker_t *)malloc(sizeof(session_id_tracker_t));
-    if(!g_session_id_tracker[*session_id])
-    {
-        return MALLOC_ERROR;
-    }
-
-    memset(g_session_id_tracker[*session_id], 0, sizeof(session_id_tracker_t));
-    g_session_id_tracker[*session_id]->session_id = *session_id;
-    session_info.status = IN_PROGRESS;
-
     //Generate Message1 that will be returned to Source Enclave
     status = sgx_dh_responder_gen_msg1((sgx_dh_msg1_t*)dh_msg1, &sgx_dh_session);
     if(SGX_SUCCESS != status)
     {
-        SAFE_FREE(g_session_id_tracker[*session_id]);
         return status;
     }
+    session_info.status = IN_PROGRESS;
     memcpy(&session_info.in_progress.dh_session, &sgx_dh_session, sizeof(sgx_dh_session_t));
-    //Store the session information under the correspoding source enlave id key
-    g_dest_session_info_map.insert(std::pair<uint32_t, dh_session_t>(*session_id, session_info));
+
+    sgx_thread_mutex_lock(&g_session_lock);
+    do
+    {
+        //get a new SessionID
+        if ((status = (sgx_status_t)generate_session_id(session_id)) != SUCCESS)
+            break; //no more sessions available
+
+        //Allocate memory for the session id tracker
+        g_session_id_tracker[*session_id] = (session_id_tracker_t *)malloc(sizeof(session_id_tracker_t));
+        if(!g_session_id_tracker[*session_id])
+        {
+            status = (sgx_status_t)MALLOC_ERROR;
+            break;
+        }
+
+        memset(g_session_id_tracker[*session_id], 0, sizeof(session_id_tracker_t));
+        g_session_id_tracker[*session_id]->session_id = *session_id;
+
+        //Store the session information under the correspoding source enlave id key
+        g_dest_session_info_map.insert(std::pair<uint32_t, dh_session_t>(*session_id, session_info));
+    } while(0);
+    sgx_thread_mutex_unlock(&g_session_lock);
 
     return status;
 }
@@ -262,24 +273,19 @@ extern "C" ATTESTATION_STATUS enclave_la_exchange_report(sgx_dh_msg2_t *dh_msg2,
     do
     {
         //Retreive the session information for the corresponding source enclave id
+        sgx_thread_mutex_lock(&g_session_lock);
         std::map<uint32_t, dh_session_t>::iterator it = g_dest_session_info_map.find(session_id);
-        if(it != g_dest_session_info_map.end())
+        if(it != g_dest_session_info_map.end() && it->second.status == IN_PROGRESS)
         {
-            session_info = &it->second;
+            memcpy(&sgx_dh_session, &it->second.in_progress.dh_session, sizeof(sgx_dh_session_t));
         }
         else
         {
             status = INVALID_SESSION;
-            break;
         }
-
-        if(session_info->status != IN_PROGRESS)
-        {
-            status = INVALID_SESSION;
+        sgx_thread_mutex_unlock(&g_session_lock);
+        if(status != SUCCESS)
             break;
-        }
-
-        memcpy(&sgx_dh_session, &session_info->in_progress.dh_session, sizeof(sgx_dh_session_t));
 
         dh_msg3->msg3_body.additional_prop_length = 0;
         //Process message 2 from source enclave and obtain message 3
@@ -301,12 +307,23 @@ extern "C" ATTESTATION_STATUS enclave_la_exchange_report(sgx_dh_msg2_t *dh_msg2,
         }
 
         //save the session ID, status and initialize the session nonce
-        session_info->session_id = session_id;
-        session_info->status = ACTIVE;
-        session_info->active.counter = 0;
-        memcpy(session_info->active.AEK, &dh_aek, sizeof(sgx_key_128bit_t));
+        sgx_thread_mutex_lock(&g_session_lock);
+        it = g_dest_session_info_map.find(session_id);
+        if(it != g_dest_session_info_map.end())
+        {
+            session_info = &it->second;
+            session_info->session_id = session_id;
+            session_info->status = ACTIVE;
+            session_info->active.counter = 0;
+            memcpy(session_info->active.AEK, &dh_aek, sizeof(sgx_key_128bit_t));
+            g_session_count++;
+        }
+        else
+        {
+            status = INVALID_SESSION;
+        }
+        sgx_thread_mutex_unlock(&g_session_lock);
         memset(&dh_aek,0, sizeof(sgx_key_128bit_t));
-        g_session_count++;
     }while(0);
 
     if(status != SUCCESS)
@@ -349,18 +366,14 @@ extern "C" ATTESTATION_STATUS enclave_la_generate_response(secure_message_t* req
         return INVALID_PARAMETER_ERROR;
     }
 
-    //Get the session information from the map corresponding to the source enclave id
+    //Get the session information from the map corresponding to the source enclave id,
+    //the entry stays in place while this session's requests are processed
+    sgx_thread_mutex_lock(&g_session_lock);
     std::map<uint32_t, dh_session_t>::iterator it = g_dest_session_info_map.find(session_id);
-    if(it != g_dest_session_info_map.end())
-    {
-        session_info = &it->second;
-    }
-    else
-    {
-        return INVALID_SESSION;
-    }
+    session_info = (it != g_dest_session_info_map.end()) ? &it->second : NULL;
+    sgx_thread_mutex_unlock(&g_session_lock);
 
-    if(session_info->status != ACTIVE)
+    if(!session_info || session_info->status != ACTIVE)
     {
         return INVALID_SESSION;
     }
@@ -496,6 +509,8 @@ extern "C" ATTESTATION_STATUS enclave_la_end_session(uint32_t session_id)
     dh_session_t session_info;
     //uint32_t session_id;
 
+    sgx_thread_mutex_lock(&g_session_lock);
+
     //Get the session information from the map corresponding to the source enclave id
     std::map<uint32_t, dh_session_t>::iterator it = g_dest_session_info_map.find(session_id);
     if(it != g_dest_session_info_map.end())
@@ -504,6 +519,7 @@ extern "C" ATTESTATION_STATUS enclave_la_end_session(uint32_t session_id)
     }
     else
     {
+        sgx_thread_mutex_unlock(&g_session_lock);
         return INVALID_SESSION;
     }
 
@@ -527,6 +543,8 @@ extern "C" ATTESTATION_STATUS enclave_la_end_session(uint32_t session_id)
         }
     }
 
+    sgx_thread_mutex_unlock(&g_session_lock);
+
     return status;
 
 }
@@ -41,12 +41,25 @@
 #include <stdlib.h>
 #include <byteswap.h>
 #include "sgx_trts.h"
+#include "sgx_tseal.h"
 #include "openssl_utility.h"
 #include "enclave_t.h"
 #include "log_utils.h"
 
 #define SGX_DOMAIN_KEY_SIZE 16
 
+/*
+ * The TLS session of the last handshake with the dkeyserver is sealed and kept on
+ * the host, so a restarted dkeycache resumes it with the session ticket instead of
+ * doing a full RA-TLS handshake. The dkeyserver falls back to a full handshake when
+ * it doesn't accept the ticket anymore, and so does the dkeycache when the resumed
+ * exchange fails. The session is sealed to MRENCLAVE, since it stands in for the
+ * attestation only this very enclave build may reuse it, not any enclave of the signer.
+ */
+#define TLS_SESSION_SEALED_MAX 4096
+
+static const sgx_attributes_t g_tls_session_seal_attributes = {TSEAL_DEFAULT_FLAGSMASK, 0x0};
+
 uint8_t g_domain_key[SGX_DOMAIN_KEY_SIZE] = {0};
 
 int verify_callback(int preverify_ok, X509_STORE_CTX *ctx);
@@ -241,6 +254,173 @@ done:
     return sockfd;
 }
 
+/* Return: the sealed session of an earlier handshake if it can still be resumed, or NULL */
+static SSL_SESSION *load_tls_session()
+{
+    uint8_t *sealed = NULL;
+    uint8_t *der = NULL;
+    uint32_t sealed_len = 0;
+    uint32_t der_len = 0;
+    const unsigned char *p = NULL;
+    SSL_SESSION *session = NULL;
+    int retstatus = -1;
+
+    sealed = (uint8_t *)malloc(TLS_SESSION_SEALED_MAX);
+    if (sealed == NULL)
+        goto out;
+
+    if (ocall_read_tls_session(&retstatus, sealed, TLS_SESSION_SEALED_MAX, &sealed_len) != SGX_SUCCESS ||
+        retstatus != 0 || sealed_len > TLS_SESSION_SEALED_MAX || sealed_len < sizeof(sgx_sealed_data_t))
+        goto out;
+
+    // a session sealed to MRSIGNER by an older build is not trusted
+    if ((((const sgx_sealed_data_t *)sealed)->key_request.key_policy & SGX_KEYPOLICY_MRENCLAVE) == 0)
+        goto out;
+
+    der_len = sgx_get_encrypt_txt_len((const sgx_sealed_data_t *)sealed);
+    if (der_len == UINT32_MAX || sgx_calc_sealed_data_size(0, der_len) != sealed_len)
+        goto out;
+
+    der = (uint8_t *)malloc(der_len);
+    if (der == NULL)
+        goto out;
+    if (sgx_unseal_data((const sgx_sealed_data_t *)sealed, NULL, 0, der, &der_len) != SGX_SUCCESS)
+        goto out;
+
+    p = der;
+    session = d2i_SSL_SESSION(NULL, &p, (long)der_len);
+    if (session != NULL && !SSL_SESSION_is_resumable(session))
+    {
+        SSL_SESSION_free(session);
+        session = NULL;
+    }
+
+out:
+    if (der != NULL)
+    {
+        OPENSSL_cleanse(der, der_len);
+        free(der);
+    }
+    free(sealed);
+    return session;
+}
+
+/* seal the session of this handshake, with the ticket the dkeyserver issued, for the next start */
+static void store_tls_session(SSL *ssl)
+{
+    SSL_SESSION *session = SSL_get1_session(ssl);
+    uint8_t *der = NULL;
+    uint8_t *sealed = NULL;
+    unsigned char *p = NULL;
+    uint32_t sealed_len = 0;
+    int der_len = 0;
+    int retstatus = -1;
+
+    if (session == NULL || !SSL_SESSION_is_resumable(session))
+        goto out;
+
+    der_len = i2d_SSL_SESSION(session, NULL);
+    if (der_len <= 0)
+        goto out;
+    sealed_len = sgx_calc_sealed_data_size(0, (uint32_t)der_len);
+    if (sealed_len == UINT32_MAX || sealed_len > TLS_SESSION_SEALED_MAX)
+        goto out;
+
+    der = (uint8_t *)malloc(der_len);
+    sealed = (uint8_t *)malloc(sealed_len);
+    if (der == NULL || sealed == NULL)
+        goto out;
+    p = der;
+    if (i2d_SSL_SESSION(session, &p) != der_len)
+        goto out;
+
+    if (sgx_seal_data_ex(SGX_KEYPOLICY_MRENCLAVE, g_tls_session_seal_attributes, TSEAL_DEFAULT_MISCMASK,
+                         0, NULL, (uint32_t)der_len, der, sealed_len, (sgx_sealed_data_t *)sealed) != SGX_SUCCESS)
+        goto out;
+
+    if (ocall_store_tls_session(&retstatus, sealed, sealed_len) != SGX_SUCCESS || retstatus != 0)
+        log_d(TLS_CLIENT "failed to store the TLS session\n");
+
+out:
+    if (der != NULL)
+    {
+        OPENSSL_cleanse(der, der_len);
+        free(der);
+    }
+    free(sealed);
+    if (session != NULL)
+        SSL_SESSION_free(session);
+}
+
+/* connect ssl to the dkeyserver and receive the domain key over it
+ * Return: 0 on success, the socket is left in *client_socket either way, -1 if none
+ */
+static int tls_client_exchange(SSL *ssl, const char *server_name, uint16_t server_port, int *client_socket)
+{
+    int error = 0;
+
+    log_d(TLS_CLIENT "new ssl connection getting created\n");
+    *client_socket = create_socket(server_name, server_port);
+    if (*client_socket == -1)
+    {
+        log_d(
+            TLS_CLIENT
+            "create a socket and initiate a TCP connect to server: %s:%d "
+            "(errno=%d)\n",
+            server_name,
+            server_port,
+            errno);
+        return -1;
+    }
+
+    // set up ssl socket and initiate TLS connection with TLS server
+    if (SSL_set_fd(ssl, *client_socket) != 1)
+    {
+        log_d(TLS_CLIENT "ssl set fd error.\n");
+    }
+    else
+    {
+        log_d(TLS_CLIENT "ssl set fd succeed.\n");
+    }
+
+    if ((error = SSL_connect(ssl)) != 1)
+    {
+        log_d(
+            TLS_CLIENT "Error: Could not establish a TLS session ret2=%d "
+                       "SSL_get_error()=%d\n",
+            error,
+            SSL_get_error(ssl, error));
+        return -1;
+    }
+    log_d(
+        TLS_CLIENT "successfully established TLS channel:%s\n",
+        SSL_get_version(ssl));
+    if (SSL_session_reused(ssl))
+        log_i(TLS_CLIENT "resumed the TLS session with the dkeyserver\n");
+
+    // start the client server communication
+    if ((error = communicate_with_server(ssl)) != 0)
+    {
+        log_d(TLS_CLIENT "Failed: communicate_with_server (ret=%d)\n", error);
+        return -1;
+    }
+    return 0;
+}
+
+/* drop the connection of a failed exchange before it is tried again */
+static void tls_client_close(SSL *ssl, int client_socket)
+{
+    int res = 0;
+
+    if (client_socket != -1)
+    {
+        ocall_close(&res, client_socket);
+        if (res != 0)
+            log_d(TLS_CLIENT "OCALL: error close socket\n");
+    }
+    SSL_free(ssl);
+}
+
 int enclave_launch_tls_client(const char *server_name, uint16_t server_port)
 {
     log_d(TLS_CLIENT " called launch tls client\n");
@@ -249,13 +429,13 @@ int enclave_launch_tls_client(const char *server_name, uint16_t server_port)
 
     SSL_CTX *ssl_client_ctx = nullptr;
     SSL *ssl_session = nullptr;
+    SSL_SESSION *resume_session = nullptr;
 
     X509 *cert = nullptr;
     EVP_PKEY *pkey = nullptr;
     SSL_CONF_CTX *ssl_confctx = SSL_CONF_CTX_new();
 
     int client_socket = -1;
-    int error = 0;
     if (server_name == NULL)
     {
         log_d("Starting" TLS_CLIENT "failed: server name unavailable.\n");
@@ -291,56 +471,35 @@ int enclave_launch_tls_client(const char *server_name, uint16_t server_port)
         goto done;
     }
 
-    if ((ssl_session = SSL_new(ssl_client_ctx)) == nullptr)
+    // offer the ticket of an earlier handshake, to skip the attestation
+    resume_session = load_tls_session();
+    while (1)
     {
-        log_d(TLS_CLIENT
-              "Unable to create a new SSL connection state object\n");
-        goto done;
-    }
-
-    log_d(TLS_CLIENT "new ssl connection getting created\n");
-    client_socket = create_socket(server_name, server_port);
-    if (client_socket == -1)
-    {
-        log_d(
-            TLS_CLIENT
-            "create a socket and initiate a TCP connect to server: %s:%d "
-            "(errno=%d)\n",
-            server_name,
-            server_port,
-            errno);
-        goto done;
-    }
-
-    // set up ssl socket and initiate TLS connection with TLS server
-    if (SSL_set_fd(ssl_session, client_socket) != 1)
-    {
-        log_d(TLS_CLIENT "ssl set fd error.\n");
-    }
-    else
-    {
-        log_d(TLS_CLIENT "ssl set fd succeed.\n");
-    }
+        if ((ssl_session = SSL_new(ssl_client_ctx)) == nullptr)
+        {
+            log_d(TLS_CLIENT
+                  "Unable to create a new SSL connection state object\n");
+            goto done;
+        }
+        if (resume_session != nullptr)
+            SSL_set_session(ssl_session, resume_session);
 
-    if ((error = SSL_connect(ssl_session)) != 1)
-    {
-        log_d(
-            TLS_CLIENT "Error: Could not establish a TLS session ret2=%d "
-                       "SSL_get_error()=%d\n",
-            error,
-            SSL_get_error(ssl_session, error));
-        goto done;
+        if (tls_client_exchange(ssl_session, server_name, server_port, &client_socket) == 0)
+            break;
+        if (resume_session == nullptr)
+            goto done;
+
+        // a rejected or broken resumption falls back to a full RA-TLS handshake
+        log_w(TLS_CLIENT "resuming the TLS session failed, retrying with a full handshake\n");
+        SSL_SESSION_free(resume_session);
+        resume_session = nullptr;
+        tls_client_close(ssl_session, client_socket);
+        ssl_session = nullptr;
+        client_socket = -1;
     }
-    log_d(
-        TLS_CLIENT "successfully established TLS channel:%s\n",
-        SSL_get_version(ssl_session));
 
-    // start the client server communication
-    if ((error = communicate_with_server(ssl_session)) != 0)
-    {
-        log_d(TLS_CLIENT "Failed: communicate_with_server (ret=%d)\n", error);
-        goto done;
-    }
+    // the session ticket arrived along with the domain key
+    store_tls_session(ssl_session);
 
     // Free the structures we don't need anymore
     ret = 0;
@@ -363,6 +522,9 @@ done:
         SSL_free(ssl_session);
     }
 
+    if (resume_session)
+        SSL_SESSION_free(resume_session);
+
     if (cert)
         X509_free(cert);
 
@@ -52,12 +52,43 @@
 #define SGX_DOMAIN_KEY_SIZE 16
 #define CLIENT_MAX_NUM 20
 
+/*
+ * The accepted connections are served by a fixed pool of enclave threads. Each
+ * one holds a TCS, the TCSNum of enclave.config.xml is 8 and the ecall running
+ * the accept loop holds another. A connection arriving while ACCEPT_QUEUE_SIZE
+ * others wait for a worker is closed right away.
+ */
+#define TLS_WORKER_NUM 6
+#define ACCEPT_QUEUE_SIZE 64
+
+/*
+ * A dkeycache reconnecting with a TLS 1.3 session ticket of an earlier handshake
+ * resumes that session, and skips the quote generation and verification of a full
+ * RA-TLS handshake. The ticket keys are generated inside the enclave, so a restarted
+ * dkeyserver doesn't accept old tickets and the peers fall back to a full handshake.
+ * A ticket only lives for minutes, a revoked TCB or a changed quote policy is then
+ * enforced by the full handshake which follows, instead of being bypassed for long.
+ */
+#define TLS_SESSION_ID_CONTEXT "ehsm-dkeyserver"
+#define TLS_SESSION_TIMEOUT 600 // seconds
+
+/* accepted client sockets waiting for a worker */
+typedef struct AcceptQueue
+{
+    int fds[ACCEPT_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t count;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} AcceptQueue;
+
+/* shared by the workers, it lives until they are joined */
 typedef struct SocketMsgHandlerParam
 {
-    int client_socket_fd;
     SSL_CTX *ssl_server_ctx;
-    SSL *ssl_session;
     uint8_t *domainkey;
+    AcceptQueue *queue;
 } SocketMsgHandlerParam;
 
 void printf(const char *fmt, ...)
@@ -229,27 +260,66 @@ sgx_status_t sgx_get_domainkey(uint8_t *domain_key)
 
 int verify_callback(int preverify_ok, X509_STORE_CTX *ctx);
 
-static void *SocketMsgHandler(void *arg)
+/* Return: false if the queue is full or closed, the caller still owns the socket */
+static bool accept_queue_push(AcceptQueue *queue, int fd)
 {
-    if (arg == NULL)
+    bool pushed = false;
+
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->closed && queue->count < ACCEPT_QUEUE_SIZE)
     {
-        log_d(TLS_SERVER
-              "arg cannot be obtained\n");
-        return ((void *)0);
+        queue->fds[(queue->head + queue->count) % ACCEPT_QUEUE_SIZE] = fd;
+        queue->count++;
+        pushed = true;
+        pthread_cond_signal(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return pushed;
+}
+
+/* Return: the next accepted socket, or -1 once the queue is closed and empty */
+static int accept_queue_pop(AcceptQueue *queue)
+{
+    int fd = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed)
+        pthread_cond_wait(&queue->cond, &queue->lock);
+    if (queue->count > 0)
+    {
+        fd = queue->fds[queue->head];
+        queue->head = (queue->head + 1) % ACCEPT_QUEUE_SIZE;
+        queue->count--;
     }
+    pthread_mutex_unlock(&queue->lock);
+
+    return fd;
+}
+
+static void accept_queue_close(AcceptQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* hand the domain key to one dkeycache over RA-TLS, the socket is closed when done */
+static void serve_client(const SocketMsgHandlerParam *handler_ctx, int client_socket_fd)
+{
     SSL *ssl_session = nullptr;
-    SocketMsgHandlerParam handler_ctx = *(SocketMsgHandlerParam *)arg;
     int test_error = 1;
     int ret = -1;
     // create a new SSL structure for a connection
-    if ((ssl_session = SSL_new(handler_ctx.ssl_server_ctx)) == nullptr)
+    if ((ssl_session = SSL_new(handler_ctx->ssl_server_ctx)) == nullptr)
     {
         log_d(TLS_SERVER
               "Unable to create a new SSL connection state object\n");
         goto exit;
     }
 
-    if (SSL_set_fd(ssl_session, handler_ctx.client_socket_fd) != 1)
+    if (SSL_set_fd(ssl_session, client_socket_fd) != 1)
     {
         log_d(TLS_SERVER
               "SSL set fd failed\n");
@@ -265,6 +335,8 @@ static void *SocketMsgHandler(void *arg)
               test_error, SSL_get_error(ssl_session, test_error));
         goto exit;
     }
+    if (SSL_session_reused(ssl_session))
+        log_i(TLS_SERVER "resumed the TLS session of an attested client\n");
 
     log_d(TLS_SERVER "<---- Read from client:\n");
     if (read_from_session_peer(
@@ -276,28 +348,40 @@ static void *SocketMsgHandler(void *arg)
 
     for (unsigned long int i = 0; i < SGX_DOMAIN_KEY_SIZE; i++)
     {
-        log_d("domain_key[%u]=%2u\n", i, handler_ctx.domainkey[i]);
+        log_d("domain_key[%u]=%2u\n", i, handler_ctx->domainkey[i]);
     }
 
     log_d(TLS_SERVER "<---- Write to client:\n");
     if (write_to_session_peer(
-            ssl_session, handler_ctx.domainkey, SGX_DOMAIN_KEY_SIZE) != 0)
+            ssl_session, handler_ctx->domainkey, SGX_DOMAIN_KEY_SIZE) != 0)
     {
         log_d(TLS_SERVER " Write to client failed\n");
         goto exit;
     }
-    if (handler_ctx.client_socket_fd > 0)
-    {
-        ocall_close(&ret, handler_ctx.client_socket_fd);
-        if (ret != 0)
-        {
-            log_d(TLS_SERVER "OCALL: error closing client socket before starting a new TLS session.\n");
-            goto exit;
-        }
-    }
+    log_i("write domainkey to clent success\n");
 exit:
     SSL_free(ssl_session);
-    log_i("write domainkey to clent success\n");
+    ocall_close(&ret, client_socket_fd);
+    if (ret != 0)
+        log_d(TLS_SERVER "OCALL: error closing client socket.\n");
+}
+
+/* a worker of the pool, it serves accepted connections until the queue is closed */
+static void *SocketMsgHandler(void *arg)
+{
+    SocketMsgHandlerParam *handler_ctx = (SocketMsgHandlerParam *)arg;
+    int client_socket_fd = -1;
+
+    if (arg == NULL)
+    {
+        log_d(TLS_SERVER
+              "arg cannot be obtained\n");
+        return ((void *)0);
+    }
+
+    while ((client_socket_fd = accept_queue_pop(handler_ctx->queue)) >= 0)
+        serve_client(handler_ctx, client_socket_fd);
+
     return ((void *)0);
 }
 
@@ -351,39 +435,62 @@ int handle_communication_until_done(
     uint8_t *domainkey)
 {
     int ret = -1;
+    int closeRet = 0;
     // waiting_for_connection_request:
     struct sockaddr_in addr;
     uint len = sizeof(addr);
+    AcceptQueue queue;
+    SocketMsgHandlerParam param;
+    pthread_t workers[TLS_WORKER_NUM];
+    int worker_num = 0;
 
-    // reset ssl_session and client_socket_fd to prepare for the new TLS
-    // connection
-
-    log_i(TLS_SERVER " waiting for client connection\n");
-
-waiting_for_connection_request:
-
-    client_socket_fd = accept(server_socket_fd, (struct sockaddr *)&addr, &len);
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.cond, NULL);
 
-    if (client_socket_fd < 0)
-    {
-        log_d(TLS_SERVER "Unable to accept the client request\n");
-        goto exit;
-    }
-
-    SocketMsgHandlerParam param;
-    param.client_socket_fd = client_socket_fd;
     param.ssl_server_ctx = ssl_server_ctx;
     param.domainkey = domainkey;
+    param.queue = &queue;
 
-    pthread_t sniffer_thread;
-    if (pthread_create(&sniffer_thread, NULL, SocketMsgHandler, (void *)&param) < 0)
+    for (worker_num = 0; worker_num < TLS_WORKER_NUM; worker_num++)
     {
-        log_d("could not create thread\n");
+        if (pthread_create(&workers[worker_num], NULL, SocketMsgHandler, (void *)&param) != 0)
+        {
+            log_d("could not create thread\n");
+            break;
+        }
+    }
+    if (worker_num == 0)
         goto exit;
+    log_i(TLS_SERVER " %d workers waiting for client connection\n", worker_num);
+
+    // the client sockets are closed by the workers
+    client_socket_fd = -1;
+    while (1)
+    {
+        len = sizeof(addr);
+        int fd = accept(server_socket_fd, (struct sockaddr *)&addr, &len);
+        if (fd < 0)
+        {
+            log_d(TLS_SERVER "Unable to accept the client request\n");
+            break;
+        }
+
+        if (!accept_queue_push(&queue, fd))
+        {
+            log_w(TLS_SERVER "all workers are busy, refused a client connection\n");
+            ocall_close(&closeRet, fd);
+        }
     }
 
-    goto waiting_for_connection_request;
 exit:
+    // the workers drain the queue and are joined before the context they share goes away
+    accept_queue_close(&queue);
+    for (int i = 0; i < worker_num; i++)
+        pthread_join(workers[i], NULL);
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.lock);
+
     return ret;
 }
 
@@ -426,6 +533,17 @@ int sgx_set_up_tls_server(char *server_port)
     }
     SSL_CTX_set_verify(ssl_server_ctx, SSL_VERIFY_PEER, &verify_callback);
 
+    // issue one TLS 1.3 session ticket per handshake, see TLS_SESSION_TIMEOUT
+    if (SSL_CTX_set_session_id_context(ssl_server_ctx,
+                                       (const unsigned char *)TLS_SESSION_ID_CONTEXT,
+                                       sizeof(TLS_SESSION_ID_CONTEXT) - 1) != 1)
+    {
+        log_d(TLS_SERVER "unable to set the session id context\n ");
+        goto exit;
+    }
+    SSL_CTX_set_timeout(ssl_server_ctx, TLS_SESSION_TIMEOUT);
+    SSL_CTX_set_num_tickets(ssl_server_ctx, 1);
+
     if (load_tls_certificates_and_keys(ssl_server_ctx, certificate, pkey) != 0)
     {
         log_d(TLS_SERVER
@@ -472,11 +590,14 @@ int sgx_set_up_tls_server(char *server_port)
 
 exit:
     int closeRet;
-    ocall_close(&closeRet, client_socket_fd); // close the socket connections
-    if (closeRet != 0)
+    if (client_socket_fd != -1)
     {
-        log_d(TLS_SERVER "OCALL: error closing client socket\n");
-        ret = -1;
+        ocall_close(&closeRet, client_socket_fd); // close the socket connections
+        if (closeRet != 0)
+        {
+            log_d(TLS_SERVER "OCALL: error closing client socket\n");
+            ret = -1;
+        }
     }
     ocall_close(&closeRet, server_socket_fd);
     if (closeRet != 0)
@@ -9,6 +9,8 @@ const cryptographic = {
   AsymmetricEncrypt: 'AsymmetricEncrypt',
   AsymmetricDecrypt: 'AsymmetricDecrypt',
   ExportDataKey: 'ExportDataKey',
+  GenerateMac: 'GenerateMac',
+  VerifyMac: 'VerifyMac',
 }
 
 const enroll = {
@@ -68,7 +68,22 @@ const ehsm_action_t = {
   [KMS_ACTION.common.GetVersion]: 12,
   [KMS_ACTION.enroll.Enroll]: 13,
   [KMS_ACTION.remote_attestation.GenerateQuote]: 14,
-  [KMS_ACTION.remote_attestation.VerifyQuote]: 15
+  [KMS_ACTION.remote_attestation.VerifyQuote]: 15,
+  EH_UPGRADE_KEYBLOB: 16,
+  EH_BATCH: 17,
+  EH_ENCRYPT_INIT: 18,
+  EH_ENCRYPT_UPDATE: 19,
+  EH_ENCRYPT_FINAL: 20,
+  EH_DECRYPT_INIT: 21,
+  EH_DECRYPT_UPDATE: 22,
+  EH_DECRYPT_FINAL: 23,
+  EH_STREAM_ABORT: 24,
+  EH_GET_METRICS: 25,
+  EH_VERIFY_REQUEST_SIGN: 26,
+  [KMS_ACTION.cryptographic.GenerateMac]: 27,
+  [KMS_ACTION.cryptographic.VerifyMac]: 28,
+  EH_SET_LOG_LEVEL: 29,
+  EH_INVALIDATE_API_KEY: 30
 }
 
 module.exports = {
@@ -9,7 +9,8 @@ const {
     _checkParams,
     _nonce_cache_timer,
     _cmk_cache_timer,
-    base64_decode
+    base64_decode,
+    napi_async_settled
 } = require('./function')
 const connectDB = require('./couchdb')
 const {
@@ -24,6 +25,10 @@ const app = express()
 app.use(express.json())
 
 const HTTPS_PORT = process.argv.slice(2)[0] || 9000
+// how long the exit waits for the answers of the requests in flight
+const EXIT_SETTLE_TIMEOUT_MS = 5000
+
+let https_server = undefined
 
 const server = (DB) => {
     /**
@@ -65,12 +70,28 @@ const server = (DB) => {
     /**
      * NAPI finalize when service exit
      */
-    process.on('SIGINT', function () {
+    let exiting = false
+    process.on('SIGINT', async function () {
+        if (exiting) {
+            return
+        }
+        exiting = true
         console.log('ehsm kms service exit')
-        ehsm_napi.EHSM_FFI_CALL(JSON.stringify({ action: ehsm_action_t.EH_FINALIZE, payload: {} }))
         clearInterval(nonce_cache_timer)
         clearInterval(cmk_cache_timer)
         clearInterval(secret_delete_timer)
+        // stop taking requests first, or a steady load would never let the calls settle
+        if (https_server != undefined) {
+            https_server.close()
+            if (typeof https_server.closeIdleConnections == 'function') {
+                https_server.closeIdleConnections()
+            }
+        }
+        // the provider answers the async calls on this thread, finalize once they are done
+        if (!await napi_async_settled(EXIT_SETTLE_TIMEOUT_MS)) {
+            console.log('ehsm kms service exit with requests still in flight')
+        }
+        ehsm_napi.EHSM_FFI_CALL(JSON.stringify({ action: ehsm_action_t.EH_FINALIZE, payload: {} }))
         process.exit(0)
     })
 
@@ -109,7 +130,7 @@ const createHttpsServer = (key, cert) => {
         key = fs.readFileSync('./openssl/privatekey.pem', 'utf8')
         cert = fs.readFileSync('./openssl/certificate.crt', 'utf8')
     }
-    https.createServer({ key, cert }, app).listen(HTTPS_PORT)
+    https_server = https.createServer({ key, cert }, app).listen(HTTPS_PORT)
     console.log(`ehsm_ksm_service application listening at ${getIPAdress()} with https port: ${HTTPS_PORT}`)
 }
 
@@ -23,7 +23,34 @@ const ehsm_napi = ffi.Library('./libehsmprovider', {
                 }
             }
     */
-    EHSM_FFI_CALL: ['string', ['string']]
+    EHSM_FFI_CALL: ['string', ['string']],
+    /**
+        EHSM_FFI_CALL_BIN
+        Description:
+            call napi function with a packed binary request, see ehsm_ffi_bin_t
+            in ehsm_provider.h for the layout
+
+        params:
+            req: Buffer, req_len: size_t, resp: Buffer, resp_len: pointer to size_t
+                (the capacity of resp, updated to the bytes used)
+
+        return int32 (ehsm_status_t)
+    */
+    EHSM_FFI_CALL_BIN: ['int32', ['pointer', 'size_t', 'pointer', 'pointer']],
+    /**
+        EHSM_FFI_CALL_ASYNC
+        Description:
+            queue the request of EHSM_FFI_CALL to the worker pool of the provider,
+            the event loop is not blocked while the enclave processes it
+
+        params:
+            paramJson: the same json string as EHSM_FFI_CALL
+            callback: ffi.Callback('void', ['string', 'pointer']) invoked with the response json
+            ctx: pointer passed back to callback
+
+        return int32 (ehsm_status_t), EH_BUSY(-11) when the queue is full
+    */
+    EHSM_FFI_CALL_ASYNC: ['int32', ['string', 'pointer', 'pointer']]
 })
 
 module.exports = ehsm_napi
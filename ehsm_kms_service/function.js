@@ -1,4 +1,5 @@
 const crypto = require('crypto')
+const ffi = require('ffi-napi')
 const {
     v4: uuidv4
 } = require('uuid')
@@ -221,6 +222,88 @@ function napi_result(action, res, payload) {
     }
 }
 
+// keep the ffi callbacks referenced until the provider invokes them
+const pending_callbacks = new Set()
+
+/**
+ * ehsm napi result, the asynchronous version of napi_result
+ * The request is processed by a worker thread of the provider, so the event loop is not
+ * blocked while the enclave works on it.
+ * If the value of the result is not equal to 200, the result is directly returned to the user
+ * @param {function name} action
+ * @param {object} res
+ * @param {EHSM_FFI_CALL function params} params
+ * @returns Promise of napi result | false
+ */
+function napi_result_async(action, res, payload) {
+    return new Promise((resolve) => {
+        const failed = (code, msg) => {
+            if (res != undefined) {
+                res.send(_result(code, msg))
+            }
+            resolve(false)
+        }
+        try {
+            let jsonParam = {
+                action: ehsm_action_t[action],
+                payload
+            }
+            const callback = ffi.Callback('void', ['string', 'pointer'], (napi_res) => {
+                pending_callbacks.delete(callback)
+                try {
+                    if (JSON.parse(napi_res)
+                        .code != 200) {
+                        if (res != undefined) {
+                            res.send(napi_res)
+                        }
+                        resolve(false)
+                    } else {
+                        resolve(JSON.parse(napi_res))
+                    }
+                } catch (e) {
+                    logger.error(e)
+                    failed(500, 'Server internal error, please contact the administrator.')
+                }
+            })
+            pending_callbacks.add(callback)
+            const ret = ehsm_napi[`EHSM_FFI_CALL_ASYNC`](JSON.stringify(jsonParam), callback, null)
+            if (ret != 0) {
+                pending_callbacks.delete(callback)
+                if (ret == -11) {
+                    failed(503, 'Server busy, please try again later.')
+                } else {
+                    failed(500, 'Server internal error, please contact the administrator.')
+                }
+            }
+        } catch (e) {
+            logger.error(e)
+            failed(500, 'Server internal error, please contact the administrator.')
+        }
+    })
+}
+
+/**
+ * resolved once every asynchronous napi call has been answered or timeout_ms passed,
+ * EH_FINALIZE drops the calls still queued in the provider and must wait for this first
+ * @param {number} timeout_ms
+ * @returns Promise of true if every call was answered
+ */
+function napi_async_settled(timeout_ms) {
+    const deadline = Date.now() + timeout_ms
+    return new Promise((resolve) => {
+        const check = () => {
+            if (pending_callbacks.size == 0) {
+                resolve(true)
+            } else if (Date.now() >= deadline) {
+                resolve(false)
+            } else {
+                setTimeout(check, 10)
+            }
+        }
+        check()
+    })
+}
+
 /**
  * test create_user_info save in couchDB
  * @param {object} DB
@@ -249,10 +332,11 @@ const create_user_info = (action, DB, res, req) => {
             const {
                 cmk
             } = cmk_res.result
+            // the appid is the aad, so the record only unwraps for its own appid
             let apikey_encrypt_res = napi_result(KMS_ACTION.cryptographic.Encrypt, res, {
                 cmk,
                 plaintext: apikey,
-                aad: '',
+                aad: base64_encode(appid),
             })
             if (apikey_encrypt_res) {
                 const {
@@ -309,10 +393,11 @@ const enroll_user_info = (action, DB, res, req) => {
             } = cmk_res.result
             // create a default secret manager CMK for current appids
             const sm_default_cmk = sm_default_cmk_res.result.cmk
+            // the appid is the aad, so the record only unwraps for its own appid
             let apikey_encrypt_res = napi_result(KMS_ACTION.cryptographic.Encrypt, undefined, {
                 cmk,
                 plaintext: base64_encode(apikey),
-                aad: ''
+                aad: base64_encode(appid)
             })
             if (apikey_encrypt_res) {
                 const {
@@ -507,13 +592,13 @@ const _checkParams = function (req, res, next, nonce_database, DB) {
             payload
         }
 
-        gen_hmac(DB, appid, sign_params)
+        verify_sign(DB, appid, sign_params, sign)
             .then(result => {
-                if (result.hmac.length == 0) {
+                if (result.error) {
                     res.send(_result(400, result.error))
                     return
                 }
-                if (sign != result.hmac) {
+                if (!result.result) {
                     res.send(_result(400, 'sign error'))
                     return
                 } else {
@@ -558,7 +643,7 @@ const _query_api_key = async (DB, appid) => {
             undefined, {
             cmk,
             ciphertext: apikey,
-            aad: ''
+            aad: base64_encode(appid)
         }
         )
 
@@ -619,6 +704,69 @@ const gen_hmac = async (DB, appid, sign_params) => {
     }
 }
 
+/**
+ * Verify the sign of a request inside the enclave, which caches the api key of the appid
+ * for a few minutes. The cmk and the encrypted api key are only read from the database
+ * when the enclave misses the api key. EH_INVALIDATE_API_KEY must be called with the appid
+ * whenever its user_info record is replaced or deleted.
+ * @param {object} DB
+ * @param {string} appid
+ * @param {object} sign_params
+ * @param {string} sign
+ * @returns { error, result }
+ */
+const verify_sign = async (DB, appid, sign_params, sign) => {
+    try {
+        const payload = {
+            appid,
+            sign_string: params_sort_str(sign_params),
+            sign
+        }
+        let verify_res = await napi_result_async('EH_VERIFY_REQUEST_SIGN', undefined, payload)
+        if (verify_res && !verify_res.result.cached) {
+            const db_query = {
+                selector: {
+                    _id: `user_info:${appid}`,
+                },
+                fields: ['cmk', 'apikey'],
+                limit: 1,
+            }
+            let query_result = await DB.partitionedFind('user_info', db_query)
+            if (!(query_result && query_result.docs[0])) {
+                return {
+                    error: 'keyid not found',
+                    result: false
+                }
+            }
+            let {
+                cmk,
+                apikey
+            } = query_result.docs[0]
+            verify_res = await napi_result_async('EH_VERIFY_REQUEST_SIGN', undefined, {
+                ...payload,
+                cmk,
+                apikey
+            })
+        }
+        if (!verify_res) {
+            return {
+                error: 'Verify sign error',
+                result: false
+            }
+        }
+        return {
+            error: '',
+            result: verify_res.result.result
+        }
+    } catch (error) {
+        logger.error(error)
+        return {
+            error: 'Unexcept error',
+            result: false
+        }
+    }
+}
+
 module.exports = {
     getIPAdress,
     base64_encode,
@@ -626,10 +774,13 @@ module.exports = {
     _checkParams,
     _result,
     napi_result,
+    napi_result_async,
+    napi_async_settled,
     create_user_info,
     enroll_user_info,
     _nonce_cache_timer,
     store_cmk,
     _cmk_cache_timer,
     gen_hmac,
+    verify_sign,
 }
\ No newline at end of file
@@ -113,6 +113,30 @@ const cryptographic_params = {
       required: true,
     },
   },
+  [KMS_ACTION.cryptographic.GenerateMac]: {
+    keyid,
+    message: {
+      type: PARAM_DATA_TYPE.BASE64,
+      maxLength: MAX_LENGTH,
+      minLength: 1,
+      required: true,
+    },
+  },
+  [KMS_ACTION.cryptographic.VerifyMac]: {
+    keyid,
+    message: {
+      type: PARAM_DATA_TYPE.BASE64,
+      maxLength: MAX_LENGTH,
+      minLength: 1,
+      required: true,
+    },
+    mac: {
+      type: PARAM_DATA_TYPE.BASE64,
+      maxLength: 128,
+      minLength: 1,
+      required: true,
+    },
+  },
   [KMS_ACTION.cryptographic.AsymmetricEncrypt]: {
     keyid,
     plaintext: {
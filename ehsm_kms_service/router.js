@@ -3,6 +3,7 @@ const { KMS_ACTION } = require('./apis')
 const logger = require('./logger')
 const {
   napi_result,
+  napi_result_async,
   _result,
   create_user_info,
   enroll_user_info,
@@ -120,7 +121,7 @@ const router = async (p) => {
         origin = ehsm_keyorigin_t[origin]
         padding_mode = ehsm_paddingMode_t[padding_mode]
         digest_mode = ehsm_digestMode_t[digest_mode]
-        const napi_res = napi_result(action, res, { keyspec, origin, purpose, padding_mode, digest_mode })
+        const napi_res = await napi_result_async(action, res, { keyspec, origin, purpose, padding_mode, digest_mode })
         napi_res && store_cmk(napi_res, res, appid, payload, DB)
       } catch (error) {
         logger.error(error)
@@ -131,7 +132,7 @@ const router = async (p) => {
       try {
         const { keyid, plaintext, aad = '' } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        const napi_res = napi_result(action, res, { cmk: cmk_base64, plaintext, aad })
+        const napi_res = await napi_result_async(action, res, { cmk: cmk_base64, plaintext, aad })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
@@ -139,7 +140,7 @@ const router = async (p) => {
       try {
         const { keyid, ciphertext, aad = '' } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, ciphertext, aad })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, ciphertext, aad })
         napi_res && res.send(napi_res)
       } catch (error) {
         logger.error(error)
@@ -150,7 +151,7 @@ const router = async (p) => {
       try {
         const { keyid, keylen, aad = '' } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, keylen, aad })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, keylen, aad })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
@@ -158,7 +159,7 @@ const router = async (p) => {
       try {
         const { keyid, keylen, aad = '' } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, keylen, aad })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, keylen, aad })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
@@ -166,7 +167,7 @@ const router = async (p) => {
       try {
         const { keyid, digest } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, digest })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, digest })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
@@ -174,7 +175,23 @@ const router = async (p) => {
       try {
         const { keyid, digest, signature } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, digest, signature })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, digest, signature })
+        napi_res && res.send(napi_res)
+      } catch (error) { }
+      break
+    case KMS_ACTION.cryptographic.GenerateMac:
+      try {
+        const { keyid, message } = payload
+        const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, message })
+        napi_res && res.send(napi_res)
+      } catch (error) { }
+      break
+    case KMS_ACTION.cryptographic.VerifyMac:
+      try {
+        const { keyid, message, mac } = payload
+        const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, message, mac })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
@@ -182,7 +199,7 @@ const router = async (p) => {
       try {
         const { keyid, plaintext } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, plaintext })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, plaintext })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
@@ -190,7 +207,7 @@ const router = async (p) => {
       try {
         const { keyid, ciphertext } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, ciphertext })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, ciphertext })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
@@ -199,7 +216,7 @@ const router = async (p) => {
         const { keyid, ukeyid, aad = '', olddatakey_base } = payload
         const cmk_base64 = await find_cmk_by_keyid(appid, keyid, res, DB)
         const ukey_base64 = await find_cmk_by_keyid(appid, ukeyid, res, DB)
-        napi_res = napi_result(action, res, { cmk: cmk_base64, ukey: ukey_base64, aad, olddatakey: olddatakey_base })
+        napi_res = await napi_result_async(action, res, { cmk: cmk_base64, ukey: ukey_base64, aad, olddatakey: olddatakey_base })
         napi_res && res.send(napi_res)
       } catch (error) { }
       break
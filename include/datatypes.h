@@ -116,6 +116,30 @@ typedef int errno_t;
 #define EH_CIPHERTEXT_MAX_SIZE (6*1024)
 #define EH_PAYLOAD_MAX_SIZE (12*1024)
 #define EH_QUOTE_MAX_SIZE (8*1024)
+#define EH_MAC_MESSAGE_MAX_SIZE (8*1024)
+
+#define EH_BATCH_MAX_ITEMS 64
+#define EH_BATCH_MAX_SIZE (512*1024)
+#define EH_BATCH_RESPONSE_MAX_SIZE (1024*1024)
+#define EH_BATCH_PAYLOAD_MAX_SIZE (1024*1024)
+/* upper bound of the output an item adds on top of its own packed input (besides twice its param) */
+#define EH_BATCH_ITEM_MAX_OVERHEAD (MAX_SIGNATURE_SIZE + 64)
+
+/*
+ * Streaming encryption: a stream is a header followed by chunks sealed one by
+ * one. The nonce of a chunk binds its index and whether it is the last one, so
+ * dropped, reordered or truncated chunks fail to decrypt. The chunks are sealed
+ * under a subkey derived from the cmk and the random salt of the header, so the
+ * nonces of a stream never collide with those of other streams or of Encrypt.
+ * AES-GCM chunks are {ciphertext|mac}, SM4 chunks are {ciphertext|iv|mac} with
+ * an HMAC-SM3 mac.
+ */
+#define EH_STREAM_VERSION           2
+#define EH_STREAM_SALT_SIZE         16
+#define EH_STREAM_HEADER_SIZE       (1 + EH_STREAM_SALT_SIZE)   /* version | salt */
+#define EH_STREAM_MAC_SIZE          16
+#define EH_STREAM_CHUNK_MAX_SIZE    (1024*1024)
+#define EH_STREAM_HANDLE_INSTANCE_SHIFT 56  /* the top byte of a handle is the owning enclave instance */
 
 #define SGX_DOMAIN_KEY_SIZE     16
 
@@ -137,6 +161,8 @@ typedef enum {
     EH_LA_SETUP_ERROR               = -7,
     EH_LA_EXCHANGE_MSG_ERROR        = -8,
     EH_LA_CLOSE_ERROR               = -9,
+    EH_BUFFER_TOO_SMALL             = -10,
+    EH_BUSY                         = -11,
 } ehsm_status_t;
 
 //sgx-ssl framework
@@ -188,6 +214,17 @@ typedef enum {
 } ehsm_padding_mode_t;
 
 
+/* operations which can be packed into a single batch ecall */
+typedef enum {
+    EH_BATCH_ENCRYPT = 0,
+    EH_BATCH_DECRYPT,
+    EH_BATCH_SIGN,
+    EH_BATCH_VERIFY,
+    EH_BATCH_GENERATE_DATAKEY,
+    EH_BATCH_GENERATE_MAC,
+    EH_BATCH_VERIFY_MAC
+} ehsm_batch_op_t;
+
 typedef enum {
     EH_NULL = 0,
     EH_DATA_T,
@@ -220,6 +257,97 @@ typedef struct {
     uint8_t             keyblob[0];
 } ehsm_keyblob_t;
 
+typedef struct {
+    uint64_t    hits;
+    uint64_t    misses;
+    uint64_t    evictions;
+    uint32_t    entries;
+    uint32_t    bytes;
+    uint32_t    max_entries;
+    uint32_t    max_bytes;
+} ehsm_key_cache_stats_t;
+
+typedef struct {
+    uint64_t    hits;       /* key pairs taken from the pool by CreateKey */
+    uint64_t    misses;     /* key pairs CreateKey had to generate inline */
+    uint64_t    generated;  /* key pairs generated by the background refill */
+    uint32_t    available;
+    uint32_t    low_watermark;
+    uint32_t    high_watermark;
+} ehsm_key_pool_stats_t;
+
+/*
+ * What the in-enclave performance counters measure. The first ones cover a whole
+ * key operation ECALL, the others the steps inside them which are worth telling
+ * apart from the ECALL transition and the marshaling done by the provider.
+ */
+typedef enum {
+    EH_STATS_CREATE_KEY = 0,
+    EH_STATS_ENCRYPT,
+    EH_STATS_DECRYPT,
+    EH_STATS_ASYMMETRIC_ENCRYPT,
+    EH_STATS_ASYMMETRIC_DECRYPT,
+    EH_STATS_SIGN,
+    EH_STATS_VERIFY,
+    EH_STATS_GENERATE_DATAKEY,
+    EH_STATS_EXPORT_DATAKEY,
+    EH_STATS_GENERATE_MAC,
+    EH_STATS_VERIFY_MAC,
+    EH_STATS_PARSE_KEYBLOB,     /* unwrapping a cmk missed by the key cache */
+    EH_STATS_PARSE_KEY,         /* decoding the PEM/DER key pair of a cmk missed by the key cache */
+    EH_STATS_CRYPTO,            /* the OpenSSL primitive of an operation */
+    EH_STATS_READ_RAND,         /* sgx_read_rand for ivs, nonces and datakeys */
+    EH_STATS_NUM
+} ehsm_stats_op_t;
+
+/* the counters are kept per keyspec, indexed by its value */
+#define EH_STATS_KEYSPEC_NUM    (EH_HMAC + 1)
+
+typedef struct {
+    uint64_t    count;
+    uint64_t    cycles;     /* sum of the elapsed TSC cycles */
+    uint64_t    max_cycles;
+} ehsm_stats_counter_t;
+
+typedef struct {
+    uint32_t                enabled;    /* nothing is counted while 0 */
+    uint32_t                reserved;
+    ehsm_stats_counter_t    counters[EH_STATS_NUM][EH_STATS_KEYSPEC_NUM];
+} ehsm_enclave_stats_t;
+
+/*
+ * One packed batch item. The payload is a sequence of ehsm_keyblob_t/ehsm_data_t
+ * placed back to back, in the request:
+ *   EH_BATCH_ENCRYPT          cmk | aad | plaintext
+ *   EH_BATCH_DECRYPT          cmk | aad | ciphertext
+ *   EH_BATCH_SIGN             cmk | digest
+ *   EH_BATCH_VERIFY           cmk | digest | signature
+ *   EH_BATCH_GENERATE_DATAKEY cmk | aad              (param is the datakey length)
+ *   EH_BATCH_GENERATE_MAC     cmk | message
+ *   EH_BATCH_VERIFY_MAC       cmk | message | mac
+ * and in the response:
+ *   EH_BATCH_ENCRYPT          ciphertext
+ *   EH_BATCH_DECRYPT          plaintext
+ *   EH_BATCH_SIGN             signature
+ *   EH_BATCH_VERIFY           result (1 byte)
+ *   EH_BATCH_GENERATE_DATAKEY plaintext | ciphertext
+ *   EH_BATCH_GENERATE_MAC     mac
+ *   EH_BATCH_VERIFY_MAC       result (1 byte)
+ * The response payload is empty when status is not SGX_SUCCESS.
+ */
+typedef struct {
+    uint32_t    action;     /* ehsm_batch_op_t */
+    uint32_t    param;
+    uint32_t    status;     /* sgx_status_t of this item, only valid in the response */
+    uint32_t    size;       /* size of the payload */
+    uint8_t     payload[0];
+} ehsm_batch_item_t;
+
+typedef struct {
+    uint32_t            count;
+    uint8_t             items[0];
+} ehsm_batch_t;
+
 
 //Format of the AES-GCM message being exchanged between the source and the destination enclaves
 typedef struct _secure_message_t
@@ -251,4 +379,217 @@ typedef struct _session_id_tracker_t
 
 #pragma pack(pop)
 
+/*
+ * Output sizes shared by the provider and the enclave. The provider sizes its
+ * output buffers from these and makes a single ecall, the enclave accepts any
+ * buffer at least this large and reports back the exact length it used.
+ */
+#define EH_KEYBLOB_HEADER_SIZE              48      /* sizeof(sgx_aes_gcm_data_ex_t) */
+
+/*
+ * Upper bounds of the DER private key plus DER public key in a v2 keyblob, the
+ * keyblob is shrunk to the exact size once the key has been generated.
+ */
+#define EH_RSA_DER_KEYPAIR_MAX_SIZE(bits)   ((bits) / 8 * 6 + 128)
+#define EH_EC_DER_KEYPAIR_MAX_SIZE          512
+
+/* DER encoded C1|C3|C2 overhead of a sm2 ciphertext, as bounded by openssl */
+#define EH_SM2_CIPHERTEXT_OVERHEAD          (10 + 2 * 32 + 32)
+
+/* an EH_HMAC key is one SHA-256/SM3 block whatever its digest mode, HMAC never rehashes it */
+#define EH_HMAC_KEY_SIZE                    64
+#define EH_MAC_MAX_SIZE                     64
+
+static inline uint32_t ehsm_get_keyblob_max_size(uint32_t keyspec)
+{
+    switch (keyspec)
+    {
+    case EH_RSA_2048:
+        return EH_RSA_DER_KEYPAIR_MAX_SIZE(RSA_2048_KEY_BITS) + EH_KEYBLOB_HEADER_SIZE;
+    case EH_RSA_3072:
+        return EH_RSA_DER_KEYPAIR_MAX_SIZE(RSA_3072_KEY_BITS) + EH_KEYBLOB_HEADER_SIZE;
+    case EH_RSA_4096:
+        return EH_RSA_DER_KEYPAIR_MAX_SIZE(RSA_4096_KEY_BITS) + EH_KEYBLOB_HEADER_SIZE;
+    case EH_EC_P224:
+    case EH_EC_P256:
+    case EH_EC_P384:
+    case EH_EC_P521:
+    case EH_SM2:
+        return EH_EC_DER_KEYPAIR_MAX_SIZE + EH_KEYBLOB_HEADER_SIZE;
+    case EH_AES_GCM_128:
+    case EH_SM4_CTR:
+    case EH_SM4_CBC:
+        return 16 + EH_KEYBLOB_HEADER_SIZE;
+    case EH_AES_GCM_192:
+        return 24 + EH_KEYBLOB_HEADER_SIZE;
+    case EH_AES_GCM_256:
+        return 32 + EH_KEYBLOB_HEADER_SIZE;
+    case EH_HMAC:
+        return EH_HMAC_KEY_SIZE + EH_KEYBLOB_HEADER_SIZE;
+    default:
+        return 0;
+    }
+}
+
+/* exact size of the symmetric cipherblob {ciphertext|iv(|mac)} */
+static inline uint32_t ehsm_get_ciphertext_size(uint32_t keyspec, uint32_t plaintext_len)
+{
+    switch (keyspec)
+    {
+    case EH_AES_GCM_128:
+    case EH_AES_GCM_192:
+    case EH_AES_GCM_256:
+        return plaintext_len + EH_AES_GCM_IV_SIZE + EH_AES_GCM_MAC_SIZE;
+    case EH_SM4_CTR:
+        return plaintext_len + SGX_SM4_IV_SIZE;
+    case EH_SM4_CBC:
+        if (plaintext_len % 16 != 0)
+            return (plaintext_len / 16 + 1) * 16 + SGX_SM4_IV_SIZE;
+        return plaintext_len + SGX_SM4_IV_SIZE;
+    default:
+        return 0;
+    }
+}
+
+/* exact size of the plaintext carried by a symmetric cipherblob, 0 if it is too short */
+static inline uint32_t ehsm_get_plaintext_size(uint32_t keyspec, uint32_t ciphertext_len)
+{
+    switch (keyspec)
+    {
+    case EH_AES_GCM_128:
+    case EH_AES_GCM_192:
+    case EH_AES_GCM_256:
+        if (ciphertext_len <= EH_AES_GCM_IV_SIZE + EH_AES_GCM_MAC_SIZE)
+            return 0;
+        return ciphertext_len - EH_AES_GCM_IV_SIZE - EH_AES_GCM_MAC_SIZE;
+    case EH_SM4_CTR:
+    case EH_SM4_CBC:
+        if (ciphertext_len <= SGX_SM4_IV_SIZE)
+            return 0;
+        return ciphertext_len - SGX_SM4_IV_SIZE;
+    default:
+        return 0;
+    }
+}
+
+/* the size of a sealed stream chunk, 0 if the keyspec cannot be streamed */
+static inline uint32_t ehsm_get_stream_chunk_size(uint32_t keyspec, uint32_t plaintext_len)
+{
+    switch (keyspec)
+    {
+    case EH_AES_GCM_128:
+    case EH_AES_GCM_192:
+    case EH_AES_GCM_256:
+        return plaintext_len + EH_STREAM_MAC_SIZE;
+    case EH_SM4_CTR:
+        return plaintext_len + SGX_SM4_IV_SIZE + EH_STREAM_MAC_SIZE;
+    case EH_SM4_CBC:
+        return (plaintext_len / 16 + 1) * 16 + SGX_SM4_IV_SIZE + EH_STREAM_MAC_SIZE;
+    default:
+        return 0;
+    }
+}
+
+/* the plaintext of a sealed stream chunk, an upper bound for SM4-CBC, 0 if the chunk is malformed */
+static inline uint32_t ehsm_get_stream_plaintext_size(uint32_t keyspec, uint32_t chunk_len)
+{
+    switch (keyspec)
+    {
+    case EH_AES_GCM_128:
+    case EH_AES_GCM_192:
+    case EH_AES_GCM_256:
+        if (chunk_len <= EH_STREAM_MAC_SIZE)
+            return 0;
+        return chunk_len - EH_STREAM_MAC_SIZE;
+    case EH_SM4_CTR:
+        if (chunk_len <= SGX_SM4_IV_SIZE + EH_STREAM_MAC_SIZE)
+            return 0;
+        return chunk_len - SGX_SM4_IV_SIZE - EH_STREAM_MAC_SIZE;
+    case EH_SM4_CBC:
+        if (chunk_len <= SGX_SM4_IV_SIZE + EH_STREAM_MAC_SIZE ||
+            (chunk_len - SGX_SM4_IV_SIZE - EH_STREAM_MAC_SIZE) % 16 != 0)
+            return 0;
+        return chunk_len - SGX_SM4_IV_SIZE - EH_STREAM_MAC_SIZE;
+    default:
+        return 0;
+    }
+}
+
+static inline uint32_t ehsm_get_asymmetric_ciphertext_max_size(uint32_t keyspec, uint32_t plaintext_len)
+{
+    switch (keyspec)
+    {
+    case EH_RSA_2048:
+        return RSA_2048_KEY_BITS / 8;
+    case EH_RSA_3072:
+        return RSA_3072_KEY_BITS / 8;
+    case EH_RSA_4096:
+        return RSA_4096_KEY_BITS / 8;
+    case EH_SM2:
+        return plaintext_len + EH_SM2_CIPHERTEXT_OVERHEAD;
+    default:
+        return 0;
+    }
+}
+
+static inline uint32_t ehsm_get_asymmetric_plaintext_max_size(uint32_t keyspec, uint32_t ciphertext_len)
+{
+    switch (keyspec)
+    {
+    case EH_RSA_2048:
+        return RSA_2048_KEY_BITS / 8;
+    case EH_RSA_3072:
+        return RSA_3072_KEY_BITS / 8;
+    case EH_RSA_4096:
+        return RSA_4096_KEY_BITS / 8;
+    case EH_SM2:
+        return ciphertext_len;
+    default:
+        return 0;
+    }
+}
+
+/* rsa signatures have a fixed size, ecc and sm2 ones are at most this long */
+static inline uint32_t ehsm_get_signature_max_size(uint32_t keyspec)
+{
+    switch (keyspec)
+    {
+    case EH_RSA_2048:
+        return RSA_OAEP_2048_SIGNATURE_SIZE;
+    case EH_RSA_3072:
+        return RSA_OAEP_3072_SIGNATURE_SIZE;
+    case EH_RSA_4096:
+        return RSA_OAEP_4096_SIGNATURE_SIZE;
+    case EH_EC_P256:
+        return EC_P256_SIGNATURE_MAX_SIZE;
+    case EH_EC_P224:
+        return EC_P224_SIGNATURE_MAX_SIZE;
+    case EH_EC_P384:
+        return EC_P384_SIGNATURE_MAX_SIZE;
+    case EH_EC_P521:
+        return EC_P521_SIGNATURE_MAX_SIZE;
+    case EH_SM2:
+        return EC_SM2_SIGNATURE_MAX_SIZE;
+    default:
+        return 0;
+    }
+}
+
+/* size of the mac of an EH_HMAC key, 0 if its digest mode is not supported */
+static inline uint32_t ehsm_get_mac_size(uint32_t digest_mode)
+{
+    switch (digest_mode)
+    {
+    case EH_SHA_2_256:
+    case EH_SM3:
+        return 32;
+    case EH_SHA_2_384:
+        return 48;
+    case EH_SHA_2_512:
+        return 64;
+    default:
+        return 0;
+    }
+}
+
 #endif
\ No newline at end of file
@@ -33,8 +33,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/socket.h>
 
 #include "sgx_eid.h"
 #include "sgx_dh.h"
@@ -47,14 +50,16 @@ typedef enum{
 	FIFO_DH_MSG_REQ,
 	FIFO_DH_MSG_RESP,
 	FIFO_DH_CLOSE_REQ,
-	FIFO_DH_CLOSE_RESP
+	FIFO_DH_CLOSE_RESP,
+	FIFO_DH_ERROR_RESP // the request with this reqid failed or was dropped, no body
 }FIFO_MSG_TYPE;
 
 typedef struct _fifomsgheader
 {
 	FIFO_MSG_TYPE type;
 	size_t size; // demonstrate FIFO message content size
-	int sockfd;
+	int sockfd;   // set by the receiver, never meaningful on the wire
+	uint32_t reqid; // chosen by the requester and echoed back in the response
 }FIFO_MSG_HEADER;
 
 typedef struct _fifomsg
@@ -95,6 +100,75 @@ typedef struct _fifo_msg_req
 	unsigned char buf[1];
 }FIFO_MSGBODY_REQ;
 
+/* Every message on the dkeyprovision socket is framed as a FIFO_MSG_HEADER
+ * followed by exactly header.size bytes, so one connection can carry many
+ * messages back to back. Bodies above this limit are treated as corrupt.
+ */
+#define FIFO_MSG_MAX_SIZE (64 * 1024)
+
+/* Function Description: write a whole FIFO message (header plus header.size bytes) to a socket
+ * Return: 0 on success, -1 if the connection failed
+ * */
+static inline int fifo_send_msg(int sockfd, const FIFO_MSG *msg)
+{
+	const char *p = (const char *)msg;
+	size_t left = sizeof(FIFO_MSG_HEADER) + msg->header.size;
+
+	while (left > 0) {
+		ssize_t n = send(sockfd, p, left, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		left -= (size_t)n;
+	}
+	return 0;
+}
+
+static inline int fifo_recv_all(int sockfd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+
+	while (len > 0) {
+		ssize_t n = recv(sockfd, p, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/* Function Description: read one framed FIFO message from a socket
+ * Return: the message allocated with malloc(), or NULL on EOF, connection error or a bad frame
+ * */
+static inline FIFO_MSG *fifo_recv_msg(int sockfd)
+{
+	FIFO_MSG_HEADER header;
+	FIFO_MSG *msg = NULL;
+
+	if (fifo_recv_all(sockfd, &header, sizeof(header)) != 0)
+		return NULL;
+	if (header.size > FIFO_MSG_MAX_SIZE)
+		return NULL;
+
+	msg = (FIFO_MSG *)malloc(sizeof(FIFO_MSG) + header.size);
+	if (msg == NULL)
+		return NULL;
+	memset(msg, 0, sizeof(FIFO_MSG) + header.size);
+	msg->header = header;
+
+	if (fifo_recv_all(sockfd, msg->msgbuf, header.size) != 0) {
+		free(msg);
+		return NULL;
+	}
+	return msg;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,7 +31,10 @@
 #ifndef _JSON_UTILS_H
 #define _JSON_UTILS_H
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <string>
 #include <jsoncpp/json/json.h>
 
 /*
@@ -43,111 +46,87 @@ class JsonObj
 {
 private:
     Json::Value m_json;
-    template <typename T>
-    void addData(std::string key, T data)
+
+    static const Json::Value &nullJson()
     {
-        // key level
-        int level = 1;
-        std::string key_tmp = key;
-        while ((int)key_tmp.find(LAYERED_CHARACTER) > 0)
-        {
-            level++;
-            key_tmp = key_tmp.substr(key_tmp.find(LAYERED_CHARACTER) + strlen(LAYERED_CHARACTER),
-                                     key_tmp.size() - strlen(LAYERED_CHARACTER));
-        }
+        static const Json::Value null_json;
+        return null_json;
+    }
 
-        // key array
-        std::string *keys = new std::string[level];
-        key_tmp = key;
-        for (int i = 0; (int)key_tmp.find(LAYERED_CHARACTER) > 0; i++)
-        {
-            std::string sub_key = key_tmp.substr(0, key_tmp.find(LAYERED_CHARACTER));
-            keys[i] = sub_key;
-            key_tmp = key_tmp.substr(key_tmp.find(LAYERED_CHARACTER) + strlen(LAYERED_CHARACTER),
-                                     key_tmp.size() - strlen(LAYERED_CHARACTER));
-        }
-        keys[level - 1] = key_tmp;
+    /*
+     * Returns the end of the first key segment in [begin, end), i.e. the
+     * position of the next LAYERED_CHARACTER or end if there is none.
+     */
+    static const char *segmentEnd(const char *begin, const char *end)
+    {
+        static const char layered[] = LAYERED_CHARACTER;
+        return std::search(begin, end, layered, layered + sizeof(layered) - 1);
+    }
 
-        switch (level)
+    /*
+     * Walks the layered key in place and returns the member it names, or a
+     * null value if any level is missing. Neither the key nor the tree is
+     * copied, and nothing is inserted into m_json along the way.
+     */
+    const Json::Value &readData(const std::string &key) const
+    {
+        const char *cur = key.data();
+        const char *end = cur + key.size();
+        const Json::Value *node = &m_json;
+
+        while (true)
         {
-        case 1:
-            m_json[key] = data;
-            break;
-        case 2:
-            m_json[keys[0]][keys[1]] = data;
-            break;
-        case 3:
-            m_json[keys[0]][keys[1]][keys[2]] = data;
-            break;
-        case 4:
-            m_json[keys[0]][keys[1]][keys[2]][keys[3]] = data;
-            break;
-        case 5:
-            m_json[keys[0]][keys[1]][keys[2]][keys[3]][keys[4]] = data;
-            break;
-        case 6:
-            m_json[keys[0]][keys[1]][keys[2]][keys[3]][keys[4]][keys[5]] = data;
-            break;
-        case 7:
-            m_json[keys[0]][keys[1]][keys[2]][keys[3]][keys[4]][keys[5]][keys[6]] = data;
-            break;
+            const char *seg_end = segmentEnd(cur, end);
+            if (!node->isObject())
+                return nullJson();
+            node = node->find(cur, seg_end);
+            if (node == NULL)
+                return nullJson();
+            if (seg_end == end)
+                return *node;
+            cur = seg_end + strlen(LAYERED_CHARACTER);
         }
     }
 
-    Json::Value readData(std::string key)
+    /*
+     * Same as readData(), but creates the missing levels as objects and
+     * returns the member for writing.
+     */
+    Json::Value &demandData(const std::string &key)
     {
-        // key level
-        int level = 1;
-        std::string key_tmp = key;
-        while ((int)key_tmp.find(LAYERED_CHARACTER) > 0)
-        {
-            level++;
-            key_tmp = key_tmp.substr(key_tmp.find(LAYERED_CHARACTER) + strlen(LAYERED_CHARACTER),
-                                     key_tmp.size() - strlen(LAYERED_CHARACTER));
-        }
+        const char *cur = key.data();
+        const char *end = cur + key.size();
+        Json::Value *node = &m_json;
 
-        // key array
-        std::string *keys = new std::string[level];
-        key_tmp = key;
-        for (int i = 0; (int)key_tmp.find(LAYERED_CHARACTER) > 0; i++)
+        while (true)
         {
-            std::string sub_key = key_tmp.substr(0, key_tmp.find(LAYERED_CHARACTER));
-            keys[i] = sub_key;
-            key_tmp = key_tmp.substr(key_tmp.find(LAYERED_CHARACTER) + strlen(LAYERED_CHARACTER),
-                                     key_tmp.size() - strlen(LAYERED_CHARACTER));
+            const char *seg_end = segmentEnd(cur, end);
+            node = node->demand(cur, seg_end);
+            if (seg_end == end)
+                return *node;
+            cur = seg_end + strlen(LAYERED_CHARACTER);
         }
-        keys[level - 1] = key_tmp;
+    }
 
-        switch (level)
-        {
-        case 1:
-            return m_json[key];
-        case 2:
-            return m_json[keys[0]][keys[1]];
-        case 3:
-            return m_json[keys[0]][keys[1]][keys[2]];
-        case 4:
-            return m_json[keys[0]][keys[1]][keys[2]][keys[3]];
-        case 5:
-            return m_json[keys[0]][keys[1]][keys[2]][keys[3]][keys[4]];
-        case 6:
-            return m_json[keys[0]][keys[1]][keys[2]][keys[3]][keys[4]][keys[5]];
-        case 7:
-            return m_json[keys[0]][keys[1]][keys[2]][keys[3]][keys[4]][keys[5]][keys[6]];
-        default:
-            Json::Value retVal;
-            return retVal;
-        }
+    template <typename T>
+    void addData(const std::string &key, T data)
+    {
+        demandData(key) = std::move(data);
     }
 
 public:
+    JsonObj() = default;
+    JsonObj(const JsonObj &) = default;
+    JsonObj(JsonObj &&) = default;
+    JsonObj &operator=(const JsonObj &) = default;
+    JsonObj &operator=(JsonObj &&) = default;
     virtual ~JsonObj(){};
 
     void setJson(Json::Value json)
     {
-        m_json = json;
+        m_json = std::move(json);
     }
-    Json::Value getJson()
+    const Json::Value &getJson() const
     {
         return m_json;
     }
@@ -157,7 +136,7 @@ public:
         m_json.clear();
     }
 
-    char *StringToChar(std::string str)
+    static char *StringToChar(const std::string &str)
     {
         char *retChar = NULL;
         if (str.size() > 0)
@@ -173,131 +152,157 @@ public:
         return retChar;
     }
 
-    void addData_string(std::string key, std::string data)
+    void addData_string(const std::string &key, std::string data)
     {
-        addData(key, data);
+        addData(key, std::move(data));
     }
-    void addData_bool(std::string key, bool data)
+    void addData_bool(const std::string &key, bool data)
     {
         addData(key, data);
     }
-    void addData_uint16(std::string key, uint16_t data)
+    void addData_uint16(const std::string &key, uint16_t data)
     {
         addData(key, data);
     }
-    void addData_uint32(std::string key, uint32_t data)
+    void addData_uint32(const std::string &key, uint32_t data)
     {
         addData(key, data);
     }
-    void addData_uint64(std::string key, uint64_t data)
+    void addData_uint64(const std::string &key, uint64_t data)
     {
-        std::string uint64_str = std::to_string(data);
-        addData(key, uint64_str);
+        addData(key, std::to_string(data));
     }
-    void addData_JsonValue(std::string key, Json::Value data)
+    void addData_JsonValue(const std::string &key, Json::Value data)
     {
-        addData(key, data);
+        addData(key, std::move(data));
     }
 
-    void addData_uint8Array(std::string key, uint8_t *data, uint32_t data_len)
+    void addData_uint8Array(const std::string &key, const uint8_t *data, uint32_t data_len)
     {
-        Json::Value jsonArray;
-        for (int i = 0; i < data_len; i++)
+        Json::Value jsonArray(Json::arrayValue);
+        jsonArray.resize(data_len);
+        for (uint32_t i = 0; i < data_len; i++)
         {
-            jsonArray.append(data[i]);
+            jsonArray[i] = data[i];
         }
-        addData(key, jsonArray);
+        addData(key, std::move(jsonArray));
     }
 
-    void addData_uint32Array(std::string key, uint32_t *data, uint32_t data_len)
+    void addData_uint32Array(const std::string &key, const uint32_t *data, uint32_t data_len)
     {
-        Json::Value jsonArray;
-        for (int i = 0; i < data_len; i++)
+        Json::Value jsonArray(Json::arrayValue);
+        jsonArray.resize(data_len);
+        for (uint32_t i = 0; i < data_len; i++)
         {
-            jsonArray.append(data[i]);
+            jsonArray[i] = data[i];
         }
-        addData(key, jsonArray);
+        addData(key, std::move(jsonArray));
     }
 
-    std::string toString()
+    std::string toString() const
     {
         Json::FastWriter writer;
         return writer.write(m_json);
     }
 
-    bool parse(std::string jsonStr)
+    /*
+     * Parses straight from the caller's buffer, no intermediate string copy
+     */
+    bool parse(const char *begin, const char *end)
     {
-        Json::Reader *pJsonParser = new Json::Reader();
-        return pJsonParser->parse(jsonStr, m_json);
+        Json::Reader reader;
+        return reader.parse(begin, end, m_json, false);
     }
 
-    void parse(char *jsonChar)
+    bool parse(const std::string &jsonStr)
     {
-        std::string jsonStr = jsonChar;
-        parse(jsonStr);
+        return parse(jsonStr.data(), jsonStr.data() + jsonStr.size());
     }
 
-    char *readData_cstr(std::string key)
+    bool parse(const char *jsonChar)
+    {
+        return parse(jsonChar, jsonChar + strlen(jsonChar));
+    }
+
+    char *readData_cstr(const std::string &key) const
     {
         return StringToChar(readData(key).asString());
     }
 
-    std::string readData_string(std::string key)
+    std::string readData_string(const std::string &key) const
     {
         return readData(key).asString();
     }
 
-    bool readData_bool(std::string key)
+    bool readData_bool(const std::string &key) const
     {
         return readData(key).asBool();
     }
 
-    uint16_t readData_uint16(std::string key)
+    uint16_t readData_uint16(const std::string &key) const
     {
         return (uint16_t)readData(key).asUInt();
     }
 
-    uint32_t readData_uint32(std::string key)
+    uint32_t readData_uint32(const std::string &key) const
     {
         return readData(key).asUInt();
     }
 
-    uint64_t readData_uint64(std::string key)
+    uint64_t readData_uint64(const std::string &key) const
     {
         uint64_t u = std::strtoull(readData(key).asString().c_str(), NULL, 0);
         return u;
     }
 
-    void readData_uint8Array(std::string key, uint8_t *data)
+    void readData_uint8Array(const std::string &key, uint8_t *data) const
     {
         if (data != NULL)
         {
-            Json::Value json = readData(key);
-            for (int i = 0; i < json.size(); i++)
+            const Json::Value &json = readData(key);
+            for (Json::ArrayIndex i = 0; i < json.size(); i++)
             {
                 data[i] = (uint8_t)json[i].asUInt();
             }
         }
     }
 
-    void readData_uint32Array(std::string key, uint32_t *data)
+    void readData_uint32Array(const std::string &key, uint32_t *data) const
     {
         if (data != NULL)
         {
-            Json::Value json = readData(key);
-            for (int i = 0; i < json.size(); i++)
+            const Json::Value &json = readData(key);
+            for (Json::ArrayIndex i = 0; i < json.size(); i++)
             {
                 data[i] = (uint32_t)json[i].asUInt();
             }
         }
     }
 
-    Json::Value readData_JsonValue(std::string key)
+    const Json::Value &readData_JsonValue(const std::string &key) const
     {
         return readData(key);
     }
 
-    bool hasOwnProperty(std::string key) { return !m_json[key].isNull(); }
+    /*
+     * Moves the member out of the object instead of copying it, leaving
+     * null behind. Use it when the rest of the object is no longer needed.
+     */
+    Json::Value takeData_JsonValue(const std::string &key)
+    {
+        Json::Value data;
+        if (!readData(key).isNull())
+            data.swap(demandData(key));
+        return data;
+    }
+
+    bool hasOwnProperty(const std::string &key) const
+    {
+        const Json::Value *json = NULL;
+        if (m_json.isObject())
+            json = m_json.find(key.data(), key.data() + key.size());
+        return json != NULL && !json->isNull();
+    }
 };
 
 class RetJsonObj
@@ -306,6 +311,8 @@ public:
     const int CODE_SUCCESS = 200;
     const int CODE_BAD_REQUEST = 400;
     const int CODE_FAILED = 500;
+    // refused by the admission control, the request may be retried later
+    const int CODE_BUSY = 503;
 
 private:
     Json::Value m_json;
@@ -329,7 +336,7 @@ public:
     }
     void setResult(JsonObj result_json)
     {
-        m_result_json = result_json;
+        m_result_json = std::move(result_json);
     }
 
     void addData_string(std::string key, std::string data)
@@ -353,12 +360,12 @@ public:
         m_result_json.addData_uint64(key, data);
     }
 
-    void addData_uint8Array(std::string key, uint8_t *data, uint32_t data_len)
+    void addData_uint8Array(std::string key, const uint8_t *data, uint32_t data_len)
     {
         m_result_json.addData_uint8Array(key, data, data_len);
     }
 
-    void addData_uint32Array(std::string key, uint32_t *data, uint32_t data_len)
+    void addData_uint32Array(std::string key, const uint32_t *data, uint32_t data_len)
     {
         m_result_json.addData_uint32Array(key, data, data_len);
     }
@@ -375,11 +382,11 @@ public:
         return m_result_json.StringToChar(toString());
     }
 
-    void parse(std::string jsonStr)
+    void parse(const std::string &jsonStr)
     {
         Json::Value tmp_json;
-        Json::Reader *pJsonParser = new Json::Reader();
-        bool res = pJsonParser->parse(jsonStr, tmp_json);
+        Json::Reader reader;
+        bool res = reader.parse(jsonStr.data(), jsonStr.data() + jsonStr.size(), tmp_json, false);
         if (!res || tmp_json["code"].asInt() == 0)
         {
             setCode(CODE_BAD_REQUEST);
@@ -388,8 +395,8 @@ public:
         else
         {
             m_json["code"] = tmp_json["code"];
-            m_json["message"] = tmp_json["message"];
-            m_result_json.setJson(tmp_json["result"]);
+            m_json["message"] = std::move(tmp_json["message"]);
+            m_result_json.setJson(std::move(tmp_json["result"]));
         }
     }
 
@@ -453,6 +460,11 @@ public:
     {
         m_result_json.readData_uint32Array(key, data);
     }
+
+    const Json::Value &readData_JsonValue(std::string key)
+    {
+        return m_result_json.readData_JsonValue(key);
+    }
 };
 
 #endif
\ No newline at end of file
@@ -37,6 +37,65 @@
 
 #define IS_DEBUG false
 
+#ifdef EHSM_ASYNC_LOG
+
+/*
+ * The untrusted binaries built with EHSM_ASYNC_LOG log through a lock-free ring
+ * drained by a background thread, see utils/ehsm_log. A log call only formats its
+ * message into a slot of the ring, the timestamp, the prefix and the output format
+ * are applied by the flusher, and a full ring drops the line rather than block the
+ * caller, an ERROR line is then written directly instead. The enclaves keep the
+ * plain printf below.
+ *  EHSM_LOG_LEVEL  debug|info|warn|error|none (default info), changed at runtime by
+ *                  ehsm_log_set_level or the EH_SET_LOG_LEVEL action of the provider
+ *  EHSM_LOG_FORMAT text|json (default text), json prints one object per line
+ */
+typedef enum
+{
+    EHSM_LOG_DEBUG = 0,
+    EHSM_LOG_INFO,
+    EHSM_LOG_WARN,
+    EHSM_LOG_ERROR,
+    EHSM_LOG_NONE
+} ehsm_log_level_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /* whether a line of the level is logged with the current level */
+    int ehsm_log_enabled(int level);
+
+    void ehsm_log_write(int level, const char *file, int line, const char *func, const char *format, ...)
+        __attribute__((format(printf, 5, 6)));
+
+    /* change the level at runtime, the lines already in the ring are still written */
+    void ehsm_log_set_level(int level);
+
+    int ehsm_log_get_level(void);
+
+    /* the level of a debug|info|warn|error|none name, default_level for any other */
+    int ehsm_log_parse_level(const char *value, int default_level);
+
+    /* wait until the lines logged so far are written to stdout */
+    void ehsm_log_flush(void);
+#ifdef __cplusplus
+}
+#endif
+
+#define EHSM_LOG_WRITE(level, format, args...)                                       \
+    {                                                                                \
+        if (ehsm_log_enabled(level))                                                 \
+            ehsm_log_write(level, __FILE__, __LINE__, __FUNCTION__, format, ##args); \
+    }
+
+#define log_i(format, args...) EHSM_LOG_WRITE(EHSM_LOG_INFO, format, ##args)
+#define log_d(format, args...) EHSM_LOG_WRITE(EHSM_LOG_DEBUG, format, ##args)
+#define log_w(format, args...) EHSM_LOG_WRITE(EHSM_LOG_WARN, format, ##args)
+#define log_e(format, args...) EHSM_LOG_WRITE(EHSM_LOG_ERROR, format, ##args)
+
+#else
+
 /*
     print info
 */
@@ -77,4 +136,6 @@
         printf("\n");                                                       \
     }
 
+#endif
+
 #endif
\ No newline at end of file
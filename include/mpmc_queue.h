@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2011-2020 Intel Corporation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _MPMC_QUEUE_H_
+#define _MPMC_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/*
+ * A bounded lock-free multi-producer multi-consumer queue of pointers, for the
+ * worker pools of the untrusted binaries.
+ *
+ * The ring works like the one of the asynchronous logger: a producer claims a
+ * slot by moving m_tail forward once the slot's sequence shows it is free, and
+ * publishes it by advancing the sequence; a consumer claims a published slot by
+ * moving m_head forward, and hands it back by moving the sequence one lap ahead.
+ * Neither side takes a lock while there is work. A consumer finding the queue
+ * empty spins for a while, then parks on a condition variable, and producers only
+ * touch the lock when someone is parked.
+ *
+ * close() makes push() fail, the consumers still drain what was queued and then
+ * pop() returns NULL. The queue never frees the elements, whatever is left in it
+ * belongs to the owner, see tryPop().
+ */
+template <typename T>
+class MpmcQueue
+{
+public:
+    typedef struct
+    {
+        uint64_t pushed;
+        uint64_t popped;
+        uint64_t rejected;      // push() on a full or closed queue
+        uint64_t depth;         // elements queued now
+        uint64_t max_depth;
+        uint64_t wait_ns_total; // time the popped elements spent queued
+        uint64_t wait_ns_max;
+    } stats_t;
+
+    /* the capacity is rounded up to a power of 2 */
+    explicit MpmcQueue(size_t capacity)
+        : m_slots(roundup(capacity)), m_mask(roundup(capacity) - 1), m_tail(0), m_head(0),
+          m_closed(false), m_sleepers(0), m_pushed(0), m_popped(0), m_rejected(0),
+          m_max_depth(0), m_wait_ns_total(0), m_wait_ns_max(0)
+    {
+        for (size_t i = 0; i < m_slots.size(); i++)
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /* Return: false if the queue is full or closed, the caller still owns value */
+    bool push(T *value)
+    {
+        slot_t *slot = NULL;
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+
+        if (m_closed.load(std::memory_order_acquire))
+        {
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        for (;;)
+        {
+            slot = &m_slots[pos & m_mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                // the consumers are a lap behind
+                m_rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = value;
+        slot->enqueued_ns = now_ns();
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+        update_max(m_max_depth, pos + 1 - m_head.load(std::memory_order_relaxed));
+
+        // pairs with the fence in park(), either the parked consumer sees the slot or this sees it parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_cond.notify_one();
+        }
+        return true;
+    }
+
+    /* take one element if there is one, without blocking */
+    bool tryPop(T **value)
+    {
+        slot_t *slot = NULL;
+        size_t pos = m_head.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            slot = &m_slots[pos & m_mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+
+        *value = slot->value;
+        uint64_t wait_ns = now_ns() - slot->enqueued_ns;
+        slot->sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+        m_popped.fetch_add(1, std::memory_order_relaxed);
+        m_wait_ns_total.fetch_add(wait_ns, std::memory_order_relaxed);
+        update_max(m_wait_ns_max, wait_ns);
+        return true;
+    }
+
+    /* Return: the next element, blocking while the queue is empty, or NULL once it is closed and drained */
+    T *pop()
+    {
+        T *value = NULL;
+
+        return popBatch(&value, 1) == 1 ? value : NULL;
+    }
+
+    /* Function Description: wait for at least one element, then take up to max of them
+     * Return: the number of elements stored in values, 0 once the queue is closed and drained
+     * */
+    size_t popBatch(T **values, size_t max)
+    {
+        size_t count = 0;
+
+        if (max == 0)
+            return 0;
+
+        while (count == 0)
+        {
+            for (int spin = 0; spin < SPIN_COUNT && count == 0; spin++)
+                count = drain(values, max);
+            if (count != 0 || !park(values, max, &count))
+                break;
+        }
+        return count;
+    }
+
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_cond.notify_all();
+    }
+
+    bool closed() const
+    {
+        return m_closed.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    stats_t stats() const
+    {
+        stats_t stats;
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_relaxed);
+
+        stats.pushed = m_pushed.load(std::memory_order_relaxed);
+        stats.popped = m_popped.load(std::memory_order_relaxed);
+        stats.rejected = m_rejected.load(std::memory_order_relaxed);
+        stats.depth = tail > head ? tail - head : 0;
+        stats.max_depth = m_max_depth.load(std::memory_order_relaxed);
+        stats.wait_ns_total = m_wait_ns_total.load(std::memory_order_relaxed);
+        stats.wait_ns_max = m_wait_ns_max.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    enum
+    {
+        SPIN_COUNT = 64,
+        CACHE_LINE = 64
+    };
+
+    typedef struct
+    {
+        std::atomic<size_t> sequence;
+        T *value;
+        uint64_t enqueued_ns;
+    } slot_t;
+
+    static size_t roundup(size_t capacity)
+    {
+        size_t size = 2;
+
+        while (size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    static uint64_t now_ns()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static void update_max(std::atomic<uint64_t> &max, uint64_t value)
+    {
+        uint64_t current = max.load(std::memory_order_relaxed);
+
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            ;
+    }
+
+    size_t drain(T **values, size_t max)
+    {
+        size_t count = 0;
+
+        while (count < max && tryPop(&values[count]))
+            count++;
+        return count;
+    }
+
+    /* Return: true to spin again, false when done, with *count set if elements were taken */
+    bool park(T **values, size_t max, size_t *count)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        m_sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        *count = drain(values, max);
+        if (*count == 0 && !m_closed.load(std::memory_order_acquire))
+            m_cond.wait(lock);
+
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        if (*count != 0)
+            return false;
+        // a closed queue is drained once nothing is left to take
+        if (m_closed.load(std::memory_order_acquire))
+        {
+            lock.unlock();
+            *count = drain(values, max);
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<slot_t> m_slots;
+    const size_t m_mask;
+
+    // the producers' and the consumers' index sit on their own cache lines
+    char m_pad0[CACHE_LINE];
+    std::atomic<size_t> m_tail;
+    char m_pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_head;
+    char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+    std::atomic<bool> m_closed;
+    std::atomic<uint32_t> m_sleepers;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+
+    std::atomic<uint64_t> m_pushed;
+    std::atomic<uint64_t> m_popped;
+    std::atomic<uint64_t> m_rejected;
+    std::atomic<uint64_t> m_max_depth;
+    std::atomic<uint64_t> m_wait_ns_total;
+    std::atomic<uint64_t> m_wait_ns_max;
+
+    MpmcQueue &operator=(const MpmcQueue &);
+    MpmcQueue(const MpmcQueue &);
+};
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2011-2020 Intel Corporation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Intel Corporation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef EHSM_ASYNC_LOG
+#define EHSM_ASYNC_LOG
+#endif
+#include "log_utils.h"
+
+/*
+ * A bounded multi-producer single-consumer ring. A producer claims a slot by
+ * moving g_log_tail forward once the slot's sequence shows it was drained, fills
+ * it, and publishes it by advancing the sequence. The flusher thread is the only
+ * consumer, it writes the published slots in order and hands them back by moving
+ * their sequence one lap ahead.
+ */
+#define EHSM_LOG_RING_SIZE 4096 /* a power of 2 */
+#define EHSM_LOG_MSG_SIZE 480
+#define EHSM_LOG_FLUSH_INTERVAL_MS 20
+
+typedef struct
+{
+    std::atomic<uint64_t> sequence;
+    int level;
+    int line;
+    const char *file;
+    const char *func;
+    long tid;
+    struct timespec time;
+    char msg[EHSM_LOG_MSG_SIZE];
+} ehsm_log_slot_t;
+
+static ehsm_log_slot_t g_log_ring[EHSM_LOG_RING_SIZE];
+static std::atomic<uint64_t> g_log_tail(0);
+static uint64_t g_log_head = 0;
+static std::atomic<uint64_t> g_log_dropped(0);
+
+static std::atomic<int> g_log_level(EHSM_LOG_INFO);
+static bool g_log_json = false;
+
+static std::once_flag g_log_once;
+static std::thread g_log_thread;
+static std::mutex g_log_lock;
+static std::condition_variable g_log_cond;
+static std::condition_variable g_log_flushed;
+static std::atomic<bool> g_log_sleeping(false);
+static std::atomic<bool> g_log_stopped(false);
+static bool g_log_stopping = false;
+
+static const char *g_log_level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+int ehsm_log_parse_level(const char *value, int default_level)
+{
+    if (value == NULL || *value == '\0')
+        return default_level;
+
+    for (int i = EHSM_LOG_DEBUG; i <= EHSM_LOG_ERROR; i++)
+    {
+        if (strcasecmp(value, g_log_level_names[i]) == 0)
+            return i;
+    }
+    if (strcasecmp(value, "none") == 0)
+        return EHSM_LOG_NONE;
+
+    return default_level;
+}
+
+static long log_tid()
+{
+    static thread_local long tid = 0;
+
+    if (tid == 0)
+        tid = syscall(SYS_gettid);
+    return tid;
+}
+
+static void log_append_json_string(std::string &out, const char *str)
+{
+    char escaped[8];
+
+    out += '"';
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            out += '\\';
+            out += (char)*p;
+        }
+        else if (*p == '\n')
+            out += "\\n";
+        else if (*p < 0x20)
+        {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
+            out += escaped;
+        }
+        else
+            out += (char)*p;
+    }
+    out += '"';
+}
+
+/* the deferred part of the formatting, done by the flusher */
+static void log_format(std::string &out, const ehsm_log_slot_t *slot)
+{
+    char time[64];
+    char number[32];
+    struct tm tm;
+
+    gmtime_r(&slot->time.tv_sec, &tm);
+    strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(time + strlen(time), sizeof(time) - strlen(time), ".%06ldZ", slot->time.tv_nsec / 1000);
+
+    if (!g_log_json)
+    {
+        out += time;
+        out += ' ';
+        out += g_log_level_names[slot->level];
+        out += " [";
+        out += slot->file;
+        snprintf(number, sizeof(number), "(%d) -> ", slot->line);
+        out += number;
+        out += slot->func;
+        out += "]: ";
+        out += slot->msg;
+        out += '\n';
+        return;
+    }
+
+    out += "{\"time\":\"";
+    out += time;
+    out += "\",\"level\":\"";
+    out += g_log_level_names[slot->level];
+    snprintf(number, sizeof(number), "\",\"tid\":%ld,\"file\":", slot->tid);
+    out += number;
+    log_append_json_string(out, slot->file);
+    snprintf(number, sizeof(number), ",\"line\":%d,\"func\":", slot->line);
+    out += number;
+    log_append_json_string(out, slot->func);
+    out += ",\"msg\":";
+    log_append_json_string(out, slot->msg);
+    out += "}\n";
+}
+
+/* write the published slots to stdout, only called by the flusher or after it stopped */
+static bool log_drain(std::string &out)
+{
+    uint64_t dropped = g_log_dropped.exchange(0, std::memory_order_relaxed);
+    bool drained = false;
+
+    out.clear();
+    for (;;)
+    {
+        ehsm_log_slot_t *slot = &g_log_ring[g_log_head & (EHSM_LOG_RING_SIZE - 1)];
+        if (slot->sequence.load(std::memory_order_acquire) != g_log_head + 1)
+            break;
+
+        log_format(out, slot);
+        slot->sequence.store(g_log_head + EHSM_LOG_RING_SIZE, std::memory_order_release);
+        g_log_head++;
+        drained = true;
+    }
+    if (dropped != 0)
+    {
+        ehsm_log_slot_t notice;
+        notice.level = EHSM_LOG_WARN;
+        notice.line = __LINE__;
+        notice.file = __FILE__;
+        notice.func = __FUNCTION__;
+        notice.tid = log_tid();
+        clock_gettime(CLOCK_REALTIME, &notice.time);
+        snprintf(notice.msg, sizeof(notice.msg), "%llu log lines dropped, the ring was full",
+                 (unsigned long long)dropped);
+        log_format(out, &notice);
+    }
+
+    if (!out.empty())
+    {
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+    return drained;
+}
+
+static void log_flusher()
+{
+    std::string out;
+
+    out.reserve(EHSM_LOG_RING_SIZE * 64);
+    for (;;)
+    {
+        if (log_drain(out))
+            continue;
+
+        std::unique_lock<std::mutex> lock(g_log_lock);
+        g_log_flushed.notify_all();
+        if (g_log_stopping)
+            return;
+        g_log_sleeping.store(true);
+        // a producer wakes the flusher up, the interval only bounds a missed wake up
+        g_log_cond.wait_for(lock, std::chrono::milliseconds(EHSM_LOG_FLUSH_INTERVAL_MS));
+        g_log_sleeping.store(false);
+    }
+}
+
+/* stop the flusher at exit, the lines logged from then on are written directly */
+static void log_stop()
+{
+    std::string out;
+
+    {
+        std::lock_guard<std::mutex> lock(g_log_lock);
+        g_log_stopping = true;
+    }
+    g_log_cond.notify_one();
+    if (g_log_thread.joinable())
+        g_log_thread.join();
+
+    g_log_stopped.store(true);
+    std::lock_guard<std::mutex> lock(g_log_lock);
+    log_drain(out);
+}
+
+static void log_start()
+{
+    const char *format = getenv("EHSM_LOG_FORMAT");
+
+    for (uint64_t i = 0; i < EHSM_LOG_RING_SIZE; i++)
+        g_log_ring[i].sequence.store(i, std::memory_order_relaxed);
+
+    g_log_level.store(ehsm_log_parse_level(getenv("EHSM_LOG_LEVEL"), EHSM_LOG_INFO));
+    g_log_json = format != NULL && strcasecmp(format, "json") == 0;
+
+    g_log_thread = std::thread(log_flusher);
+    atexit(log_stop);
+}
+
+static void log_write_sync(int level, const char *file, int line, const char *func, const char *msg)
+{
+    ehsm_log_slot_t slot;
+    std::string out;
+
+    slot.level = level;
+    slot.line = line;
+    slot.file = file;
+    slot.func = func;
+    slot.tid = log_tid();
+    clock_gettime(CLOCK_REALTIME, &slot.time);
+    strncpy(slot.msg, msg, sizeof(slot.msg) - 1);
+    slot.msg[sizeof(slot.msg) - 1] = '\0';
+
+    log_format(out, &slot);
+    std::lock_guard<std::mutex> lock(g_log_lock);
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+}
+
+int ehsm_log_enabled(int level)
+{
+    std::call_once(g_log_once, log_start);
+    return level >= g_log_level.load(std::memory_order_relaxed);
+}
+
+void ehsm_log_write(int level, const char *file, int line, const char *func, const char *format, ...)
+{
+    va_list args;
+    uint64_t pos = 0;
+    ehsm_log_slot_t *slot = NULL;
+
+    if (level < EHSM_LOG_DEBUG || level > EHSM_LOG_ERROR || !ehsm_log_enabled(level))
+        return;
+
+    if (g_log_stopped.load())
+    {
+        char msg[EHSM_LOG_MSG_SIZE];
+        va_start(args, format);
+        vsnprintf(msg, sizeof(msg), format, args);
+        va_end(args);
+        log_write_sync(level, file, line, func, msg);
+        return;
+    }
+
+    pos = g_log_tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        slot = &g_log_ring[pos & (EHSM_LOG_RING_SIZE - 1)];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(sequence - pos);
+
+        if (diff == 0)
+        {
+            if (g_log_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // the flusher is a lap behind, never wait for stdout on the request path
+            // but for an error, which is written directly ahead of the queued lines
+            if (level == EHSM_LOG_ERROR)
+            {
+                char msg[EHSM_LOG_MSG_SIZE];
+                va_start(args, format);
+                vsnprintf(msg, sizeof(msg), format, args);
+                va_end(args);
+                log_write_sync(level, file, line, func, msg);
+                return;
+            }
+            g_log_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = g_log_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->line = line;
+    slot->file = file;
+    slot->func = func;
+    slot->tid = log_tid();
+    clock_gettime(CLOCK_REALTIME, &slot->time);
+    va_start(args, format);
+    vsnprintf(slot->msg, sizeof(slot->msg), format, args);
+    va_end(args);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    if (g_log_sleeping.load(std::memory_order_relaxed))
+        g_log_cond.notify_one();
+}
+
+void ehsm_log_set_level(int level)
+{
+    std::call_once(g_log_once, log_start);
+    if (level < EHSM_LOG_DEBUG || level > EHSM_LOG_NONE)
+        return;
+    g_log_level.store(level);
+}
+
+int ehsm_log_get_level(void)
+{
+    std::call_once(g_log_once, log_start);
+    return g_log_level.load();
+}
+
+void ehsm_log_flush(void)
+{
+    uint64_t tail = 0;
+
+    std::call_once(g_log_once, log_start);
+    tail = g_log_tail.load();
+
+    std::unique_lock<std::mutex> lock(g_log_lock);
+    while (!g_log_stopping)
+    {
+        // the slot before tail is handed back once the flusher wrote it
+        if (tail == 0 ||
+            g_log_ring[(tail - 1) & (EHSM_LOG_RING_SIZE - 1)].sequence.load(std::memory_order_acquire) >=
+                tail - 1 + EHSM_LOG_RING_SIZE)
+            return;
+        g_log_cond.notify_one();
+        g_log_flushed.wait_for(lock, std::chrono::milliseconds(EHSM_LOG_FLUSH_INTERVAL_MS));
+    }
+}